@@ -530,6 +530,47 @@ AI_get_alerts ()
 }		/* -----  end of function AI_get_alerts  ----- */
 
 
+/**
+ * \brief  Return a copy of the alerts parsed from the log file after a certain one, so that the caller
+ * only gets the alerts it hasn't seen yet
+ * \param  cursor 	Reference to the latest alert already returned (NULL for getting all the alerts).
+ * It is updated to the latest alert parsed so far, and it must not be dereferenced by the caller
+ * \return A copy of the new alerts as a linked list, NULL if there are no new alerts
+ */
+AI_snort_alert*
+AI_get_alerts_since ( AI_snort_alert **cursor )
+{
+	AI_snort_alert *node = NULL,
+				*copy = NULL,
+				*head = NULL,
+				*tail = NULL;
+
+	pthread_mutex_lock ( &alert_mutex );
+
+	for ( node = ( *cursor ) ? ( *cursor )->next : alerts; node; node = node->next )
+	{
+		if ( !( copy = ( AI_snort_alert* ) malloc ( sizeof ( AI_snort_alert )) ))
+		{
+			AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+		}
+
+		memcpy ( copy, node, sizeof ( AI_snort_alert ));
+		copy->next = NULL;
+
+		if ( tail )
+			tail->next = copy;
+		else
+			head = copy;
+
+		tail = copy;
+		*cursor = node;
+	}
+
+	pthread_mutex_unlock ( &alert_mutex );
+	return head;
+}		/* -----  end of function AI_get_alerts_since  ----- */
+
+
 /**
  * \brief  Deallocate the memory of a log alert linked list
  * \param  node 	Linked list to be freed
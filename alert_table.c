@@ -0,0 +1,202 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  alert_table.c
+ *
+ *    Description:  Columnar table of alerts, keeping the fields scanned by the analysis
+ *    			stages in contiguous arrays
+ *
+ *        Version:  0.1
+ *        Created:  18/10/2026 18:42:15
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  BlackLight (http://0x00.ath.cx), <blacklight@autistici.org>
+ *        Licence:  GNU GPL v.3
+ *        Company:  DO WHAT YOU WANT CAUSE A PIRATE IS FREE, YOU ARE A PIRATE!
+ *
+ * =====================================================================================
+ */
+
+#include	"spp_ai.h"
+
+/** \defgroup alert_table Columnar table of alerts
+ * @{ */
+
+/** Initial number of rows allocated for a table */
+#define 	ALERT_TABLE_INITIAL_SIZE 	64
+
+/** Interned string */
+typedef struct  {
+	char            *str;
+	UT_hash_handle  hh;
+} AI_interned_string;
+
+/** Pool of the interned strings */
+PRIVATE AI_interned_string *strings = NULL;
+
+/** Mutex on the pool of the interned strings */
+PRIVATE pthread_mutex_t strings_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * \brief  Get the interned copy of a string: equal strings always get the same pointer, which stays
+ * valid for the whole life of the module, so they can be compared by address
+ * \param  str 	String to be interned
+ * \return The interned copy of the string, NULL if str is NULL
+ */
+
+const char*
+AI_string_intern ( const char *str )
+{
+	AI_interned_string *found = NULL;
+
+	if ( !str )
+		return NULL;
+
+	pthread_mutex_lock ( &strings_mutex );
+	HASH_FIND_STR ( strings, str, found );
+
+	if ( !found )
+	{
+		if ( !( found = ( AI_interned_string* ) malloc ( sizeof ( AI_interned_string ))))
+			AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+		if ( !( found->str = strdup ( str )))
+			AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+		HASH_ADD_KEYPTR ( hh, strings, found->str, strlen ( found->str ), found );
+	}
+
+	pthread_mutex_unlock ( &strings_mutex );
+	return found->str;
+}		/* -----  end of function AI_string_intern  ----- */
+
+/**
+ * \brief  Grow the columns of a table
+ * \param  table 	Table
+ * \param  size 	New number of rows
+ */
+
+PRIVATE void
+__AI_alert_table_grow ( AI_alert_table *table, unsigned int size )
+{
+	#define 	__AI_COLUMN_GROW(column) \
+		if ( !( table->column = realloc ( table->column, size * sizeof ( *( table->column ))))) \
+			AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+	__AI_COLUMN_GROW ( gid );
+	__AI_COLUMN_GROW ( sid );
+	__AI_COLUMN_GROW ( rev );
+	__AI_COLUMN_GROW ( priority );
+	__AI_COLUMN_GROW ( timestamp );
+	__AI_COLUMN_GROW ( ip_src_addr );
+	__AI_COLUMN_GROW ( ip_dst_addr );
+	__AI_COLUMN_GROW ( tcp_src_port );
+	__AI_COLUMN_GROW ( tcp_dst_port );
+	__AI_COLUMN_GROW ( grouped_alerts_count );
+	__AI_COLUMN_GROW ( desc );
+	__AI_COLUMN_GROW ( classification );
+	__AI_COLUMN_GROW ( alerts );
+
+	#undef 	__AI_COLUMN_GROW
+
+	table->size = size;
+}		/* -----  end of function __AI_alert_table_grow  ----- */
+
+/**
+ * \brief  Create a new empty table of alerts
+ * \return The new table
+ */
+
+AI_alert_table*
+AI_alert_table_new ()
+{
+	AI_alert_table *table = NULL;
+
+	if ( !( table = ( AI_alert_table* ) calloc ( 1, sizeof ( AI_alert_table ))))
+		AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+	__AI_alert_table_grow ( table, ALERT_TABLE_INITIAL_SIZE );
+	return table;
+}		/* -----  end of function AI_alert_table_new  ----- */
+
+/**
+ * \brief  Append an alert to a table as a new row
+ * \param  table 	Table
+ * \param  alert 	Alert (the row keeps a reference to it)
+ * \return The index of the new row
+ */
+
+unsigned int
+AI_alert_table_append ( AI_alert_table *table, AI_snort_alert *alert )
+{
+	unsigned int row;
+
+	if ( table->n_alerts == table->size )
+		__AI_alert_table_grow ( table, 2 * table->size );
+
+	row = table->n_alerts++;
+	table->gid[row]                  = alert->gid;
+	table->sid[row]                  = alert->sid;
+	table->rev[row]                  = alert->rev;
+	table->priority[row]             = alert->priority;
+	table->timestamp[row]            = alert->timestamp;
+	table->ip_src_addr[row]          = alert->ip_src_addr;
+	table->ip_dst_addr[row]          = alert->ip_dst_addr;
+	table->tcp_src_port[row]         = alert->tcp_src_port;
+	table->tcp_dst_port[row]         = alert->tcp_dst_port;
+	table->grouped_alerts_count[row] = alert->grouped_alerts_count;
+	table->desc[row]                 = AI_string_intern ( alert->desc );
+	table->classification[row]       = AI_string_intern ( alert->classification );
+	table->alerts[row]               = alert;
+
+	return row;
+}		/* -----  end of function AI_alert_table_append  ----- */
+
+/**
+ * \brief  Build a table out of a linked list of alerts
+ * \param  alerts 	List of alerts
+ * \return The table, with a row for each alert in the same order of the list
+ */
+
+AI_alert_table*
+AI_alert_table_from_list ( AI_snort_alert *alerts )
+{
+	AI_alert_table *table = AI_alert_table_new();
+	AI_snort_alert *alert = NULL;
+
+	for ( alert = alerts; alert; alert = alert->next )
+		AI_alert_table_append ( table, alert );
+
+	return table;
+}		/* -----  end of function AI_alert_table_from_list  ----- */
+
+/**
+ * \brief  Free a table of alerts (the alerts referenced by the rows and the interned strings are not freed)
+ * \param  table 	Table
+ */
+
+void
+AI_alert_table_free ( AI_alert_table *table )
+{
+	if ( !table )
+		return;
+
+	free ( table->gid );
+	free ( table->sid );
+	free ( table->rev );
+	free ( table->priority );
+	free ( table->timestamp );
+	free ( table->ip_src_addr );
+	free ( table->ip_dst_addr );
+	free ( table->tcp_src_port );
+	free ( table->tcp_dst_port );
+	free ( table->grouped_alerts_count );
+	free ( table->desc );
+	free ( table->classification );
+	free ( table->alerts );
+	free ( table );
+}		/* -----  end of function AI_alert_table_free  ----- */
+
+/** @} */
+
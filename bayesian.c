@@ -53,6 +53,9 @@ typedef struct  {
 PRIVATE AI_bayesian_correlation  *bayesian_cache    = NULL;
 PRIVATE double                   k_exp_value        = 0.0;
 
+/** Lock over the cache, which is read at the same time by all the correlation scoring workers */
+PRIVATE pthread_rwlock_t         bayesian_cache_lock = PTHREAD_RWLOCK_INITIALIZER;
+
 /**
  * \brief  Get the current weight of the bayesian correlation index using a hyperbolic tangent function with a parameter expressed in function of the current number of alerts in the history file
  * \return The weight of the correlation index ( 0 <= weight < 1 )
@@ -122,18 +125,27 @@ AI_alert_bayesian_correlation ( const AI_snort_alert *a, const AI_snort_alert *b
 	key_b.rev = b->rev;
 
 	/* Check if this correlation value is already in our cache */
+	memset ( &bayesian_key, 0, sizeof ( bayesian_key ));
 	bayesian_key.a = key_a;
 	bayesian_key.b = key_b;
+
+	pthread_rwlock_rdlock ( &bayesian_cache_lock );
 	HASH_FIND ( hh, bayesian_cache, &bayesian_key, sizeof ( bayesian_key ), found );
 
 	if ( found )
 	{
 		/* Ok, the abs() is not needed until the time starts running backwards, but it's better going safe... */
 		if ( abs ( time ( NULL ) - found->latest_computation_time ) <= config->bayesianCorrelationCacheValidity )
+		{
 			/* If our alert couple is there, just return it */
-			return found->correlation;
+			corr = found->correlation;
+			pthread_rwlock_unlock ( &bayesian_cache_lock );
+			return corr;
+		}
 	}
 
+	pthread_rwlock_unlock ( &bayesian_cache_lock );
+
 	if ( !( events_a = (AI_alert_event*) AI_get_alert_events_by_key ( key_a )) ||
 			!( events_b = (AI_alert_event*) AI_get_alert_events_by_key ( key_b )))
 		return 0.0;
@@ -164,6 +176,10 @@ AI_alert_bayesian_correlation ( const AI_snort_alert *a, const AI_snort_alert *b
 		corr -= ( events_a->count - corr_count_a ) / events_a->count;
 	}
 
+	/* Another worker may have cached the same couple in the meantime */
+	pthread_rwlock_wrlock ( &bayesian_cache_lock );
+	HASH_FIND ( hh, bayesian_cache, &bayesian_key, sizeof ( bayesian_key ), found );
+
 	if ( found )
 	{
 		found->correlation = corr;
@@ -175,8 +191,11 @@ AI_alert_bayesian_correlation ( const AI_snort_alert *a, const AI_snort_alert *b
 		found->key = bayesian_key;
 		found->correlation = corr;
 		found->latest_computation_time = time ( NULL );
+		HASH_ADD ( hh, bayesian_cache, key, sizeof ( bayesian_key ), found );
 	}
 
+	pthread_rwlock_unlock ( &bayesian_cache_lock );
+
 	return corr;
 }		/* -----  end of function AI_alert_bayesian_correlation  ----- */
 
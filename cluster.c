@@ -21,6 +21,7 @@
 
 #include	<limits.h>
 #include	<math.h>
+#include	<stdarg.h>
 #include	<stdio.h>
 #include	<unistd.h>
 
@@ -33,428 +34,1993 @@ typedef struct  {
 	int max;
 } attribute_key;
 
-/** Representation of a cluster attribute value */
+/** Number of open clusters for each value (hierarchy node) of a clustering attribute. The counts
+ * are indexed by node id and kept up to date as the clusters are opened, generalised, merged and
+ * closed, together with the number of nodes having each count, so that the maximum count (the
+ * heuristic value of the attribute) is always available without scanning the clusters */
+typedef struct  {
+	/** Number of open clusters per node id */
+	unsigned int    *node_counts;
+
+	/** Allocated size of node_counts */
+	unsigned int    nodes_size;
+
+	/** Number of nodes per count of open clusters (count_freq[c] nodes have c open clusters) */
+	unsigned int    *count_freq;
+	unsigned int    freq_size;
+
+	/** Maximum number of open clusters sharing the same node */
+	unsigned int    max;
+} AI_attribute_counts;
+
+/** Range stored in a merge key for a clustering attribute with no hierarchy node
+ * (no real node can have its minimum greater than its maximum) */
+#define 	NO_RANGE_MIN 	1
+#define 	NO_RANGE_MAX 	0
+
+/** Key identifying the alerts that can be merged together: same signature and
+ * same generalised ranges for all the clustering attributes */
+typedef struct  {
+	unsigned int   gid;
+	unsigned int   sid;
+	unsigned int   rev;
+	attribute_key  range[CLUSTER_TYPES];
+} AI_merge_key;
+
+/** Structure containing the count of occurrences of the single alerts in the log */
+typedef struct  {
+	AI_hyperalert_key   key;
+	unsigned int        count;
+	UT_hash_handle  hh;
+} AI_alert_occurrence;
+
+/** Number of entries in the lookup table of a port hierarchy */
+#define 	PORT_TABLE_SIZE 	65536
+
+/** Number of entries in the lookup table of a protocol hierarchy */
+#define 	PROTOCOL_TABLE_SIZE 	256
+
+/** Interval of addresses matched by the same node of a hierarchy */
+typedef struct  {
+	/** First address of the interval (the interval goes on until the start of the next one) */
+	uint32_t        start;
+
+	/** Deepest node of the hierarchy matching the addresses of the interval, NULL if none */
+	hierarchy_node  *node;
+} AI_range_entry;
+
+/** Lookup table of an address hierarchy, as a sorted array of disjoint intervals */
+typedef struct  {
+	AI_range_entry  *entries;
+	unsigned int    n_entries;
+} AI_range_table;
+
+/** Key identifying a leaf node (single value) of a hierarchy, or a bucket of a time hierarchy */
 typedef struct  {
-	attribute_key   key;
 	cluster_type    type;
-	unsigned int    count;
+
+	/** 0 for a leaf, or the level of the time bucket (1 = narrowest buckets) */
+	unsigned int    level;
+
+	/** Value of the leaf, or index of the time bucket */
+	uint32_t        value;
+} AI_leaf_key;
+
+/** Leaf node of a hierarchy (or time bucket), shared by all the alerts with the same value */
+typedef struct  {
+	AI_leaf_key     key;
+	hierarchy_node  *node;
+	UT_hash_handle  hh;
+} AI_leaf_node;
+
+struct _AI_merge_bucket;
+
+/** Cluster still open, i.e. still able to absorb new alerts (its alerts are within
+ * cluster_max_alert_interval from the latest alert received) */
+typedef struct _AI_cluster  {
+	/** Alert representing the cluster, grouping all the others */
+	AI_snort_alert           *alert;
+
+	/** Bucket the cluster currently belongs to */
+	struct _AI_merge_bucket  *bucket;
+
+	/** Previous cluster in the same bucket */
+	struct _AI_cluster       *prev;
+
+	/** Next cluster in the same bucket */
+	struct _AI_cluster       *next;
+
+	/** Set if the cluster has to be generalised in the current pass */
+	BOOL                     dirty;
+
+	/** Set if the cluster was merged into another one */
+	BOOL                     absorbed;
+
+	/** Set if the cluster was opened or changed since the latest journal record */
+	BOOL                     changed;
+
+	/** Identifier of the cluster that absorbed this one */
+	unsigned long            merged_into;
+} AI_cluster;
+
+/** Depth in the hierarchies of the nodes of the open clusters generalised to the same levels
+ * (NO_DEPTH for an attribute with no node): a new alert can only be merged into a cluster at
+ * those levels through the ancestors of its nodes at the same depths */
+typedef struct  {
+	unsigned int    depth[CLUSTER_TYPES];
+} AI_merge_shape_key;
+
+/** Generalisation levels of some open clusters, and the number of buckets at those levels */
+typedef struct  {
+	AI_merge_shape_key  key;
+	unsigned int        n_buckets;
+	UT_hash_handle      hh;
+} AI_merge_shape;
+
+/** Depth of a missing node in a merge shape */
+#define 	NO_DEPTH 	((unsigned int) -1)
+
+/** Bucket of the open clusters sharing the same merge key */
+typedef struct _AI_merge_bucket  {
+	AI_merge_key    key;
+	AI_cluster      *clusters;
+	AI_merge_shape  *shape;
 	UT_hash_handle  hh;
-} attribute_value;
+} AI_merge_bucket;
+
+/** Number of partitions per clustering thread: having more partitions than threads balances
+ * the load when a few signatures account for most of the alerts */
+#define 	PARTITIONS_PER_THREAD 	4
+
+/** Independent share of the clustering problem. Alerts with different signatures can never
+ * be merged, so each signature is assigned to one partition, which keeps its own open clusters
+ * and can be processed by a worker without touching the others */
+typedef struct  {
+	/** Open clusters, indexed by merge key */
+	AI_merge_bucket      *buckets;
+
+	/** Generalisation levels of the buckets */
+	AI_merge_shape       *shapes;
+
+	/** Open clusters, in order of creation */
+	AI_cluster           **open_clusters;
+	unsigned int         n_open_clusters;
+	unsigned int         open_clusters_size;
+
+	/** Clusters closed in the latest pass because out of the time window, which won't change anymore */
+	AI_snort_alert       *closed_log;
+	AI_snort_alert       *closed_log_tail;
+
+	/** Alerts received since the latest clustering pass */
+	AI_snort_alert       *new_alerts;
+	AI_snort_alert       *new_alerts_tail;
+
+	/** Number of open clusters per value of each clustering attribute */
+	AI_attribute_counts  attribute_counts[CLUSTER_TYPES];
+
+	/** Number of clusters opened so far in the partition */
+	unsigned long        n_created;
+
+	/** Records of the clusters changed in the latest pass, to be appended to the journal */
+	char                 *journal;
+	size_t               journal_len;
+	size_t               journal_size;
+} AI_cluster_partition;
+
+PRIVATE hierarchy_node  *h_root[CLUSTER_TYPES] = { NULL };
+PRIVATE AI_snort_alert  *alert_log             = NULL;
+PRIVATE pthread_mutex_t  mutex;
+
+/** Lookup tables compiled from the port and protocol hierarchies */
+PRIVATE hierarchy_node  **value_tables[CLUSTER_TYPES] = { NULL };
+
+/** Lookup tables compiled from the address hierarchies */
+PRIVATE AI_range_table  addr_tables[CLUSTER_TYPES];
+
+/** Leaf nodes of the hierarchies */
+PRIVATE AI_leaf_node    *leaf_nodes            = NULL;
+
+/** Widths in seconds of the buckets of the time hierarchy, from the narrowest to the widest */
+PRIVATE int             *time_widths           = NULL;
+PRIVATE unsigned int    n_time_widths          = 0;
+
+/** Labels of the buckets of the time hierarchy, one per width */
+PRIVATE char            (*time_labels)[256]    = NULL;
+
+/** Number of node ids assigned so far for each clustering attribute */
+PRIVATE unsigned int    n_node_ids[CLUSTER_TYPES] = { 0 };
+
+/** Partitions of the clustering problem */
+PRIVATE AI_cluster_partition *partitions       = NULL;
+PRIVATE unsigned int    n_partitions           = 0;
+
+/** Pool of the clustering workers: at every pass the workers pick the partitions one at a time
+ * (next_partition) until none is left, and the last one going idle signals the end of the pass */
+PRIVATE pthread_mutex_t pool_mutex;
+PRIVATE pthread_cond_t  pool_start_cond;
+PRIVATE pthread_cond_t  pool_done_cond;
+PRIVATE unsigned int    n_workers              = 0;
+PRIVATE unsigned int    busy_workers           = 0;
+PRIVATE unsigned int    next_partition         = 0;
+PRIVATE unsigned long   pool_pass              = 0;
+
+/** Minimum size of the clusters for the current and for the previous pass */
+PRIVATE int             cluster_min_size       = 1;
+PRIVATE int             prev_cluster_min_size  = 1;
+
+/** Latest alert of the source already clustered (opaque cursor for get_alerts_since) */
+PRIVATE AI_snort_alert  *alerts_cursor         = NULL;
+
+/** Distinct signatures seen so far, and total number of alerts clustered so far
+ * (the ratio between them is the heterogeneity of the alerts) */
+PRIVATE AI_alert_occurrence *signatures        = NULL;
+PRIVATE unsigned long   total_alerts           = 0;
+
+/** Timestamp of the latest alert clustered so far */
+PRIVATE time_t          latest_timestamp       = 0;
+
+/** Time of the latest snapshot of the clustered alerts file */
+PRIVATE time_t          latest_snapshot        = 0;
+
+/** Clusters closed and already written, waiting to be handed to the correlation thread */
+PRIVATE AI_snort_alert  *closed_alerts         = NULL;
+PRIVATE AI_snort_alert  *closed_alerts_tail    = NULL;
+
+/** Clusters handed to the correlation thread in its previous pass, released in its next one */
+PRIVATE AI_snort_alert  *handed_alerts         = NULL;
+
+/** Records of the clusters closed since the latest snapshot, not written to the clustered alerts file yet */
+PRIVATE char            *closed_buf            = NULL;
+PRIVATE size_t          closed_len             = 0;
+PRIVATE size_t          closed_size            = 0;
+
+/** Length of the records of the closed clusters at the beginning of the clustered alerts file */
+PRIVATE long            closed_file_len        = 0;
+
+/**
+ * \brief  Assign an id to a new node of a clustering hierarchy (the count arrays of the partitions
+ * make room for it when a cluster with that value is first counted)
+ * \param  type 	Attribute type
+ * \param  node 	Node
+ */
+
+PRIVATE void
+__AI_attribute_node_register ( cluster_type type, hierarchy_node *node )
+{
+	node->id = n_node_ids[type]++;
+}		/* -----  end of function __AI_attribute_node_register  ----- */
+
+/**
+ * \brief  Assign an id to all the nodes of a configured clustering hierarchy
+ * \param  type 	Attribute type
+ * \param  node 	Root of the (sub)hierarchy
+ */
+
+PRIVATE void
+__AI_attribute_nodes_register ( cluster_type type, hierarchy_node *node )
+{
+	int i;
+
+	__AI_attribute_node_register ( type, node );
+
+	for ( i=0; i < node->nchildren; i++ )
+		__AI_attribute_nodes_register ( type, node->children[i] );
+}		/* -----  end of function __AI_attribute_nodes_register  ----- */
+
+/**
+ * \brief  Update the number of open clusters of a partition having a certain value for an attribute
+ * \param  part 	Partition
+ * \param  type 	Attribute type
+ * \param  node 	Value of the attribute
+ * \param  add 	true if a cluster with that value was opened, false if it was removed
+ */
+
+PRIVATE void
+__AI_attribute_count_update ( AI_cluster_partition *part, cluster_type type, hierarchy_node *node, BOOL add )
+{
+	AI_attribute_counts *counts = &( part->attribute_counts[type] );
+	unsigned int        old_count = 0,
+					new_count = 0,
+					size;
+
+	if ( node->id >= counts->nodes_size )
+	{
+		for ( size = ( counts->nodes_size ) ? counts->nodes_size : 64; size <= node->id; size *= 2 );
+
+		if ( !( counts->node_counts = ( unsigned int* ) realloc ( counts->node_counts, size * sizeof ( unsigned int ))))
+			AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+		memset ( counts->node_counts + counts->nodes_size, 0, ( size - counts->nodes_size ) * sizeof ( unsigned int ));
+		counts->nodes_size = size;
+	}
+
+	old_count = counts->node_counts[ node->id ];
+
+	if ( !add && old_count == 0 )
+		return;
+
+	new_count = ( add ) ? old_count + 1 : old_count - 1;
+
+	if ( new_count >= counts->freq_size )
+	{
+		size = ( counts->freq_size ) ? 2 * counts->freq_size : 64;
+
+		if ( !( counts->count_freq = ( unsigned int* ) realloc ( counts->count_freq, size * sizeof ( unsigned int ))))
+			AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+		memset ( counts->count_freq + counts->freq_size, 0, ( size - counts->freq_size ) * sizeof ( unsigned int ));
+		counts->freq_size = size;
+	}
+
+	if ( old_count > 0 )
+		counts->count_freq[ old_count ]--;
+
+	if ( new_count > 0 )
+		counts->count_freq[ new_count ]++;
+
+	counts->node_counts[ node->id ] = new_count;
+
+	/* The maximum can only move by one at a time: when the last node with the maximum count
+	 * loses a cluster, that node has now the maximum count minus one */
+	if ( new_count > counts->max )
+		counts->max = new_count;
+	else if ( old_count == counts->max && counts->count_freq[ old_count ] == 0 )
+		counts->max = new_count;
+}		/* -----  end of function __AI_attribute_count_update  ----- */
+
+/**
+ * \brief  Update the attribute counts for all the attributes of an open cluster, in one pass
+ * \param  part 	Partition of the cluster
+ * \param  alert 	Alert representing the cluster
+ * \param  add 	true if the cluster was opened, false if it was removed
+ */
+
+PRIVATE void
+__AI_attribute_counts_update ( AI_cluster_partition *part, AI_snort_alert *alert, BOOL add )
+{
+	cluster_type type;
+
+	for ( type=0; type < CLUSTER_TYPES; type++ )
+	{
+		if ( type != none && h_root[type] && alert->h_node[type] )
+			__AI_attribute_count_update ( part, type, alert->h_node[type], add );
+	}
+}		/* -----  end of function __AI_attribute_counts_update  ----- */
+
+/**
+ * \brief  Function that picks up the heuristic value for a clustering attribute in according to Julisch's heuristic (ACM, Vol.2, No.3, 09 2002, pag.124),
+ * i.e. the maximum number of open clusters of a partition sharing the same value for that attribute
+ * \param  part 	Partition
+ * \param  type 	Attribute type
+ * \return The heuristic coefficient for that attribute, -1 if no clustering information is available for that attribute
+ */
+
+PRIVATE int
+__AI_heuristic_func ( AI_cluster_partition *part, cluster_type type )
+{
+	if ( type == none || !part->n_open_clusters || !h_root[type] )
+		return -1;
+
+	return (int) part->attribute_counts[type].max;
+}		/* -----  end of function __AI_heuristic_func  ----- */
+
+/**
+ * \brief  Create a new clustering hierarchy node
+ * \param  label 	Label for the node
+ * \param  min_val 	Minimum value for the range represented by the node
+ * \param  max_val 	Maximum value for the range represented by the node
+ * \return The brand new node if the allocation was ok, otherwise abort the application
+ */
+
+PRIVATE hierarchy_node*
+__AI_hierarchy_node_new ( char *label, int min_val, int max_val )
+{
+	hierarchy_node *n = NULL;
+
+	if ( !( n = ( hierarchy_node* ) malloc ( sizeof ( hierarchy_node )) ))
+	{
+		AI_fatal_err ( "Fatal dynamic memory allocation failure", __FILE__, __LINE__ );
+	}
+
+	n->min_val    = min_val;
+	n->max_val    = max_val;
+	n->nchildren  = 0;
+	n->children   = NULL;
+	n->parent     = NULL;
+	strncpy ( n->label, label, sizeof ( n->label ));
+
+	return n;
+}		/* -----  end of function __AI_hierarchy_node_new  ----- */
+
+
+/**
+ * \brief  Append a node to a clustering hierarchy node
+ * \param  parent 	Parent node
+ * \param  child 	Child node
+ */
+
+PRIVATE void
+__AI_hierarchy_node_append ( hierarchy_node *parent, hierarchy_node *child )
+{
+	if ( !( parent->children = ( hierarchy_node** ) realloc ( parent->children, (++(parent->nchildren)) * sizeof ( hierarchy_node* )) ))
+	{
+		AI_fatal_err ( "Fatal dynamic memory allocation failure", __FILE__, __LINE__ );
+	}
+
+	parent->children[ parent->nchildren - 1 ] = child;
+	child->parent = parent;
+}		/* -----  end of function __AI_hierarchy_node_append  ----- */
+
+
+/**
+ * \brief  Get the minimum node in a hierarchy tree that matches a certain value
+ * \param  val 	Value to be matched in the range
+ * \param  root 	Root of the hierarchy
+ * \return The minimum node that matches the value if any, NULL otherwise
+ */
+PRIVATE hierarchy_node*
+__AI_get_min_hierarchy_node ( int val, hierarchy_node *root )
+{
+	int i;
+	hierarchy_node *next = NULL;
+
+	if ( !root )
+	{
+		return NULL;
+	}
+
+	if ( (unsigned) val < (unsigned) root->min_val || (unsigned) val > (unsigned) root->max_val )
+	{
+		return NULL;
+	}
+
+	for ( i=0; i < root->nchildren && !next; i++ )
+	{
+		if ( (unsigned) root->children[i]->min_val <= (unsigned) val && (unsigned) root->children[i]->max_val >= (unsigned) val )
+		{
+			next = root->children[i];
+		}
+	}
+
+	if ( !next )
+		return root;
+	
+	return __AI_get_min_hierarchy_node ( val, next );
+}		/* -----  end of function __AI_get_min_hierarchy_node  ----- */
+
+/**
+ * \brief  Paint the range of a hierarchy node and of its children on the lookup table of a port or
+ * protocol hierarchy. The children are painted after their parent, and in reverse order, so that each
+ * value gets the same node __AI_get_min_hierarchy_node would return for it
+ * \param  table 	Lookup table
+ * \param  size 	Number of entries of the table
+ * \param  node 	Node to be painted
+ */
+
+PRIVATE void
+__AI_value_table_paint ( hierarchy_node **table, int size, hierarchy_node *node )
+{
+	int i;
+
+	for ( i = ( node->min_val < 0 ) ? 0 : node->min_val; i <= node->max_val && i < size; i++ )
+		table[i] = node;
+
+	for ( i = node->nchildren - 1; i >= 0; i-- )
+		__AI_value_table_paint ( table, size, node->children[i] );
+}		/* -----  end of function __AI_value_table_paint  ----- */
+
+/**
+ * \brief  Collect the boundaries of the ranges of a hierarchy, i.e. the points where the
+ * deepest node matching an address may change
+ * \param  node 	Root of the (sub)hierarchy
+ * \param  bounds 	Reference to the array of boundaries
+ * \param  n_bounds 	Reference to the number of boundaries
+ */
+
+PRIVATE void
+__AI_range_bounds_collect ( hierarchy_node *node, uint32_t **bounds, unsigned int *n_bounds )
+{
+	int i;
+
+	if ( !( *bounds = ( uint32_t* ) realloc ( *bounds, ( *n_bounds + 2 ) * sizeof ( uint32_t ))))
+		AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+	(*bounds)[ (*n_bounds)++ ] = (uint32_t) node->min_val;
+
+	if ( (uint32_t) node->max_val != 0xffffffff )
+		(*bounds)[ (*n_bounds)++ ] = (uint32_t) node->max_val + 1;
+
+	for ( i=0; i < node->nchildren; i++ )
+		__AI_range_bounds_collect ( node->children[i], bounds, n_bounds );
+}		/* -----  end of function __AI_range_bounds_collect  ----- */
+
+PRIVATE int
+__AI_uint32_compare ( const void *a, const void *b )
+{
+	uint32_t x = *((const uint32_t*) a),
+		    y = *((const uint32_t*) b);
+
+	return ( x < y ) ? -1 : (( x > y ) ? 1 : 0 );
+}
+
+/**
+ * \brief  Compile an address hierarchy into a sorted table of disjoint intervals, each one
+ * associated to the deepest node of the hierarchy matching its addresses
+ * \param  table 	Table to be filled
+ * \param  root 	Root of the hierarchy
+ */
+
+PRIVATE void
+__AI_range_table_build ( AI_range_table *table, hierarchy_node *root )
+{
+	uint32_t       *bounds = NULL;
+	unsigned int   i, n_bounds = 0;
+	hierarchy_node *node = NULL;
+
+	if ( !( bounds = ( uint32_t* ) malloc ( sizeof ( uint32_t ))))
+		AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+	/* The addresses before the first range are matched by no node */
+	bounds[ n_bounds++ ] = 0;
+	__AI_range_bounds_collect ( root, &bounds, &n_bounds );
+	qsort ( bounds, n_bounds, sizeof ( uint32_t ), __AI_uint32_compare );
+
+	if ( !( table->entries = ( AI_range_entry* ) malloc ( n_bounds * sizeof ( AI_range_entry ))))
+		AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+	table->n_entries = 0;
+
+	for ( i=0; i < n_bounds; i++ )
+	{
+		if ( i > 0 && bounds[i] == bounds[i-1] )
+			continue;
+
+		node = __AI_get_min_hierarchy_node ( (int) bounds[i], root );
+
+		/* Adjacent intervals matched by the same node are merged */
+		if ( table->n_entries > 0 && table->entries[ table->n_entries - 1 ].node == node )
+			continue;
+
+		table->entries[ table->n_entries ].start = bounds[i];
+		table->entries[ table->n_entries ].node  = node;
+		table->n_entries++;
+	}
+
+	free ( bounds );
+}		/* -----  end of function __AI_range_table_build  ----- */
+
+/**
+ * \brief  Compile the clustering hierarchies into flat lookup tables: a PORT_TABLE_SIZE entries
+ * array for the port hierarchies, a PROTOCOL_TABLE_SIZE entries array for the protocol hierarchy,
+ * and a table of disjoint intervals for the address hierarchies (the time hierarchy has fixed-width
+ * buckets, found by division).
+ * The configured nodes also get their ids in the attribute count arrays
+ */
+
+PRIVATE void
+__AI_lookup_tables_build ()
+{
+	cluster_type type;
+
+	for ( type=0; type < CLUSTER_TYPES; type++ )
+	{
+		if ( !h_root[type] )
+			continue;
+
+		__AI_attribute_nodes_register ( type, h_root[type] );
+
+		switch ( type )
+		{
+			case src_port:
+			case dst_port:
+				if ( !( value_tables[type] = ( hierarchy_node** ) calloc ( PORT_TABLE_SIZE, sizeof ( hierarchy_node* ))))
+					AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+				__AI_value_table_paint ( value_tables[type], PORT_TABLE_SIZE, h_root[type] );
+				break;
+
+			case ip_protocol:
+				if ( !( value_tables[type] = ( hierarchy_node** ) calloc ( PROTOCOL_TABLE_SIZE, sizeof ( hierarchy_node* ))))
+					AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+				__AI_value_table_paint ( value_tables[type], PROTOCOL_TABLE_SIZE, h_root[type] );
+				break;
+
+			case src_addr:
+			case dst_addr:
+				__AI_range_table_build ( &( addr_tables[type] ), h_root[type] );
+				break;
+
+			default:
+				break;
+		}
+	}
+}		/* -----  end of function __AI_lookup_tables_build  ----- */
+
+/**
+ * \brief  Get the deepest configured node of a hierarchy matching a value, through the lookup tables
+ * \param  type 	Hierarchy type
+ * \param  val 	Value (in host byte order)
+ * \return The deepest node matching the value, NULL if none
+ */
+
+PRIVATE hierarchy_node*
+__AI_hierarchy_lookup ( cluster_type type, uint32_t val )
+{
+	AI_range_table *table = NULL;
+	unsigned int   low = 0, high = 0, mid = 0;
+
+	switch ( type )
+	{
+		case src_port:
+		case dst_port:
+			if ( !value_tables[type] || val >= PORT_TABLE_SIZE )
+				return NULL;
+
+			return value_tables[type][val];
+
+		case ip_protocol:
+			if ( !value_tables[type] || val >= PROTOCOL_TABLE_SIZE )
+				return NULL;
+
+			return value_tables[type][val];
+
+		case src_addr:
+		case dst_addr:
+			table = &( addr_tables[type] );
+
+			if ( table->n_entries == 0 )
+				return NULL;
+
+			/* Find the last interval starting before the value */
+			for ( low = 0, high = table->n_entries; high - low > 1; )
+			{
+				mid = ( low + high ) / 2;
+
+				if ( table->entries[mid].start <= val )
+					low = mid;
+				else
+					high = mid;
+			}
+
+			return table->entries[low].node;
+
+		default:
+			return NULL;
+	}
+}		/* -----  end of function __AI_hierarchy_lookup  ----- */
+
+/**
+ * \brief  Get the leaf node for a single value of a hierarchy. The leaves are shared by all the
+ * alerts with the same value and are not linked as children of the configured nodes, so the
+ * hierarchies don't grow at runtime
+ * \param  type 	Hierarchy type
+ * \param  val 	Value (in host byte order)
+ * \param  parent 	Deepest configured node matching the value
+ * \param  label 	Label for the leaf
+ * \return The leaf node
+ */
+
+PRIVATE hierarchy_node*
+__AI_leaf_node_get ( cluster_type type, uint32_t val, hierarchy_node *parent, char *label )
+{
+	AI_leaf_key  key;
+	AI_leaf_node *leaf = NULL;
+
+	memset ( &key, 0, sizeof ( key ));
+	key.type  = type;
+	key.value = val;
+	HASH_FIND ( hh, leaf_nodes, &key, sizeof ( AI_leaf_key ), leaf );
+
+	if ( !leaf )
+	{
+		if ( !( leaf = ( AI_leaf_node* ) malloc ( sizeof ( AI_leaf_node ))))
+			AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+		leaf->key  = key;
+		leaf->node = __AI_hierarchy_node_new ( label, (int) val, (int) val );
+		leaf->node->type   = type;
+		leaf->node->parent = parent;
+		__AI_attribute_node_register ( type, leaf->node );
+		HASH_ADD ( hh, leaf_nodes, key, sizeof ( AI_leaf_key ), leaf );
+	}
+
+	return leaf->node;
+}		/* -----  end of function __AI_leaf_node_get  ----- */
+
+/**
+ * \brief  Get the bucket of the time hierarchy containing a timestamp, creating it (and the wider
+ * buckets containing it) the first time. The buckets are aligned to multiples of their width, so
+ * each bucket is entirely contained in a single bucket of the next width
+ * \param  level 	Index of the width of the bucket in time_widths
+ * \param  ts 	Timestamp
+ * \return The bucket node
+ */
+
+PRIVATE hierarchy_node*
+__AI_time_bucket_get ( unsigned int level, time_t ts )
+{
+	AI_leaf_key    key;
+	AI_leaf_node   *bucket = NULL;
+	hierarchy_node *parent = NULL;
+	time_t         bucket_start;
+	struct tm      tm;
+	char           start[64],
+				label[256];
+
+	memset ( &key, 0, sizeof ( key ));
+	key.type  = alert_time;
+	key.level = level + 1;
+	key.value = (uint32_t) ( ts / time_widths[level] );
+	HASH_FIND ( hh, leaf_nodes, &key, sizeof ( AI_leaf_key ), bucket );
+
+	if ( !bucket )
+	{
+		parent = ( level + 1 < n_time_widths ) ? __AI_time_bucket_get ( level + 1, ts ) : h_root[alert_time];
+		bucket_start = (time_t) key.value * time_widths[level];
+		localtime_r ( &bucket_start, &tm );
+		strftime ( start, sizeof ( start ), "%Y-%m-%d %H:%M:%S", &tm );
+		snprintf ( label, sizeof ( label ), "%s %s", time_labels[level], start );
+
+		if ( !( bucket = ( AI_leaf_node* ) malloc ( sizeof ( AI_leaf_node ))))
+			AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+		bucket->key  = key;
+		bucket->node = __AI_hierarchy_node_new ( label, (int) bucket_start, (int) ( bucket_start + time_widths[level] - 1 ));
+		bucket->node->type   = alert_time;
+		bucket->node->parent = parent;
+		__AI_attribute_node_register ( alert_time, bucket->node );
+		HASH_ADD ( hh, leaf_nodes, key, sizeof ( AI_leaf_key ), bucket );
+	}
+
+	return bucket->node;
+}		/* -----  end of function __AI_time_bucket_get  ----- */
+
+/**
+ * \brief  Add a bucket width to the time hierarchy, keeping the widths sorted from the narrowest
+ * \param  node 	Configured node (its range is the width of the buckets in seconds)
+ */
+
+PRIVATE void
+__AI_time_width_add ( hierarchy_node *node )
+{
+	unsigned int i, j;
+
+	if ( !h_root[alert_time] )
+		h_root[alert_time] = __AI_hierarchy_node_new ( "any time", 0, INT_MAX );
+
+	for ( i=0; i < n_time_widths && time_widths[i] < node->min_val; i++ );
+
+	if ( i < n_time_widths && time_widths[i] == node->min_val )
+	{
+		AI_fatal_err ( "Parse error: duplicate cluster range in module configuration", __FILE__, __LINE__ );
+	}
+
+	if ( !( time_widths = ( int* ) realloc ( time_widths, ( n_time_widths + 1 ) * sizeof ( int ))))
+		AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+	if ( !( time_labels = ( char(*)[256] ) realloc ( time_labels, ( n_time_widths + 1 ) * sizeof ( *time_labels ))))
+		AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+	for ( j = n_time_widths; j > i; j-- )
+	{
+		time_widths[j] = time_widths[j-1];
+		memcpy ( time_labels[j], time_labels[j-1], sizeof ( time_labels[j] ));
+	}
+
+	time_widths[i] = node->min_val;
+	strncpy ( time_labels[i], node->label, sizeof ( time_labels[i] ));
+	time_labels[i][ sizeof ( time_labels[i] ) - 1 ] = 0;
+	n_time_widths++;
+}		/* -----  end of function __AI_time_width_add  ----- */
+
+/**
+ * \brief  Fill the key identifying the alerts with the signature of a certain alert and the given
+ * values of the clustering attributes
+ * \param  alert 	Alert
+ * \param  nodes 	Values of the clustering attributes
+ * \param  key 	Key to be filled
+ */
+
+PRIVATE void
+__AI_merge_key_from_nodes ( const AI_snort_alert *alert, hierarchy_node * const *nodes, AI_merge_key *key )
+{
+	cluster_type type;
+
+	/* The key is hashed as raw bytes, so any padding must be zeroed */
+	memset ( key, 0, sizeof ( AI_merge_key ));
+	key->gid = alert->gid;
+	key->sid = alert->sid;
+	key->rev = alert->rev;
+
+	for ( type=0; type < CLUSTER_TYPES; type++ )
+	{
+		if ( type != none && nodes[type] )
+		{
+			key->range[type].min = nodes[type]->min_val;
+			key->range[type].max = nodes[type]->max_val;
+		} else {
+			key->range[type].min = NO_RANGE_MIN;
+			key->range[type].max = NO_RANGE_MAX;
+		}
+	}
+}		/* -----  end of function __AI_merge_key_from_nodes  ----- */
+
+/**
+ * \brief  Fill the key identifying the alerts that can be merged with a certain alert
+ * \param  alert 	Alert
+ * \param  key 	Key to be filled
+ */
+
+PRIVATE void
+__AI_merge_key_init ( AI_snort_alert *alert, AI_merge_key *key )
+{
+	__AI_merge_key_from_nodes ( alert, alert->h_node, key );
+}		/* -----  end of function __AI_merge_key_init  ----- */
+
+/**
+ * \brief  Get the depth of a node in its hierarchy
+ * \param  node 	Node
+ * \return The number of ancestors of the node, NO_DEPTH for a missing node
+ */
+
+PRIVATE unsigned int
+__AI_hierarchy_node_depth ( const hierarchy_node *node )
+{
+	unsigned int depth = 0;
+
+	if ( !node )
+		return NO_DEPTH;
+
+	for ( ; node->parent; node = node->parent )
+		depth++;
+
+	return depth;
+}		/* -----  end of function __AI_hierarchy_node_depth  ----- */
+
+/**
+ * \brief  Add a cluster to the bucket of its current merge key, counting its attribute values
+ * \param  part 	Partition of the cluster
+ * \param  cluster 	Cluster to be indexed
+ */
+
+PRIVATE void
+__AI_bucket_insert ( AI_cluster_partition *part, AI_cluster *cluster )
+{
+	AI_merge_key       key;
+	AI_merge_shape_key shape_key;
+	AI_merge_bucket    *bucket = NULL;
+	cluster_type       type;
+
+	__AI_merge_key_init ( cluster->alert, &key );
+	HASH_FIND ( hh, part->buckets, &key, sizeof ( AI_merge_key ), bucket );
+
+	if ( !bucket )
+	{
+		if ( !( bucket = ( AI_merge_bucket* ) calloc ( 1, sizeof ( AI_merge_bucket ))))
+			AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+		bucket->key = key;
+		HASH_ADD ( hh, part->buckets, key, sizeof ( AI_merge_key ), bucket );
+
+		/* Count the bucket under the generalisation levels of its nodes */
+		memset ( &shape_key, 0, sizeof ( shape_key ));
+
+		for ( type=0; type < CLUSTER_TYPES; type++ )
+			shape_key.depth[type] = ( type != none ) ? __AI_hierarchy_node_depth ( cluster->alert->h_node[type] ) : NO_DEPTH;
+
+		HASH_FIND ( hh, part->shapes, &shape_key, sizeof ( AI_merge_shape_key ), bucket->shape );
+
+		if ( !bucket->shape )
+		{
+			if ( !( bucket->shape = ( AI_merge_shape* ) calloc ( 1, sizeof ( AI_merge_shape ))))
+				AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+			bucket->shape->key = shape_key;
+			HASH_ADD ( hh, part->shapes, key, sizeof ( AI_merge_shape_key ), bucket->shape );
+		}
+
+		bucket->shape->n_buckets++;
+	}
+
+	__AI_attribute_counts_update ( part, cluster->alert, true );
+	cluster->bucket = bucket;
+	cluster->prev   = NULL;
+	cluster->next   = bucket->clusters;
+
+	if ( bucket->clusters )
+		bucket->clusters->prev = cluster;
+
+	bucket->clusters = cluster;
+}		/* -----  end of function __AI_bucket_insert  ----- */
+
+/**
+ * \brief  Remove a cluster from its bucket, deleting the bucket if it gets empty, and uncount its attribute values
+ * \param  part 	Partition of the cluster
+ * \param  cluster 	Cluster to be removed
+ */
+
+PRIVATE void
+__AI_bucket_remove ( AI_cluster_partition *part, AI_cluster *cluster )
+{
+	AI_merge_bucket *bucket = cluster->bucket;
+
+	if ( !bucket )
+		return;
+
+	__AI_attribute_counts_update ( part, cluster->alert, false );
+
+	if ( cluster->prev )
+		cluster->prev->next = cluster->next;
+	else
+		bucket->clusters = cluster->next;
+
+	if ( cluster->next )
+		cluster->next->prev = cluster->prev;
+
+	if ( !bucket->clusters )
+	{
+		if ( --( bucket->shape->n_buckets ) == 0 )
+		{
+			HASH_DEL ( part->shapes, bucket->shape );
+			free ( bucket->shape );
+		}
+
+		HASH_DEL ( part->buckets, bucket );
+		free ( bucket );
+	}
+
+	cluster->bucket = NULL;
+	cluster->prev   = NULL;
+	cluster->next   = NULL;
+}		/* -----  end of function __AI_bucket_remove  ----- */
+
+/**
+ * \brief  Find, in a bucket, an open cluster whose representative alert is within cluster_max_alert_interval
+ * from the one of a cluster (if a time window was defined)
+ * \param  bucket 	Bucket
+ * \param  cluster 	Cluster to be merged
+ * \return The cluster to merge it into, NULL if none
+ */
+
+PRIVATE AI_cluster*
+__AI_bucket_cluster_match ( const AI_merge_bucket *bucket, const AI_cluster *cluster )
+{
+	AI_cluster *c = NULL;
+
+	for ( c = bucket->clusters; c; c = c->next )
+	{
+		if ( c == cluster )
+			continue;
+
+		if ( config->clusterMaxAlertInterval == 0 ||
+				labs ( (long) ( c->alert->timestamp - cluster->alert->timestamp )) <= (long) config->clusterMaxAlertInterval )
+			return c;
+	}
+
+	return NULL;
+}		/* -----  end of function __AI_bucket_cluster_match  ----- */
+
+/**
+ * \brief  Find an open cluster which a cluster can be merged into: same merge key, or else merge key made of
+ * ancestors of the nodes of the cluster (the open clusters may have already been generalised further, or along
+ * other attributes), with the representative alert within cluster_max_alert_interval. Among the clusters at
+ * different levels, the least generalised one is picked
+ * \param  part 	Partition of the cluster
+ * \param  cluster 	Cluster to be merged
+ * \return The cluster to merge it into, NULL if none
+ */
+
+PRIVATE AI_cluster*
+__AI_bucket_find_match ( AI_cluster_partition *part, AI_cluster *cluster )
+{
+	AI_merge_key    key;
+	AI_merge_bucket *bucket = NULL;
+	AI_merge_shape  *shape  = NULL;
+	AI_cluster      *c      = NULL,
+				 *best   = NULL;
+	hierarchy_node  *nodes[CLUSTER_TYPES];
+	unsigned int    depth, level, best_level = 0;
+	cluster_type    type;
+
+	__AI_merge_key_init ( cluster->alert, &key );
+	HASH_FIND ( hh, part->buckets, &key, sizeof ( AI_merge_key ), bucket );
+
+	if ( bucket && ( c = __AI_bucket_cluster_match ( bucket, cluster )))
+		return c;
+
+	/* Look the cluster up under the ancestors of its nodes at the levels of each group of open clusters */
+	for ( shape = part->shapes; shape; shape = (AI_merge_shape*) shape->hh.next )
+	{
+		level = 0;
+
+		for ( type=0; type < CLUSTER_TYPES; type++ )
+		{
+			nodes[type] = ( type != none ) ? cluster->alert->h_node[type] : NULL;
+			depth = __AI_hierarchy_node_depth ( nodes[type] );
+
+			if (( depth == NO_DEPTH ) != ( shape->key.depth[type] == NO_DEPTH ) || ( depth != NO_DEPTH && depth < shape->key.depth[type] ))
+				break;
+
+			for ( ; depth != NO_DEPTH && depth > shape->key.depth[type]; depth-- )
+				nodes[type] = nodes[type]->parent;
+
+			level += ( depth != NO_DEPTH ) ? depth : 0;
+		}
+
+		if ( type < CLUSTER_TYPES || ( best && level <= best_level ))
+			continue;
+
+		__AI_merge_key_from_nodes ( cluster->alert, nodes, &key );
+		HASH_FIND ( hh, part->buckets, &key, sizeof ( AI_merge_key ), bucket );
+
+		if ( bucket && ( c = __AI_bucket_cluster_match ( bucket, cluster )))
+		{
+			best       = c;
+			best_level = level;
+		}
+	}
+
+	return best;
+}		/* -----  end of function __AI_bucket_find_match  ----- */
+
+/**
+ * \brief  Merge a cluster into another one
+ * \param  part 	Partition of the clusters
+ * \param  into 	Cluster absorbing the other one
+ * \param  from 	Cluster to be absorbed
+ */
+
+PRIVATE void
+__AI_cluster_absorb ( AI_cluster_partition *part, AI_cluster *into, AI_cluster *from )
+{
+	AI_snort_alert   *rep    = into->alert,
+				  *merged = from->alert;
+	AI_alerts_couple alerts_couple;
+	unsigned int     i, count = rep->grouped_alerts_count;
+
+	if ( !( rep->grouped_alerts = ( AI_snort_alert** ) realloc ( rep->grouped_alerts,
+			( rep->grouped_alerts_count + merged->grouped_alerts_count ) * sizeof ( AI_snort_alert* ))))
+		AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+	/* The first slot of the group is the representative alert itself */
+	rep->grouped_alerts[0] = rep;
+	rep->grouped_alerts[ count++ ] = merged;
+
+	for ( i=1; i < merged->grouped_alerts_count && merged->grouped_alerts; i++ )
+		rep->grouped_alerts[ count++ ] = merged->grouped_alerts[i];
+
+	rep->grouped_alerts_count = count;
+
+	/* If we are storing the outputs of the module to a database, save the clusters containing the
+	 * merged alerts (all the members of the absorbed cluster have to be moved, not only its head) */
+	if ( config->outdbtype != outdb_none )
+	{
+		alerts_couple.alert1 = rep;
+		alerts_couple.alert2 = merged;
+		AI_store_cluster_to_db ( &alerts_couple );
+
+		for ( i=1; i < merged->grouped_alerts_count && merged->grouped_alerts; i++ )
+		{
+			alerts_couple.alert2 = merged->grouped_alerts[i];
+			AI_store_cluster_to_db ( &alerts_couple );
+		}
+	}
+
+	free ( merged->grouped_alerts );
+	merged->grouped_alerts       = NULL;
+	merged->grouped_alerts_count = 1;
+	merged->next                 = NULL;
+
+	__AI_bucket_remove ( part, from );
+	from->absorbed    = true;
+	from->merged_into = rep->cluster_id;
+	into->changed     = true;
+}		/* -----  end of function __AI_cluster_absorb  ----- */
+
+/**
+ * \brief  Initialize the clustering hierarchy nodes of a new alert
+ * \param  alert 	Alert
+ */
+
+PRIVATE void
+__AI_alert_hierarchies_init ( AI_snort_alert *alert )
+{
+	hierarchy_node *node;
+	cluster_type   type;
+	char           label[256];
+	int            hostval;
+	int            netval;
+
+	for ( type=0; type < CLUSTER_TYPES; type++ )
+	{
+		/* If "type" is a valid clustering hierarchy but the corresponding node in the alert is not initialized, initialize it */
+		if ( h_root[type] && !alert->h_node[type] )
+		{
+			switch ( type )
+			{
+				case src_addr:
+				case dst_addr:
+					netval  = ( type == src_addr ) ? alert->ip_src_addr : alert->ip_dst_addr;
+					hostval = ntohl ( netval );
+					inet_ntop ( AF_INET, &(netval), label, INET_ADDRSTRLEN );
+					break;
+
+				case src_port:
+				case dst_port:
+					netval  = ( type == src_port ) ? alert->tcp_src_port : alert->tcp_dst_port;
+					hostval = ntohs ( netval );
+					snprintf ( label, sizeof(label), "%d", hostval );
+					break;
+
+				case ip_protocol:
+					hostval = alert->ip_proto;
+
+					if ( hostval == IPPROTO_TCP )
+						strncpy ( label, "tcp", sizeof ( label ));
+					else if ( hostval == IPPROTO_UDP )
+						strncpy ( label, "udp", sizeof ( label ));
+					else if ( hostval == IPPROTO_ICMP )
+						strncpy ( label, "icmp", sizeof ( label ));
+					else
+						snprintf ( label, sizeof(label), "%d", hostval );
+
+					break;
+
+				/* The alerts start from the narrowest time bucket containing them */
+				case alert_time:
+					if ( n_time_widths > 0 )
+						alert->h_node[type] = __AI_time_bucket_get ( 0, alert->timestamp );
+
+					continue;
+
+				default:
+					continue;
+			}
+
+			if (( node = __AI_hierarchy_lookup ( type, (uint32_t) hostval )))
+			{
+				if ( (unsigned) node->min_val < (unsigned) node->max_val )
+				{
+					node = __AI_leaf_node_get ( type, (uint32_t) hostval, node, label );
+				}
+
+				alert->h_node[type] = node;
+			}
+		}
+	}
+}		/* -----  end of function __AI_alert_hierarchies_init  ----- */
+
+/**
+ * \brief  Dispatch a new alert to the partition of its signature, updating the global
+ * statistics about the alerts (signatures, number of alerts, latest timestamp)
+ * \param  alert 	Alert to be dispatched
+ */
+
+PRIVATE void
+__AI_alert_dispatch ( AI_snort_alert *alert )
+{
+	AI_hyperalert_key    key;
+	AI_alert_occurrence  *found = NULL;
+	AI_cluster_partition *part  = NULL;
+
+	/* If an alert has an unitialized "grouped alarms count", set its counter to 1 (it only groupes the current alert) */
+	if ( alert->grouped_alerts_count == 0 )
+	{
+		alert->grouped_alerts_count = 1;
+	}
+
+	alert->next = NULL;
+
+	/* The leaf nodes are shared by all the partitions, so they are interned here, before the workers run */
+	__AI_alert_hierarchies_init ( alert );
+
+	memset ( &key, 0, sizeof ( key ));
+	key.gid = alert->gid;
+	key.sid = alert->sid;
+	key.rev = alert->rev;
+	HASH_FIND ( hh, signatures, &key, sizeof ( AI_hyperalert_key ), found );
+
+	if ( !found )
+	{
+		if ( !( found = (AI_alert_occurrence*) malloc ( sizeof ( AI_alert_occurrence ))))
+			AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+		found->key   = key;
+		found->count = 0;
+		HASH_ADD ( hh, signatures, key, sizeof ( AI_hyperalert_key ), found );
+	}
+
+	found->count++;
+	total_alerts += alert->grouped_alerts_count;
+
+	if ( alert->timestamp > latest_timestamp )
+		latest_timestamp = alert->timestamp;
+
+	part = &( partitions[ (( alert->gid * 31 + alert->sid ) * 31 + alert->rev ) % n_partitions ] );
+
+	if ( part->new_alerts_tail )
+		part->new_alerts_tail->next = alert;
+	else
+		part->new_alerts = alert;
+
+	part->new_alerts_tail = alert;
+}		/* -----  end of function __AI_alert_dispatch  ----- */
+
+/**
+ * \brief  Insert a new alert in the clusters of its partition: it is merged into an open cluster with the
+ * same merge key if any (O(1) expected time), or else into an open cluster at the levels of the ancestors of
+ * its values (one lookup per group of clusters generalised to the same levels), otherwise it opens a new
+ * cluster to be generalised
+ * \param  part 	Partition of the alert
+ * \param  alert 	Alert to be inserted
+ */
+
+PRIVATE void
+__AI_cluster_insert_alert ( AI_cluster_partition *part, AI_snort_alert *alert )
+{
+	AI_cluster *cluster = NULL,
+			 *match   = NULL;
+
+	if ( !( cluster = ( AI_cluster* ) calloc ( 1, sizeof ( AI_cluster ))))
+		AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+	cluster->alert = alert;
+
+	if (( match = __AI_bucket_find_match ( part, cluster )))
+	{
+		__AI_cluster_absorb ( part, match, cluster );
+		free ( cluster );
+		return;
+	}
+
+	__AI_bucket_insert ( part, cluster );
+	cluster->dirty   = true;
+	cluster->changed = true;
+
+	/* The partition index in the low digits keeps the ids unique across the partitions */
+	alert->cluster_id = ( ++( part->n_created )) * n_partitions + (unsigned long) ( part - partitions );
+
+	if ( part->n_open_clusters == part->open_clusters_size )
+	{
+		part->open_clusters_size = ( part->open_clusters_size ) ? 2 * part->open_clusters_size : 64;
+
+		if ( !( part->open_clusters = ( AI_cluster** ) realloc ( part->open_clusters, part->open_clusters_size * sizeof ( AI_cluster* ))))
+			AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+	}
+
+	part->open_clusters[ part->n_open_clusters++ ] = cluster;
+}		/* -----  end of function __AI_cluster_insert_alert  ----- */
+
+/**
+ * \brief  Generalise the dirty open clusters of a partition smaller than cluster_min_size, one attribute at
+ * a time (the one picked by the heuristic function), until no more clusters are merged
+ * \param  part 	Partition
+ * \param  min_size 	Minimum size of a cluster
+ * \return The number of merged clusters
+ */
+
+PRIVATE int
+__AI_clusters_generalise ( AI_cluster_partition *part, int min_size )
+{
+	AI_cluster     *cluster = NULL,
+				*match   = NULL;
+	cluster_type   type, best_type;
+	unsigned int   i;
+	int            heuristic_val, minval;
+	int            merged = 0,
+				total_merged = 0;
+
+	do
+	{
+		merged = 0;
+		minval = INT_MAX;
+		best_type = none;
+
+		/* Choose the best attribute to cluster using the heuristic function */
+		for ( type = 0; type < CLUSTER_TYPES; type++ )
+		{
+			if ( type != none && h_root[type] )
+			{
+				if (( heuristic_val = __AI_heuristic_func ( part, type )) > 0 && heuristic_val < minval )
+				{
+					minval = heuristic_val;
+					best_type = type;
+				}
+			}
+		}
+
+		if ( best_type == none )
+			break;
+
+		/* For the small clusters, the corresponing clustering value is the parent of the current one in the hierarchy */
+		for ( i=0; i < part->n_open_clusters; i++ )
+		{
+			cluster = part->open_clusters[i];
+
+			if ( cluster->absorbed || !cluster->dirty )
+				continue;
+
+			if ( cluster->alert->grouped_alerts_count >= min_size )
+			{
+				cluster->dirty = false;
+				continue;
+			}
+
+			if ( !cluster->alert->h_node[best_type] || !cluster->alert->h_node[best_type]->parent )
+				continue;
+
+			__AI_bucket_remove ( part, cluster );
+			cluster->alert->h_node[best_type] = cluster->alert->h_node[best_type]->parent;
+			cluster->changed = true;
+
+			if (( match = __AI_bucket_find_match ( part, cluster )))
+			{
+				__AI_cluster_absorb ( part, match, cluster );
+				merged++;
+			} else {
+				__AI_bucket_insert ( part, cluster );
+			}
+		}
+
+		total_merged += merged;
+	} while ( merged > 0 );
+
+	return total_merged;
+}		/* -----  end of function __AI_clusters_generalise  ----- */
+
+/**
+ * \brief  Append a formatted string to a growing buffer
+ * \param  buf 	Reference to the buffer
+ * \param  len 	Reference to the length of the buffer content
+ * \param  size 	Reference to the allocated size of the buffer
+ * \param  fmt 	Format string
+ */
+
+PRIVATE void
+__AI_buffer_append ( char **buf, size_t *len, size_t *size, const char *fmt, ... )
+{
+	va_list ap;
+	int     n = 0;
+
+	while ( 1 )
+	{
+		if ( *size - *len < 2 || !*buf )
+		{
+			*size = ( *size ) ? 2 * ( *size ) : 4096;
+
+			if ( !( *buf = (char*) realloc ( *buf, *size )))
+				AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+		}
+
+		va_start ( ap, fmt );
+		n = vsnprintf ( *buf + *len, *size - *len, fmt, ap );
+		va_end ( ap );
+
+		if ( n >= 0 && (size_t) n < *size - *len )
+			break;
+
+		*size = ( n >= 0 ) ? 2 * ( *len + n + 1 ) : 2 * ( *size );
+
+		if ( !( *buf = (char*) realloc ( *buf, *size )))
+			AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+	}
+
+	*len += n;
+}		/* -----  end of function __AI_buffer_append  ----- */
+
+/**
+ * \brief  Append a string to a growing buffer as a JSON string literal
+ * \param  buf 	Reference to the buffer
+ * \param  len 	Reference to the length of the buffer content
+ * \param  size 	Reference to the allocated size of the buffer
+ * \param  str 	String to be appended (NULL is written as null)
+ */
+
+PRIVATE void
+__AI_buffer_append_json_string ( char **buf, size_t *len, size_t *size, const char *str )
+{
+	const unsigned char *c = NULL;
+
+	if ( !str )
+	{
+		__AI_buffer_append ( buf, len, size, "null" );
+		return;
+	}
+
+	__AI_buffer_append ( buf, len, size, "\"" );
+
+	for ( c = (const unsigned char*) str; *c; c++ )
+	{
+		if ( *c == '"' || *c == '\\' )
+			__AI_buffer_append ( buf, len, size, "\\%c", *c );
+		else if ( *c < 0x20 )
+			__AI_buffer_append ( buf, len, size, "\\u%04x", *c );
+		else
+			__AI_buffer_append ( buf, len, size, "%c", *c );
+	}
+
+	__AI_buffer_append ( buf, len, size, "\"" );
+}		/* -----  end of function __AI_buffer_append_json_string  ----- */
+
+/**
+ * \brief  Append the description of a cluster to a buffer, in the format of the clustered alerts file
+ * \param  buf 	Reference to the buffer
+ * \param  len 	Reference to the length of the buffer content
+ * \param  size 	Reference to the allocated size of the buffer
+ * \param  alert 	Alert representing the cluster
+ * \param  state 	State of the cluster ("open" or "closed") for a journal record, NULL for a snapshot
+ */
+
+PRIVATE void
+__AI_cluster_format ( char **buf, size_t *len, size_t *size, AI_snort_alert *alert, const char *state )
+{
+	static const char *type_names[CLUSTER_TYPES] = {
+		NULL, "src_addr", "dst_addr", "src_port", "dst_port", "time", "protocol"
+	};
+
+	static const cluster_type addr_order[4] = { src_addr, src_port, dst_addr, dst_port };
+
+	char         timestamp[32],
+			   values[CLUSTER_TYPES][INET_ADDRSTRLEN];
+	BOOL         has_value[CLUSTER_TYPES] = { false };
+	cluster_type type;
+	struct tm    tm;
+	int          i;
+
+	/* Values of the attributes with no clustering hierarchy, printed as they are */
+	inet_ntop ( AF_INET, &(alert->ip_src_addr), values[src_addr], INET_ADDRSTRLEN );
+	inet_ntop ( AF_INET, &(alert->ip_dst_addr), values[dst_addr], INET_ADDRSTRLEN );
+	snprintf ( values[src_port], sizeof ( values[src_port] ), "%d", htons ( alert->tcp_src_port ));
+	snprintf ( values[dst_port], sizeof ( values[dst_port] ), "%d", htons ( alert->tcp_dst_port ));
+
+	for ( type=0; type < CLUSTER_TYPES; type++ )
+		has_value[type] = ( type != none && h_root[type] && alert->h_node[type] );
+
+	if ( config->clusterOutputFormat == cluster_output_json )
+	{
+		localtime_r ( &( alert->timestamp ), &tm );
+		strftime ( timestamp, sizeof ( timestamp ), "%Y-%m-%dT%H:%M:%S", &tm );
+
+		__AI_buffer_append ( buf, len, size, "{\"id\":%lu,", alert->cluster_id );
+
+		if ( state )
+			__AI_buffer_append ( buf, len, size, "\"state\":\"%s\",", state );
+
+		__AI_buffer_append ( buf, len, size, "\"gid\":%u,\"sid\":%u,\"rev\":%u,\"desc\":",
+			alert->gid, alert->sid, alert->rev );
+		__AI_buffer_append_json_string ( buf, len, size, alert->desc );
+		__AI_buffer_append ( buf, len, size, ",\"classification\":" );
+		__AI_buffer_append_json_string ( buf, len, size, alert->classification );
+		__AI_buffer_append ( buf, len, size, ",\"priority\":%u,\"timestamp\":\"%s\",\"grouped_alerts\":%u",
+			alert->priority, timestamp, alert->grouped_alerts_count );
+
+		for ( type=0; type < CLUSTER_TYPES; type++ )
+		{
+			if ( has_value[type] )
+			{
+				__AI_buffer_append ( buf, len, size, ",\"%s\":", type_names[type] );
+				__AI_buffer_append_json_string ( buf, len, size, alert->h_node[type]->label );
+			} else if ( type >= src_addr && type <= dst_port ) {
+				__AI_buffer_append ( buf, len, size, ",\"%s\":\"%s\"", type_names[type], values[type] );
+			}
+		}
+
+		__AI_buffer_append ( buf, len, size, "}\n" );
+		return;
+	}
+
+	/* Every record carries the cluster id, which the merge records of the journal refer to */
+	if ( state )
+		__AI_buffer_append ( buf, len, size, "[Cluster ID: %lu] [State: %s]\n", alert->cluster_id, state );
+	else
+		__AI_buffer_append ( buf, len, size, "[Cluster ID: %lu]\n", alert->cluster_id );
+
+	__AI_buffer_append ( buf, len, size, "[**] [%d:%d:%d] %s [**]\n", alert->gid, alert->sid, alert->rev, alert->desc );
+
+	if ( alert->classification )
+		__AI_buffer_append ( buf, len, size, "[Classification: %s] ", alert->classification );
+
+	__AI_buffer_append ( buf, len, size, "[Priority: %d]\n", alert->priority );
+
+	ctime_r ( &( alert->timestamp ), timestamp );
+	timestamp [ strlen ( timestamp ) - 1 ] = 0;
+	__AI_buffer_append ( buf, len, size, "[Grouped alerts: %d] [Starting from: %s]\n", alert->grouped_alerts_count, timestamp );
+
+	if ( has_value[alert_time] )
+		__AI_buffer_append ( buf, len, size, "[Time: %s]\n", alert->h_node[alert_time]->label );
+
+	if ( has_value[ip_protocol] )
+		__AI_buffer_append ( buf, len, size, "[Protocol: %s]\n", alert->h_node[ip_protocol]->label );
+
+	for ( i=0; i < 4; i++ )
+	{
+		type = addr_order[i];
+
+		if ( has_value[type] )
+		{
+			__AI_buffer_append ( buf, len, size, "[%s]", alert->h_node[type]->label );
+		} else {
+			__AI_buffer_append ( buf, len, size, "%s", values[type] );
+		}
+
+		/* src_addr:src_port -> dst_addr:dst_port */
+		__AI_buffer_append ( buf, len, size, "%s", ( i % 2 == 0 ) ? ":" : (( i == 1 ) ? " -> " : "\n" ));
+	}
+
+	__AI_buffer_append ( buf, len, size, "\n" );
+}		/* -----  end of function __AI_cluster_format  ----- */
+
+/**
+ * \brief  Append to a journal the record of a cluster merged into another one
+ * \param  buf 	Reference to the buffer
+ * \param  len 	Reference to the length of the buffer content
+ * \param  size 	Reference to the allocated size of the buffer
+ * \param  id 	Identifier of the merged cluster
+ * \param  into 	Identifier of the cluster that absorbed it
+ */
+
+PRIVATE void
+__AI_cluster_merge_format ( char **buf, size_t *len, size_t *size, unsigned long id, unsigned long into )
+{
+	if ( config->clusterOutputFormat == cluster_output_json )
+		__AI_buffer_append ( buf, len, size, "{\"id\":%lu,\"state\":\"merged\",\"merged_into\":%lu}\n", id, into );
+	else
+		__AI_buffer_append ( buf, len, size, "[Cluster ID: %lu] [Merged into: %lu]\n\n", id, into );
+}		/* -----  end of function __AI_cluster_merge_format  ----- */
+
+/**
+ * \brief  Close the clusters of a partition out of the time window and drop the absorbed ones from the open clusters,
+ * recording the changes of the clusters in the journal of the partition
+ * \param  part 	Partition
+ */
+
+PRIVATE void
+__AI_clusters_compact ( AI_cluster_partition *part )
+{
+	AI_cluster     *cluster = NULL;
+	unsigned int   i, j;
+	BOOL           journal  = ( config->clusterSnapshotInterval > 0 );
+
+	for ( i=0, j=0; i < part->n_open_clusters; i++ )
+	{
+		cluster = part->open_clusters[i];
+
+		if ( cluster->absorbed )
+		{
+			if ( journal )
+				__AI_cluster_merge_format ( &( part->journal ), &( part->journal_len ), &( part->journal_size ),
+					cluster->alert->cluster_id, cluster->merged_into );
+
+			free ( cluster );
+			continue;
+		}
+
+		/* No alert newer than the latest one can be merged into this cluster anymore */
+		if ( config->clusterMaxAlertInterval > 0 &&
+				cluster->alert->timestamp + (time_t) config->clusterMaxAlertInterval < latest_timestamp )
+		{
+			__AI_bucket_remove ( part, cluster );
+			cluster->alert->next = NULL;
+
+			if ( journal )
+				__AI_cluster_format ( &( part->journal ), &( part->journal_len ), &( part->journal_size ), cluster->alert, "closed" );
+
+			if ( part->closed_log_tail )
+				part->closed_log_tail->next = cluster->alert;
+			else
+				part->closed_log = cluster->alert;
+
+			part->closed_log_tail = cluster->alert;
+			free ( cluster );
+			continue;
+		}
 
-/** Structure containing the count of occurrences of the single alerts in the log */
-typedef struct  {
-	AI_hyperalert_key   key;
-	unsigned int        count;
-	UT_hash_handle  hh;
-} AI_alert_occurrence;
+		if ( journal && cluster->changed )
+			__AI_cluster_format ( &( part->journal ), &( part->journal_len ), &( part->journal_size ), cluster->alert, "open" );
 
+		cluster->dirty   = false;
+		cluster->changed = false;
+		part->open_clusters[j++] = cluster;
+	}
 
-PRIVATE hierarchy_node  *h_root[CLUSTER_TYPES] = { NULL };
-PRIVATE AI_snort_alert  *alert_log             = NULL;
-PRIVATE pthread_mutex_t  mutex;
+	part->n_open_clusters = j;
+}		/* -----  end of function __AI_clusters_compact  ----- */
 
 /**
- * \brief  Function that picks up the heuristic value for a clustering attribute in according to Julisch's heuristic (ACM, Vol.2, No.3, 09 2002, pag.124)
- * \param  type 	Attribute type
- * \return The heuristic coefficient for that attribute, -1 if no clustering information is available for that attribute
+ * \brief  Run a clustering pass on a partition: insert the alerts received since the previous pass,
+ * generalise the clusters they touched (or all the clusters too small for a grown cluster_min_size)
+ * and close the clusters out of the time window
+ * \param  part 	Partition
  */
 
-PRIVATE int
-__AI_heuristic_func ( cluster_type type )
-{
-	AI_snort_alert  *alert_iterator;
-	attribute_key   key;
-	attribute_value *values = NULL;
-	attribute_value *value  = NULL;
-	attribute_value *found  = NULL;
-	int             max     = 0;
-	
-	if ( type == none || !alert_log || !h_root[type] )
-		return -1;
+PRIVATE void
+__AI_partition_process ( AI_cluster_partition *part )
+{
+	AI_snort_alert *alert, *next;
+	unsigned int   i;
 
-	for ( alert_iterator = alert_log; alert_iterator; alert_iterator = alert_iterator->next )
+	for ( alert = part->new_alerts; alert; alert = next )
 	{
-		if ( !alert_iterator->h_node[type] )
-			continue;
+		next = alert->next;
+		alert->next = NULL;
+		__AI_cluster_insert_alert ( part, alert );
+	}
 
-		key.min = alert_iterator->h_node[type]->min_val;
-		key.max = alert_iterator->h_node[type]->max_val;
+	part->new_alerts = NULL;
+	part->new_alerts_tail = NULL;
 
-		if ( values )
+	/* If the minimum size grew, the open clusters that became too small have to be generalised again */
+	if ( cluster_min_size > prev_cluster_min_size )
+	{
+		for ( i=0; i < part->n_open_clusters; i++ )
 		{
-			HASH_FIND ( hh, values, &key, sizeof ( attribute_key ), found );
+			if ( !part->open_clusters[i]->absorbed && part->open_clusters[i]->alert->grouped_alerts_count < cluster_min_size )
+				part->open_clusters[i]->dirty = true;
 		}
+	}
 
-		if ( !found )
-		{
-			if ( !( value = ( attribute_value* ) malloc ( sizeof ( attribute_value )) ))
-			{
-				AI_fatal_err ( "Fatal dynamic memory allocation failure", __FILE__, __LINE__ );
-			}
+	__AI_clusters_generalise ( part, cluster_min_size );
+	__AI_clusters_compact ( part );
+}		/* -----  end of function __AI_partition_process  ----- */
 
-			memset ( value, 0, sizeof ( attribute_value ));
-			value->key   = key;
-			value->type  = type;
-			value->count = 1;
-			HASH_ADD ( hh, values, key, sizeof ( attribute_key ), value );
-		} else {
-			found->count++;
-		}
-	}
+/**
+ * \brief  Thread of the clustering pool: at every pass it processes the partitions not taken yet by the other workers
+ */
+
+PRIVATE void*
+__AI_cluster_worker_thread ( void *arg )
+{
+	unsigned long pass = 0;
+	unsigned int  i;
 
-	for ( value = values; value; value = ( attribute_value* ) value->hh.next )
+	pthread_mutex_lock ( &pool_mutex );
+
+	while ( 1 )
 	{
-		if ( value->count > max )
+		while ( pool_pass == pass )
+			pthread_cond_wait ( &pool_start_cond, &pool_mutex );
+
+		pass = pool_pass;
+
+		while ( next_partition < n_partitions )
 		{
-			max = value->count;
+			i = next_partition++;
+			pthread_mutex_unlock ( &pool_mutex );
+			__AI_partition_process ( &( partitions[i] ));
+			pthread_mutex_lock ( &pool_mutex );
 		}
-	}
 
-	while ( values )
-	{
-		value = values;
-		HASH_DEL ( values, value );
-		free ( value );
+		if ( --busy_workers == 0 )
+			pthread_cond_signal ( &pool_done_cond );
 	}
 
-	return max;
-}		/* -----  end of function __AI_heuristic_func  ----- */
+	pthread_mutex_unlock ( &pool_mutex );
+	pthread_exit ((void*) 0 );
+	return (void*) 0;
+}		/* -----  end of function __AI_cluster_worker_thread  ----- */
 
 /**
- * \brief  Create a new clustering hierarchy node
- * \param  label 	Label for the node
- * \param  min_val 	Minimum value for the range represented by the node
- * \param  max_val 	Maximum value for the range represented by the node
- * \return The brand new node if the allocation was ok, otherwise abort the application
+ * \brief  Create the partitions of the clustering problem and start the pool of clustering workers
  */
 
-PRIVATE hierarchy_node*
-__AI_hierarchy_node_new ( char *label, int min_val, int max_val )
+PRIVATE void
+__AI_partitions_init ()
 {
-	hierarchy_node *n = NULL;
+	pthread_t    worker;
+	long         n_cpus = 0;
+	unsigned int i;
 
-	if ( !( n = ( hierarchy_node* ) malloc ( sizeof ( hierarchy_node )) ))
+	if (( n_workers = config->clusteringThreads ) == 0 )
 	{
-		AI_fatal_err ( "Fatal dynamic memory allocation failure", __FILE__, __LINE__ );
+		n_workers = (( n_cpus = sysconf ( _SC_NPROCESSORS_ONLN )) > 0 ) ? (unsigned int) n_cpus : 1;
 	}
 
-	n->min_val    = min_val;
-	n->max_val    = max_val;
-	n->nchildren  = 0;
-	n->children   = NULL;
-	n->parent     = NULL;
-	strncpy ( n->label, label, sizeof ( n->label ));
+	n_partitions = ( n_workers > 1 ) ? PARTITIONS_PER_THREAD * n_workers : 1;
 
-	return n;
-}		/* -----  end of function __AI_hierarchy_node_new  ----- */
+	if ( !( partitions = ( AI_cluster_partition* ) calloc ( n_partitions, sizeof ( AI_cluster_partition ))))
+		AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+	/* With a single thread the partition is processed by the clustering thread itself */
+	if ( n_workers <= 1 )
+		return;
+
+	pthread_mutex_init ( &pool_mutex, NULL );
+	pthread_cond_init ( &pool_start_cond, NULL );
+	pthread_cond_init ( &pool_done_cond, NULL );
+
+	for ( i=0; i < n_workers; i++ )
+	{
+		if ( pthread_create ( &worker, NULL, __AI_cluster_worker_thread, NULL ) != 0 )
+		{
+			AI_fatal_err ( "Failed to create the clustering worker thread", __FILE__, __LINE__ );
+		}
 
+		pthread_detach ( worker );
+	}
+}		/* -----  end of function __AI_partitions_init  ----- */
 
 /**
- * \brief  Append a node to a clustering hierarchy node
- * \param  parent 	Parent node
- * \param  child 	Child node
+ * \brief  Run a clustering pass on all the partitions, on the pool of workers if any, and wait for its end
  */
 
 PRIVATE void
-__AI_hierarchy_node_append ( hierarchy_node *parent, hierarchy_node *child )
+__AI_partitions_process ()
 {
-	if ( !( parent->children = ( hierarchy_node** ) realloc ( parent->children, (++(parent->nchildren)) * sizeof ( hierarchy_node* )) ))
+	unsigned int i;
+
+	if ( n_workers <= 1 )
 	{
-		AI_fatal_err ( "Fatal dynamic memory allocation failure", __FILE__, __LINE__ );
+		for ( i=0; i < n_partitions; i++ )
+			__AI_partition_process ( &( partitions[i] ));
+
+		return;
 	}
 
-	parent->children[ parent->nchildren - 1 ] = child;
-	child->parent = parent;
-}		/* -----  end of function __AI_hierarchy_node_append  ----- */
+	pthread_mutex_lock ( &pool_mutex );
+	next_partition = 0;
+	busy_workers   = n_workers;
+	pool_pass++;
+	pthread_cond_broadcast ( &pool_start_cond );
 
+	while ( busy_workers > 0 )
+		pthread_cond_wait ( &pool_done_cond, &pool_mutex );
+
+	pthread_mutex_unlock ( &pool_mutex );
+}		/* -----  end of function __AI_partitions_process  ----- */
 
 /**
- * \brief  Get the minimum node in a hierarchy tree that matches a certain value
- * \param  val 	Value to be matched in the range
- * \param  root 	Root of the hierarchy
- * \return The minimum node that matches the value if any, NULL otherwise
+ * \brief  Rebuild the clustered alert log from the open clusters of all the partitions
  */
-PRIVATE hierarchy_node*
-__AI_get_min_hierarchy_node ( int val, hierarchy_node *root )
+
+PRIVATE void
+__AI_alert_log_stitch ()
 {
-	int i;
-	hierarchy_node *next = NULL;
+	AI_cluster_partition *part = NULL;
+	AI_snort_alert       *tail = NULL;
+	unsigned int         i, j;
 
-	if ( !root )
-	{
-		return NULL;
-	}
+	alert_log = NULL;
 
-	if ( (unsigned) val < (unsigned) root->min_val || (unsigned) val > (unsigned) root->max_val )
+	for ( i=0; i < n_partitions; i++ )
 	{
-		return NULL;
-	}
+		part = &( partitions[i] );
 
-	for ( i=0; i < root->nchildren && !next; i++ )
-	{
-		if ( root->children[i]->min_val <= val && root->children[i]->max_val >= val )
+		for ( j=0; j < part->n_open_clusters; j++ )
 		{
-			next = root->children[i];
+			if ( tail )
+				tail->next = part->open_clusters[j]->alert;
+			else
+				alert_log = part->open_clusters[j]->alert;
+
+			tail = part->open_clusters[j]->alert;
 		}
 	}
 
-	if ( !next )
-		return root;
-	
-	return __AI_get_min_hierarchy_node ( val, next );
-}		/* -----  end of function __AI_get_min_hierarchy_node  ----- */
+	if ( tail )
+		tail->next = NULL;
+}		/* -----  end of function __AI_alert_log_stitch  ----- */
 
 /**
- * \brief  Check if two alerts are semantically equal
- * \param  a1 	First alert
- * \param  a2 	Second alert
- * \return True if they are equal, false otherwise
+ * \brief  Free a list of closed clusters: the alert grouping each cluster, its array of grouped alerts
+ * and the grouped alerts themselves, all owned by the clustering
+ * \param  list 	List of the alerts grouping the closed clusters
  */
 
-PRIVATE BOOL
-__AI_equal_alerts ( AI_snort_alert *a1, AI_snort_alert *a2 )
+PRIVATE void
+__AI_closed_clusters_free ( AI_snort_alert *list )
 {
-	if ( a1->gid != a2->gid || a1->sid != a2->sid || a1->rev != a2->rev )
-	{
-		return false;
-	}
-
-	if ( a1->h_node[src_addr] && a2->h_node[src_addr] )
-	{
-		if ( a1->h_node[src_addr]->min_val != a2->h_node[src_addr]->min_val ||
-				a1->h_node[src_addr]->max_val != a2->h_node[src_addr]->max_val )
-			return false;
-	}
+	AI_snort_alert *alert = NULL,
+				*next  = NULL;
+	unsigned int   i;
 
-	if ( a1->h_node[dst_addr] && a2->h_node[dst_addr] )
+	for ( alert = list; alert; alert = next )
 	{
-		if ( a1->h_node[dst_addr]->min_val != a2->h_node[dst_addr]->min_val ||
-				a1->h_node[dst_addr]->max_val != a2->h_node[dst_addr]->max_val )
-			return false;
-	}
+		next = alert->next;
 
-	if ( a1->h_node[src_port] && a2->h_node[src_port] )
-	{
-		if ( a1->h_node[src_port]->min_val != a2->h_node[src_port]->min_val ||
-				a1->h_node[src_port]->max_val != a2->h_node[src_port]->max_val )
-			return false;
-	}
+		/* The first grouped alert is the grouping alert itself */
+		for ( i=1; alert->grouped_alerts && i < alert->grouped_alerts_count; i++ )
+			free ( alert->grouped_alerts[i] );
 
-	if ( a1->h_node[dst_port] && a2->h_node[dst_port] )
-	{
-		if ( a1->h_node[dst_port]->min_val != a2->h_node[dst_port]->min_val ||
-				a1->h_node[dst_port]->max_val != a2->h_node[dst_port]->max_val )
-			return false;
+		free ( alert->grouped_alerts );
+		free ( alert );
 	}
-
-	return true;
-}		/* -----  end of function __AI_equal_alerts  ----- */
-
+}		/* -----  end of function __AI_closed_clusters_free  ----- */
 
 /**
- * \brief  Merge the alerts marked as equal in the log
- * \param  log 	Alert log reference
- * \return The number of merged couples
+ * \brief  Take the clusters closed by the partitions in the latest pass, after they have been written to the output
+ * database: their records are kept until the next snapshot of the clustered alerts file, and the clusters themselves
+ * are released, or kept until they are handed to the correlation thread if the correlation is active
  */
 
-PRIVATE int
-__AI_merge_alerts ( AI_snort_alert **log )
+PRIVATE void
+__AI_closed_clusters_collect ()
 {
-	AI_snort_alert *tmp, *tmp2, *tmp3;
-	AI_alerts_couple *alerts_couple;
-	int count = 0;
+	AI_cluster_partition *part  = NULL;
+	AI_snort_alert       *alert = NULL;
+	unsigned int         i;
 
-	for ( tmp = *log; tmp; tmp = tmp->next )
+	for ( i=0; i < n_partitions; i++ )
 	{
-		for ( tmp2 = *log; tmp2; )
+		part = &( partitions[i] );
+
+		if ( !part->closed_log )
+			continue;
+
+		for ( alert = part->closed_log; alert; alert = alert->next )
+			__AI_cluster_format ( &closed_buf, &closed_len, &closed_size, alert, NULL );
+
+		if ( config->correlationGraphInterval == 0 )
 		{
-			if ( tmp2->next )
-			{
-				/* If the two alerts are in the same clustering time window (if a time window was defined...) */
-				if ( config->clusterMaxAlertInterval == 0 ||
-						( config->clusterMaxAlertInterval > 0 && abs ( tmp->timestamp - tmp2->next->timestamp ) <= config->clusterMaxAlertInterval ))
-				{
-					if ( tmp != tmp2->next )
-					{
-						/* If the two alerts are equal... */
-						if ( __AI_equal_alerts ( tmp, tmp2->next ))
-						{
-							/* If we are storing the outputs of the module to a database, save the cluster containing the two alerts */
-							if ( config->outdbtype != outdb_none )
-							{
-								if ( !( alerts_couple = (AI_alerts_couple*) malloc ( sizeof ( AI_alerts_couple ))))
-									AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
-
-								alerts_couple->alert1 = tmp;
-								alerts_couple->alert2 = tmp2->next;
-
-								AI_store_cluster_to_db ( alerts_couple );
-							}
-
-							/* Merge the two alerts */
-							if ( !( tmp->grouped_alerts = ( AI_snort_alert** ) realloc ( tmp->grouped_alerts, (++(tmp->grouped_alerts_count)) * sizeof ( AI_snort_alert* ))))
-								AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
-
-							tmp->grouped_alerts[ tmp->grouped_alerts_count - 1 ] = tmp2->next;
-							count++;
-
-							tmp3 = tmp2->next->next;
-							tmp2->next = tmp3;
-						}
-					}
-				}
+			__AI_closed_clusters_free ( part->closed_log );
+		} else {
+			if ( closed_alerts_tail )
+				closed_alerts_tail->next = part->closed_log;
+			else
+				closed_alerts = part->closed_log;
 
-				tmp2 = tmp2->next;
-			} else
-				break;
+			closed_alerts_tail = part->closed_log_tail;
 		}
-	}
 
-	return count;
-}		/* -----  end of function __AI_merge_alerts  ----- */
+		part->closed_log      = NULL;
+		part->closed_log_tail = NULL;
+	}
+}		/* -----  end of function __AI_closed_clusters_collect  ----- */
 
 /**
- * \brief  Get the average heterogeneity coefficient of the set of alerts
- * \return The average heterogeneity coefficient of the set of alerts
+ * \brief  Write the snapshot of the clustered alerts: the records of the closed clusters already at the beginning
+ * of the clustered alerts file are copied from it, followed by the records of the clusters closed since the previous
+ * snapshot and by the open clusters, already formatted in one buffer. The file is written to a temporary file and
+ * renamed over the clustered alerts file, so that readers never see a torn file
+ * \param  buf 	Buffer containing the formatted open clusters
+ * \param  len 	Length of the buffer
  */
 
-double
-__AI_get_alerts_heterogeneity ( int *alert_count )
+PRIVATE void
+__AI_clusters_snapshot_write ( const char *buf, size_t len )
 {
-	double       heterogeneity  = 0.0;
-	int          distinct_count = 0;
+	FILE           *fp   = NULL,
+				*old  = NULL;
+	char           tmpfile[1040],
+				journalfile[1040],
+				chunk[65536];
+	long           copied = 0;
+	size_t         n      = 0;
 
-	AI_hyperalert_key key;
-	AI_snort_alert *alert_iterator = NULL;
+	snprintf ( tmpfile, sizeof ( tmpfile ), "%s.tmp", config->clusterfile );
 
-	AI_alert_occurrence *table = NULL,
-					*found = NULL;
-	*alert_count = 0;
+	if ( !( fp = fopen ( tmpfile, "w" )))
+	{
+		_dpd.logMsg ( "AIPreproc: Unable to write the clustered alerts to %s\n", tmpfile );
+		return;
+	}
 
-	for ( alert_iterator = alert_log; alert_iterator; alert_iterator = alert_iterator->next )
+	/* The closed clusters were released from memory, so their records are only found in the previous snapshot */
+	if ( closed_file_len > 0 )
 	{
-		found   = NULL;
-		*alert_count += alert_iterator->grouped_alerts_count;
-		key.gid = alert_iterator->gid;
-		key.sid = alert_iterator->sid;
-		key.rev = alert_iterator->rev;
-		HASH_FIND ( hh, table, &key, sizeof ( AI_hyperalert_key ), found );
+		if (( old = fopen ( config->clusterfile, "r" )))
+		{
+			while ( copied < closed_file_len )
+			{
+				n = (size_t) ( closed_file_len - copied );
+
+				if ( n > sizeof ( chunk ))
+					n = sizeof ( chunk );
+
+				if (( n = fread ( chunk, 1, n, old )) == 0 || fwrite ( chunk, 1, n, fp ) != n )
+					break;
+
+				copied += (long) n;
+			}
+
+			fclose ( old );
+		}
 
-		if ( !found )
+		if ( copied < closed_file_len )
 		{
-			if ( !( found = (AI_alert_occurrence*) malloc ( sizeof ( AI_alert_occurrence ))))
-				AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+			_dpd.logMsg ( "AIPreproc: Unable to read the closed clusters from %s, they won't be in the new snapshot\n",
+				config->clusterfile );
 
-			found->key   = key;
-			found->count = 1;
-			HASH_ADD ( hh, table, key, sizeof ( AI_hyperalert_key ), found );
-		} else {
-			found->count++;
+			if ( fflush ( fp ) != 0 || ftruncate ( fileno ( fp ), 0 ) != 0 || fseek ( fp, 0, SEEK_SET ) != 0 )
+			{
+				_dpd.logMsg ( "AIPreproc: Unable to write the clustered alerts to %s\n", tmpfile );
+				fclose ( fp );
+				unlink ( tmpfile );
+				return;
+			}
+
+			closed_file_len = 0;
 		}
 	}
 
-	for ( found = table; found; found = (AI_alert_occurrence*) found->hh.next )
-		distinct_count++;
+	if (( closed_len > 0 && fwrite ( closed_buf, 1, closed_len, fp ) != closed_len ) ||
+			( len > 0 && fwrite ( buf, 1, len, fp ) != len ) || fflush ( fp ) != 0 || fsync ( fileno ( fp )) != 0 )
+	{
+		_dpd.logMsg ( "AIPreproc: Unable to write the clustered alerts to %s\n", tmpfile );
+		fclose ( fp );
+		unlink ( tmpfile );
+		return;
+	}
 
-	if ( *alert_count > 0 )
-		heterogeneity = (double) distinct_count / (double) *alert_count;
-	else
-		heterogeneity = 0.0;
+	fclose ( fp );
 
-	while ( table )
+	if ( rename ( tmpfile, config->clusterfile ) != 0 )
 	{
-		found = table;
-		HASH_DEL ( table, found );
-		free ( found );
+		_dpd.logMsg ( "AIPreproc: Unable to replace the clustered alerts file %s\n", config->clusterfile );
+		unlink ( tmpfile );
+		return;
 	}
 
-	return heterogeneity;
-}		/* -----  end of function __AI_get_alerts_heterogeneity  ----- */
+	/* The records of the clusters closed since the previous snapshot are now part of the file */
+	closed_file_len += (long) closed_len;
+	closed_len = 0;
+
+	/* The changes recorded in the journal are all included in the new snapshot */
+	if ( config->clusterSnapshotInterval > 0 )
+	{
+		snprintf ( journalfile, sizeof ( journalfile ), "%s.journal", config->clusterfile );
+
+		if (( fp = fopen ( journalfile, "w" )))
+			fclose ( fp );
+	}
+}		/* -----  end of function __AI_clusters_snapshot_write  ----- */
 
 /**
- * \brief  Print the clustered alerts to a log file
- * \param  log 	Log containing the alerts
- * \param  fp 		File pointer where the alerts will be printed
+ * \brief  Append the changes of the clusters recorded by the partitions in the latest pass to the journal of the clustered alerts file
+ * \param  write 	If false, the records are discarded (e.g. because a snapshot is going to be written anyway)
  */
 
 PRIVATE void
-__AI_print_clustered_alerts ( AI_snort_alert *log, FILE *fp )
+__AI_clusters_journal_flush ( BOOL write )
 {
-	AI_snort_alert *tmp;
-	char ip[INET_ADDRSTRLEN];
-	char *timestamp;
+	AI_cluster_partition *part = NULL;
+	FILE                 *fp   = NULL;
+	char                 journalfile[1040];
+	unsigned int         i;
 
-	for ( tmp = log; tmp; tmp = tmp->next )
+	if ( write )
 	{
-		fprintf ( fp, "[**] [%d:%d:%d] %s [**]\n", tmp->gid, tmp->sid, tmp->rev, tmp->desc );
-
-		if ( tmp->classification )
-			fprintf ( fp, "[Classification: %s] ", tmp->classification );
-
-		fprintf ( fp, "[Priority: %d]\n", tmp->priority );
+		snprintf ( journalfile, sizeof ( journalfile ), "%s.journal", config->clusterfile );
 
-		timestamp = ctime ( &( tmp->timestamp ));
-		timestamp [ strlen ( timestamp ) - 1 ] = 0;
-		fprintf ( fp, "[Grouped alerts: %d] [Starting from: %s]\n", tmp->grouped_alerts_count, timestamp );
-
-		if ( h_root[src_addr] && tmp->h_node[src_addr] )
-		{
-			fprintf ( fp, "[%s]:", (tmp->h_node[src_addr]->label) ? tmp->h_node[src_addr]->label : "no label" );
-		} else {
-			inet_ntop ( AF_INET, &(tmp->ip_src_addr), ip, INET_ADDRSTRLEN );
-			fprintf ( fp, "%s:", ip );
-		}
-
-		if ( h_root[src_port] && tmp->h_node[src_port] )
-		{
-			fprintf ( fp, "[%s] -> ", (tmp->h_node[src_port]->label) ? tmp->h_node[src_port]->label : "no label" );
-		} else {
-			fprintf ( fp, "%d -> ", htons ( tmp->tcp_src_port ));
-		}
+		if ( !( fp = fopen ( journalfile, "a" )))
+			_dpd.logMsg ( "AIPreproc: Unable to append the changed clusters to %s\n", journalfile );
+	}
 
-		if ( h_root[dst_addr] && tmp->h_node[dst_addr] )
-		{
-			fprintf ( fp, "[%s]:", (tmp->h_node[dst_addr]->label) ? tmp->h_node[dst_addr]->label : "no label" );
-		} else {
-			inet_ntop ( AF_INET, &(tmp->ip_dst_addr), ip, INET_ADDRSTRLEN );
-			fprintf ( fp, "%s:", ip );
-		}
+	for ( i=0; i < n_partitions; i++ )
+	{
+		part = &( partitions[i] );
 
-		if ( h_root[dst_port] && tmp->h_node[dst_port] )
-		{
-			fprintf ( fp, "[%s]\n", (tmp->h_node[dst_port]->label) ? tmp->h_node[dst_port]->label : "no label" );
-		} else {
-			fprintf ( fp, "%d\n", htons ( tmp->tcp_dst_port ));
-		}
+		if ( fp && part->journal_len > 0 )
+			fwrite ( part->journal, 1, part->journal_len, fp );
 
-		fprintf ( fp, "\n" );
+		part->journal_len = 0;
 	}
-}		/* -----  end of function __AI_print_clustered_alerts  ----- */
+
+	if ( fp )
+		fclose ( fp );
+}		/* -----  end of function __AI_clusters_journal_flush  ----- */
 
 
 /**
- * \brief  Thread for periodically clustering the log information
+ * \brief  Thread for periodically clustering the log information. The clusters are kept across
+ * the runs: at every run only the alerts received since the previous one are inserted, and only
+ * the clusters they touched are generalised. The alerts are split by signature into independent
+ * partitions, processed in parallel by the pool of clustering workers
  */
 PRIVATE void*
 __AI_cluster_thread ( void* arg )
 {
-	AI_snort_alert *tmp;
-	hierarchy_node *node, *child;
-	cluster_type   type;
-	cluster_type   best_type;
-	FILE           *cluster_fp;
-	char           label[256];
-	int            hostval;
-	int            netval;
-	int            minval;
-	int            heuristic_val;
-	int            cluster_min_size = 1;
-	int            alert_count = 0;
-	int            old_alert_count = 0;
-	int            single_alerts_count = 0;
+	AI_snort_alert *tmp, *next;
+	BOOL           snapshot = false;
+	time_t         now;
+	char           *snapshot_buf  = NULL;
+	size_t         snapshot_len   = 0,
+				snapshot_size  = 0;
+	int            new_cluster_min_size = 1;
 	double         heterogeneity = 0;
 
 	pthread_mutex_init ( &mutex, NULL );
+	__AI_partitions_init();
 
 	while ( 1 )
 	{
@@ -464,127 +2030,67 @@ __AI_cluster_thread ( void* arg )
 		/* Set the lock over the alert log until it's done with the clustering operation */
 		pthread_mutex_lock ( &mutex );
 
-		/* Free the current alert log and get the latest one */
-		if ( alert_log )
-		{
-			AI_free_alerts ( alert_log );
-			alert_log = NULL;
-		}
-		
-		/* get_alerts() is a function pointer that can point to the function for getting the alerts from
+		/* get_alerts_since() is a function pointer that can point to the function for getting the alerts from
 		 * the plain alert log file or from the database. Calling it the source of the alerts is
 		 * completely transparent to this level */
-		if ( !( alert_log = get_alerts() ))
+		if ( !( tmp = get_alerts_since ( &alerts_cursor )))
 		{
 			pthread_mutex_unlock ( &mutex );
 			continue;
 		}
 
-		for ( tmp = alert_log, alert_count=0; tmp; tmp = tmp->next, alert_count++ )
+		for ( ; tmp; tmp = next )
 		{
-			/* If an alert has an unitialized "grouped alarms count", set its counter to 1 (it only groupes the current alert) */
-			if ( tmp->grouped_alerts_count == 0 )
-			{
-				tmp->grouped_alerts_count = 1;
-			}
-
-			/* Initialize the clustering hierarchies in the current alert */
-			for ( type=0; type < CLUSTER_TYPES; type++ )
-			{
-				/* If "type" is a valid clustering hierarchy but the corresponding node in the alert is not initialized, initialize it */
-				if ( h_root[type] && !tmp->h_node[type] )
-				{
-					switch ( type )
-					{
-						case src_addr:
-						case dst_addr:
-							netval  = ( type == src_addr ) ? tmp->ip_src_addr : tmp->ip_dst_addr;
-							hostval = ntohl ( netval );
-							inet_ntop ( AF_INET, &(netval), label, INET_ADDRSTRLEN );
-							break;
-
-						case src_port:
-						case dst_port:
-							netval  = ( type == src_port ) ? tmp->tcp_src_port : tmp->tcp_dst_port;
-							hostval = ntohs ( netval );
-							snprintf ( label, sizeof(label), "%d", hostval );
-							break;
-
-						default:
-							pthread_exit (( void* ) 0 );
-							return (void*) 0;
-					}
-
-					node = __AI_get_min_hierarchy_node ( hostval, h_root[type] );
-
-					if ( node )
-					{
-						if ( node->min_val < node->max_val )
-						{
-							child = __AI_hierarchy_node_new ( label, hostval, hostval);
-							__AI_hierarchy_node_append ( node, child );
-							node = child;
-						}
-
-						tmp->h_node[type] = node;
-					}
-				}
-			}
+			next = tmp->next;
+			__AI_alert_dispatch ( tmp );
 		}
 
-		alert_count -= __AI_merge_alerts ( &alert_log );
-		heterogeneity = __AI_get_alerts_heterogeneity ( &single_alerts_count );
-
 		/* Get the minimum size for the clusters in function of the heterogeneity of alerts' set */
+		heterogeneity = ( total_alerts > 0 ) ? (double) HASH_COUNT ( signatures ) / (double) total_alerts : 0.0;
+
 		if ( heterogeneity > 0 )
-			cluster_min_size = (int) round ( 1/heterogeneity );
+			new_cluster_min_size = (int) round ( 1/heterogeneity );
 		else
-			cluster_min_size = 1;
+			new_cluster_min_size = 1;
+
+		prev_cluster_min_size = cluster_min_size;
+		cluster_min_size = new_cluster_min_size;
+
+		__AI_partitions_process();
+		__AI_alert_log_stitch();
 
-		do
+		/* Write the cluster assignments computed in this pass to the output database */
+		if ( config->outdbtype != outdb_none )
 		{
-			old_alert_count = alert_count;
-			minval = INT_MAX;
-			best_type = none;
+			AI_flush_clusters_to_db();
+		}
 
-			/* Choose the best attribute to cluster using the heuristic function */
-			for ( type = 0; type < CLUSTER_TYPES; type++ )
-			{
-				if ( type != none && h_root[type] )
-				{
-					if (( heuristic_val = __AI_heuristic_func ( type )) > 0 && heuristic_val < minval )
-					{
-						minval = heuristic_val;
-						best_type = type;
-					}
-				}
-			}
+		/* The clusters closed in this pass won't change anymore: once stored they are released */
+		__AI_closed_clusters_collect();
+
+		/* The clusters changed in this pass are appended to the journal, and the whole clustered
+		 * alerts file is only rewritten every cluster_snapshot_interval seconds */
+		now = time ( NULL );
+		snapshot = ( config->clusterSnapshotInterval == 0 || latest_snapshot == 0 ||
+				now - latest_snapshot >= (time_t) config->clusterSnapshotInterval );
+		snapshot_len = 0;
 
-			/* For all the alerts, the corresponing clustering value is the parent of the current one in the hierarchy */
+		if ( snapshot )
+		{
 			for ( tmp = alert_log; tmp; tmp = tmp->next )
-			{
-				if ( tmp->grouped_alerts_count < cluster_min_size && tmp->h_node[best_type] )
-				{
-					if ( tmp->h_node[best_type]->parent )
-					{
-						tmp->h_node[best_type] = tmp->h_node[best_type]->parent;
-					}
-				}
-			}
+				__AI_cluster_format ( &snapshot_buf, &snapshot_len, &snapshot_size, tmp, NULL );
 
-			alert_count -= __AI_merge_alerts ( &alert_log );
-		} while ( old_alert_count != alert_count );
+			latest_snapshot = now;
+		}
 
 		pthread_mutex_unlock ( &mutex );
 
-		if ( !( cluster_fp = fopen ( config->clusterfile, "w" )) )
-		{
-			pthread_exit ((void*) 0 );
-			return (void*) 0;
-		}
+		/* The partitions are only touched by this thread and its workers, and the snapshot
+		 * is already formatted, so the files are written without holding the lock */
+		__AI_clusters_journal_flush ( !snapshot );
 
-		__AI_print_clustered_alerts ( alert_log, cluster_fp );
-		fclose ( cluster_fp );
+		if ( snapshot )
+			__AI_clusters_snapshot_write ( snapshot_buf, snapshot_len );
 	}
 
 	pthread_exit ((void*) 0 );
@@ -655,7 +2161,18 @@ AI_hierarchies_build ( hierarchy_node **nodes, int n_nodes )
 				min_range = 0xffffffff;
 				break;
 
-			/* TODO Manage ranges for timestamps (and something more?) */
+			case ip_protocol:
+				if ( !h_root[ nodes[i]->type ] )
+					h_root[ nodes[i]->type ] = __AI_hierarchy_node_new ( "any protocol", 0, 255 );
+
+				min_range = 255;
+				break;
+
+			/* The time hierarchy is made of buckets of the configured widths, created when needed */
+			case alert_time:
+				__AI_time_width_add ( nodes[i] );
+				continue;
+
 			default:
 				return;
 		}
@@ -670,7 +2187,7 @@ AI_hierarchies_build ( hierarchy_node **nodes, int n_nodes )
 
 		for ( j=0; j < n_nodes; j++ )
 		{
-			if ( i != j )
+			if ( i != j && nodes[j]->type == nodes[i]->type )
 			{
 				if ( (unsigned) nodes[j]->min_val <= (unsigned) nodes[i]->min_val &&
 						(unsigned) nodes[j]->max_val >= (unsigned) nodes[i]->max_val )
@@ -698,6 +2215,17 @@ AI_hierarchies_build ( hierarchy_node **nodes, int n_nodes )
 		}
 	}
 
+	/* Each time bucket must be entirely contained in a bucket of the next width */
+	for ( i=1; i < (int) n_time_widths; i++ )
+	{
+		if ( time_widths[i] % time_widths[i-1] != 0 )
+		{
+			AI_fatal_err ( "Parse error: each time cluster range must be a multiple of the narrower ones", __FILE__, __LINE__ );
+		}
+	}
+
+	__AI_lookup_tables_build();
+
 	if ( pthread_create ( &cluster_thread, NULL, __AI_cluster_thread, NULL ) != 0 )
 	{
 		AI_fatal_err ( "Failed to create the hash cleanup thread", __FILE__, __LINE__  );
@@ -706,33 +2234,39 @@ AI_hierarchies_build ( hierarchy_node **nodes, int n_nodes )
 
 
 /**
- * \brief Return a copy of the clustered alerts
- * \return An AI_snort_alert pointer identifying the list of clustered alerts
+ * \brief Return a copy of the clustered alerts not older than a given time
+ * \param  node 	First clustered alert
+ * \param  since 	Oldest timestamp of the alerts to be copied
+ * \return An AI_snort_alert pointer identifying the list of the copied alerts
  */
 
 PRIVATE AI_snort_alert*
-__AI_copy_clustered_alerts ( AI_snort_alert *node )
+__AI_copy_clustered_alerts ( AI_snort_alert *node, time_t since )
 {
-	AI_snort_alert *current = NULL, *next = NULL;
+	AI_snort_alert *head = NULL, *tail = NULL, *current = NULL;
 
-	if ( !node )
+	for ( ; node; node = node->next )
 	{
-		return NULL;
-	}
+		if ( node->timestamp < since )
+			continue;
 
-	if ( node->next )
-	{
-		next = __AI_copy_clustered_alerts ( node->next );
-	}
+		if ( !( current = ( AI_snort_alert* ) malloc ( sizeof ( AI_snort_alert )) ))
+		{
+			AI_fatal_err ( "Fatal dynamic memory allocation failure", __FILE__, __LINE__ );
+		}
 
-	if ( !( current = ( AI_snort_alert* ) malloc ( sizeof ( AI_snort_alert )) ))
-	{
-		AI_fatal_err ( "Fatal dynamic memory allocation failure", __FILE__, __LINE__ );
+		memcpy ( current, node, sizeof ( AI_snort_alert ));
+		current->next = NULL;
+
+		if ( tail )
+			tail->next = current;
+		else
+			head = current;
+
+		tail = current;
 	}
 
-	memcpy ( current, node, sizeof ( AI_snort_alert ));
-	current->next = next;
-	return current;
+	return head;
 }		/* -----  end of function __AI_copy_clustered_alerts  ----- */
 
 
@@ -743,15 +2277,41 @@ __AI_copy_clustered_alerts ( AI_snort_alert *node )
 
 AI_snort_alert*
 AI_get_clustered_alerts ()
+{
+	return AI_get_clustered_alerts_since ( 0, NULL );
+}		/* -----  end of function AI_get_clustered_alerts  ----- */
+
+
+/**
+ * \brief  Return the clustered alerts not older than a given time as a linked list
+ * \param  since 	Oldest timestamp of the alerts to be returned
+ * \param  closed 	If not NULL, reference to the list of the clusters closed since the previous call, which are not in the
+ * returned list anymore. They are handed over only once, and their grouped alerts are released at the next call, so the
+ * caller has to copy whatever it keeps of them before calling this function again
+ * \return An AI_snort_alert pointer identifying the list of the open clusters
+ */
+
+AI_snort_alert*
+AI_get_clustered_alerts_since ( time_t since, AI_snort_alert **closed )
 {
 	AI_snort_alert *alerts_copy = NULL;
 
 	pthread_mutex_lock ( &mutex );
-	alerts_copy = __AI_copy_clustered_alerts ( alert_log );
+	alerts_copy = __AI_copy_clustered_alerts ( alert_log, since );
+
+	if ( closed )
+	{
+		__AI_closed_clusters_free ( handed_alerts );
+		handed_alerts      = closed_alerts;
+		closed_alerts      = NULL;
+		closed_alerts_tail = NULL;
+		*closed = __AI_copy_clustered_alerts ( handed_alerts, 0 );
+	}
+
 	pthread_mutex_unlock ( &mutex );
 
 	return alerts_copy;
-}		/* -----  end of function AI_get_clustered_alerts  ----- */
+}		/* -----  end of function AI_get_clustered_alerts_since  ----- */
 
 /** @} */
 
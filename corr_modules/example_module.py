@@ -10,6 +10,7 @@
 # $ [sudo] python setup.py install
 # in order to build and install the snortai Python module
 import snortai
+import array
 
 # Function that takes two alerts as arguments (arguments of
 # alert object: 
@@ -27,6 +28,19 @@ def AI_corr_index ( alert1, alert2 ):
 	# print alert2.gid, alert2.sid, alert2.rev
 	return 0.0
 
+# Optional function that computes the correlation indexes of
+# all the couples of alerts of a correlation pass at once, and
+# that is called instead of AI_corr_index, only once per pass.
+# alerts is the list of the alerts (None for the alerts not
+# involved in any couple), pairs is an array.array('I') where
+# the couple k is made of alerts[pairs[2*k]] and
+# alerts[pairs[2*k+1]]. It returns the correlation indexes of
+# all the couples in the same order, as an array.array('d')
+# or as any other sequence of numbers
+
+def AI_corr_index_batch ( alerts, pairs ):
+	return array.array ( 'd', [0.0] * ( len ( pairs ) / 2 ))
+
 # Return the weight of this index, between 0 and 1
 
 def AI_corr_index_weight():
@@ -21,17 +21,46 @@
 
 /** Function that, given two alerts, returns a correlation index in [0,1] */
 
-double
-AI_corr_index ( const AI_snort_alert *a, const AI_snort_alert *b )
+PRIVATE double
+example_corr_index ( const AI_snort_alert *a, const AI_snort_alert *b )
 {
 	return 0.5;
 }
 
+/** Function that, given a block of couples of alerts as rows of the columnar table of the alerts,
+ * writes the correlation index of each couple in scores. It is optional, but it is called once per
+ * block instead of once per couple, and it can scan the columns of the table it needs */
+
+PRIVATE void
+example_corr_index_batch ( const AI_alert_table *table, const AI_correlation_candidate *couples,
+		unsigned int n_couples, double *scores )
+{
+	unsigned int i;
+
+	for ( i=0; i < n_couples; i++ )
+		scores[i] = ( table->sid[ couples[i].a ] != table->sid[ couples[i].b ] ) ? 0.5 : 0.0;
+}
+
 /** Function that returns the weight of this index */
 
-double
-AI_corr_index_weight ()
+PRIVATE double
+example_corr_index_weight ()
 {
 	return 0.0;
 }
 
+/** Descriptor of the module. The modules only exporting the functions
+ * double AI_corr_index ( const AI_snort_alert*, const AI_snort_alert* ) and
+ * double AI_corr_index_weight () are still supported */
+
+const AI_corr_module_descriptor AI_corr_module = {
+	AI_CORR_MODULE_VERSION,
+	"example",
+	AI_CORR_MODULE_THREAD_SAFE,
+	NULL,
+	NULL,
+	example_corr_index_weight,
+	example_corr_index,
+	example_corr_index_batch
+};
+
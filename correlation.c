@@ -30,6 +30,7 @@
 
 #ifdef 	HAVE_LIBGVC
 	#include	<gvc.h>
+	#include	<sys/resource.h>
 #endif
 
 #ifdef HAVE_LIBPYTHON2_6
@@ -58,317 +59,2871 @@ PRIVATE AI_snort_alert           *alerts                = NULL;
 PRIVATE AI_alert_correlation     *correlation_table     = NULL;
 PRIVATE pthread_mutex_t          mutex;
 
+/** Number of couples of alerts scored together: the partial sums of a block and the columns of the
+ * alerts it refers to stay in the cache while all the correlation indexes are computed over it */
+#define 	CORRELATION_BLOCK_SIZE 	1024
+
+/** Kind of a value of an endpoint in the index of the alerts */
+enum  { ENDPOINT_ADDRESS, ENDPOINT_CLUSTER };
+
+/** Key of the index of the alerts by endpoints. Two alerts can only be correlated if they have the same source
+ * and destination, each of them being either the same address or the same clustering range, so each alert
+ * is indexed under every combination of its source and destination address and clustering range */
+typedef struct  {
+	unsigned int  src_kind;
+	uint32_t      src_min;
+	uint32_t      src_max;
+	unsigned int  dst_kind;
+	uint32_t      dst_min;
+	uint32_t      dst_max;
+} AI_endpoints_key;
+
+/** Alert in the index of the alerts */
+typedef struct  {
+	time_t        timestamp;
+	unsigned int  row;
+} AI_indexed_alert;
+
+/** Alerts sharing the same endpoints, sorted by timestamp */
+typedef struct  {
+	AI_endpoints_key  key;
+	AI_indexed_alert  *alerts;
+	unsigned int      n_alerts;
+	unsigned int      alerts_size;
+	UT_hash_handle    hh;
+} AI_endpoints_bucket;
+
+/** Alerts with the same signature */
+typedef struct  {
+	AI_hyperalert_key  key;
+	AI_indexed_alert   *alerts;
+	unsigned int       n_alerts;
+	unsigned int       alerts_size;
+	UT_hash_handle     hh;
+} AI_signature_bucket;
+
+/** Columns of the unweighted correlation indexes kept for each candidate couple: the built-in indexes, followed by
+ * one column per extra correlation module (the C modules first, then the Python ones). A NaN value means that the
+ * index doesn't count for the couple */
+enum  { COLUMN_BAYESIAN, COLUMN_KB, COLUMN_NEURAL, BUILTIN_COLUMNS };
+
+/** Block of candidate couples being scored */
+typedef struct  {
+	/** First couple of the block in the list of the couples to be scored */
+	const AI_correlation_candidate  *couples;
+
+	/** Index of each couple of the block in the candidate couples */
+	const size_t  *index;
+
+	/** Number of couples in the block */
+	unsigned int  n_couples;
+
+	/** Scores returned by the batch function of a correlation module */
+	double        scores[ CORRELATION_BLOCK_SIZE ];
+} AI_correlation_block;
+
+/** Running mean and variance of the correlation scores (Welford's algorithm) */
+typedef struct  {
+	unsigned long n;
+	double        mean;
+	double        m2;
+} AI_correlation_stats;
+
+/** Couples of alerts that could be correlated in a pass, sorted by A and B, with their scores and their state in the correlation graph */
+typedef struct  {
+	AI_correlation_candidate  *couples;
+	double                    *scores;
+
+	/** Unweighted correlation indexes of each couple, one row of scoring.n_columns values per couple */
+	double                    *values;
+
+	/** Set if the couple was carried over from the previous pass with its correlation indexes */
+	BOOL                      *carried;
+
+	/** Set if the couple is an edge of the correlation graph */
+	BOOL                      *accepted;
+
+	/** Set if the couple was carried over to the next pass with its score */
+	BOOL                      *reused;
+
+	size_t                    n_couples;
+	size_t                    size;
+
+	/** The couples of the alert A on row r are the ones from offsets[r] to offsets[r+1] */
+	size_t                    *offsets;
+	unsigned int              n_rows;
+} AI_correlation_couples;
+
+/** Candidate couples of the current pass and of the previous one */
+PRIVATE AI_correlation_couples   candidates;
+PRIVATE AI_correlation_couples   prev_candidates;
+
+/** Couples to be scored in the current pass (the couples involving new or changed alerts), their scores,
+ * and their index in the candidate couples */
+PRIVATE AI_correlation_candidate *pending              = NULL;
+PRIVATE double                   *pending_scores       = NULL;
+PRIVATE size_t                   *pending_index        = NULL;
+PRIVATE size_t                   n_pending             = 0;
+PRIVATE size_t                   pending_size          = 0;
+
+/** Clustered alert kept in the correlation graph across the passes */
+typedef struct  {
+	/** Identifier of the cluster of the alert */
+	unsigned long   cluster_id;
+
+	/** Copy of the alert owned by the correlation thread */
+	AI_snort_alert  *alert;
+
+	/** Row of the alert in the table of the latest pass */
+	unsigned int    row;
+
+	/** Latest pass the cluster was found in */
+	unsigned long   pass;
+
+	/** Set if the subgraph of the alert was archived, so that it is released in the next pass */
+	BOOL            archived;
+
+	/** Set if the cluster was closed: the clustering doesn't return it anymore, but it stays in the graph */
+	BOOL            closed;
+
+	UT_hash_handle  hh;
+} AI_correlation_node;
+
+/** Alerts of the correlation graph, by cluster id */
+PRIVATE AI_correlation_node      *correlation_nodes    = NULL;
+PRIVATE unsigned long            correlation_pass      = 0;
+
+/** Running statistics of the scores of all the candidate couples */
+PRIVATE AI_correlation_stats     graph_stats;
+
+/** Threshold the edges of the correlation graph were evaluated against */
+PRIVATE double                   graph_threshold       = 0.0;
+
+/** Digest of the manual correlations the edges of the correlation graph were evaluated against */
+PRIVATE unsigned long            graph_manual_digest   = 0;
+
+/** Version of the model of each column of the correlation indexes in the current pass, and the version the values
+ * of the candidate couples were computed with (0 for a disabled index) */
+PRIVATE unsigned long            *column_versions        = NULL;
+PRIVATE unsigned long            *cached_column_versions = NULL;
+
+/** Enabled columns of the correlation indexes whose model changed in the current pass */
+PRIVATE BOOL                     *stale_columns          = NULL;
+
+/** Weight of each column of the correlation indexes in the previous pass */
+PRIVATE double                   *prev_column_weights    = NULL;
+
+/** Metrics of the correlation indexes carried over across the passes: couples carried with their indexes,
+ * couples scored, and columns of indexes computed again for all the couples because their model changed */
+PRIVATE unsigned long            score_cache_hits          = 0;
+PRIVATE unsigned long            score_cache_misses        = 0;
+PRIVATE unsigned long            score_cache_invalidations = 0;
+
+/** Row of each alert of the current pass in the table of the previous pass (NO_ROW for the new and changed alerts) */
+PRIVATE unsigned int             *prev_rows            = NULL;
+PRIVATE unsigned int             prev_rows_size        = 0;
+
+/** Timestamp of the latest alert of the correlation graph, and oldest timestamp still inside the correlation horizon */
+PRIVATE time_t                   graph_latest          = 0;
+PRIVATE time_t                   graph_cutoff          = 0;
+
+/** Connected components of the correlation graph, i.e. the distinct attack scenarios, largest first */
+typedef struct  {
+	/** Rows of the alerts of each scenario, one scenario after the other */
+	unsigned int          *rows;
+
+	/** Start of each scenario in rows (n_scenarios + 1 entries) */
+	unsigned int          *offsets;
+
+	/** Edges of each scenario, one scenario after the other */
+	AI_alert_correlation  **edges;
+
+	/** Start of each scenario in edges (n_scenarios + 1 entries) */
+	unsigned int          *edge_offsets;
+
+	/** Scenario of each row */
+	unsigned int          *scenario;
+
+	unsigned int          n_scenarios;
+
+	/** Number of scenarios with more than one alert, which come first: the others are isolated alerts */
+	unsigned int          n_correlated;
+} AI_correlation_scenarios;
+
+/** Key for sorting the scenarios */
+typedef struct  {
+	unsigned int  size;
+	unsigned int  root;
+} AI_scenario_key;
+
+PRIVATE AI_correlation_scenarios scenarios;
+
+/** Number of scenarios whose output files were written in the latest pass */
+PRIVATE unsigned int             n_scenario_files      = 0;
+
+/** Row of an alert that wasn't in the previous pass */
+#define 	NO_ROW 	((unsigned int) -1)
+
+/** Inputs of a scoring pass, shared by the scoring workers */
+typedef struct  {
+	const AI_alert_table  *table;
+
+	/** Neurons of the SOM the alerts are mapped on */
+	const int             *som_x;
+	const int             *som_y;
+	BOOL                  has_som_neurons;
+
+	/** Weights of the correlation indexes */
+	double                bayesian_weight;
+	double                neural_weight;
+
+	/** Descriptors of the extra correlation modules, their weights, and the locks serialising the calls to
+	 * the modules that are not thread-safe */
+	const AI_corr_module_descriptor  **corr_modules;
+	double                *module_weights;
+	pthread_mutex_t       *module_locks;
+	size_t                n_corr_modules;
+
+	#ifdef HAVE_LIBPYTHON2_6
+	/** Python objects of the alerts, correlation functions of the extra Python modules and their weights */
+	PyObject              **py_alerts;
+	PyObject              **py_corr_functions;
+	double                *py_weights;
+	size_t                n_py_corr_functions;
+
+	/** Batch correlation functions of the extra Python modules (NULL for the modules without one), and the scores
+	 * they returned for the couples to be scored */
+	PyObject              **py_batch_functions;
+	double                **py_batch_scores;
+	#endif
+
+	/** Scores of the extra correlation modules computed by the helper processes, one array of the couples to be
+	 * scored per module, the C modules first (NULL if the helpers didn't run in this pass) */
+	const double          *proc_scores;
+
+	/** Number of columns of the correlation indexes, their weights in the current pass, and the columns
+	 * computed by the current scoring run */
+	size_t                n_columns;
+	double                *column_weights;
+	BOOL                  *columns_run;
+} AI_scoring_pass;
+
+/** Range of blocks of candidate couples owned by a scoring worker in the current pass: the worker scores
+ * its blocks from the first one, and a worker left without blocks steals the second half of the largest
+ * range still to be scored */
+typedef struct  {
+	size_t                next_block;
+	size_t                end_block;
+
+	/** Statistics of the scores computed by the worker in the current pass */
+	AI_correlation_stats  stats;
+
+	/** Partial sums of the block being scored */
+	AI_correlation_block  *block;
+} AI_scoring_worker;
+
+/** Inputs of the current scoring pass */
+PRIVATE AI_scoring_pass          scoring;
+
+/** Pool of the scoring workers */
+PRIVATE AI_scoring_worker        *scoring_workers      = NULL;
+PRIVATE unsigned int             n_scoring_workers     = 0;
+PRIVATE unsigned int             busy_scoring_workers  = 0;
+PRIVATE unsigned long            scoring_pass_id       = 0;
+PRIVATE pthread_mutex_t          scoring_mutex;
+PRIVATE pthread_cond_t           scoring_start_cond;
+PRIVATE pthread_cond_t           scoring_done_cond;
+
+/** Whether the extra correlation modules run in the helper processes, and the flags of the modules to be run by
+ * the helpers in the current pass */
+PRIVATE BOOL                     modules_in_procs      = false;
+PRIVATE BOOL                     *proc_modules_run     = NULL;
+
+/** Alerts involved in the couples of the current scoring run, and the neurons of the SOM they are mapped on */
+PRIVATE BOOL                     *pending_rows         = NULL;
+PRIVATE int                      *som_x                = NULL;
+PRIVATE int                      *som_y                = NULL;
+
+/**
+ * \brief  Compare two indexed alerts by timestamp (and by row, for the alerts with the same timestamp)
+ */
+
+PRIVATE int
+__AI_indexed_alert_compare ( const void *a, const void *b )
+{
+	const AI_indexed_alert *x = (const AI_indexed_alert*) a,
+					   *y = (const AI_indexed_alert*) b;
+
+	if ( x->timestamp != y->timestamp )
+		return ( x->timestamp < y->timestamp ) ? -1 : 1;
+
+	return ( x->row < y->row ) ? -1 : (( x->row > y->row ) ? 1 : 0 );
+}		/* -----  end of function __AI_indexed_alert_compare  ----- */
+
+/**
+ * \brief  Append an alert to a growing array of indexed alerts
+ * \param  alerts 	Reference to the array
+ * \param  n_alerts 	Reference to the number of alerts in the array
+ * \param  alerts_size 	Reference to the allocated size of the array
+ * \param  table 	Table of the alerts
+ * \param  row 	Row of the alert in the table
+ */
+
+PRIVATE void
+__AI_indexed_alert_append ( AI_indexed_alert **alerts, unsigned int *n_alerts, unsigned int *alerts_size,
+		const AI_alert_table *table, unsigned int row )
+{
+	if ( *n_alerts == *alerts_size )
+	{
+		*alerts_size = ( *alerts_size ) ? 2 * ( *alerts_size ) : 8;
+
+		if ( !( *alerts = (AI_indexed_alert*) realloc ( *alerts, ( *alerts_size ) * sizeof ( AI_indexed_alert ))))
+			AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+	}
+
+	( *alerts )[ *n_alerts ].timestamp = table->timestamp[row];
+	( *alerts )[ *n_alerts ].row       = row;
+	( *n_alerts )++;
+}		/* -----  end of function __AI_indexed_alert_append  ----- */
+
+/**
+ * \brief  Get the keys an alert is indexed under in the index of the alerts by endpoints
+ * \param  table 	Table of the alerts
+ * \param  row 	Row of the alert in the table
+ * \param  keys 	Array that will contain the keys (at most 4)
+ * \return The number of keys of the alert
+ */
+
+PRIVATE unsigned int
+__AI_alert_endpoints_keys ( const AI_alert_table *table, unsigned int row, AI_endpoints_key *keys )
+{
+	unsigned int    i, j, n_src = 1, n_dst = 1, n_keys = 0;
+	uint32_t        src[2][3], dst[2][3];
+	hierarchy_node  *node = NULL;
+
+	src[0][0] = ENDPOINT_ADDRESS;
+	src[0][1] = src[0][2] = table->ip_src_addr[row];
+	dst[0][0] = ENDPOINT_ADDRESS;
+	dst[0][1] = dst[0][2] = table->ip_dst_addr[row];
+
+	if (( node = table->alerts[row]->h_node[src_addr] ))
+	{
+		src[1][0] = ENDPOINT_CLUSTER;
+		src[1][1] = (uint32_t) node->min_val;
+		src[1][2] = (uint32_t) node->max_val;
+		n_src++;
+	}
+
+	if (( node = table->alerts[row]->h_node[dst_addr] ))
+	{
+		dst[1][0] = ENDPOINT_CLUSTER;
+		dst[1][1] = (uint32_t) node->min_val;
+		dst[1][2] = (uint32_t) node->max_val;
+		n_dst++;
+	}
+
+	for ( i=0; i < n_src; i++ )
+	{
+		for ( j=0; j < n_dst; j++ )
+		{
+			memset ( &( keys[n_keys] ), 0, sizeof ( AI_endpoints_key ));
+			keys[n_keys].src_kind = src[i][0];
+			keys[n_keys].src_min  = src[i][1];
+			keys[n_keys].src_max  = src[i][2];
+			keys[n_keys].dst_kind = dst[j][0];
+			keys[n_keys].dst_min  = dst[j][1];
+			keys[n_keys].dst_max  = dst[j][2];
+			n_keys++;
+		}
+	}
+
+	return n_keys;
+}		/* -----  end of function __AI_alert_endpoints_keys  ----- */
+
+/**
+ * \brief  Index the alerts of a table by endpoints and by signature
+ * \param  table 	Table of the alerts
+ * \param  endpoints_index 	Reference to the index by endpoints
+ * \param  signatures_index 	Reference to the index by signature
+ */
+
+PRIVATE void
+__AI_alert_indexes_build ( const AI_alert_table *table, AI_endpoints_bucket **endpoints_index, AI_signature_bucket **signatures_index )
+{
+	AI_endpoints_key     keys[4];
+	AI_hyperalert_key    sig_key;
+	AI_endpoints_bucket  *bucket     = NULL;
+	AI_signature_bucket  *sig_bucket = NULL;
+	unsigned int         row, i, n_keys;
+
+	for ( row=0; row < table->n_alerts; row++ )
+	{
+		n_keys = __AI_alert_endpoints_keys ( table, row, keys );
+
+		for ( i=0; i < n_keys; i++ )
+		{
+			HASH_FIND ( hh, *endpoints_index, &( keys[i] ), sizeof ( AI_endpoints_key ), bucket );
+
+			if ( !bucket )
+			{
+				if ( !( bucket = (AI_endpoints_bucket*) calloc ( 1, sizeof ( AI_endpoints_bucket ))))
+					AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+				bucket->key = keys[i];
+				HASH_ADD ( hh, *endpoints_index, key, sizeof ( AI_endpoints_key ), bucket );
+			}
+
+			__AI_indexed_alert_append ( &( bucket->alerts ), &( bucket->n_alerts ), &( bucket->alerts_size ), table, row );
+		}
+
+		/* The alerts are only looked up by signature for the manual correlations */
+		if ( manual_correlations )
+		{
+			memset ( &sig_key, 0, sizeof ( sig_key ));
+			sig_key.gid = table->gid[row];
+			sig_key.sid = table->sid[row];
+			sig_key.rev = table->rev[row];
+			HASH_FIND ( hh, *signatures_index, &sig_key, sizeof ( AI_hyperalert_key ), sig_bucket );
+
+			if ( !sig_bucket )
+			{
+				if ( !( sig_bucket = (AI_signature_bucket*) calloc ( 1, sizeof ( AI_signature_bucket ))))
+					AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+				sig_bucket->key = sig_key;
+				HASH_ADD ( hh, *signatures_index, key, sizeof ( AI_hyperalert_key ), sig_bucket );
+			}
+
+			__AI_indexed_alert_append ( &( sig_bucket->alerts ), &( sig_bucket->n_alerts ), &( sig_bucket->alerts_size ), table, row );
+		}
+	}
+
+	for ( bucket = *endpoints_index; bucket; bucket = (AI_endpoints_bucket*) bucket->hh.next )
+		qsort ( bucket->alerts, bucket->n_alerts, sizeof ( AI_indexed_alert ), __AI_indexed_alert_compare );
+}		/* -----  end of function __AI_alert_indexes_build  ----- */
+
+/**
+ * \brief  Free the indexes of the alerts by endpoints and by signature
+ * \param  endpoints_index 	Reference to the index by endpoints
+ * \param  signatures_index 	Reference to the index by signature
+ */
+
+PRIVATE void
+__AI_alert_indexes_free ( AI_endpoints_bucket **endpoints_index, AI_signature_bucket **signatures_index )
+{
+	AI_endpoints_bucket  *bucket     = NULL;
+	AI_signature_bucket  *sig_bucket = NULL;
+
+	while ( *endpoints_index )
+	{
+		bucket = *endpoints_index;
+		HASH_DEL ( *endpoints_index, bucket );
+		free ( bucket->alerts );
+		free ( bucket );
+	}
+
+	while ( *signatures_index )
+	{
+		sig_bucket = *signatures_index;
+		HASH_DEL ( *signatures_index, sig_bucket );
+		free ( sig_bucket->alerts );
+		free ( sig_bucket );
+	}
+}		/* -----  end of function __AI_alert_indexes_free  ----- */
+
+/**
+ * \brief  Look for the couple of signatures of two alerts in a table of manual correlations
+ * \param  pairs 	Table of manual correlations (or uncorrelations)
+ * \param  a 	First alert
+ * \param  b 	Second alert
+ * \return The manual correlation, NULL if none
+ */
+
+PRIVATE AI_alert_type_pair*
+__AI_manual_pair_find ( AI_alert_type_pair *pairs, const AI_snort_alert *a, const AI_snort_alert *b )
+{
+	AI_alert_type_pair_key  pair_key;
+	AI_alert_type_pair      *pair = NULL;
+
+	if ( !pairs )
+		return NULL;
+
+	memset ( &pair_key, 0, sizeof ( pair_key ));
+	pair_key.from_sid = a->sid;
+	pair_key.from_gid = a->gid;
+	pair_key.from_rev = a->rev;
+	pair_key.to_sid = b->sid;
+	pair_key.to_gid = b->gid;
+	pair_key.to_rev = b->rev;
+
+	HASH_FIND ( hh, pairs, &pair_key, sizeof ( pair_key ), pair );
+	return pair;
+}		/* -----  end of function __AI_manual_pair_find  ----- */
+
+/**
+ * \brief  Add a couple to the candidates, unless it was already added for the same alert A or it can't be scored
+ * \param  table 	Table of the alerts
+ * \param  a 	Row of the alert A
+ * \param  b 	Row of the alert B
+ * \param  seen 	Array marking the alerts B already added for the alert A (seen[b] == a+1)
+ */
+
+PRIVATE void
+__AI_correlation_candidate_add ( const AI_alert_table *table, unsigned int a, unsigned int b, unsigned int *seen )
+{
+	size_t i;
+
+	if ( a == b || seen[b] == a + 1 )
+		return;
+
+	/* The couples of alerts with the same signature are only scored if they were manually correlated */
+	if ( table->gid[a] == table->gid[b] && table->sid[a] == table->sid[b] && table->rev[a] == table->rev[b] &&
+			!__AI_manual_pair_find ( manual_correlations, table->alerts[a], table->alerts[b] ))
+		return;
+
+	seen[b] = a + 1;
+
+	/* The couples manually marked as not correlated are never accepted */
+	if ( __AI_manual_pair_find ( manual_uncorrelations, table->alerts[a], table->alerts[b] ))
+		return;
+
+	if ( candidates.n_couples == candidates.size )
+	{
+		candidates.size = ( candidates.size ) ? 2 * candidates.size : 1024;
+
+		if ( !( candidates.couples = (AI_correlation_candidate*) realloc ( candidates.couples, candidates.size * sizeof ( AI_correlation_candidate ))) ||
+				!( candidates.scores = (double*) realloc ( candidates.scores, candidates.size * sizeof ( double ))) ||
+				!( candidates.values = (double*) realloc ( candidates.values, candidates.size * scoring.n_columns * sizeof ( double ))) ||
+				!( candidates.carried = (BOOL*) realloc ( candidates.carried, candidates.size * sizeof ( BOOL ))) ||
+				!( candidates.accepted = (BOOL*) realloc ( candidates.accepted, candidates.size * sizeof ( BOOL ))) ||
+				!( candidates.reused = (BOOL*) realloc ( candidates.reused, candidates.size * sizeof ( BOOL ))))
+			AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+	}
+
+	for ( i=0; i < scoring.n_columns; i++ )
+		candidates.values[ candidates.n_couples * scoring.n_columns + i ] = NAN;
+
+	candidates.couples [ candidates.n_couples ].a = a;
+	candidates.couples [ candidates.n_couples ].b = b;
+	candidates.scores  [ candidates.n_couples ] = 0.0;
+	candidates.carried [ candidates.n_couples ] = false;
+	candidates.accepted[ candidates.n_couples ] = false;
+	candidates.reused  [ candidates.n_couples ] = false;
+	candidates.n_couples++;
+}		/* -----  end of function __AI_correlation_candidate_add  ----- */
+
+/**
+ * \brief  Compare two candidate couples of the same alert A by alert B
+ */
+
+PRIVATE int
+__AI_correlation_candidate_compare ( const void *a, const void *b )
+{
+	const AI_correlation_candidate *x = (const AI_correlation_candidate*) a,
+						      *y = (const AI_correlation_candidate*) b;
+
+	return ( x->b < y->b ) ? -1 : (( x->b > y->b ) ? 1 : 0 );
+}		/* -----  end of function __AI_correlation_candidate_compare  ----- */
+
+/**
+ * \brief  Build the list of the couples of alerts that could be correlated. A couple A -> B can only be accepted
+ * if B is not older than A, they have different signatures and the same source and destination (address or
+ * clustering range), or if the couple of signatures was manually correlated (even with the same signature):
+ * only these couples are scored.
+ * If a correlation horizon is set, B must also be at most correlation_horizon seconds newer than A
+ * \param  table 	Table of the alerts
+ */
+
+PRIVATE void
+__AI_correlation_candidates_build ( const AI_alert_table *table )
+{
+	AI_endpoints_bucket  *endpoints_index  = NULL,
+					 *bucket           = NULL;
+	AI_signature_bucket  *signatures_index = NULL,
+					 *sig_bucket       = NULL;
+	AI_alert_type_pair   *pair             = NULL;
+	AI_endpoints_key     keys[4];
+	AI_hyperalert_key    sig_key;
+	unsigned int         *seen             = NULL;
+	unsigned int         a, i, j, lo, hi, mid, n_keys;
+	size_t               first;
+
+	candidates.n_couples = 0;
+	candidates.n_rows    = table->n_alerts;
+
+	if ( !( candidates.offsets = (size_t*) realloc ( candidates.offsets, ( table->n_alerts + 1 ) * sizeof ( size_t ))))
+		AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+	candidates.offsets[0] = 0;
+
+	if ( table->n_alerts == 0 )
+		return;
+
+	if ( !( seen = (unsigned int*) calloc ( table->n_alerts, sizeof ( unsigned int ))))
+		AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+	__AI_alert_indexes_build ( table, &endpoints_index, &signatures_index );
+
+	for ( a=0; a < table->n_alerts; a++ )
+	{
+		first  = candidates.n_couples;
+		n_keys = __AI_alert_endpoints_keys ( table, a, keys );
+
+		for ( i=0; i < n_keys; i++ )
+		{
+			HASH_FIND ( hh, endpoints_index, &( keys[i] ), sizeof ( AI_endpoints_key ), bucket );
+
+			if ( !bucket )
+				continue;
+
+			/* Binary search of the first alert of the bucket not older than A */
+			for ( lo=0, hi=bucket->n_alerts; lo < hi; )
+			{
+				mid = lo + ( hi - lo ) / 2;
+
+				if ( bucket->alerts[mid].timestamp < table->timestamp[a] )
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+
+			/* The buckets are sorted by timestamp, so the scan stops at the end of the horizon */
+			for ( j=lo; j < bucket->n_alerts; j++ )
+			{
+				if ( config->correlationHorizon != 0 &&
+						bucket->alerts[j].timestamp - table->timestamp[a] > (time_t) config->correlationHorizon )
+					break;
+
+				__AI_correlation_candidate_add ( table, a, bucket->alerts[j].row, seen );
+			}
+		}
+
+		for ( pair = manual_correlations; pair; pair = (AI_alert_type_pair*) pair->hh.next )
+		{
+			if ( (unsigned int) pair->key.from_gid != table->gid[a] ||
+					(unsigned int) pair->key.from_sid != table->sid[a] ||
+					(unsigned int) pair->key.from_rev != table->rev[a] )
+				continue;
+
+			memset ( &sig_key, 0, sizeof ( sig_key ));
+			sig_key.gid = pair->key.to_gid;
+			sig_key.sid = pair->key.to_sid;
+			sig_key.rev = pair->key.to_rev;
+			HASH_FIND ( hh, signatures_index, &sig_key, sizeof ( AI_hyperalert_key ), sig_bucket );
+
+			for ( j=0; sig_bucket && j < sig_bucket->n_alerts; j++ )
+			{
+				if ( config->correlationHorizon != 0 &&
+						labs ( (long) ( table->timestamp[ sig_bucket->alerts[j].row ] - table->timestamp[a] )) > (long) config->correlationHorizon )
+					continue;
+
+				__AI_correlation_candidate_add ( table, a, sig_bucket->alerts[j].row, seen );
+			}
+		}
+
+		/* Keep the couples in the same order as a full scan of the table */
+		qsort ( candidates.couples + first, candidates.n_couples - first, sizeof ( AI_correlation_candidate ), __AI_correlation_candidate_compare );
+		candidates.offsets[a+1] = candidates.n_couples;
+	}
+
+	__AI_alert_indexes_free ( &endpoints_index, &signatures_index );
+	free ( seen );
+}		/* -----  end of function __AI_correlation_candidates_build  ----- */
+
+/**
+ * \brief  Initialize a block of candidate couples to be scored
+ * \param  block 	Block
+ * \param  first 	Index of the first couple of the block in the list of the couples to be scored
+ */
+
+PRIVATE void
+__AI_correlation_block_init ( AI_correlation_block *block, size_t first )
+{
+	block->couples   = pending + first;
+	block->index     = pending_index + first;
+	block->n_couples = ( n_pending - first < CORRELATION_BLOCK_SIZE ) ? n_pending - first : CORRELATION_BLOCK_SIZE;
+}		/* -----  end of function __AI_correlation_block_init  ----- */
+
+/**
+ * \brief  Get the correlation indexes of a couple of a block
+ * \param  block 	Block
+ * \param  i 	Couple in the block
+ * \return The row of the correlation indexes of the couple
+ */
+
+PRIVATE double*
+__AI_correlation_block_values ( const AI_correlation_block *block, unsigned int i )
+{
+	return candidates.values + block->index[i] * scoring.n_columns;
+}		/* -----  end of function __AI_correlation_block_values  ----- */
+
+/**
+ * \brief  Mark a correlation index as not counting for all the couples of a block
+ * \param  block 	Block
+ * \param  column 	Column of the index
+ */
+
+PRIVATE void
+__AI_correlation_block_clear ( AI_correlation_block *block, size_t column )
+{
+	unsigned int i;
+
+	for ( i=0; i < block->n_couples; i++ )
+		__AI_correlation_block_values ( block, i )[column] = NAN;
+}		/* -----  end of function __AI_correlation_block_clear  ----- */
+
+/**
+ * \brief  Compute the knowledge base correlation index of the couples of a block
+ * \param  block 	Block
+ * \param  table 	Table of the alerts
+ */
+
+PRIVATE void
+__AI_correlation_block_kb ( AI_correlation_block *block, const AI_alert_table *table )
+{
+	unsigned int i;
+	double       value;
+
+	for ( i=0; i < block->n_couples; i++ )
+	{
+		value = AI_kb_correlation_coefficient ( table->alerts[ block->couples[i].a ], table->alerts[ block->couples[i].b ] );
+		__AI_correlation_block_values ( block, i )[COLUMN_KB] = ( value != 0.0 ) ? value : NAN;
+	}
+}		/* -----  end of function __AI_correlation_block_kb  ----- */
+
+/**
+ * \brief  Compute the bayesian correlation index of the couples of a block
+ * \param  block 	Block
+ * \param  table 	Table of the alerts
+ */
+
+PRIVATE void
+__AI_correlation_block_bayesian ( AI_correlation_block *block, const AI_alert_table *table )
+{
+	unsigned int i;
+	double       value;
+
+	for ( i=0; i < block->n_couples; i++ )
+	{
+		value = AI_alert_bayesian_correlation ( table->alerts[ block->couples[i].a ], table->alerts[ block->couples[i].b ] );
+		__AI_correlation_block_values ( block, i )[COLUMN_BAYESIAN] = ( value != 0.0 ) ? value : NAN;
+	}
+}		/* -----  end of function __AI_correlation_block_bayesian  ----- */
+
+/**
+ * \brief  Compute the neural correlation index of the couples of a block from the distance between the neurons
+ * of the SOM the alerts are mapped on (same as AI_neural_som_neurons_correlation)
+ * \param  block 	Block
+ * \param  som_x 	x coordinate of the neuron of each alert
+ * \param  som_y 	y coordinate of the neuron of each alert
+ */
+
+PRIVATE void
+__AI_correlation_block_neural ( AI_correlation_block *block, const int *som_x, const int *som_y )
+{
+	unsigned int i;
+	double       dx, dy, distance,
+			   max_distance = sqrt ((double) ( 2 * (config->outputNeuronsPerSide-1) * (config->outputNeuronsPerSide-1) ));
+
+	for ( i=0; i < block->n_couples; i++ )
+	{
+		dx = (double) ( som_x[ block->couples[i].b ] - som_x[ block->couples[i].a ] );
+		dy = (double) ( som_y[ block->couples[i].b ] - som_y[ block->couples[i].a ] );
+		distance = sqrt ( dx*dx + dy*dy );
+
+		/* The index is zero (and doesn't count) only for the couples on opposite corners of the map */
+		__AI_correlation_block_values ( block, i )[COLUMN_NEURAL] = ( distance != max_distance ) ? 1.0 / ( 1.0 + distance ) : NAN;
+	}
+}		/* -----  end of function __AI_correlation_block_neural  ----- */
+
+/**
+ * \brief  Compute the correlation index of an extra correlation module for the couples of a block, with a single
+ * call to the batch function of the module if it provides one, or with a call per couple otherwise
+ * \param  block 	Block
+ * \param  table 	Table of the alerts
+ * \param  module 	Descriptor of the module
+ * \param  column 	Column of the module
+ * \param  lock 	Lock held during the calls to the module, if it is not thread-safe (NULL otherwise)
+ */
+
+PRIVATE void
+__AI_correlation_block_module ( AI_correlation_block *block, const AI_alert_table *table,
+		const AI_corr_module_descriptor *module, size_t column, pthread_mutex_t *lock )
+{
+	unsigned int i;
+
+	if ( lock )
+		pthread_mutex_lock ( lock );
+
+	if ( module->index_batch )
+	{
+		module->index_batch ( table, block->couples, block->n_couples, block->scores );
+	} else {
+		for ( i=0; i < block->n_couples; i++ )
+			block->scores[i] = module->index ( table->alerts[ block->couples[i].a ], table->alerts[ block->couples[i].b ] );
+	}
+
+	if ( lock )
+		pthread_mutex_unlock ( lock );
+
+	for ( i=0; i < block->n_couples; i++ )
+		__AI_correlation_block_values ( block, i )[column] = block->scores[i];
+}		/* -----  end of function __AI_correlation_block_module  ----- */
+
+/**
+ * \brief  Store the correlation index of an extra correlation module, computed beforehand for all the couples of the
+ * run (by the batch function of a Python module or by a helper process), for the couples of a block. The couples
+ * with a NaN score got no score from the module, and the module doesn't count for them
+ * \param  block 	Block
+ * \param  scores 	Scores of the couples of the block
+ * \param  column 	Column of the module
+ */
+
+PRIVATE void
+__AI_correlation_block_scores ( AI_correlation_block *block, const double *scores, size_t column )
+{
+	unsigned int i;
+
+	for ( i=0; i < block->n_couples; i++ )
+		__AI_correlation_block_values ( block, i )[column] = scores[i];
+}		/* -----  end of function __AI_correlation_block_scores  ----- */
+
+/**
+ * \brief  Store the correlation indexes computed by the helper processes for the extra correlation modules for the couples of a block
+ * \param  block 	Block
+ * \param  first 	Index of the first couple of the block in the list of the couples to be scored
+ */
+
+PRIVATE void
+__AI_correlation_block_proc ( AI_correlation_block *block, size_t first )
+{
+	size_t i;
+
+	for ( i = BUILTIN_COLUMNS; i < scoring.n_columns; i++ )
+	{
+		if ( !scoring.columns_run[i] )
+			continue;
+
+		if ( scoring.proc_scores )
+			__AI_correlation_block_scores ( block, scoring.proc_scores + ( i - BUILTIN_COLUMNS ) * n_pending + first, i );
+		else
+			__AI_correlation_block_clear ( block, i );
+	}
+}		/* -----  end of function __AI_correlation_block_proc  ----- */
+
+/**
+ * \brief  Score all the couples of the current pass with the extra correlation modules in the helper processes.
+ * If no helper is running, the modules don't count in this pass
+ */
+
+PRIVATE void
+__AI_correlation_proc_score ()
+{
+	size_t i;
+	BOOL   any = false;
+
+	for ( i = BUILTIN_COLUMNS; i < scoring.n_columns; i++ )
+	{
+		proc_modules_run[ i - BUILTIN_COLUMNS ] = scoring.columns_run[i];
+		any = any || scoring.columns_run[i];
+	}
+
+	scoring.proc_scores = ( any ) ? AI_corr_modules_proc_score ( scoring.table, pending, n_pending, proc_modules_run ) : NULL;
+}		/* -----  end of function __AI_correlation_proc_score  ----- */
+
+#ifdef HAVE_LIBPYTHON2_6
+/**
+ * \brief  Compute the correlation index of an extra Python correlation module for the couples of a block
+ * \param  block 	Block
+ * \param  py_alerts 	Python objects of the alerts
+ * \param  py_function 	Correlation function of the module
+ * \param  column 	Column of the module
+ */
+
+PRIVATE void
+__AI_correlation_block_py_module ( AI_correlation_block *block, PyObject **py_alerts, PyObject *py_function, size_t column )
+{
+	unsigned int i;
+
+	for ( i=0; i < block->n_couples; i++ )
+	{
+		__AI_correlation_block_values ( block, i )[column] = ( !py_alerts[ block->couples[i].a ] || !py_alerts[ block->couples[i].b ] ) ?
+			NAN : AI_py_corr_index ( py_function, py_alerts[ block->couples[i].a ], py_alerts[ block->couples[i].b ] );
+	}
+}		/* -----  end of function __AI_correlation_block_py_module  ----- */
+
+/**
+ * \brief  Score all the couples of the current pass with the batch functions of the Python correlation modules.
+ * Each batch function is called once per pass as AI_corr_index_batch(alerts, pairs), where alerts is the list of
+ * the alerts of the pass (None for the alerts not involved in any couple to be scored) and pairs is an
+ * array.array('I') containing the indexes in alerts of the two alerts of each couple, one after the other
+ */
+
+PRIVATE void
+__AI_correlation_py_batch_score ()
+{
+	PyObject      *pAlerts = NULL,
+			    *pPairs  = NULL,
+			    *pRet    = NULL;
+	size_t        i;
+	BOOL          has_batch = false;
+
+	for ( i=0; scoring.py_batch_functions && i < scoring.n_py_corr_functions; i++ )
+	{
+		if ( scoring.py_batch_functions[i] && scoring.columns_run[ BUILTIN_COLUMNS + scoring.n_corr_modules + i ] )
+			has_batch = true;
+	}
+
+	if ( !has_batch || n_pending == 0 )
+		return;
+
+	pAlerts = AI_py_alerts_list ( scoring.py_alerts, scoring.table->n_alerts );
+	pPairs  = AI_py_couples_array ( pending, n_pending );
+
+	for ( i=0; i < scoring.n_py_corr_functions; i++ )
+	{
+		if ( !scoring.py_batch_functions[i] || !scoring.columns_run[ BUILTIN_COLUMNS + scoring.n_corr_modules + i ] )
+			continue;
+
+		if ( !( scoring.py_batch_scores[i] = (double*) realloc ( scoring.py_batch_scores[i], n_pending * sizeof ( double ))))
+			AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+		if ( !( pRet = PyObject_CallFunctionObjArgs ( scoring.py_batch_functions[i], pAlerts, pPairs, NULL )))
+		{
+			PyErr_Print();
+			AI_fatal_err ( "Could not call the batch correlation function from the Python module", __FILE__, __LINE__ );
+		}
+
+		AI_py_batch_scores_read ( pRet, scoring.py_batch_scores[i], n_pending );
+		Py_DECREF ( pRet );
+	}
+
+	Py_DECREF ( pPairs );
+	Py_DECREF ( pAlerts );
+}		/* -----  end of function __AI_correlation_py_batch_score  ----- */
+#endif
+
+/**
+ * \brief  Compute the score of a couple as the weighted mean of its correlation indexes in the current pass
+ * \param  values 	Row of the correlation indexes of the couple
+ * \return The score of the couple
+ */
+
+PRIVATE double
+__AI_correlation_couple_score ( const double *values )
+{
+	double        sum   = 0.0;
+	unsigned int  count = 0;
+	size_t        i;
+
+	for ( i=0; i < scoring.n_columns; i++ )
+	{
+		if ( column_versions[i] == 0 || isnan ( values[i] ))
+			continue;
+
+		sum += scoring.column_weights[i] * values[i];
+		count++;
+	}
+
+	return ( count != 0 ) ? sum / (double) count : 0.0;
+}		/* -----  end of function __AI_correlation_couple_score  ----- */
+
+/**
+ * \brief  Store the scores of the couples of a block, and update the running mean and variance of the scores
+ * \param  block 	Block
+ * \param  first 	Index of the first couple of the block in the list of the couples to be scored
+ * \param  stats 	Running statistics of the scores
+ */
+
+PRIVATE void
+__AI_correlation_block_store ( const AI_correlation_block *block, size_t first, AI_correlation_stats *stats )
+{
+	unsigned int i;
+	double       score, delta;
+
+	for ( i=0; i < block->n_couples; i++ )
+	{
+		score = __AI_correlation_couple_score ( __AI_correlation_block_values ( block, i ));
+		pending_scores[ first + i ] = score;
+
+		stats->n++;
+		delta = score - stats->mean;
+		stats->mean += delta / (double) stats->n;
+		stats->m2   += delta * ( score - stats->mean );
+	}
+}		/* -----  end of function __AI_correlation_block_store  ----- */
+
+/**
+ * \brief  Compute the correlation indexes of the current scoring run for a block of candidate couples, and their scores
+ * \param  block 	Block
+ * \param  first 	Index of the first couple of the block in the list of the couples to be scored
+ * \param  stats 	Running statistics of the scores
+ */
+
+PRIVATE void
+__AI_correlation_block_score ( AI_correlation_block *block, size_t first, AI_correlation_stats *stats )
+{
+	size_t i;
+
+	#ifdef HAVE_LIBPYTHON2_6
+	size_t column;
+	#endif
+
+	__AI_correlation_block_init ( block, first );
+
+	if ( scoring.columns_run[COLUMN_BAYESIAN] )
+		__AI_correlation_block_bayesian ( block, scoring.table );
+
+	if ( scoring.columns_run[COLUMN_KB] )
+		__AI_correlation_block_kb ( block, scoring.table );
+
+	if ( scoring.columns_run[COLUMN_NEURAL] )
+	{
+		if ( scoring.has_som_neurons )
+			__AI_correlation_block_neural ( block, scoring.som_x, scoring.som_y );
+		else
+			__AI_correlation_block_clear ( block, COLUMN_NEURAL );
+	}
+
+	/* The extra correlation modules running in the helper processes already scored all the couples of the run */
+	if ( modules_in_procs )
+	{
+		__AI_correlation_block_proc ( block, first );
+		__AI_correlation_block_store ( block, first, stats );
+		return;
+	}
+
+	/* Get the correlation indexes from extra correlation modules */
+	for ( i=0; scoring.corr_modules && i < scoring.n_corr_modules; i++ )
+	{
+		if ( scoring.columns_run[ BUILTIN_COLUMNS + i ] )
+			__AI_correlation_block_module ( block, scoring.table, scoring.corr_modules[i], BUILTIN_COLUMNS + i,
+				( scoring.corr_modules[i]->flags & AI_CORR_MODULE_THREAD_SAFE ) ? NULL : &( scoring.module_locks[i] ));
+	}
+
+	#ifdef HAVE_LIBPYTHON2_6
+	for ( i=0; scoring.py_corr_functions && i < scoring.n_py_corr_functions; i++ )
+	{
+		column = BUILTIN_COLUMNS + scoring.n_corr_modules + i;
+
+		if ( !scoring.columns_run[column] )
+			continue;
+
+		/* The scores of the modules with a batch function were computed at once before the blocks */
+		if ( scoring.py_batch_functions && scoring.py_batch_functions[i] )
+			__AI_correlation_block_scores ( block, scoring.py_batch_scores[i] + first, column );
+		else
+			__AI_correlation_block_py_module ( block, scoring.py_alerts, scoring.py_corr_functions[i], column );
+	}
+	#endif
+
+	__AI_correlation_block_store ( block, first, stats );
+}		/* -----  end of function __AI_correlation_block_score  ----- */
+
+/**
+ * \brief  Merge the statistics of a set of scores into the statistics of another set (Chan's formula)
+ * \param  into 	Statistics to be updated
+ * \param  from 	Statistics to be merged
+ */
+
+PRIVATE void
+__AI_correlation_stats_merge ( AI_correlation_stats *into, const AI_correlation_stats *from )
+{
+	double        delta;
+	unsigned long n;
+
+	if ( from->n == 0 )
+		return;
+
+	n     = into->n + from->n;
+	delta = from->mean - into->mean;
+
+	into->mean += delta * (double) from->n / (double) n;
+	into->m2   += from->m2 + delta * delta * (double) into->n * (double) from->n / (double) n;
+	into->n     = n;
+}		/* -----  end of function __AI_correlation_stats_merge  ----- */
+
+/**
+ * \brief  Pick the next block to be scored by a worker, stealing the second half of the largest range of
+ * another worker if its own range is over (to be called with scoring_mutex locked)
+ * \param  self 	Worker
+ * \param  block 	Reference to the index of the block to be scored
+ * \return false if no block is left to be scored, true otherwise
+ */
+
+PRIVATE BOOL
+__AI_scoring_block_next ( AI_scoring_worker *self, size_t *block )
+{
+	AI_scoring_worker *victim = NULL;
+	size_t            left, max_left = 0;
+	unsigned int      i;
+
+	if ( self->next_block >= self->end_block )
+	{
+		for ( i=0; i < n_scoring_workers; i++ )
+		{
+			left = scoring_workers[i].end_block - scoring_workers[i].next_block;
+
+			if ( scoring_workers[i].next_block < scoring_workers[i].end_block && left > max_left )
+			{
+				max_left = left;
+				victim   = &( scoring_workers[i] );
+			}
+		}
+
+		if ( !victim )
+			return false;
+
+		self->end_block   = victim->end_block;
+		self->next_block  = victim->end_block - ( max_left + 1 ) / 2;
+		victim->end_block = self->next_block;
+	}
+
+	*block = self->next_block++;
+	return true;
+}		/* -----  end of function __AI_scoring_block_next  ----- */
+
+/**
+ * \brief  Thread of the scoring pool: at every pass it scores its range of blocks of candidate couples,
+ * then helps the other workers with theirs
+ * \param  arg 	Worker
+ */
+
+PRIVATE void*
+__AI_scoring_worker_thread ( void *arg )
+{
+	AI_scoring_worker *self = (AI_scoring_worker*) arg;
+	unsigned long     pass  = 0;
+	size_t            block;
+
+	pthread_mutex_lock ( &scoring_mutex );
+
+	while ( 1 )
+	{
+		while ( scoring_pass_id == pass )
+			pthread_cond_wait ( &scoring_start_cond, &scoring_mutex );
+
+		pass = scoring_pass_id;
+
+		while ( __AI_scoring_block_next ( self, &block ))
+		{
+			pthread_mutex_unlock ( &scoring_mutex );
+			__AI_correlation_block_score ( self->block, block * CORRELATION_BLOCK_SIZE, &( self->stats ));
+			pthread_mutex_lock ( &scoring_mutex );
+		}
+
+		if ( --busy_scoring_workers == 0 )
+			pthread_cond_signal ( &scoring_done_cond );
+	}
+
+	pthread_mutex_unlock ( &scoring_mutex );
+	pthread_exit ((void*) 0 );
+	return (void*) 0;
+}		/* -----  end of function __AI_scoring_worker_thread  ----- */
+
+/**
+ * \brief  Start the pool of the scoring workers
+ */
+
+PRIVATE void
+__AI_scoring_pool_init ()
+{
+	pthread_t    worker;
+	long         n_cpus = 0;
+	unsigned int i;
+
+	if (( n_scoring_workers = config->correlationThreads ) == 0 )
+	{
+		n_scoring_workers = (( n_cpus = sysconf ( _SC_NPROCESSORS_ONLN )) > 0 ) ? (unsigned int) n_cpus : 1;
+	}
+
+	/* With a single thread the couples are scored by the correlation thread itself */
+	if ( n_scoring_workers <= 1 )
+		return;
+
+	if ( !( scoring_workers = (AI_scoring_worker*) calloc ( n_scoring_workers, sizeof ( AI_scoring_worker ))))
+		AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+	pthread_mutex_init ( &scoring_mutex, NULL );
+	pthread_cond_init ( &scoring_start_cond, NULL );
+	pthread_cond_init ( &scoring_done_cond, NULL );
+
+	for ( i=0; i < n_scoring_workers; i++ )
+	{
+		if ( !( scoring_workers[i].block = (AI_correlation_block*) malloc ( sizeof ( AI_correlation_block ))))
+			AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+		if ( pthread_create ( &worker, NULL, __AI_scoring_worker_thread, &( scoring_workers[i] )) != 0 )
+		{
+			AI_fatal_err ( "Failed to create the correlation scoring thread", __FILE__, __LINE__ );
+		}
+
+		pthread_detach ( worker );
+	}
+}		/* -----  end of function __AI_scoring_pool_init  ----- */
+
+/**
+ * \brief  Compute the correlation indexes of the current scoring run for the couples to be scored, on the pool of the scoring workers
+ * if any, and compute the statistics of their scores
+ * \param  block 	Block used for scoring the couples in the calling thread
+ * \param  stats 	Statistics of the scores
+ */
+
+PRIVATE void
+__AI_correlation_candidates_score ( AI_correlation_block *block, AI_correlation_stats *stats )
+{
+	size_t       n_blocks = ( n_pending + CORRELATION_BLOCK_SIZE - 1 ) / CORRELATION_BLOCK_SIZE,
+			   i;
+	BOOL         serial   = ( n_scoring_workers <= 1 || n_blocks <= 1 );
+
+	memset ( stats, 0, sizeof ( AI_correlation_stats ));
+
+	/* The embedded Python interpreter can only be called from the correlation thread: the blocks are only
+	 * scored on the pool if all the Python modules in use already returned their scores in batch, or run
+	 * in the helper processes */
+	#ifdef HAVE_LIBPYTHON2_6
+	for ( i=0; !modules_in_procs && scoring.py_corr_functions && i < scoring.n_py_corr_functions; i++ )
+	{
+		if ( scoring.columns_run[ BUILTIN_COLUMNS + scoring.n_corr_modules + i ] && !( scoring.py_batch_functions && scoring.py_batch_functions[i] ))
+			serial = true;
+	}
+	#endif
+
+	if ( serial )
+	{
+		for ( i=0; i < n_blocks; i++ )
+			__AI_correlation_block_score ( block, i * CORRELATION_BLOCK_SIZE, stats );
+
+		return;
+	}
+
+	pthread_mutex_lock ( &scoring_mutex );
+
+	for ( i=0; i < n_scoring_workers; i++ )
+	{
+		scoring_workers[i].next_block = i * n_blocks / n_scoring_workers;
+		scoring_workers[i].end_block  = ( i + 1 ) * n_blocks / n_scoring_workers;
+		memset ( &( scoring_workers[i].stats ), 0, sizeof ( AI_correlation_stats ));
+	}
+
+	busy_scoring_workers = n_scoring_workers;
+	scoring_pass_id++;
+	pthread_cond_broadcast ( &scoring_start_cond );
+
+	while ( busy_scoring_workers > 0 )
+		pthread_cond_wait ( &scoring_done_cond, &scoring_mutex );
+
+	pthread_mutex_unlock ( &scoring_mutex );
+
+	for ( i=0; i < n_scoring_workers; i++ )
+		__AI_correlation_stats_merge ( stats, &( scoring_workers[i].stats ));
+}		/* -----  end of function __AI_correlation_candidates_score  ----- */
+
+/**
+ * \brief  Compute the correlation indexes of the current scoring run (scoring.columns_run) for the couples to be scored,
+ * and their scores
+ * \param  block 	Block used for scoring the couples in the calling thread
+ * \param  stats 	Statistics of the scores
+ */
+
+PRIVATE void
+__AI_correlation_pending_score ( AI_correlation_block *block, AI_correlation_stats *stats )
+{
+	const AI_alert_table *table = scoring.table;
+	size_t               i;
+
+	#ifdef HAVE_LIBPYTHON2_6
+	BOOL                 py_run = false;
+
+	for ( i=0; scoring.py_corr_functions && i < scoring.n_py_corr_functions; i++ )
+		py_run |= scoring.columns_run[ BUILTIN_COLUMNS + scoring.n_corr_modules + i ];
+	#endif
+
+	/* Only the alerts of the couples to be scored are mapped on the SOM or converted to Python objects */
+	if ( !( pending_rows = (BOOL*) realloc ( pending_rows, table->n_alerts * sizeof ( BOOL ))))
+		AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+	memset ( pending_rows, 0, table->n_alerts * sizeof ( BOOL ));
+
+	for ( i=0; i < n_pending; i++ )
+		pending_rows[ pending[i].a ] = pending_rows[ pending[i].b ] = true;
+
+	/* Map each alert on the SOM only once, instead of once per couple */
+	scoring.has_som_neurons = false;
+
+	if ( scoring.columns_run[COLUMN_NEURAL] )
+	{
+		if ( !( som_x = (int*) realloc ( som_x, table->n_alerts * sizeof ( int ))) ||
+				!( som_y = (int*) realloc ( som_y, table->n_alerts * sizeof ( int ))))
+			AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+		scoring.som_x = som_x;
+		scoring.som_y = som_y;
+		scoring.has_som_neurons = AI_neural_som_neurons ( table, pending_rows, som_x, som_y );
+	}
+
+	/* The extra modules score all the couples at once in the helper processes, if any */
+	if ( modules_in_procs )
+		__AI_correlation_proc_score();
+
+	#ifdef HAVE_LIBPYTHON2_6
+	if ( py_run && !modules_in_procs )
+	{
+		/* Convert each alert to a Python object only once, instead of twice per couple */
+		if ( !( scoring.py_alerts = (PyObject**) realloc ( scoring.py_alerts, ( table->n_alerts + 1 ) * sizeof ( PyObject* ))))
+			AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+		for ( i=0; i < table->n_alerts; i++ )
+			scoring.py_alerts[i] = ( pending_rows[i] ) ? AI_alert_to_pyalert ( table->alerts[i] ) : NULL;
+
+		/* The modules with a batch function score all the couples with a single call */
+		__AI_correlation_py_batch_score();
+	}
+	#endif
+
+	/* Compute the scores of the couples to be scored, one block at a time on the pool of the scoring workers:
+	 * each correlation index is computed over a whole block, and the scores are accumulated in the running
+	 * mean and variance of each worker */
+	__AI_correlation_candidates_score ( block, stats );
+
+	#ifdef HAVE_LIBPYTHON2_6
+	if ( py_run && !modules_in_procs )
+	{
+		for ( i=0; i < table->n_alerts; i++ )
+		{
+			if ( scoring.py_alerts[i] )
+			{
+				Py_DECREF ( scoring.py_alerts[i] );
+			}
+		}
+	}
+	#endif
+
+	for ( i=0; i < n_pending; i++ )
+		candidates.scores[ pending_index[i] ] = pending_scores[i];
+}		/* -----  end of function __AI_correlation_pending_score  ----- */
+
+/**
+ * \brief  Check whether the cluster of an alert changed since the copy of the alert taken in the previous pass
+ * \param  old 	Copy of the alert taken in the previous pass
+ * \param  fresh 	Copy of the alert taken in the current pass
+ * \return true if the cluster was generalised or grew, false otherwise
+ */
+
+PRIVATE BOOL
+__AI_alert_changed ( const AI_snort_alert *old, const AI_snort_alert *fresh )
+{
+	return ( old->gid != fresh->gid || old->sid != fresh->sid || old->rev != fresh->rev ||
+		old->timestamp != fresh->timestamp ||
+		old->grouped_alerts_count != fresh->grouped_alerts_count ||
+		memcmp ( old->h_node, fresh->h_node, sizeof ( old->h_node )) != 0 );
+}		/* -----  end of function __AI_alert_changed  ----- */
+
+/**
+ * \brief  Free a list of alerts of the correlation graph, together with their own copy of the grouped alerts
+ * \param  list 	List of alerts
+ */
+
+PRIVATE void
+__AI_correlation_alerts_free ( AI_snort_alert *list )
+{
+	AI_snort_alert *alert = NULL;
+	unsigned int   i;
+
+	for ( alert = list; alert; alert = alert->next )
+	{
+		for ( i=1; alert->grouped_alerts && i < alert->grouped_alerts_count; i++ )
+			free ( alert->grouped_alerts[i] );
+
+		free ( alert->grouped_alerts );
+		alert->grouped_alerts = NULL;
+	}
+
+	AI_free_alerts ( list );
+}		/* -----  end of function __AI_correlation_alerts_free  ----- */
+
+/**
+ * \brief  Merge a fresh copy of the clustered alerts into the alerts of the correlation graph: the alerts whose
+ * cluster didn't change keep their copy from the previous pass (and so their couples and edges), the new and
+ * changed ones take the fresh copy, and the alerts whose cluster is gone (e.g. merged into another one) or whose
+ * subgraph was archived are released. The closed clusters are returned by the clustering only once, and they are
+ * kept in the graph afterwards. If a correlation horizon is set, the alerts out of the horizon are not added
+ * to the graph anymore, and the ones already in the graph are kept as they are until their subgraph is archived
+ * \param  fresh 	Fresh copy of the clustered alerts
+ * \param  closed 	Copy of the clusters closed since the previous pass
+ * \param  released 	Reference to the list of the alerts released from the graph, to be freed by the caller
+ * \param  changed 	Reference to a flag set if any alert of the graph was added, changed or released
+ * \return The list of the alerts of the graph: the fresh copy first, in the same order, then the alerts out of the horizon
+ */
+
+PRIVATE AI_snort_alert*
+__AI_correlation_nodes_sync ( AI_snort_alert *fresh, AI_snort_alert *closed, AI_snort_alert **released, BOOL *changed )
+{
+	AI_correlation_node  *node  = NULL,
+					 *tmp   = NULL;
+	AI_snort_alert       *alert = NULL,
+					 *next  = NULL,
+					 *head  = NULL,
+					 *tail  = NULL,
+					 **grouped = NULL;
+	unsigned int         row    = 0,
+					 i;
+	BOOL                 closing = false;
+
+	correlation_pass++;
+	*released = NULL;
+
+	/* The alerts not bound to any cluster can't be recognised in the next pass */
+	for ( alert = alerts; alert; alert = next )
+	{
+		next = alert->next;
+
+		if ( alert->cluster_id == 0 )
+		{
+			alert->next = *released;
+			*released   = alert;
+			*changed    = true;
+		}
+	}
+
+	/* The closed clusters are synchronised after the open ones, as they were still in the fresh copy */
+	if ( fresh )
+	{
+		for ( alert = fresh; alert->next; alert = alert->next );
+		alert->next = closed;
+	} else {
+		fresh = closed;
+	}
+
+	if ( config->correlationHorizon != 0 )
+	{
+		for ( alert = fresh; alert; alert = alert->next )
+		{
+			if ( alert->timestamp > graph_latest )
+				graph_latest = alert->timestamp;
+		}
+
+		graph_cutoff = graph_latest - (time_t) config->correlationHorizon;
+	}
+
+	for ( alert = fresh; alert; alert = next )
+	{
+		next = alert->next;
+		node = NULL;
+
+		if ( alert == closed )
+			closing = true;
+
+		if ( alert->cluster_id != 0 )
+			HASH_FIND ( hh, correlation_nodes, &( alert->cluster_id ), sizeof ( unsigned long ), node );
+
+		/* A new alert out of the horizon can't be correlated to the alerts still to come */
+		if ( !node && alert->timestamp < graph_cutoff )
+		{
+			free ( alert );
+			continue;
+		}
+
+		if ( row == prev_rows_size )
+		{
+			prev_rows_size = ( prev_rows_size ) ? 2 * prev_rows_size : 1024;
+
+			if ( !( prev_rows = (unsigned int*) realloc ( prev_rows, prev_rows_size * sizeof ( unsigned int ))))
+				AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+		}
+
+		if ( node && !node->archived && !__AI_alert_changed ( node->alert, alert ))
+		{
+			/* The fresh copy only shares its pointers with the clustered alert, so it is just dropped */
+			prev_rows[row] = node->row;
+			free ( alert );
+			alert = node->alert;
+		} else {
+			prev_rows[row] = NO_ROW;
+			*changed = true;
+
+			if ( node )
+			{
+				node->alert->next = *released;
+				*released = node->alert;
+				node->archived = false;
+			} else if ( alert->cluster_id != 0 ) {
+				if ( !( node = (AI_correlation_node*) calloc ( 1, sizeof ( AI_correlation_node ))))
+					AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+				node->cluster_id = alert->cluster_id;
+				HASH_ADD ( hh, correlation_nodes, cluster_id, sizeof ( unsigned long ), node );
+			}
+
+			if ( node )
+				node->alert = alert;
+
+			/* The grouped alerts may be reallocated by the clustering, or released once their cluster
+			 * is closed, so the graph keeps its own copy of them */
+			if ( alert->grouped_alerts && alert->grouped_alerts_count > 0 )
+			{
+				if ( !( grouped = (AI_snort_alert**) malloc ( alert->grouped_alerts_count * sizeof ( AI_snort_alert* ))))
+					AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+				grouped[0] = alert;
+
+				for ( i=1; i < alert->grouped_alerts_count; i++ )
+				{
+					if ( !( grouped[i] = (AI_snort_alert*) malloc ( sizeof ( AI_snort_alert ))))
+						AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+					memcpy ( grouped[i], alert->grouped_alerts[i], sizeof ( AI_snort_alert ));
+					grouped[i]->next = NULL;
+				}
+
+				alert->grouped_alerts = grouped;
+			} else {
+				alert->grouped_alerts = NULL;
+			}
+
+			/* Only the new alerts need their hyperalert information */
+			alert->next = NULL;
+			AI_kb_index_init ( alert );
+		}
+
+		if ( node )
+		{
+			node->row    = row;
+			node->pass   = correlation_pass;
+			node->closed = closing;
+		}
+
+		if ( tail )
+			tail->next = alert;
+		else
+			head = alert;
+
+		tail = alert;
+		row++;
+	}
+
+	for ( node = correlation_nodes; node; node = tmp )
+	{
+		tmp = (AI_correlation_node*) node->hh.next;
+
+		if ( node->pass == correlation_pass )
+			continue;
+
+		/* The closed clusters and the alerts out of the horizon are not copied by the clustering anymore,
+		 * but they stay in the graph, unchanged, until their subgraph is archived */
+		if ( !node->archived && ( node->closed || node->alert->timestamp < graph_cutoff ))
+		{
+			if ( row == prev_rows_size )
+			{
+				prev_rows_size = ( prev_rows_size ) ? 2 * prev_rows_size : 1024;
+
+				if ( !( prev_rows = (unsigned int*) realloc ( prev_rows, prev_rows_size * sizeof ( unsigned int ))))
+					AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+			}
+
+			prev_rows[row] = node->row;
+			node->row  = row++;
+			node->pass = correlation_pass;
+
+			if ( tail )
+				tail->next = node->alert;
+			else
+				head = node->alert;
+
+			tail = node->alert;
+			continue;
+		}
+
+		node->alert->next = *released;
+		*released = node->alert;
+		*changed  = true;
+
+		HASH_DEL ( correlation_nodes, node );
+		free ( node );
+	}
+
+	if ( tail )
+		tail->next = NULL;
+
+	return head;
+}		/* -----  end of function __AI_correlation_nodes_sync  ----- */
+
+/**
+ * \brief  Carry over the correlation indexes, the scores and the state in the graph of the couples of the previous pass
+ * whose alerts didn't change, and put the other couples in the list of the couples to be scored
+ */
+
+PRIVATE void
+__AI_correlation_couples_carry ()
+{
+	size_t        i, lo, hi, mid;
+	unsigned int  a, b;
+
+	n_pending = 0;
+
+	for ( i=0; i < prev_candidates.n_couples; i++ )
+		prev_candidates.reused[i] = false;
+
+	for ( i=0; i < candidates.n_couples; i++ )
+	{
+		a = prev_rows[ candidates.couples[i].a ];
+		b = prev_rows[ candidates.couples[i].b ];
+
+		if ( a != NO_ROW && b != NO_ROW && a < prev_candidates.n_rows )
+		{
+			/* Binary search of the alert B among the couples of the alert A in the previous pass */
+			for ( lo = prev_candidates.offsets[a], hi = prev_candidates.offsets[a+1]; lo < hi; )
+			{
+				mid = lo + ( hi - lo ) / 2;
+
+				if ( prev_candidates.couples[mid].b < b )
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+
+			if ( lo < prev_candidates.offsets[a+1] && prev_candidates.couples[lo].b == b )
+			{
+				memcpy ( candidates.values + i * scoring.n_columns, prev_candidates.values + lo * scoring.n_columns,
+					scoring.n_columns * sizeof ( double ));
+				candidates.scores[i]       = prev_candidates.scores[lo];
+				candidates.carried[i]      = true;
+				candidates.accepted[i]     = prev_candidates.accepted[lo];
+				prev_candidates.reused[lo] = true;
+				score_cache_hits++;
+				continue;
+			}
+		}
+
+		if ( n_pending == pending_size )
+		{
+			pending_size = ( pending_size ) ? 2 * pending_size : 1024;
+
+			if ( !( pending = (AI_correlation_candidate*) realloc ( pending, pending_size * sizeof ( AI_correlation_candidate ))) ||
+					!( pending_scores = (double*) realloc ( pending_scores, pending_size * sizeof ( double ))) ||
+					!( pending_index = (size_t*) realloc ( pending_index, pending_size * sizeof ( size_t ))))
+				AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+		}
+
+		pending[ n_pending ]       = candidates.couples[i];
+		pending_index[ n_pending ] = i;
+		n_pending++;
+	}
+
+	score_cache_misses += n_pending;
+}		/* -----  end of function __AI_correlation_couples_carry  ----- */
+
+/**
+ * \brief  Put the couples carried over from the previous pass in the list of the couples to be scored
+ */
+
+PRIVATE void
+__AI_correlation_couples_pending_carried ()
+{
+	size_t i;
+
+	n_pending = 0;
+
+	if ( pending_size < candidates.n_couples )
+	{
+		pending_size = candidates.n_couples;
+
+		if ( !( pending = (AI_correlation_candidate*) realloc ( pending, pending_size * sizeof ( AI_correlation_candidate ))) ||
+				!( pending_scores = (double*) realloc ( pending_scores, pending_size * sizeof ( double ))) ||
+				!( pending_index = (size_t*) realloc ( pending_index, pending_size * sizeof ( size_t ))))
+			AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+	}
+
+	for ( i=0; i < candidates.n_couples; i++ )
+	{
+		if ( !candidates.carried[i] )
+			continue;
+
+		pending[ n_pending ]       = candidates.couples[i];
+		pending_index[ n_pending ] = i;
+		n_pending++;
+	}
+}		/* -----  end of function __AI_correlation_couples_pending_carried  ----- */
+
+/**
+ * \brief  Compute again the scores of all the candidate couples from their correlation indexes, with the weights of the current pass
+ */
+
+PRIVATE void
+__AI_correlation_couples_rescore ()
+{
+	size_t i;
+
+	for ( i=0; i < candidates.n_couples; i++ )
+		candidates.scores[i] = __AI_correlation_couple_score ( candidates.values + i * scoring.n_columns );
+}		/* -----  end of function __AI_correlation_couples_rescore  ----- */
+
+/**
+ * \brief  Swap the candidate couples of the current pass with the ones of the previous pass
+ */
+
+PRIVATE void
+__AI_correlation_couples_swap ()
+{
+	AI_correlation_couples tmp = prev_candidates;
+
+	prev_candidates = candidates;
+	candidates      = tmp;
+}		/* -----  end of function __AI_correlation_couples_swap  ----- */
+
+/**
+ * \brief  Remove a score from the statistics of a set of scores (inverse of Welford's update)
+ * \param  stats 	Statistics
+ * \param  score 	Score to be removed
+ */
+
+PRIVATE void
+__AI_correlation_stats_remove ( AI_correlation_stats *stats, double score )
+{
+	double mean;
+
+	if ( stats->n <= 1 )
+	{
+		memset ( stats, 0, sizeof ( AI_correlation_stats ));
+		return;
+	}
+
+	mean = ( stats->mean * (double) stats->n - score ) / (double) ( stats->n - 1 );
+	stats->m2  -= ( score - stats->mean ) * ( score - mean );
+	stats->mean = mean;
+	stats->n--;
+
+	if ( stats->m2 < 0.0 )
+		stats->m2 = 0.0;
+}		/* -----  end of function __AI_correlation_stats_remove  ----- */
+
+/**
+ * \brief  Compute from scratch the statistics of the scores of all the candidate couples
+ * \param  stats 	Statistics
+ */
+
+PRIVATE void
+__AI_correlation_stats_compute ( AI_correlation_stats *stats )
+{
+	size_t i;
+	double delta;
+
+	memset ( stats, 0, sizeof ( AI_correlation_stats ));
+
+	for ( i=0; i < candidates.n_couples; i++ )
+	{
+		stats->n++;
+		delta = candidates.scores[i] - stats->mean;
+		stats->mean += delta / (double) stats->n;
+		stats->m2   += delta * ( candidates.scores[i] - stats->mean );
+	}
+}		/* -----  end of function __AI_correlation_stats_compute  ----- */
+
+/**
+ * \brief  Get a digest of the manual correlations and uncorrelations, for telling whether they changed since the previous pass
+ * \return The digest (the same for the same couples of signatures, in whatever order)
+ */
+
+PRIVATE unsigned long
+__AI_manual_pairs_digest ()
+{
+	AI_alert_type_pair  *pair   = NULL;
+	unsigned long       digest  = 0,
+					h       = 0;
+	int                 i;
+
+	for ( i=0; i < 2; i++ )
+	{
+		for ( pair = ( i == 0 ) ? manual_correlations : manual_uncorrelations; pair; pair = (AI_alert_type_pair*) pair->hh.next )
+		{
+			h = (unsigned long) pair->key.from_gid;
+			h = h * 31 + (unsigned long) pair->key.from_sid;
+			h = h * 31 + (unsigned long) pair->key.from_rev;
+			h = h * 31 + (unsigned long) pair->key.to_gid;
+			h = h * 31 + (unsigned long) pair->key.to_sid;
+			h = h * 31 + (unsigned long) pair->key.to_rev;
+			digest += ( h ^ ( h >> 17 )) * ( i == 0 ? 2654435761UL : 2246822519UL );
+		}
+	}
+
+	return digest;
+}		/* -----  end of function __AI_manual_pairs_digest  ----- */
+
+/**
+ * \brief  Update the versions and the weights of the columns of the correlation indexes for the current pass. The version
+ * of a column only changes when the model of its index changes: a new version of the SOM for the neural index, the expiry
+ * of the bayesian correlation cache (bayesian_correlation_cache_validity) for the bayesian index, or the index being
+ * enabled or disabled. The knowledge base rules are read once per signature, and the extra modules loaded once, so their
+ * models never change. The values of a column computed with another version have to be computed again, while a change of
+ * the weights only takes a new weighted mean of the values already computed
+ * \param  n_stale 	Reference to the number of enabled columns whose values have to be computed again (flagged in stale_columns)
+ * \return true if the scores of the couples carried over from the previous pass changed, false otherwise
+ */
+
+PRIVATE BOOL
+__AI_correlation_columns_update ( size_t *n_stale )
+{
+	size_t  i;
+	BOOL    changed = false;
+
+	column_versions[COLUMN_BAYESIAN] = 0;
+	column_versions[COLUMN_KB]       = ( config->use_knowledge_base_correlation_index ) ? 1 : 0;
+	column_versions[COLUMN_NEURAL]   = ( config->neuralNetworkTrainingInterval != 0 ) ? 1 + AI_neural_som_version() : 0;
+
+	/* With no cache validity the bayesian index is computed again at every pass */
+	if ( config->bayesianCorrelationInterval != 0 )
+	{
+		column_versions[COLUMN_BAYESIAN] = ( config->bayesianCorrelationCacheValidity > 0 ) ?
+			1 + (unsigned long) time ( NULL ) / config->bayesianCorrelationCacheValidity : 1 + correlation_pass;
+	}
+
+	scoring.column_weights[COLUMN_BAYESIAN] = scoring.bayesian_weight;
+	scoring.column_weights[COLUMN_KB]       = 1.0;
+	scoring.column_weights[COLUMN_NEURAL]   = scoring.neural_weight;
+
+	for ( i=0; scoring.corr_modules && i < scoring.n_corr_modules; i++ )
+	{
+		column_versions[ BUILTIN_COLUMNS + i ]        = ( scoring.module_weights[i] != 0.0 ) ? 1 : 0;
+		scoring.column_weights[ BUILTIN_COLUMNS + i ] = scoring.module_weights[i];
+	}
+
+	#ifdef HAVE_LIBPYTHON2_6
+	for ( i=0; scoring.py_corr_functions && i < scoring.n_py_corr_functions; i++ )
+	{
+		column_versions[ BUILTIN_COLUMNS + scoring.n_corr_modules + i ]        = ( scoring.py_weights[i] != 0.0 ) ? 1 : 0;
+		scoring.column_weights[ BUILTIN_COLUMNS + scoring.n_corr_modules + i ] = scoring.py_weights[i];
+	}
+	#endif
+
+	*n_stale = 0;
+
+	for ( i=0; i < scoring.n_columns; i++ )
+	{
+		stale_columns[i] = ( column_versions[i] != 0 && column_versions[i] != cached_column_versions[i] );
+
+		if ( stale_columns[i] )
+			( *n_stale )++;
+
+		if ( column_versions[i] != cached_column_versions[i] ||
+				( column_versions[i] != 0 && scoring.column_weights[i] != prev_column_weights[i] ))
+			changed = true;
+
+		cached_column_versions[i] = column_versions[i];
+		prev_column_weights[i]    = scoring.column_weights[i];
+	}
+
+	return changed;
+}		/* -----  end of function __AI_correlation_columns_update  ----- */
+
+/**
+ * \brief  Tell whether a candidate couple is an edge of the correlation graph
+ * \param  table 	Table of the alerts
+ * \param  i 	Index of the couple in the candidate couples
+ * \param  corr_threshold 	Correlation threshold
+ * \return true if the couple is correlated, false otherwise
+ */
+
+PRIVATE BOOL
+__AI_correlation_couple_accepted ( const AI_alert_table *table, size_t i, double corr_threshold )
+{
+	AI_alert_correlation_key  corr_key;
+	AI_alert_type_pair        *pair   = NULL,
+						 *unpair = NULL;
+	double                    score  = candidates.scores[i];
+
+	corr_key.a = table->alerts[ candidates.couples[i].a ];
+	corr_key.b = table->alerts[ candidates.couples[i].b ];
+	pair   = __AI_manual_pair_find ( manual_correlations, corr_key.a, corr_key.b );
+	unpair = __AI_manual_pair_find ( manual_uncorrelations, corr_key.a, corr_key.b );
+
+	/* Yes, BlackLight wrote this line of code in a pair of minutes and immediately
+	 * compiled it without a single error */
+	return ( !unpair && ( pair || (
+			score >= corr_threshold &&
+			corr_threshold != 0.0 &&
+			corr_key.a->timestamp <= corr_key.b->timestamp && (
+				corr_key.a->ip_src_addr == corr_key.b->ip_src_addr || (
+					(corr_key.a->h_node[src_addr] && corr_key.b->h_node[src_addr]) ?
+						( corr_key.a->h_node[src_addr]->max_val == corr_key.b->h_node[src_addr]->max_val &&
+						corr_key.a->h_node[src_addr]->min_val == corr_key.b->h_node[src_addr]->min_val ) : 0
+				)) && (
+				corr_key.a->ip_dst_addr == corr_key.b->ip_dst_addr || (
+					(corr_key.a->h_node[dst_addr] && corr_key.b->h_node[dst_addr]) ?
+						( corr_key.a->h_node[dst_addr]->max_val == corr_key.b->h_node[dst_addr]->max_val &&
+						corr_key.a->h_node[dst_addr]->min_val == corr_key.b->h_node[dst_addr]->min_val ) : 0
+				))
+			)
+		)
+	);
+}		/* -----  end of function __AI_correlation_couple_accepted  ----- */
+
+/**
+ * \brief  Add an edge to the correlation graph, or remove it
+ * \param  a 	Alert A
+ * \param  b 	Alert B
+ * \param  score 	Correlation score of the couple
+ * \param  accepted 	true if the edge has to be added, false if it has to be removed
+ */
+
+PRIVATE void
+__AI_correlation_edge_set ( AI_snort_alert *a, AI_snort_alert *b, double score, BOOL accepted )
+{
+	AI_alert_correlation_key  corr_key;
+	AI_alert_correlation      *corr = NULL;
+
+	memset ( &corr_key, 0, sizeof ( corr_key ));
+	corr_key.a = a;
+	corr_key.b = b;
+	HASH_FIND ( hh, correlation_table, &corr_key, sizeof ( AI_alert_correlation_key ), corr );
+
+	if ( accepted )
+	{
+		if ( !corr )
+		{
+			if ( !( corr = ( AI_alert_correlation* ) malloc ( sizeof ( AI_alert_correlation ))))
+				AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+			corr->key = corr_key;
+			HASH_ADD ( hh, correlation_table, key, sizeof ( AI_alert_correlation_key ), corr );
+		}
+
+		corr->correlation = score;
+	} else if ( corr ) {
+		HASH_DEL ( correlation_table, corr );
+		free ( corr );
+	}
+}		/* -----  end of function __AI_correlation_edge_set  ----- */
+
+/**
+ * \brief  Rebuild the lists of the parent and derived alerts of each alert from the edges of the correlation graph
+ */
+
+PRIVATE void
+__AI_correlation_graph_links ()
+{
+	AI_snort_alert        *alert = NULL;
+	AI_alert_correlation  *corr  = NULL;
+
+	for ( alert = alerts; alert; alert = alert->next )
+	{
+		free ( alert->derived_alerts );
+		free ( alert->parent_alerts );
+		alert->derived_alerts   = NULL;
+		alert->parent_alerts    = NULL;
+		alert->n_derived_alerts = 0;
+		alert->n_parent_alerts  = 0;
+	}
+
+	for ( corr = correlation_table; corr; corr = (AI_alert_correlation*) corr->hh.next )
+	{
+		if ( !( corr->key.a->derived_alerts = ( AI_snort_alert** ) realloc ( corr->key.a->derived_alerts,
+						(++corr->key.a->n_derived_alerts) * sizeof ( AI_snort_alert* ))))
+			AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+		if ( !( corr->key.b->parent_alerts = ( AI_snort_alert** ) realloc ( corr->key.b->parent_alerts,
+						(++corr->key.b->n_parent_alerts) * sizeof ( AI_snort_alert* ))))
+			AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+		corr->key.a->derived_alerts[ corr->key.a->n_derived_alerts - 1 ] = corr->key.b;
+		corr->key.b->parent_alerts [ corr->key.b->n_parent_alerts  - 1 ] = corr->key.a;
+	}
+}		/* -----  end of function __AI_correlation_graph_links  ----- */
+
+/**
+ * \brief  Recursively write a flow of correlated alerts to a .dot file, ready for being rendered as graph
+ * \param  corr 	Correlated alerts
+ * \param  fp       File pointer
+ */
+
+PRIVATE void
+__AI_correlated_alerts_to_dot ( AI_alert_correlation *corr, FILE *fp )
+{
+	int   i;
+
+	char  src_addr1[INET_ADDRSTRLEN],
+		 dst_addr1[INET_ADDRSTRLEN],
+		 src_addr2[INET_ADDRSTRLEN],
+		 dst_addr2[INET_ADDRSTRLEN],
+		 src_port1[10],
+		 dst_port1[10],
+		 src_port2[10],
+		 dst_port2[10];
+
+	char *time1 = NULL,
+		*time2 = NULL;
+
+	if ( !corr )
+		return;
+
+	inet_ntop ( AF_INET, &(corr->key.a->ip_src_addr), src_addr1, INET_ADDRSTRLEN );
+	inet_ntop ( AF_INET, &(corr->key.a->ip_dst_addr), dst_addr1, INET_ADDRSTRLEN );
+
+	snprintf ( src_port1, sizeof ( src_port1 ), "%d", ntohs ( corr->key.a->tcp_src_port ));
+	snprintf ( dst_port1, sizeof ( dst_port1 ), "%d", ntohs ( corr->key.a->tcp_dst_port ));
+
+	inet_ntop ( AF_INET, &(corr->key.b->ip_src_addr), src_addr2, INET_ADDRSTRLEN );
+	inet_ntop ( AF_INET, &(corr->key.b->ip_dst_addr), dst_addr2, INET_ADDRSTRLEN );
+
+	snprintf ( src_port2, sizeof ( src_port2 ), "%d", ntohs ( corr->key.b->tcp_src_port ));
+	snprintf ( dst_port2, sizeof ( dst_port2 ), "%d", ntohs ( corr->key.b->tcp_dst_port ));
+
+	time1 = strdup ( ctime ( &(corr->key.a->timestamp )) );
+
+	for ( i = strlen ( time1 ) - 1; i >= 0; i-- )
+	{
+		if ( time1[i] == '\n' || time1[i] == '\r' || time1[i] == ' ' )
+		{
+			time1[i] = 0;
+		} else {
+			break;
+		}
+	}
+
+	time2 = strdup ( ctime ( &(corr->key.b->timestamp )) );
+
+	for ( i = strlen ( time2 ) - 1; i >= 0; i-- )
+	{
+		if ( time2[i] == '\n' || time2[i] == '\r' || time2[i] == ' ' )
+		{
+			time2[i] = 0;
+		} else {
+			break;
+		}
+	}
+
+	fprintf ( fp,
+		"\t\"[%d.%d.%d] %s\\n"
+		"%s:%s -> %s:%s\\n"
+		"starting from %s\\n"
+		"(%d alerts grouped)\" -> "
+
+		"\"[%d.%d.%d] %s\\n"
+		"%s:%s -> %s:%s\\n"
+		"starting from %s\\n"
+		"(%d alerts grouped)\";\n",
+
+		corr->key.a->gid, corr->key.a->sid, corr->key.a->rev, corr->key.a->desc,
+		src_addr1, src_port1, dst_addr1, dst_port1,
+		time1,
+		corr->key.a->grouped_alerts_count,
+
+		corr->key.b->gid, corr->key.b->sid, corr->key.b->rev, corr->key.b->desc,
+		src_addr2, src_port2, dst_addr2, dst_port2,
+		time2,
+		corr->key.b->grouped_alerts_count
+	);
+
+	free ( time1 );
+	free ( time2 );
+}		/* -----  end of function __AI_correlated_alerts_to_dot  ----- */
+
+/**
+ * \brief  Find the representative of the set of an element in a union-find forest, halving the path on the way
+ * \param  parent 	Parent of each element in the forest
+ * \param  i 	Element
+ * \return The representative of the set of the element
+ */
+
+PRIVATE unsigned int
+__AI_union_find_root ( unsigned int *parent, unsigned int i )
+{
+	while ( parent[i] != i )
+	{
+		parent[i] = parent[ parent[i] ];
+		i = parent[i];
+	}
+
+	return i;
+}		/* -----  end of function __AI_union_find_root  ----- */
+
+/**
+ * \brief  Merge the sets of two elements in a union-find forest, attaching the smaller set to the larger one
+ * \param  parent 	Parent of each element in the forest
+ * \param  size 	Size of the set of each representative
+ * \param  a 	First element
+ * \param  b 	Second element
+ */
+
+PRIVATE void
+__AI_union_find_merge ( unsigned int *parent, unsigned int *size, unsigned int a, unsigned int b )
+{
+	unsigned int tmp;
+
+	a = __AI_union_find_root ( parent, a );
+	b = __AI_union_find_root ( parent, b );
+
+	if ( a == b )
+		return;
+
+	if ( size[a] < size[b] )
+	{
+		tmp = a;
+		a   = b;
+		b   = tmp;
+	}
+
+	parent[b] = a;
+	size[a]  += size[b];
+}		/* -----  end of function __AI_union_find_merge  ----- */
+
+/**
+ * \brief  Compare two scenarios by number of alerts (largest first) and by their first row
+ */
+
+PRIVATE int
+__AI_scenario_key_compare ( const void *a, const void *b )
+{
+	const AI_scenario_key *x = (const AI_scenario_key*) a,
+					  *y = (const AI_scenario_key*) b;
+
+	if ( x->size != y->size )
+		return ( x->size > y->size ) ? -1 : 1;
+
+	return ( x->root < y->root ) ? -1 : ( x->root > y->root );
+}		/* -----  end of function __AI_scenario_key_compare  ----- */
+
+/**
+ * \brief  Split the correlation graph in its connected components (attack scenarios), using a union-find pass
+ * over the accepted couples of the current pass
+ * \param  table 	Table of the alerts of the current pass
+ */
+
+PRIVATE void
+__AI_correlation_scenarios_build ( const AI_alert_table *table )
+{
+	unsigned int              *parent = NULL,
+						 *size   = NULL,
+						 row, root, s;
+	AI_scenario_key           *keys   = NULL;
+	AI_alert_correlation_key  corr_key;
+	AI_alert_correlation      *corr   = NULL;
+	size_t                    i;
+
+	if ( !( scenarios.rows = (unsigned int*) realloc ( scenarios.rows, ( table->n_alerts + 1 ) * sizeof ( unsigned int ))) ||
+			!( scenarios.offsets = (unsigned int*) realloc ( scenarios.offsets, ( table->n_alerts + 1 ) * sizeof ( unsigned int ))) ||
+			!( scenarios.edge_offsets = (unsigned int*) realloc ( scenarios.edge_offsets, ( table->n_alerts + 1 ) * sizeof ( unsigned int ))) ||
+			!( scenarios.scenario = (unsigned int*) realloc ( scenarios.scenario, ( table->n_alerts + 1 ) * sizeof ( unsigned int ))) ||
+			!( parent = (unsigned int*) malloc (( table->n_alerts + 1 ) * sizeof ( unsigned int ))) ||
+			!( size   = (unsigned int*) malloc (( table->n_alerts + 1 ) * sizeof ( unsigned int ))) ||
+			!( keys   = (AI_scenario_key*) malloc (( table->n_alerts + 1 ) * sizeof ( AI_scenario_key ))))
+		AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+	scenarios.n_scenarios  = 0;
+	scenarios.n_correlated = 0;
+
+	for ( row=0; row < table->n_alerts; row++ )
+	{
+		parent[row] = row;
+		size[row]   = 1;
+	}
+
+	for ( i=0; i < candidates.n_couples; i++ )
+	{
+		if ( candidates.accepted[i] )
+			__AI_union_find_merge ( parent, size, candidates.couples[i].a, candidates.couples[i].b );
+	}
+
+	for ( row=0; row < table->n_alerts; row++ )
+	{
+		if ( __AI_union_find_root ( parent, row ) == row )
+		{
+			keys[ scenarios.n_scenarios ].size = size[row];
+			keys[ scenarios.n_scenarios ].root = row;
+			scenarios.n_scenarios++;
+
+			if ( size[row] > 1 )
+				scenarios.n_correlated++;
+		}
+	}
+
+	qsort ( keys, scenarios.n_scenarios, sizeof ( AI_scenario_key ), __AI_scenario_key_compare );
+
+	/* Group the rows and the edges by scenario */
+	memset ( scenarios.offsets, 0, ( scenarios.n_scenarios + 1 ) * sizeof ( unsigned int ));
+	memset ( scenarios.edge_offsets, 0, ( scenarios.n_scenarios + 1 ) * sizeof ( unsigned int ));
+
+	for ( s=0; s < scenarios.n_scenarios; s++ )
+	{
+		scenarios.scenario[ keys[s].root ] = s;
+		scenarios.offsets[s+1] = scenarios.offsets[s] + keys[s].size;
+	}
+
+	for ( row=0; row < table->n_alerts; row++ )
+	{
+		root = __AI_union_find_root ( parent, row );
+		scenarios.scenario[row] = scenarios.scenario[root];
+	}
+
+	for ( i=0; i < candidates.n_couples; i++ )
+	{
+		if ( candidates.accepted[i] )
+			scenarios.edge_offsets[ scenarios.scenario[ candidates.couples[i].a ] + 1 ]++;
+	}
+
+	for ( s=0; s < scenarios.n_scenarios; s++ )
+		scenarios.edge_offsets[s+1] += scenarios.edge_offsets[s];
+
+	if ( !( scenarios.edges = (AI_alert_correlation**) realloc ( scenarios.edges,
+					( scenarios.edge_offsets[ scenarios.n_scenarios ] + 1 ) * sizeof ( AI_alert_correlation* ))))
+		AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+	/* The offsets are used as insertion points (size is not needed anymore), in the order of the rows */
+	memcpy ( parent, scenarios.offsets, ( scenarios.n_scenarios + 1 ) * sizeof ( unsigned int ));
+	memcpy ( size, scenarios.edge_offsets, ( scenarios.n_scenarios + 1 ) * sizeof ( unsigned int ));
+
+	for ( row=0; row < table->n_alerts; row++ )
+		scenarios.rows[ parent[ scenarios.scenario[row] ]++ ] = row;
+
+	for ( i=0; i < candidates.n_couples; i++ )
+	{
+		if ( !candidates.accepted[i] )
+			continue;
+
+		memset ( &corr_key, 0, sizeof ( corr_key ));
+		corr_key.a = table->alerts[ candidates.couples[i].a ];
+		corr_key.b = table->alerts[ candidates.couples[i].b ];
+		HASH_FIND ( hh, correlation_table, &corr_key, sizeof ( AI_alert_correlation_key ), corr );
+		scenarios.edges[ size[ scenarios.scenario[ candidates.couples[i].a ]]++ ] = corr;
+	}
+
+	free ( parent );
+	free ( size );
+	free ( keys );
+}		/* -----  end of function __AI_correlation_scenarios_build  ----- */
+
+/**
+ * \brief  Write the edges of a scenario as a dot graph
+ * \param  s 	Index of the scenario
+ * \param  fp 	File pointer
+ */
+
+PRIVATE void
+__AI_correlation_scenario_dot_write ( unsigned int s, FILE *fp )
+{
+	unsigned int  i;
+
+	fprintf ( fp, "digraph G  {\n" );
+
+	for ( i = scenarios.edge_offsets[s]; i < scenarios.edge_offsets[s+1]; i++ )
+		__AI_correlated_alerts_to_dot ( scenarios.edges[i], fp );
+
+	fprintf ( fp, "}\n" );
+}		/* -----  end of function __AI_correlation_scenario_dot_write  ----- */
+
+/**
+ * \brief  Write the edges of a scenario to a .dot file
+ * \param  s 	Index of the scenario
+ * \param  dot_file 	Path of the .dot file
+ */
+
+PRIVATE void
+__AI_correlation_scenario_to_dot ( unsigned int s, const char *dot_file )
+{
+	FILE          *fp = NULL;
+
+	if ( !( fp = fopen ( dot_file, "w" )))
+		AI_fatal_err ( "Could not write on a correlated alerts .dot file", __FILE__, __LINE__ );
+
+	__AI_correlation_scenario_dot_write ( s, fp );
+	fclose ( fp );
+}		/* -----  end of function __AI_correlation_scenario_to_dot  ----- */
+
+/**
+ * \brief  Archive the scenarios of the correlation graph whose alerts are all out of the correlation horizon: no
+ * new alert can be correlated to them anymore, so each of them is written to its own .dot file in the archive
+ * directory and to the output database, and its alerts are released from the graph in the next pass
+ * \param  table 	Table of the alerts of the current pass
+ */
+
+PRIVATE void
+__AI_correlation_subgraphs_archive ( const AI_alert_table *table )
+{
+	unsigned int          s, i, row, oldest, n_edges = 0;
+	time_t                newest;
+	AI_alert_correlation  **edges  = NULL;
+	AI_correlation_node   *node    = NULL;
+	char                  archive_dir[ sizeof ( config->corr_alerts_dir ) + sizeof ( "/archive" ) ] = { 0 },
+					  archive_file[4096] = { 0 };
+	struct stat           st;
+
+	if ( snprintf ( archive_dir, sizeof ( archive_dir ), "%s/archive", config->corr_alerts_dir ) >= (int) sizeof ( archive_dir ))
+	{
+		_dpd.logMsg ( "AIPreproc: The path of the archive of the correlated alerts is too long, the subgraphs won't be archived\n" );
+		return;
+	}
+
+	for ( s=0; s < scenarios.n_scenarios; s++ )
+	{
+		oldest = scenarios.rows[ scenarios.offsets[s] ];
+		newest = table->timestamp[oldest];
+
+		for ( i = scenarios.offsets[s]; i < scenarios.offsets[s+1]; i++ )
+		{
+			row = scenarios.rows[i];
+
+			if ( table->timestamp[row] > newest )
+				newest = table->timestamp[row];
+
+			if ( table->timestamp[row] < table->timestamp[oldest] )
+				oldest = row;
+		}
+
+		if ( newest >= graph_cutoff )
+			continue;
+
+		for ( i = scenarios.offsets[s]; i < scenarios.offsets[s+1]; i++ )
+		{
+			HASH_FIND ( hh, correlation_nodes, &( table->alerts[ scenarios.rows[i] ]->cluster_id ), sizeof ( unsigned long ), node );
+
+			if ( node )
+				node->archived = true;
+		}
+
+		if ( scenarios.edge_offsets[s] == scenarios.edge_offsets[s+1] )
+			continue;
+
+		if ( stat ( archive_dir, &st ) < 0 )
+		{
+			if ( stat ( config->corr_alerts_dir, &st ) < 0 )
+				mkdir ( config->corr_alerts_dir, 0755 );
+
+			if ( mkdir ( archive_dir, 0755 ) < 0 )
+				AI_fatal_err ( "Unable to create the directory of the archived correlated alerts", __FILE__, __LINE__ );
+		}
+
+		if ( snprintf ( archive_file, sizeof ( archive_file ), "%s/%lu_%lu.dot", archive_dir,
+				(unsigned long) table->timestamp[oldest], table->alerts[oldest]->cluster_id ) < (int) sizeof ( archive_file ))
+			__AI_correlation_scenario_to_dot ( s, archive_file );
+
+		if ( config->outdbtype != outdb_none )
+		{
+			if ( !( edges = (AI_alert_correlation**) realloc ( edges,
+							( n_edges + scenarios.edge_offsets[s+1] - scenarios.edge_offsets[s] ) * sizeof ( AI_alert_correlation* ))))
+				AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+			for ( i = scenarios.edge_offsets[s]; i < scenarios.edge_offsets[s+1]; i++ )
+				edges[ n_edges++ ] = scenarios.edges[i];
+		}
+	}
+
+	if ( n_edges > 0 )
+		AI_archive_correlations_to_db ( edges, n_edges );
+
+	free ( edges );
+}		/* -----  end of function __AI_correlation_subgraphs_archive  ----- */
+
+/**
+ * \brief  Write the endpoints, the position and the stream of packets of an alert as members of a JSON object
+ * \param  writer 	JSON writer
+ * \param  alert 	Alert
+ * \param  grouped 	true for an alert grouped in a cluster, whose packets are sized on their IP header
+ */
+
+PRIVATE void
+__AI_alert_details_to_json ( AI_json_writer *writer, const AI_snort_alert *alert, BOOL grouped )
+{
+	struct pkt_info *pkt_iterator = NULL;
+	unsigned int    pkt_len       = 0;
+
+	char srcip[INET_ADDRSTRLEN] = { 0 },
+		dstip[INET_ADDRSTRLEN] = { 0 },
+		buf[64]                = { 0 };
+
+	AI_json_key ( writer, "date" );
+	AI_json_time ( writer, alert->timestamp );
+
+	inet_ntop ( AF_INET, &( alert->ip_src_addr ), srcip, INET_ADDRSTRLEN );
+	inet_ntop ( AF_INET, &( alert->ip_dst_addr ), dstip, INET_ADDRSTRLEN );
+
+	snprintf ( buf, sizeof ( buf ), "%s:%d", srcip, htons ( alert->tcp_src_port ));
+	AI_json_key ( writer, "from" );
+	AI_json_string ( writer, buf );
+
+	snprintf ( buf, sizeof ( buf ), "%s:%d", dstip, htons ( alert->tcp_dst_port ));
+	AI_json_key ( writer, "to" );
+	AI_json_string ( writer, buf );
+
+	snprintf ( buf, sizeof ( buf ), "%f", alert->geocoord[0] );
+	AI_json_key ( writer, "latitude" );
+	AI_json_string ( writer, buf );
+
+	snprintf ( buf, sizeof ( buf ), "%f", alert->geocoord[1] );
+	AI_json_key ( writer, "longitude" );
+	AI_json_string ( writer, buf );
+
+	if ( !alert->stream )
+		return;
+
+	AI_json_key ( writer, "packets" );
+	AI_json_begin_array ( writer );
+
+	for ( pkt_iterator = alert->stream; pkt_iterator; pkt_iterator = pkt_iterator->next )
+	{
+		if ( !grouped )
+		{
+			pkt_len = pkt_iterator->pkt->pcap_header->len + pkt_iterator->pkt->payload_size;
+		} else if ( !pkt_iterator->pkt->ip4_header ) {
+			pkt_len = pkt_iterator->pkt->pcap_header->len +
+				pkt_iterator->pkt->tcp_options_length +
+				pkt_iterator->pkt->payload_size;
+		} else {
+			pkt_len = pkt_iterator->pkt->ip4_header->data_length;
+		}
+
+		AI_json_base64 ( writer, (const char*) pkt_iterator->pkt->pkt_data, pkt_len );
+	}
+
+	AI_json_end_array ( writer );
+}		/* -----  end of function __AI_alert_details_to_json  ----- */
+
+/**
+ * \brief  Write a clustered alert, with its grouped alerts, packets and derived alerts, as a JSON object
+ * \param  writer 	JSON writer
+ * \param  alert 	Alert to be written
+ */
+
+PRIVATE void
+__AI_alert_to_json ( AI_json_writer *writer, const AI_snort_alert *alert )
+{
+	unsigned int i = 0;
+	char buf[16] = { 0 };
+
+	AI_json_begin_object ( writer );
+
+	AI_json_key ( writer, "id" );
+	AI_json_uint ( writer, alert->alert_id );
+
+	snprintf ( buf, sizeof ( buf ), "%u", alert->sid );
+	AI_json_key ( writer, "snortSID" );
+	AI_json_string ( writer, buf );
+
+	snprintf ( buf, sizeof ( buf ), "%u", alert->gid );
+	AI_json_key ( writer, "snortGID" );
+	AI_json_string ( writer, buf );
+
+	snprintf ( buf, sizeof ( buf ), "%u", alert->rev );
+	AI_json_key ( writer, "snortREV" );
+	AI_json_string ( writer, buf );
+
+	AI_json_key ( writer, "label" );
+	AI_json_string ( writer, alert->desc );
+
+	AI_json_key ( writer, "clusteredAlertsCount" );
+	AI_json_uint ( writer, alert->grouped_alerts_count );
+
+	__AI_alert_details_to_json ( writer, alert, false );
+
+	if ( alert->grouped_alerts && alert->grouped_alerts_count > 1 )
+	{
+		AI_json_key ( writer, "clusteredAlerts" );
+		AI_json_begin_array ( writer );
+
+		for ( i=1; i < alert->grouped_alerts_count; i++ )
+		{
+			if ( !alert->grouped_alerts[i] )
+				continue;
+
+			AI_json_begin_object ( writer );
+			AI_json_key ( writer, "id" );
+			AI_json_uint ( writer, alert->grouped_alerts[i]->alert_id );
+			AI_json_key ( writer, "label" );
+			AI_json_string ( writer, alert->grouped_alerts[i]->desc );
+			__AI_alert_details_to_json ( writer, alert->grouped_alerts[i], true );
+			AI_json_end_object ( writer );
+		}
+
+		AI_json_end_array ( writer );
+	}
+
+	if ( alert->n_derived_alerts > 0 )
+	{
+		AI_json_key ( writer, "connectedTo" );
+		AI_json_begin_array ( writer );
+
+		for ( i=0; i < alert->n_derived_alerts; i++ )
+		{
+			AI_json_begin_object ( writer );
+			AI_json_key ( writer, "id" );
+			AI_json_uint ( writer, alert->derived_alerts[i]->alert_id );
+			AI_json_end_object ( writer );
+		}
+
+		AI_json_end_array ( writer );
+	}
+
+	AI_json_end_object ( writer );
+}		/* -----  end of function __AI_alert_to_json  ----- */
+
 /**
- * \brief  Clean up the correlation hash table
+ * \brief  Write the alerts of a range of scenarios to a .json file, ready for being rendered in the web interface
+ * \param  table 	Table of the alerts of the current pass
+ * \param  first 	First scenario to be written
+ * \param  last 	Last scenario to be written (excluded)
+ * \param  json_file 	Path of the .json file
  */
 
 PRIVATE void
-__AI_correlation_table_cleanup ()
+__AI_correlation_scenarios_to_json ( const AI_alert_table *table, unsigned int first, unsigned int last, const char *json_file )
 {
-	AI_alert_correlation *current;
+	unsigned int    i;
+	AI_json_writer  *writer = NULL;
 
-	while ( correlation_table )
+	if ( !( writer = AI_json_open ( json_file )))
 	{
-		current = correlation_table;
-		HASH_DEL ( correlation_table, current );
-		free ( current );
+		AI_fatal_err ( "Unable to write on a correlation graph .json file in htdocs directory", __FILE__, __LINE__ );
 	}
-}		/* -----  end of function __AI_correlation_table_cleanup  ----- */
+
+	AI_json_begin_array ( writer );
+
+	for ( i = scenarios.offsets[first]; i < scenarios.offsets[last]; i++ )
+		__AI_alert_to_json ( writer, table->alerts[ scenarios.rows[i] ] );
+
+	AI_json_end_array ( writer );
+	AI_json_close ( writer );
+}		/* -----  end of function __AI_correlation_scenarios_to_json  ----- */
 
 /**
- * \brief  Recursively write a flow of correlated alerts to a .dot file, ready for being rendered as graph
- * \param  corr 	Correlated alerts
- * \param  fp       File pointer
+ * \brief  Write the correlation graph for the web interface: one .json file per scenario, one for all the isolated
+ * alerts, and the index of the scenarios in correlation_graph.json, so that the browser only loads the scenarios
+ * the user looks at
+ * \param  table 	Table of the alerts of the current pass
  */
 
 PRIVATE void
-__AI_correlated_alerts_to_dot ( AI_alert_correlation *corr, FILE *fp )
+__AI_correlated_alerts_to_json ( const AI_alert_table *table )
 {
-	int   i;
+	AI_json_writer *writer = NULL;
 
-	char  src_addr1[INET_ADDRSTRLEN],
-		 dst_addr1[INET_ADDRSTRLEN],
-		 src_addr2[INET_ADDRSTRLEN],
-		 dst_addr2[INET_ADDRSTRLEN],
-		 src_port1[10],
-		 dst_port1[10],
-		 src_port2[10],
-		 dst_port2[10];
+	unsigned int s = 0,
+			   i = 0,
+			   oldest = 0,
+			   newest = 0;
 
-	char *time1 = NULL,
-		*time2 = NULL;
+	/* Room for the web interface directory followed by the longest of the file names */
+	char json_file[ sizeof ( config->webserv_dir ) + sizeof ( "/correlation_graph_4294967295.json" ) ] = { 0 };
 
-	if ( !corr )
+	/* If there is no directory configured for the web interface, just exit */
+	if ( strlen ( config->webserv_dir ) == 0 )
 		return;
 
-	inet_ntop ( AF_INET, &(corr->key.a->ip_src_addr), src_addr1, INET_ADDRSTRLEN );
-	inet_ntop ( AF_INET, &(corr->key.a->ip_dst_addr), dst_addr1, INET_ADDRSTRLEN );
+	/* The scenarios are written before the index, so that the index never refers to a missing file */
+	for ( s=0; s < scenarios.n_correlated; s++ )
+	{
+		if ( snprintf ( json_file, sizeof ( json_file ), "%s/correlation_graph_%u.json", config->webserv_dir, s ) >= (int) sizeof ( json_file ))
+		{
+			_dpd.logMsg ( "AIPreproc: The path of the web interface directory is too long, the correlation graph won't be written\n" );
+			return;
+		}
 
-	snprintf ( src_port1, sizeof ( src_port1 ), "%d", ntohs ( corr->key.a->tcp_src_port ));
-	snprintf ( dst_port1, sizeof ( dst_port1 ), "%d", ntohs ( corr->key.a->tcp_dst_port ));
+		__AI_correlation_scenarios_to_json ( table, s, s+1, json_file );
+	}
 
-	inet_ntop ( AF_INET, &(corr->key.b->ip_src_addr), src_addr2, INET_ADDRSTRLEN );
-	inet_ntop ( AF_INET, &(corr->key.b->ip_dst_addr), dst_addr2, INET_ADDRSTRLEN );
+	if ( snprintf ( json_file, sizeof ( json_file ), "%s/correlation_graph_isolated.json", config->webserv_dir ) >= (int) sizeof ( json_file ))
+	{
+		_dpd.logMsg ( "AIPreproc: The path of the web interface directory is too long, the correlation graph won't be written\n" );
+		return;
+	}
 
-	snprintf ( src_port2, sizeof ( src_port2 ), "%d", ntohs ( corr->key.b->tcp_src_port ));
-	snprintf ( dst_port2, sizeof ( dst_port2 ), "%d", ntohs ( corr->key.b->tcp_dst_port ));
+	__AI_correlation_scenarios_to_json ( table, scenarios.n_correlated, scenarios.n_scenarios, json_file );
 
-	time1 = strdup ( ctime ( &(corr->key.a->timestamp )) );
+	if ( snprintf ( json_file, sizeof ( json_file ), "%s/correlation_graph.json", config->webserv_dir ) >= (int) sizeof ( json_file ))
+	{
+		_dpd.logMsg ( "AIPreproc: The path of the web interface directory is too long, the correlation graph won't be written\n" );
+		return;
+	}
 
-	for ( i = strlen ( time1 ) - 1; i >= 0; i-- )
+	if ( !( writer = AI_json_open ( json_file )))
 	{
-		if ( time1[i] == '\n' || time1[i] == '\r' || time1[i] == ' ' )
-		{
-			time1[i] = 0;
-		} else {
-			break;
-		}
+		AI_fatal_err ( "Unable to write on correlated_graph.json in htdocs directory", __FILE__, __LINE__ );
 	}
 
-	time2 = strdup ( ctime ( &(corr->key.b->timestamp )) );
+	AI_json_begin_object ( writer );
+	AI_json_key ( writer, "scenarios" );
+	AI_json_begin_array ( writer );
 
-	for ( i = strlen ( time2 ) - 1; i >= 0; i-- )
+	for ( s=0; s < scenarios.n_correlated; s++ )
 	{
-		if ( time2[i] == '\n' || time2[i] == '\r' || time2[i] == ' ' )
+		oldest = newest = scenarios.rows[ scenarios.offsets[s] ];
+
+		for ( i = scenarios.offsets[s]; i < scenarios.offsets[s+1]; i++ )
 		{
-			time2[i] = 0;
-		} else {
-			break;
+			if ( table->timestamp[ scenarios.rows[i] ] < table->timestamp[oldest] )
+				oldest = scenarios.rows[i];
+
+			if ( table->timestamp[ scenarios.rows[i] ] > table->timestamp[newest] )
+				newest = scenarios.rows[i];
 		}
+
+		snprintf ( json_file, sizeof ( json_file ), "correlation_graph_%u.json", s );
+
+		AI_json_begin_object ( writer );
+		AI_json_key ( writer, "id" );
+		AI_json_uint ( writer, s );
+		AI_json_key ( writer, "file" );
+		AI_json_string ( writer, json_file );
+		AI_json_key ( writer, "label" );
+		AI_json_string ( writer, table->alerts[oldest]->desc );
+		AI_json_key ( writer, "alerts" );
+		AI_json_uint ( writer, scenarios.offsets[s+1] - scenarios.offsets[s] );
+		AI_json_key ( writer, "correlations" );
+		AI_json_uint ( writer, scenarios.edge_offsets[s+1] - scenarios.edge_offsets[s] );
+		AI_json_key ( writer, "from" );
+		AI_json_time ( writer, table->timestamp[oldest] );
+		AI_json_key ( writer, "to" );
+		AI_json_time ( writer, table->timestamp[newest] );
+		AI_json_end_object ( writer );
 	}
 
-	fprintf ( fp,
-		"\t\"[%d.%d.%d] %s\\n"
-		"%s:%s -> %s:%s\\n"
-		"starting from %s\\n"
-		"(%d alerts grouped)\" -> "
+	AI_json_end_array ( writer );
+
+	AI_json_key ( writer, "isolated" );
+	AI_json_begin_object ( writer );
+	AI_json_key ( writer, "file" );
+	AI_json_string ( writer, "correlation_graph_isolated.json" );
+	AI_json_key ( writer, "alerts" );
+	AI_json_uint ( writer, scenarios.offsets[ scenarios.n_scenarios ] - scenarios.offsets[ scenarios.n_correlated ] );
+	AI_json_end_object ( writer );
+
+	/* Scores carried over across the passes and scores computed since the start */
+	AI_json_key ( writer, "scoreCache" );
+	AI_json_begin_object ( writer );
+	AI_json_key ( writer, "hits" );
+	AI_json_uint ( writer, score_cache_hits );
+	AI_json_key ( writer, "misses" );
+	AI_json_uint ( writer, score_cache_misses );
+	AI_json_key ( writer, "invalidations" );
+	AI_json_uint ( writer, score_cache_invalidations );
+	AI_json_end_object ( writer );
+
+	AI_json_end_object ( writer );
+	AI_json_close ( writer );
+}		/* -----  end of function __AI_correlated_alerts_to_json  ----- */
 
-		"\"[%d.%d.%d] %s\\n"
-		"%s:%s -> %s:%s\\n"
-		"starting from %s\\n"
-		"(%d alerts grouped)\";\n",
+#ifdef HAVE_LIBGVC
+/** Snapshot of the correlation graph to be rendered: the dot source of each scenario */
+typedef struct  {
+	char          **dot;
+	unsigned int  *n_edges;
+	unsigned int  n_scenarios;
+} AI_render_snapshot;
+
+/** Latest snapshot not rendered yet: a newer snapshot replaces it */
+PRIVATE AI_render_snapshot       *render_pending       = NULL;
+PRIVATE pthread_mutex_t          render_mutex          = PTHREAD_MUTEX_INITIALIZER;
+PRIVATE pthread_cond_t           render_cond           = PTHREAD_COND_INITIALIZER;
+PRIVATE BOOL                     render_thread_active  = false;
+
+/** Nice value of the rendering thread */
+#define 	RENDER_THREAD_NICE 	10
 
-		corr->key.a->gid, corr->key.a->sid, corr->key.a->rev, corr->key.a->desc,
-		src_addr1, src_port1, dst_addr1, dst_port1,
-		time1,
-		corr->key.a->grouped_alerts_count,
+/**
+ * \brief  Free a snapshot of the correlation graph
+ * \param  snapshot 	Snapshot to be freed
+ */
 
-		corr->key.b->gid, corr->key.b->sid, corr->key.b->rev, corr->key.b->desc,
-		src_addr2, src_port2, dst_addr2, dst_port2,
-		time2,
-		corr->key.b->grouped_alerts_count
-	);
+PRIVATE void
+__AI_render_snapshot_free ( AI_render_snapshot *snapshot )
+{
+	unsigned int s;
 
-	free ( time1 );
-	free ( time2 );
-}		/* -----  end of function __AI_correlated_alerts_to_dot  ----- */
+	if ( !snapshot )
+		return;
+
+	for ( s=0; s < snapshot->n_scenarios; s++ )
+		free ( snapshot->dot[s] );
+
+	free ( snapshot->dot );
+	free ( snapshot->n_edges );
+	free ( snapshot );
+}		/* -----  end of function __AI_render_snapshot_free  ----- */
 
 /**
- * \brief  Recursively write the flow of correlated alerts to a .json file, ready for being rendered in the web interface
+ * \brief  Digest of the dot source of a scenario, for skipping the scenarios that didn't change since their latest rendering
+ * \param  dot 	Dot source
+ * \return The digest of the source
  */
 
-PRIVATE void
-__AI_correlated_alerts_to_json ()
+PRIVATE unsigned long
+__AI_render_digest ( const char *dot )
 {
-	AI_snort_alert  *alert_iterator = NULL;
-	struct pkt_info *pkt_iterator   = NULL;
-	FILE *fp;
-
-	unsigned int i = 0,
-			   pkt_len = 0;
+	unsigned long digest = 5381;
 
-	char *strtime = NULL,
-		*encoded_pkt = NULL,
-		json_file[1040] = { 0 },
-		srcip[INET_ADDRSTRLEN] = { 0 },
-		dstip[INET_ADDRSTRLEN] = { 0 },
-		srcport[10] = { 0 },
-		dstport[10] = { 0 };
+	for ( ; *dot; dot++ )
+		digest = ( digest * 33 ) ^ (unsigned char) *dot;
 
-	/* If there is no directory configured for the web interface, just exit */
-	if ( strlen ( config->webserv_dir ) == 0 )
-		return;
+	return digest;
+}		/* -----  end of function __AI_render_digest  ----- */
 
-	snprintf ( json_file, sizeof ( json_file ), "%s/correlation_graph.json", config->webserv_dir );
+/**
+ * \brief  Thread rendering the scenarios of the correlation graph to .png and .ps files. It runs with a lower
+ * priority than the rest of the module, on a snapshot of the graph, at most once every correlation_render_interval
+ * seconds (the snapshots posted in the meantime replace each other), and only renders the scenarios that changed
+ */
 
-	if ( !( fp = fopen ( json_file, "w" )))
+PRIVATE void*
+__AI_render_thread ( void *arg )
+{
+	AI_render_snapshot  *snapshot  = NULL;
+	GVC_t               *gvc       = NULL;
+	graph_t             *g         = NULL;
+	unsigned long       *digests   = NULL,
+					digest;
+	unsigned int        n_rendered = 0,
+					s;
+	time_t              last_render = 0,
+					now;
+	const char          *layout    = NULL;
+	char                png_file[4096]     = { 0 },
+					ps_file [4096]     = { 0 },
+					tmp_file[4096]     = { 0 };
+	struct stat         st;
+
+	/* On Linux the nice value of a thread only applies to the thread itself */
+	setpriority ( PRIO_PROCESS, 0, RENDER_THREAD_NICE );
+
+	/* A single graphviz context is used for all the renderings */
+	if ( !( gvc = gvContext() ))
 	{
-		AI_fatal_err ( "Unable to write on correlated_graph.json in htdocs directory", __FILE__, __LINE__ );
+		pthread_mutex_lock ( &render_mutex );
+		render_thread_active = false;
+		pthread_mutex_unlock ( &render_mutex );
+		pthread_exit (( void* ) 0 );
+		return (void*) 0;
 	}
 
-	fprintf ( fp, "[\n" );
-
-	for ( alert_iterator = alerts; alert_iterator; alert_iterator = alert_iterator->next )
-	{
-		strtime = ctime ( &(alert_iterator->timestamp ));
-		strtime[ strlen(strtime) - 1 ] = 0;
-		inet_ntop ( AF_INET, &(alert_iterator->ip_src_addr), srcip, INET_ADDRSTRLEN );
-		inet_ntop ( AF_INET, &(alert_iterator->ip_dst_addr), dstip, INET_ADDRSTRLEN );
-		snprintf ( srcport, sizeof ( srcport ), "%d", htons ( alert_iterator->tcp_src_port ));
-		snprintf ( dstport, sizeof ( dstport ), "%d", htons ( alert_iterator->tcp_dst_port ));
-
-		fprintf ( fp, "{\n"
-			"\t\"id\": %lu,\n"
-			"\t\"snortSID\": \"%u\",\n"
-			"\t\"snortGID\": \"%u\",\n"
-			"\t\"snortREV\": \"%u\",\n"
-			"\t\"label\": \"%s\",\n"
-			"\t\"date\": \"%s\",\n"
-			"\t\"clusteredAlertsCount\": %u,\n"
-			"\t\"from\": \"%s:%s\",\n"
-			"\t\"to\": \"%s:%s\",\n"
-			"\t\"latitude\": \"%f\",\n"
-			"\t\"longitude\": \"%f\"",
-			alert_iterator->alert_id,
-			alert_iterator->sid,
-			alert_iterator->gid,
-			alert_iterator->rev,
-			alert_iterator->desc,
-			strtime,
-			alert_iterator->grouped_alerts_count,
-			srcip, srcport, dstip, dstport,
-			alert_iterator->geocoord[0],
-			alert_iterator->geocoord[1]
-		);
-
-		if ( alert_iterator->stream )
-		{
-			fprintf ( fp, ",\n"
-					"\t\"packets\": [\n" );
-
-			for ( pkt_iterator = alert_iterator->stream; pkt_iterator; pkt_iterator = pkt_iterator->next )
-			{
-				encoded_pkt = NULL;
-				pkt_len = pkt_iterator->pkt->pcap_header->len + pkt_iterator->pkt->payload_size;
+	while ( 1 )
+	{
+		pthread_mutex_lock ( &render_mutex );
 
-				if ( !( encoded_pkt = (char*) calloc ( 4*pkt_len + 1, sizeof ( char ))))
-				{
-					AI_fatal_err ( "Fatal dynamic memory allocation", __FILE__, __LINE__ );
-				}
+		while ( !render_pending )
+			pthread_cond_wait ( &render_cond, &render_mutex );
 
-				base64_encode (
-					(const char*) pkt_iterator->pkt->pkt_data,
-					pkt_len,
-					&encoded_pkt
-				);
+		pthread_mutex_unlock ( &render_mutex );
 
-				fprintf ( fp, "\t\t\"%s\"%s\n",
-						encoded_pkt, ((pkt_iterator->next) ? "," : ""));
+		/* Wait until the interval from the previous rendering is over, rendering only the latest snapshot */
+		if (( now = time ( NULL )) < last_render + (time_t) config->correlationRenderInterval )
+			sleep ( last_render + config->correlationRenderInterval - now );
 
-				free ( encoded_pkt );
-				encoded_pkt = NULL;
-			}
+		pthread_mutex_lock ( &render_mutex );
+		snapshot = render_pending;
+		render_pending = NULL;
+		pthread_mutex_unlock ( &render_mutex );
 
-			fprintf ( fp, "\t]" );
-		}
+		if ( !( digests = (unsigned long*) realloc ( digests, ( snapshot->n_scenarios + 1 ) * sizeof ( unsigned long ))))
+			AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
 
-		for ( i=1; i < alert_iterator->grouped_alerts_count; i++ )
+		for ( s=0; s < snapshot->n_scenarios; s++ )
 		{
-			if ( i == 1 )
-			{
-				fprintf ( fp, ",\n\t\"clusteredAlerts\": [\n" );
-			}
+			snprintf ( png_file, sizeof ( png_file ), "%s/correlated_alerts_%u.png", config->corr_alerts_dir, s );
+			snprintf ( ps_file , sizeof ( ps_file  ), "%s/correlated_alerts_%u.ps" , config->corr_alerts_dir, s );
+			digest = __AI_render_digest ( snapshot->dot[s] );
 
-			if ( alert_iterator->grouped_alerts )
-			{
-				if ( alert_iterator->grouped_alerts[i] )
-				{
-					strtime = ctime ( &(alert_iterator->grouped_alerts[i]->timestamp ));
-					strtime[ strlen ( strtime ) - 1 ] = 0;
-					inet_ntop ( AF_INET, &(alert_iterator->grouped_alerts[i]->ip_src_addr), srcip, INET_ADDRSTRLEN );
-					inet_ntop ( AF_INET, &(alert_iterator->grouped_alerts[i]->ip_dst_addr), dstip, INET_ADDRSTRLEN );
-					snprintf ( srcport, sizeof ( srcport ), "%d", htons ( alert_iterator->grouped_alerts[i]->tcp_src_port ));
-					snprintf ( dstport, sizeof ( dstport ), "%d", htons ( alert_iterator->grouped_alerts[i]->tcp_dst_port ));
-
-					fprintf ( fp, "\t\t{\n"
-						"\t\t\t\"id\": %lu,\n"
-						"\t\t\t\"label\": \"%s\",\n"
-						"\t\t\t\"date\": \"%s\",\n"
-						"\t\t\t\"from\": \"%s:%s\",\n"
-						"\t\t\t\"to\": \"%s:%s\",\n"
-						"\t\t\t\"latitude\": \"%f\",\n"
-						"\t\t\t\"longitude\": \"%f\"%s",
-						alert_iterator->grouped_alerts[i]->alert_id,
-						alert_iterator->grouped_alerts[i]->desc,
-						strtime,
-						srcip, srcport, dstip, dstport,
-						alert_iterator->grouped_alerts[i]->geocoord[0],
-						alert_iterator->grouped_alerts[i]->geocoord[1],
-						(( alert_iterator->grouped_alerts[i]->stream ) ? ",\n" : "\n" )
-					);
-
-					if ( alert_iterator->grouped_alerts[i]->stream )
-					{
-						fprintf ( fp, "\t\t\t\"packets\": [\n" );
-
-						for ( pkt_iterator = alert_iterator->grouped_alerts[i]->stream; pkt_iterator; pkt_iterator = pkt_iterator->next )
-						{
-							if ( !pkt_iterator->pkt->ip4_header )
-							{
-								pkt_len = pkt_iterator->pkt->pcap_header->len +
-									pkt_iterator->pkt->tcp_options_length +
-									pkt_iterator->pkt->payload_size;
-							} else {
-								pkt_len = pkt_iterator->pkt->ip4_header->data_length;
-							}
-
-							if ( !( encoded_pkt = (char*) malloc ( 4*pkt_len + 1 )))
-							{
-								AI_fatal_err ( "Fatal dynamic memory allocation", __FILE__, __LINE__ );
-							}
-
-							memset ( encoded_pkt, 0, 4*pkt_len + 1  );
-
-							base64_encode (
-								(const char*) pkt_iterator->pkt->pkt_data,
-								pkt_len,
-								&encoded_pkt
-							);
-
-							fprintf ( fp, "\t\t\t\t\"%s\"%s\n",
-									encoded_pkt, ((pkt_iterator->next) ? "," : ""));
-						}
-
-						fprintf ( fp, "\t\t\t]\n" );
-					}
+			if ( s < n_rendered && digests[s] == digest && stat ( png_file, &st ) == 0 )
+				continue;
 
-					fprintf ( fp,
-						"\t\t}%s\n",
-						(( i < alert_iterator->grouped_alerts_count - 1 ) ? "," : "" ));
-				}
-			}
+			digests[s] = digest;
+
+			if ( !( g = agmemread ( snapshot->dot[s] )))
+				continue;
 
-			if ( i == alert_iterator->grouped_alerts_count - 1 )
+			/* dot layout is super-linear in the size of the graph, sfdp scales to the larger scenarios */
+			layout = ( config->correlationRenderMaxEdges != 0 && snapshot->n_edges[s] > config->correlationRenderMaxEdges ) ?
+				"sfdp" : "dot";
+
+			if ( gvLayout ( gvc, g, layout ) != 0 )
 			{
-				fprintf ( fp, "\t]" );
+				agclose ( g );
+				continue;
 			}
+
+			/* The files are rendered aside and renamed, so that a reader never sees a partial image */
+			snprintf ( tmp_file, sizeof ( tmp_file ), "%s.tmp", png_file );
+
+			if ( gvRenderFilename ( gvc, g, "png", tmp_file ) == 0 )
+				rename ( tmp_file, png_file );
+
+			snprintf ( tmp_file, sizeof ( tmp_file ), "%s.tmp", ps_file );
+
+			if ( gvRenderFilename ( gvc, g, "ps", tmp_file ) == 0 )
+				rename ( tmp_file, ps_file );
+
+			gvFreeLayout ( gvc, g );
+			agclose ( g );
 		}
 
-		for ( i=0; i < alert_iterator->n_derived_alerts; i++ )
+		/* Remove the images of the scenarios that are gone */
+		for ( s = snapshot->n_scenarios; s < n_rendered; s++ )
 		{
-			if ( i == 0 )
-			{
-				fprintf ( fp, ",\n\t\"connectedTo\": [\n" );
-			}
+			snprintf ( png_file, sizeof ( png_file ), "%s/correlated_alerts_%u.png", config->corr_alerts_dir, s );
+			snprintf ( ps_file , sizeof ( ps_file  ), "%s/correlated_alerts_%u.ps" , config->corr_alerts_dir, s );
+			unlink ( png_file );
+			unlink ( ps_file );
+		}
 
-			fprintf ( fp, "\t\t{ \"id\": %lu }%s\n",
-				alert_iterator->derived_alerts[i]->alert_id,
-				((i < alert_iterator->n_derived_alerts - 1) ? "," : ""));
+		n_rendered  = snapshot->n_scenarios;
+		last_render = time ( NULL );
+		__AI_render_snapshot_free ( snapshot );
+		snapshot = NULL;
+	}
 
-			if ( i == alert_iterator->n_derived_alerts - 1 )
-			{
-				fprintf ( fp, "\t]" );
-			}
+	gvFreeContext ( gvc );
+	pthread_exit (( void* ) 0 );
+	return (void*) 0;
+}		/* -----  end of function __AI_render_thread  ----- */
+
+/**
+ * \brief  Take a snapshot of the scenarios of the correlation graph and post it to the rendering thread, starting
+ * it if needed. The correlation thread never waits for a rendering: a snapshot not rendered yet is just replaced
+ */
+
+PRIVATE void
+__AI_render_snapshot_post ()
+{
+	AI_render_snapshot  *snapshot = NULL;
+	pthread_t           render_thread;
+	unsigned int        s;
+	size_t              dot_size  = 0;
+	FILE                *fp       = NULL;
+
+	if ( !( snapshot = (AI_render_snapshot*) calloc ( 1, sizeof ( AI_render_snapshot ))))
+		AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+	snapshot->n_scenarios = scenarios.n_correlated;
+
+	if ( !( snapshot->dot = (char**) calloc ( snapshot->n_scenarios + 1, sizeof ( char* ))) ||
+			!( snapshot->n_edges = (unsigned int*) calloc ( snapshot->n_scenarios + 1, sizeof ( unsigned int ))))
+		AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+	for ( s=0; s < snapshot->n_scenarios; s++ )
+	{
+		if ( !( fp = open_memstream ( &( snapshot->dot[s] ), &dot_size )))
+			AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+		__AI_correlation_scenario_dot_write ( s, fp );
+		fclose ( fp );
+		snapshot->n_edges[s] = scenarios.edge_offsets[s+1] - scenarios.edge_offsets[s];
+	}
+
+	pthread_mutex_lock ( &render_mutex );
+	__AI_render_snapshot_free ( render_pending );
+	render_pending = snapshot;
+
+	if ( !render_thread_active )
+	{
+		if ( pthread_create ( &render_thread, NULL, __AI_render_thread, NULL ) != 0 )
+		{
+			pthread_mutex_unlock ( &render_mutex );
+			AI_fatal_err ( "Failed to create the graph rendering thread", __FILE__, __LINE__ );
 		}
 
-		fprintf ( fp, "\n}%s\n",
-			(alert_iterator->next ? "," : ""));
+		pthread_detach ( render_thread );
+		render_thread_active = true;
 	}
 
-	fprintf ( fp, "]\n" );
-	fclose ( fp );
-	chmod ( json_file, 0644 );
-}		/* -----  end of function __AI_correlated_alerts_to_json  ----- */
+	pthread_cond_signal ( &render_cond );
+	pthread_mutex_unlock ( &render_mutex );
+}		/* -----  end of function __AI_render_snapshot_post  ----- */
+#endif
 
 /**
  * \brief  Thread for correlating clustered alerts
@@ -378,72 +2933,106 @@ void*
 AI_alert_correlation_thread ( void *arg )
 {
 	int                       i;
+	unsigned int              s;
 	struct stat               st;
 
 	char                      corr_dot_file[4096]   = { 0 };
 
-#ifdef HAVE_LIBGVC
-	char                      corr_ps_file [4096]   = { 0 };
-#endif
-
 	double                    avg_correlation       = 0.0,
 						 std_deviation         = 0.0,
-						 corr_threshold        = 0.0,
-						 kb_correlation        = 0.0,
-						 bayesian_correlation  = 0.0,
-						 neural_correlation    = 0.0;
+						 corr_threshold        = 0.0;
 
-	size_t                    n_correlations        = 0,
-						 n_corr_functions      = 0,
-						 n_corr_weights        = 0;
+	AI_correlation_block      *block                = NULL;
+	size_t                    first                 = 0,
+					      n_proc_modules        = 0,
+					      n_stale               = 0;
+	AI_correlation_stats      stats;
 
 	FILE                      *fp                   = NULL;
 
-	AI_alert_correlation_key  corr_key;
-	AI_alert_correlation      *corr                 = NULL;
+	AI_alert_correlation      *corr                 = NULL,
+					      **db_corrs            = NULL;
+
+	unsigned int              n_db_corrs            = 0;
+	unsigned long             manual_digest         = 0;
+	BOOL                      accepted              = false,
+					      graph_changed         = false,
+					      inputs_changed        = false;
 
-	AI_alert_type_pair_key    pair_key;
-	AI_alert_type_pair        *pair                 = NULL,
-						 *unpair               = NULL;
+	AI_snort_alert            *fresh_alerts         = NULL,
+					      *closed_alerts        = NULL,
+					      *released_alerts      = NULL;
 
-	AI_snort_alert            *alert_iterator       = NULL,
-					      *alert_iterator2      = NULL;
+	AI_alert_table            *table                = NULL,
+					      *prev_table           = NULL;
 
 	pthread_t                 manual_corr_thread;
 
-	#ifdef                    HAVE_LIBGVC
-	char                      corr_png_file[4096]   = { 0 };
-	GVC_t                     *gvc                  = NULL;
-	graph_t                   *g                    = NULL;
+	#ifdef HAVE_LIBPYTHON2_6
+	PyObject *pRet  = NULL;
+
+	PyObject **py_weight_functions = NULL;
+
+	size_t   n_py_weight_functions = 0;
+
+	scoring.py_corr_functions = AI_get_py_functions ( &( scoring.n_py_corr_functions ));
+	scoring.py_batch_functions = AI_get_py_batch_functions ( &( scoring.n_py_corr_functions ));
+	py_weight_functions = AI_get_py_weights ( &n_py_weight_functions );
 	#endif
 
-	double (**corr_functions)( const AI_snort_alert*, const AI_snort_alert* ) = NULL;
-	double (**corr_weights)() = NULL;
+	scoring.corr_modules = AI_get_corr_modules ( &( scoring.n_corr_modules ));
+
+	if ( scoring.corr_modules && scoring.n_corr_modules > 0 )
+	{
+		if ( !( scoring.module_weights = (double*) calloc ( scoring.n_corr_modules, sizeof ( double ))) ||
+				!( scoring.module_locks = (pthread_mutex_t*) malloc ( scoring.n_corr_modules * sizeof ( pthread_mutex_t ))))
+			AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+		for ( i=0; i < scoring.n_corr_modules; i++ )
+			pthread_mutex_init ( &( scoring.module_locks[i] ), NULL );
+	}
 
 	#ifdef HAVE_LIBPYTHON2_6
-	PyObject *pyA = NULL,
-		    *pyB = NULL;
+	if ( scoring.py_corr_functions && scoring.n_py_corr_functions > 0 )
+	{
+		if ( !( scoring.py_weights = (double*) calloc ( scoring.n_py_corr_functions, sizeof ( double ))) ||
+				!( scoring.py_batch_scores = (double**) calloc ( scoring.n_py_corr_functions, sizeof ( double* ))))
+			AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+	}
+	#endif
 
-	PyObject *pArgs = NULL,
-		    *pRet  = NULL;
+	/* The extra modules run in the helper processes, if configured, only if any module is loaded */
+	n_proc_modules = scoring.n_corr_modules;
 
-	PyObject **py_corr_functions   = NULL;
-	PyObject **py_weight_functions = NULL;
+	#ifdef HAVE_LIBPYTHON2_6
+	n_proc_modules += ( scoring.py_corr_functions ) ? scoring.n_py_corr_functions : 0;
+	#endif
 
-	size_t   n_py_corr_functions   = 0;
-	size_t   n_py_weight_functions = 0;
+	if ( config->correlationModulesProcesses > 0 && n_proc_modules > 0 )
+	{
+		modules_in_procs = true;
+
+		if ( !( proc_modules_run = (BOOL*) calloc ( n_proc_modules, sizeof ( BOOL ))))
+			AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+	}
 
-	double   py_value  = 0.0,
-		    py_weight = 0.0;
+	/* One column of correlation indexes per built-in index, then one per extra module */
+	scoring.n_columns = BUILTIN_COLUMNS + n_proc_modules;
 
-	py_corr_functions = AI_get_py_functions ( &n_py_corr_functions );
-	py_weight_functions = AI_get_py_weights ( &n_py_weight_functions );
-	#endif
+	if ( !( column_versions = (unsigned long*) calloc ( scoring.n_columns, sizeof ( unsigned long ))) ||
+			!( cached_column_versions = (unsigned long*) calloc ( scoring.n_columns, sizeof ( unsigned long ))) ||
+			!( stale_columns = (BOOL*) calloc ( scoring.n_columns, sizeof ( BOOL ))) ||
+			!( prev_column_weights = (double*) calloc ( scoring.n_columns, sizeof ( double ))) ||
+			!( scoring.column_weights = (double*) calloc ( scoring.n_columns, sizeof ( double ))) ||
+			!( scoring.columns_run = (BOOL*) calloc ( scoring.n_columns, sizeof ( BOOL ))))
+		AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
 
-	corr_functions = AI_get_corr_functions ( &n_corr_functions );
-	corr_weights   = AI_get_corr_weights ( &n_corr_weights );
+	/* The partial sums of a block are too large for the stack of the thread */
+	if ( !( block = (AI_correlation_block*) malloc ( sizeof ( AI_correlation_block ))))
+		AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
 
 	pthread_mutex_init ( &mutex, NULL );
+	__AI_scoring_pool_init();
 
 	/* Start the thread for parsing manual correlations from XML */
 	if ( pthread_create ( &manual_corr_thread, NULL, AI_manual_correlations_parsing_thread, NULL ) != 0 )
@@ -466,171 +3055,179 @@ AI_alert_correlation_thread ( void *arg )
 		/* Set the lock flag to true, and keep it this way until I've done with correlating alerts */
 		pthread_mutex_lock ( &mutex );
 
-		if ( alerts )
-		{
-			AI_free_alerts ( alerts );
-			alerts = NULL;
-		}
+		/* With a correlation horizon only the alerts not older than the previous cutoff are copied */
+		fresh_alerts = AI_get_clustered_alerts_since ( graph_cutoff, &closed_alerts );
 
-		if ( !( alerts = AI_get_clustered_alerts() ))
+		if ( !fresh_alerts && !closed_alerts )
 		{
 			pthread_mutex_unlock ( &mutex );
 			continue;
 		}
 
-		if ( config->use_knowledge_base_correlation_index != 0 )
+		/* The correlation graph is kept across the passes: only the alerts whose cluster is new or
+		 * changed are replaced, and only the couples involving them are scored again */
+		graph_changed = false;
+		alerts = __AI_correlation_nodes_sync ( fresh_alerts, closed_alerts, &released_alerts, &graph_changed );
+
+		/* The couples of alerts are scanned on the columnar view of the alerts, the
+		 * linked list is only used for passing the alerts to the correlation functions */
+		prev_table = table;
+		table = AI_alert_table_from_list ( alerts );
+		scoring.table = table;
+
+		/* The weights of the correlation indexes don't depend on the couple of alerts, so they are computed
+		 * once per pass (the neural weight comes from a query on the database) */
+		scoring.bayesian_weight = ( config->bayesianCorrelationInterval != 0 ) ? AI_bayesian_correlation_weight() : 0.0;
+		scoring.neural_weight   = ( config->neuralNetworkTrainingInterval != 0 ) ? AI_neural_correlation_weight() : 0.0;
+
+		for ( i=0; scoring.corr_modules && i < scoring.n_corr_modules; i++ )
+			scoring.module_weights[i] = scoring.corr_modules[i]->weight();
+
+		#ifdef HAVE_LIBPYTHON2_6
+		for ( i=0; scoring.py_corr_functions && i < scoring.n_py_corr_functions; i++ )
+		{
+			if ( !( pRet = PyEval_CallObject ( py_weight_functions[i], (PyObject*) NULL )))
+			{
+				PyErr_Print();
+				AI_fatal_err ( "Could not call the correlation function from the Python module", __FILE__, __LINE__ );
+			}
+
+			if ( !( PyArg_Parse ( pRet, "d", &( scoring.py_weights[i] ))))
+			{
+				PyErr_Print();
+				AI_fatal_err ( "Could not parse the correlation weight out of the Python correlation function", __FILE__, __LINE__ );
+			}
+
+			Py_DECREF ( pRet );
+		}
+		#endif
+
+		/* The correlation indexes carried over from the previous pass are only computed again for the indexes whose
+		 * model changed, while the scores are only computed again if an index or a weight changed */
+		inputs_changed = __AI_correlation_columns_update ( &n_stale );
+		inputs_changed = ( inputs_changed && prev_candidates.n_couples > 0 );
+
+		if ( n_stale > 0 && prev_candidates.n_couples > 0 )
 		{
-			AI_kb_index_init ( alerts );
+			score_cache_invalidations += n_stale;
+			_dpd.logMsg ( "AIPreproc: The models of %lu correlation indexes changed, computing them again for all the couples of alerts "
+				"(carried scores: %lu, computed scores: %lu, invalidations: %lu)\n",
+				(unsigned long) n_stale, score_cache_hits, score_cache_misses, score_cache_invalidations );
 		}
 
-		__AI_correlation_table_cleanup();
-		correlation_table = NULL;
+		/* Only the couples of alerts that could pass the acceptance test are candidates */
+		__AI_correlation_candidates_build ( table );
+		__AI_correlation_couples_carry();
 
-		/* Fill the table of correlated alerts */
-		for ( alert_iterator = alerts; alert_iterator; alert_iterator = alert_iterator->next )
+		/* The couples of the previous pass that were not carried over leave the statistics and the graph */
+		for ( first = 0; first < prev_candidates.n_couples; first++ )
 		{
-			for ( alert_iterator2 = alerts; alert_iterator2; alert_iterator2 = alert_iterator2->next )
+			if ( prev_candidates.reused[first] )
+				continue;
+
+			__AI_correlation_stats_remove ( &graph_stats, prev_candidates.scores[first] );
+
+			if ( prev_candidates.accepted[first] )
 			{
-				if ( alert_iterator != alert_iterator2 && ! (
-					alert_iterator->gid == alert_iterator2->gid &&
-					alert_iterator->sid == alert_iterator2->sid &&
-					alert_iterator->rev == alert_iterator2->rev ))
-				{
-					if ( !( corr = ( AI_alert_correlation* ) malloc ( sizeof ( AI_alert_correlation ))))
-						AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+				__AI_correlation_edge_set ( prev_table->alerts[ prev_candidates.couples[first].a ],
+					prev_table->alerts[ prev_candidates.couples[first].b ], 0.0, false );
+				graph_changed = true;
+			}
+		}
 
-					corr_key.a = alert_iterator;
-					corr_key.b = alert_iterator2;
-					corr->key  = corr_key;
-					corr->correlation = 0.0;
-					n_correlations = 0;
+		AI_alert_table_free ( prev_table );
+		prev_table = NULL;
+		__AI_correlation_alerts_free ( released_alerts );
+		released_alerts = NULL;
 
-					kb_correlation = AI_kb_correlation_coefficient ( corr_key.a, corr_key.b );
-					bayesian_correlation = AI_alert_bayesian_correlation ( corr_key.a, corr_key.b );
-					neural_correlation = AI_alert_neural_som_correlation ( corr_key.a, corr_key.b );
+		/* The new couples get all the enabled indexes */
+		for ( first = 0; first < scoring.n_columns; first++ )
+			scoring.columns_run[first] = ( column_versions[first] != 0 );
 
-					/* Use the correlation indexes for which we have a value */
-					if ( bayesian_correlation != 0.0 && config->bayesianCorrelationInterval != 0 )
-					{
-						corr->correlation += AI_bayesian_correlation_weight() * bayesian_correlation;
-						n_correlations++;
-					}
+		if ( n_pending > 0 )
+		{
+			__AI_correlation_pending_score ( block, &stats );
+			__AI_correlation_stats_merge ( &graph_stats, &stats );
+		}
 
-					if ( kb_correlation != 0.0 && config->use_knowledge_base_correlation_index )
-					{
-						corr->correlation += kb_correlation;
-						n_correlations++;
-					}
+		/* The couples carried over only get the indexes whose model changed, and the scores of all the couples are
+		 * computed again from their indexes with the weights of this pass (the statistics are then computed again) */
+		if ( inputs_changed )
+		{
+			if ( n_stale > 0 )
+			{
+				memcpy ( scoring.columns_run, stale_columns, scoring.n_columns * sizeof ( BOOL ));
+				__AI_correlation_couples_pending_carried();
 
-					if ( neural_correlation != 0.0 && config->neuralNetworkTrainingInterval != 0 )
-					{
-						corr->correlation += AI_neural_correlation_weight() * neural_correlation;
-						n_correlations++;
-					}
+				if ( n_pending > 0 )
+					__AI_correlation_pending_score ( block, &stats );
+			}
 
-					/* Get the correlation indexes from extra correlation modules */
-					if (( corr_functions ))
-					{
-						for ( i=0; i < n_corr_functions; i++ )
-						{
-							if ( corr_weights[i]() != 0.0 )
-							{
-								corr->correlation += corr_weights[i]() * corr_functions[i] ( corr_key.a, corr_key.b );
-								n_correlations++;
-							}
-						}
-					}
+			__AI_correlation_couples_rescore();
+		}
+
+		if ( graph_stats.n > 0 )
+		{
+			avg_correlation = graph_stats.mean;
+			std_deviation   = sqrt ( graph_stats.m2 / (double) graph_stats.n );
+			corr_threshold  = avg_correlation + ( config->correlationThresholdCoefficient * std_deviation );
+			manual_digest   = __AI_manual_pairs_digest();
+
+			/* The edges already in the graph are only evaluated again if the threshold moved by more than the
+			 * tolerance since they were evaluated, or if the manual correlations changed: otherwise only the new
+			 * couples are evaluated, against the same threshold as the rest of the graph */
+			if ( fabs ( corr_threshold - graph_threshold ) > config->correlationThresholdTolerance * std_deviation ||
+					manual_digest != graph_manual_digest || inputs_changed )
+			{
+				/* Start again from the exact statistics, dropping the rounding errors of the incremental updates */
+				__AI_correlation_stats_compute ( &graph_stats );
+				avg_correlation = graph_stats.mean;
+				std_deviation   = sqrt ( graph_stats.m2 / (double) graph_stats.n );
+				graph_threshold = avg_correlation + ( config->correlationThresholdCoefficient * std_deviation );
+				graph_manual_digest = manual_digest;
+
+				for ( first = 0; first < candidates.n_couples; first++ )
+				{
+					accepted = __AI_correlation_couple_accepted ( table, first, graph_threshold );
 
-					#ifdef HAVE_LIBPYTHON2_6
-					if (( py_corr_functions ))
+					/* The edges whose score changed are updated as well */
+					if ( accepted != candidates.accepted[first] || ( accepted && inputs_changed ))
 					{
-						pyA = AI_alert_to_pyalert ( corr_key.a );
-						pyB = AI_alert_to_pyalert ( corr_key.b );
-
-						if ( pyA && pyB )
-						{
-							for ( i=0; i < n_py_corr_functions; i++ )
-							{
-								if ( !( pArgs = Py_BuildValue ( "(OO)", pyA, pyB )))
-								{
-									PyErr_Print();
-									AI_fatal_err ( "Could not initialize the Python arguments for the call", __FILE__, __LINE__ );
-								}
-
-								if ( !( pRet = PyEval_CallObject ( py_corr_functions[i], pArgs )))
-								{
-									PyErr_Print();
-									AI_fatal_err ( "Could not call the correlation function from the Python module", __FILE__, __LINE__ );
-								}
-
-								if ( !( PyArg_Parse ( pRet, "d", &py_value )))
-								{
-									PyErr_Print();
-									AI_fatal_err ( "Could not parse the correlation value out of the Python correlation function", __FILE__, __LINE__ );
-								}
-
-								Py_DECREF ( pRet );
-								Py_DECREF ( pArgs );
-
-								if ( !( pRet = PyEval_CallObject ( py_weight_functions[i], (PyObject*) NULL )))
-								{
-									PyErr_Print();
-									AI_fatal_err ( "Could not call the correlation function from the Python module", __FILE__, __LINE__ );
-								}
-
-								if ( !( PyArg_Parse ( pRet, "d", &py_weight )))
-								{
-									PyErr_Print();
-									AI_fatal_err ( "Could not parse the correlation weight out of the Python correlation function", __FILE__, __LINE__ );
-								}
-
-								Py_DECREF ( pRet );
-
-								if ( py_weight != 0.0 )
-								{
-									corr->correlation += py_weight * py_value;
-									n_correlations++;
-								}
-							}
-
-							Py_DECREF ( pyA ); Py_DECREF ( pyB );
-							/* free ( pyA ); free ( pyB ); */
-							pyA = NULL; pyB = NULL;
-						}
+						candidates.accepted[first] = accepted;
+						__AI_correlation_edge_set ( table->alerts[ candidates.couples[first].a ],
+							table->alerts[ candidates.couples[first].b ], candidates.scores[first], accepted );
+						graph_changed = true;
 					}
-					#endif
+				}
+			} else {
+				for ( i=0; i < n_pending; i++ )
+				{
+					first = pending_index[i];
 
-					if ( n_correlations != 0 )
+					if (( candidates.accepted[first] = __AI_correlation_couple_accepted ( table, first, graph_threshold )))
 					{
-						corr->correlation /= (double) n_correlations;
+						__AI_correlation_edge_set ( table->alerts[ candidates.couples[first].a ],
+							table->alerts[ candidates.couples[first].b ], candidates.scores[first], true );
+						graph_changed = true;
 					}
-
-					HASH_ADD ( hh, correlation_table, key, sizeof ( AI_alert_correlation_key ), corr );
 				}
 			}
 		}
 
-		if ( HASH_COUNT ( correlation_table ) > 0 )
-		{
-			avg_correlation = 0.0;
-			std_deviation   = 0.0;
-
-			/* Compute the average correlation coefficient */
-			for ( corr = correlation_table; corr; corr = ( AI_alert_correlation* ) corr->hh.next )
-			{
-				avg_correlation += corr->correlation;
-			}
+		/* Split the graph in its connected components, i.e. the distinct attack scenarios */
+		__AI_correlation_scenarios_build ( table );
 
-			avg_correlation /= (double) HASH_COUNT ( correlation_table );
+		/* The scenarios out of the correlation horizon are archived, and released in the next pass */
+		if ( config->correlationHorizon != 0 )
+			__AI_correlation_subgraphs_archive ( table );
 
-			/* Compute the standard deviation */
-			for ( corr = correlation_table; corr; corr = ( AI_alert_correlation* ) corr->hh.next )
-			{
-				std_deviation += ( corr->correlation - avg_correlation ) * ( corr->correlation - avg_correlation );
-			}
+		/* The candidate couples of this pass are the previous ones for the next pass */
+		__AI_correlation_couples_swap();
 
-			std_deviation = sqrt ( std_deviation / (double) HASH_COUNT ( correlation_table ));
-			corr_threshold = avg_correlation + ( config->correlationThresholdCoefficient * std_deviation );
+		/* The outputs are only written again if the graph changed */
+		if ( graph_changed )
+		{
+			__AI_correlation_graph_links();
 			snprintf ( corr_dot_file, sizeof ( corr_dot_file ), "%s/correlated_alerts.dot", config->corr_alerts_dir );
 			
 			if ( stat ( config->corr_alerts_dir, &st ) < 0 )
@@ -647,93 +3244,52 @@ AI_alert_correlation_thread ( void *arg )
 				AI_fatal_err ( "Could not write on the correlated alerts .dot file", __FILE__, __LINE__ );
 			fprintf ( fp, "digraph G  {\n" );
 
-			/* Find correlated alerts */
-			for ( corr = correlation_table; corr; corr = ( AI_alert_correlation* ) corr->hh.next )
+			for ( corr = correlation_table; corr; corr = (AI_alert_correlation*) corr->hh.next )
 			{
-				pair_key.from_sid = corr->key.a->sid;
-				pair_key.from_gid = corr->key.a->gid;
-				pair_key.from_rev = corr->key.a->rev;
-				pair_key.to_sid = corr->key.b->sid;
-				pair_key.to_gid = corr->key.b->gid;
-				pair_key.to_rev = corr->key.b->rev;
-
-				HASH_FIND ( hh, manual_correlations, &pair_key, sizeof ( pair_key ), pair );
-				HASH_FIND ( hh, manual_uncorrelations, &pair_key, sizeof ( pair_key ), unpair );
-
-				/* Yes, BlackLight wrote this line of code in a pair of minutes and immediately
-				 * compiled it without a single error */
-				if ( !unpair && ( pair || (
-						corr->correlation >= corr_threshold &&
-						corr_threshold != 0.0 &&
-						corr->key.a->timestamp <= corr->key.b->timestamp && ! (
-						corr->key.a->gid == corr->key.b->gid &&
-						corr->key.a->sid == corr->key.b->sid &&
-						corr->key.a->rev == corr->key.b->rev ) && (
-							corr->key.a->ip_src_addr == corr->key.b->ip_src_addr || (
-								(corr->key.a->h_node[src_addr] && corr->key.b->h_node[src_addr]) ?
-									( corr->key.a->h_node[src_addr]->max_val == corr->key.b->h_node[src_addr]->max_val &&
-									corr->key.a->h_node[src_addr]->min_val == corr->key.b->h_node[src_addr]->min_val ) : 0
-							)) && (
-							corr->key.a->ip_dst_addr == corr->key.b->ip_dst_addr || (
-								(corr->key.a->h_node[dst_addr] && corr->key.b->h_node[dst_addr]) ?
-									( corr->key.a->h_node[dst_addr]->max_val == corr->key.b->h_node[dst_addr]->max_val &&
-									corr->key.a->h_node[dst_addr]->min_val == corr->key.b->h_node[dst_addr]->min_val ) : 0
-							))
-						)
-					)
-				)  {
-					if ( !( corr->key.a->derived_alerts = ( AI_snort_alert** ) realloc ( corr->key.a->derived_alerts,
-									(++corr->key.a->n_derived_alerts) * sizeof ( AI_snort_alert* ))))
-						AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+				__AI_correlated_alerts_to_dot ( corr, fp );
 
-					if ( !( corr->key.b->parent_alerts = ( AI_snort_alert** ) realloc ( corr->key.b->parent_alerts,
-									(++corr->key.b->n_parent_alerts) * sizeof ( AI_snort_alert* ))))
+				if ( config->outdbtype != outdb_none )
+				{
+					if ( !( db_corrs = ( AI_alert_correlation** ) realloc ( db_corrs, (++n_db_corrs) * sizeof ( AI_alert_correlation* ))))
 						AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
 
-					corr->key.a->derived_alerts[ corr->key.a->n_derived_alerts - 1 ] = corr->key.b;
-					corr->key.b->parent_alerts [ corr->key.b->n_parent_alerts  - 1 ] = corr->key.a;
-					__AI_correlated_alerts_to_dot ( corr, fp );
-
-					if ( config->outdbtype != outdb_none )
-					{
-						AI_store_correlation_to_db ( corr );
-					}
+					db_corrs[ n_db_corrs - 1 ] = corr;
 				}
 			}
 
 			fprintf ( fp, "}\n" );
 			fclose ( fp );
 
-			#ifdef HAVE_LIBGVC
-				snprintf ( corr_png_file, sizeof ( corr_png_file ), "%s/correlated_alerts.png", config->corr_alerts_dir );
-				snprintf ( corr_ps_file , sizeof ( corr_ps_file  ), "%s/correlated_alerts.ps" , config->corr_alerts_dir );
-
-				if ( !( gvc = gvContext() ))
-				{
-					pthread_mutex_unlock ( &mutex );
-					continue;
-				}
+			/* Each scenario also gets its own .dot file, so that it can be rendered and browsed on its own */
+			for ( s=0; s < scenarios.n_correlated; s++ )
+			{
+				snprintf ( corr_dot_file, sizeof ( corr_dot_file ), "%s/correlated_alerts_%u.dot", config->corr_alerts_dir, s );
+				__AI_correlation_scenario_to_dot ( s, corr_dot_file );
+			}
 
-				if ( !( fp = fopen ( corr_dot_file, "r" )))
-				{
-					pthread_mutex_unlock ( &mutex );
-					continue;
-				}
+			/* Remove the files of the scenarios of the previous pass that are gone */
+			for ( s = scenarios.n_correlated; s < n_scenario_files; s++ )
+			{
+				snprintf ( corr_dot_file, sizeof ( corr_dot_file ), "%s/correlated_alerts_%u.dot", config->corr_alerts_dir, s );
+				unlink ( corr_dot_file );
 
-				if ( !( g = agread ( fp )))
+				if ( strlen ( config->webserv_dir ) != 0 )
 				{
-					pthread_mutex_unlock ( &mutex );
-					continue;
+					snprintf ( corr_dot_file, sizeof ( corr_dot_file ), "%s/correlation_graph_%u.json", config->webserv_dir, s );
+					unlink ( corr_dot_file );
 				}
+			}
 
-				gvLayout ( gvc, g, "dot" );
-				gvRenderFilename ( gvc, g, "png", corr_png_file );
-				gvRenderFilename ( gvc, g, "ps" , corr_ps_file  );
+			n_scenario_files = scenarios.n_correlated;
 
-				gvFreeLayout ( gvc, g );
-				agclose ( g );
-				fclose ( fp );
-			#endif
+			/* Replace the correlation graph on the output database in a single transaction */
+			if ( config->outdbtype != outdb_none )
+			{
+				AI_store_correlations_to_db ( db_corrs, n_db_corrs );
+				free ( db_corrs );
+				db_corrs   = NULL;
+				n_db_corrs = 0;
+			}
 
 			/* If no database output is defined, then the alerts have no alert_id, so we cannot use the
 			 * web interface for correlating them, as they have no unique identifier */
@@ -741,9 +3297,14 @@ AI_alert_correlation_thread ( void *arg )
 			{
 				if ( strlen ( config->webserv_dir ) != 0 )
 				{
-					__AI_correlated_alerts_to_json ();
+					__AI_correlated_alerts_to_json ( table );
 				}
 			}
+
+			/* The layout of the graph is left to the rendering thread, on a snapshot of the scenarios */
+			#ifdef HAVE_LIBGVC
+				__AI_render_snapshot_post();
+			#endif
 		}
 
 		pthread_mutex_unlock ( &mutex );
@@ -331,6 +331,47 @@ AI_db_get_alerts ()
 	return alerts_copy;
 }		/* -----  end of function AI_db_get_alerts  ----- */
 
+
+/**
+ * \brief  Return a copy of the alerts read from the database after a certain one, so that the caller
+ * only gets the alerts it hasn't seen yet
+ * \param  cursor 	Reference to the latest alert already returned (NULL for getting all the alerts).
+ * It is updated to the latest alert parsed so far, and it must not be dereferenced by the caller
+ * \return A copy of the new alerts as a linked list, NULL if there are no new alerts
+ */
+AI_snort_alert*
+AI_db_get_alerts_since ( AI_snort_alert **cursor )
+{
+	AI_snort_alert *node = NULL,
+				*copy = NULL,
+				*head = NULL,
+				*tail = NULL;
+
+	pthread_mutex_lock ( &mutex );
+
+	for ( node = ( *cursor ) ? ( *cursor )->next : alerts; node; node = node->next )
+	{
+		if ( !( copy = ( AI_snort_alert* ) malloc ( sizeof ( AI_snort_alert )) ))
+		{
+			AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+		}
+
+		memcpy ( copy, node, sizeof ( AI_snort_alert ));
+		copy->next = NULL;
+
+		if ( tail )
+			tail->next = copy;
+		else
+			head = copy;
+
+		tail = copy;
+		*cursor = node;
+	}
+
+	pthread_mutex_unlock ( &mutex );
+	return head;
+}		/* -----  end of function AI_db_get_alerts_since  ----- */
+
 /** @} */
 
 #endif  /* HAVE_DB */
@@ -41,6 +41,7 @@
 	#define 	DB_out_init 			mysql_do_out_init
 	#define 	DB_is_out_init 		mysql_is_out_init
 	#define 	DB_out_query 			mysql_do_out_query
+	#define 	DB_out_exec 			mysql_do_out_exec
 	#define 	DB_out_escape_string 	mysql_do_out_escape_string
 	#define 	DB_do_out_error 		mysql_do_out_error
 	#define 	DB_is_out_gone 		mysql_is_out_gone
@@ -80,14 +81,53 @@
 	#define 	DB_out_init 			postgresql_do_out_init
 	#define 	DB_is_out_init 		postgresql_is_out_init
 	#define 	DB_out_query 			postgresql_do_out_query
+	#define 	DB_out_exec 			postgresql_do_out_exec
 	#define 	DB_out_escape_string 	postgresql_do_out_escape_string
 	#define 	DB_out_close 			postgresql_do_out_close
+	#define 	DB_out_copy 			postgresql_do_out_copy
 
 	int 			DB_num_rows ( PSQL_result *res );
 	DB_row 		DB_fetch_row ( PSQL_result *res );
 	void 		DB_free_result ( PSQL_result *res );
 	DB_result 	DB_query ( const char* );
 	DB_result 	DB_out_query ( const char* );
+	BOOL 		DB_out_copy ( const char*, const char*, size_t );
+#endif
+
+#ifdef 	HAVE_LIBSQLITE3
+	#include	<sqlite3.h>
+
+	typedef struct  {
+		char ***rows;
+		int nrows;
+		int ncols;
+		int index;
+	} SQLITE_result;
+
+	typedef 	SQLITE_result* 	DB_result;
+	typedef 	char** 		DB_row;
+
+	#define 	DB_init 			sqlite_do_init
+	#define 	DB_is_init 		sqlite_is_init
+	#define 	DB_query 			sqlite_do_query
+	#define 	DB_num_rows 		sqlite_num_rows
+	#define 	DB_fetch_row 		sqlite_fetch_row
+	#define 	DB_free_result 	sqlite_free_result
+	#define 	DB_escape_string 	sqlite_do_escape_string
+	#define 	DB_close 			sqlite_do_close
+
+	#define 	DB_out_init 			sqlite_do_out_init
+	#define 	DB_is_out_init 		sqlite_is_out_init
+	#define 	DB_out_query 			sqlite_do_out_query
+	#define 	DB_out_exec 			sqlite_do_out_exec
+	#define 	DB_out_escape_string 	sqlite_do_out_escape_string
+	#define 	DB_out_close 			sqlite_do_out_close
+
+	int 			DB_num_rows ( SQLITE_result *res );
+	DB_row 		DB_fetch_row ( SQLITE_result *res );
+	void 		DB_free_result ( SQLITE_result *res );
+	DB_result 	DB_query ( const char* );
+	DB_result 	DB_out_query ( const char* );
 #endif
 
 	void*          DB_init();
@@ -95,6 +135,7 @@
 	void           DB_close();
 
 	void*          DB_out_init();
+	BOOL           DB_out_exec ( const char* );
 	unsigned long  DB_out_escape_string ( char **to, const char *from, unsigned long length );
 	void           DB_out_close();
 
@@ -0,0 +1,374 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  json.c
+ *
+ *    Description:  Streaming writer of JSON files, buffered and replaced atomically
+ *
+ *        Version:  0.1
+ *        Created:  18/10/2026 23:41:08
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  BlackLight (http://0x00.ath.cx), <blacklight@autistici.org>
+ *        Licence:  GNU GPL v.3
+ *        Company:  DO WHAT YOU WANT CAUSE A PIRATE IS FREE, YOU ARE A PIRATE!
+ *
+ * =====================================================================================
+ */
+
+#include	"spp_ai.h"
+#include	"cencode.h"
+
+#include	<stdio.h>
+#include	<stdlib.h>
+#include	<string.h>
+#include	<unistd.h>
+#include	<sys/stat.h>
+#include	<time.h>
+
+/** \defgroup json Streaming writer of JSON files
+ * @{ */
+
+/** Size of the output buffer of a JSON writer */
+#define 	JSON_BUFFER_SIZE 	(1 << 20)
+
+/**
+ * \brief  Write a sequence of bytes through the output buffer of a JSON writer
+ * \param  writer 	JSON writer
+ * \param  data 	Bytes to be written
+ * \param  len 	Number of bytes
+ */
+
+PRIVATE void
+__AI_json_write ( AI_json_writer *writer, const char *data, size_t len )
+{
+	if ( writer->len + len > writer->size )
+	{
+		if ( writer->len > 0 && fwrite ( writer->buf, 1, writer->len, writer->fp ) != writer->len )
+			writer->error = true;
+
+		writer->len = 0;
+
+		/* Larger than the whole buffer: straight to the file */
+		if ( len > writer->size )
+		{
+			if ( fwrite ( data, 1, len, writer->fp ) != len )
+				writer->error = true;
+
+			return;
+		}
+	}
+
+	memcpy ( writer->buf + writer->len, data, len );
+	writer->len += len;
+}		/* -----  end of function __AI_json_write  ----- */
+
+/**
+ * \brief  Write the separator needed before a new value in the current object or array
+ * \param  writer 	JSON writer
+ */
+
+PRIVATE void
+__AI_json_separator ( AI_json_writer *writer )
+{
+	if ( writer->after_key )
+	{
+		writer->after_key = false;
+		return;
+	}
+
+	if ( writer->depth > 0 )
+	{
+		if ( writer->has_items[ writer->depth ] )
+			__AI_json_write ( writer, ",", 1 );
+
+		writer->has_items[ writer->depth ] = true;
+	}
+}		/* -----  end of function __AI_json_separator  ----- */
+
+/**
+ * \brief  Open an object or an array
+ * \param  writer 	JSON writer
+ * \param  c 	Opening character
+ */
+
+PRIVATE void
+__AI_json_begin ( AI_json_writer *writer, char c )
+{
+	__AI_json_separator ( writer );
+	__AI_json_write ( writer, &c, 1 );
+
+	if ( writer->depth + 1 >= JSON_MAX_DEPTH )
+		AI_fatal_err ( "JSON document nested too deeply", __FILE__, __LINE__ );
+
+	writer->has_items[ ++writer->depth ] = false;
+}		/* -----  end of function __AI_json_begin  ----- */
+
+/**
+ * \brief  Close an object or an array
+ * \param  writer 	JSON writer
+ * \param  c 	Closing character
+ */
+
+PRIVATE void
+__AI_json_end ( AI_json_writer *writer, char c )
+{
+	__AI_json_write ( writer, &c, 1 );
+
+	if ( writer->depth > 0 )
+		writer->depth--;
+}		/* -----  end of function __AI_json_end  ----- */
+
+/**
+ * \brief  Open a JSON file for writing. The document is written to <file>.tmp and renamed over the file when it
+ * is closed, so that a reader never sees a partial document
+ * \param  file 	Path of the JSON file
+ * \return The JSON writer, or NULL if the file couldn't be opened
+ */
+
+AI_json_writer*
+AI_json_open ( const char *file )
+{
+	AI_json_writer *writer = NULL;
+
+	if ( !( writer = (AI_json_writer*) calloc ( 1, sizeof ( AI_json_writer ))))
+		AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+	snprintf ( writer->file, sizeof ( writer->file ), "%s", file );
+	snprintf ( writer->tmp_file, sizeof ( writer->tmp_file ), "%s.tmp", file );
+
+	if ( !( writer->fp = fopen ( writer->tmp_file, "w" )))
+	{
+		free ( writer );
+		return NULL;
+	}
+
+	writer->size = JSON_BUFFER_SIZE;
+
+	if ( !( writer->buf = (char*) malloc ( writer->size )))
+		AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+	return writer;
+}		/* -----  end of function AI_json_open  ----- */
+
+/**
+ * \brief  Flush and close a JSON file, replacing the previous version of the file, and free the writer
+ * \param  writer 	JSON writer
+ * \return true if the whole document was written, false otherwise (the previous version of the file is kept)
+ */
+
+BOOL
+AI_json_close ( AI_json_writer *writer )
+{
+	BOOL ok;
+
+	__AI_json_write ( writer, "\n", 1 );
+
+	if ( writer->len > 0 && fwrite ( writer->buf, 1, writer->len, writer->fp ) != writer->len )
+		writer->error = true;
+
+	if ( fclose ( writer->fp ) != 0 )
+		writer->error = true;
+
+	if ( !writer->error )
+	{
+		chmod ( writer->tmp_file, 0644 );
+
+		if ( rename ( writer->tmp_file, writer->file ) != 0 )
+			writer->error = true;
+	}
+
+	if ( writer->error )
+		unlink ( writer->tmp_file );
+
+	ok = !writer->error;
+	free ( writer->buf );
+	free ( writer->scratch );
+	free ( writer );
+	return ok;
+}		/* -----  end of function AI_json_close  ----- */
+
+/**
+ * \brief  Open a JSON object
+ * \param  writer 	JSON writer
+ */
+
+void
+AI_json_begin_object ( AI_json_writer *writer )
+{
+	__AI_json_begin ( writer, '{' );
+}		/* -----  end of function AI_json_begin_object  ----- */
+
+/**
+ * \brief  Close a JSON object
+ * \param  writer 	JSON writer
+ */
+
+void
+AI_json_end_object ( AI_json_writer *writer )
+{
+	__AI_json_end ( writer, '}' );
+}		/* -----  end of function AI_json_end_object  ----- */
+
+/**
+ * \brief  Open a JSON array
+ * \param  writer 	JSON writer
+ */
+
+void
+AI_json_begin_array ( AI_json_writer *writer )
+{
+	__AI_json_begin ( writer, '[' );
+}		/* -----  end of function AI_json_begin_array  ----- */
+
+/**
+ * \brief  Close a JSON array
+ * \param  writer 	JSON writer
+ */
+
+void
+AI_json_end_array ( AI_json_writer *writer )
+{
+	__AI_json_end ( writer, ']' );
+}		/* -----  end of function AI_json_end_array  ----- */
+
+/**
+ * \brief  Write the key of the next member of the current object
+ * \param  writer 	JSON writer
+ * \param  key 	Key (not escaped, it is supposed to be a plain identifier)
+ */
+
+void
+AI_json_key ( AI_json_writer *writer, const char *key )
+{
+	__AI_json_separator ( writer );
+	__AI_json_write ( writer, "\"", 1 );
+	__AI_json_write ( writer, key, strlen ( key ));
+	__AI_json_write ( writer, "\":", 2 );
+	writer->after_key = true;
+}		/* -----  end of function AI_json_key  ----- */
+
+/**
+ * \brief  Write a string value, escaping the quotes, the backslashes and the control characters
+ * \param  writer 	JSON writer
+ * \param  str 	String (NULL is written as null)
+ */
+
+void
+AI_json_string ( AI_json_writer *writer, const char *str )
+{
+	const char  *c     = NULL,
+			  *start = NULL;
+	char        escaped[8];
+
+	__AI_json_separator ( writer );
+
+	if ( !str )
+	{
+		__AI_json_write ( writer, "null", 4 );
+		return;
+	}
+
+	__AI_json_write ( writer, "\"", 1 );
+
+	/* The runs of characters not to be escaped are written at once */
+	for ( c = start = str; *c; c++ )
+	{
+		if ( *c != '"' && *c != '\\' && (unsigned char) *c >= 0x20 )
+			continue;
+
+		__AI_json_write ( writer, start, c - start );
+
+		if ( *c == '"' || *c == '\\' )
+		{
+			escaped[0] = '\\';
+			escaped[1] = *c;
+			__AI_json_write ( writer, escaped, 2 );
+		} else {
+			snprintf ( escaped, sizeof ( escaped ), "\\u%04x", (unsigned char) *c );
+			__AI_json_write ( writer, escaped, 6 );
+		}
+
+		start = c + 1;
+	}
+
+	__AI_json_write ( writer, start, c - start );
+	__AI_json_write ( writer, "\"", 1 );
+}		/* -----  end of function AI_json_string  ----- */
+
+/**
+ * \brief  Write an unsigned integer value
+ * \param  writer 	JSON writer
+ * \param  value 	Value
+ */
+
+void
+AI_json_uint ( AI_json_writer *writer, unsigned long value )
+{
+	char buf[32];
+	int  len;
+
+	__AI_json_separator ( writer );
+	len = snprintf ( buf, sizeof ( buf ), "%lu", value );
+	__AI_json_write ( writer, buf, len );
+}		/* -----  end of function AI_json_uint  ----- */
+
+/**
+ * \brief  Write a timestamp as a string in the same format as ctime(3), without the trailing newline
+ * \param  writer 	JSON writer
+ * \param  timestamp 	Timestamp
+ */
+
+void
+AI_json_time ( AI_json_writer *writer, time_t timestamp )
+{
+	struct tm  tm;
+	char       buf[64] = { 0 };
+
+	/* localtime_r, unlike ctime, doesn't share a static buffer with the other threads */
+	localtime_r ( &timestamp, &tm );
+	strftime ( buf, sizeof ( buf ), "%a %b %e %H:%M:%S %Y", &tm );
+	AI_json_string ( writer, buf );
+}		/* -----  end of function AI_json_time  ----- */
+
+/**
+ * \brief  Write a sequence of bytes as a base64 string. The encoding goes through a scratch buffer owned by the
+ * writer and reused by all the values, instead of a buffer allocated for each value
+ * \param  writer 	JSON writer
+ * \param  data 	Bytes to be encoded
+ * \param  len 	Number of bytes
+ */
+
+void
+AI_json_base64 ( AI_json_writer *writer, const char *data, size_t len )
+{
+	base64_encodestate  state;
+	size_t              needed  = 4 * ( len / 3 + 1 ) + 4;
+	int                 written = 0;
+
+	if ( needed > writer->scratch_size )
+	{
+		writer->scratch_size = ( needed > 2 * writer->scratch_size ) ? needed : 2 * writer->scratch_size;
+
+		if ( !( writer->scratch = (char*) realloc ( writer->scratch, writer->scratch_size )))
+			AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+	}
+
+	base64_init_encodestate ( &state );
+	written  = base64_encode_block ( data, (int) len, writer->scratch, &state );
+	written += base64_encode_blockend ( writer->scratch + written, &state );
+
+	/* The encoder terminates its output with a newline */
+	if ( written > 0 && writer->scratch[ written - 1 ] == '\n' )
+		written--;
+
+	/* The base64 alphabet needs no escaping */
+	__AI_json_separator ( writer );
+	__AI_json_write ( writer, "\"", 1 );
+	__AI_json_write ( writer, writer->scratch, written );
+	__AI_json_write ( writer, "\"", 1 );
+}		/* -----  end of function AI_json_base64  ----- */
+
+/** @} */
+
@@ -48,7 +48,7 @@ __AI_get_function_name ( const char *orig_stmt )
 	char function_name[4096];
 	char *stmt = NULL;
 
-	if ( !( stmt = (char*) alloca ( strlen ( orig_stmt ))))
+	if ( !( stmt = (char*) alloca ( strlen ( orig_stmt ) + 1 )))
 		return NULL;
 	strcpy ( stmt, orig_stmt );
 
@@ -78,10 +78,11 @@ __AI_get_function_arguments ( char *orig_stmt, int *n_args )
 	char **args  = NULL;
 	char *tok    = NULL;
 	char *stmt   = NULL;
+	char *saveptr = NULL;
 	unsigned long int  par_pos = 0;
 	     *n_args = 0;
 
-	if ( !( stmt = (char*) alloca ( strlen ( orig_stmt ))))
+	if ( !( stmt = (char*) alloca ( strlen ( orig_stmt ) + 1 )))
 		return NULL;
 	strcpy ( stmt, orig_stmt );
 
@@ -94,14 +95,15 @@ __AI_get_function_arguments ( char *orig_stmt, int *n_args )
 	if ( stmt [ strlen(stmt) - 1 ] == ')' )
 		stmt[ strlen(stmt) - 1 ] = 0;
 
-	tok = (char*) strtok ( stmt, "," );
+	/* The correlation coefficients are computed concurrently by the scoring workers, so strtok's static state can't be used */
+	tok = (char*) strtok_r ( stmt, ",", &saveptr );
 
 	while ( tok )  {
 		if ( !( args = (char**) realloc ( args, (++(*n_args)) * sizeof ( char* ))))
 			AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
 
 		args [ (*n_args) - 1 ] = strdup ( tok );
-		tok = (char*) strtok ( NULL, " " );
+		tok = (char*) strtok_r ( NULL, " ", &saveptr );
 	}
 
 	if ( !(*n_args) )
@@ -27,11 +27,9 @@
 /** \defgroup modules Software component for loading extra user-provided modules for correlating alerts
  * @{ */
 
-PRIVATE double (**corr_functions)(const AI_snort_alert*, const AI_snort_alert*) = NULL;
-PRIVATE size_t n_corr_functions = 0;
-
-PRIVATE double (**weight_functions)() = NULL;
-PRIVATE size_t n_weight_functions = 0;
+/** Descriptors of the correlation modules written in C */
+PRIVATE const AI_corr_module_descriptor **corr_modules = NULL;
+PRIVATE size_t n_corr_modules = 0;
 
 #ifdef HAVE_LIBPYTHON2_6
 
@@ -41,33 +39,119 @@ PRIVATE size_t   n_py_corr_functions = 0;
 PRIVATE PyObject **py_weight_functions = NULL;
 PRIVATE size_t   n_py_weight_functions = 0;
 
+/** Batch correlation functions of the Python modules (NULL for the modules not providing AI_corr_index_batch) */
+PRIVATE PyObject **py_batch_functions = NULL;
+
+/** Constructor of the 'alert' objects of the 'snortai' Python module */
+PRIVATE PyObject *py_alert_class = NULL;
+
+/** Constructor of the arrays of the 'array' Python module */
+PRIVATE PyObject *py_array_class = NULL;
+
 #endif
 
 /**
- * \brief  Get the correlation functions from the extra correlation modules as array of function pointers
- * \param  n_functions 	Number of function pointers in the array
- * \return The array of correlation functions
+ * \brief  Get the descriptors of the extra correlation modules written in C
+ * \param  n_modules 	Number of modules in the array
+ * \return The array of the descriptors of the modules
  */
 
-double
-(**AI_get_corr_functions ( size_t *n_functions )) (const AI_snort_alert*, const AI_snort_alert*)
+const AI_corr_module_descriptor**
+AI_get_corr_modules ( size_t *n_modules )
 {
-	*n_functions = n_corr_functions;
-	return corr_functions;
-}		/* -----  end of function AI_get_corr_functions  ----- */
+	*n_modules = n_corr_modules;
+	return corr_modules;
+}		/* -----  end of function AI_get_corr_modules  ----- */
 
 /**
- * \brief  Get the weights of the correlation extra modules as array of function pointers
- * \param  n_functions 	Number of function pointers in the array
- * \return The array of correlation weights functions
+ * \brief  Get the descriptor of a correlation module from its shared library. The modules exporting the
+ * symbol AI_corr_module provide their own descriptor, while a descriptor is built here for the modules only
+ * exporting AI_corr_index and AI_corr_index_weight
+ * \param  dl_handle 	Handle of the shared library
+ * \param  fname 	Path of the shared library
+ * \return The descriptor of the module
  */
 
-double
-(**AI_get_corr_weights ( size_t *n_functions )) ()
+PRIVATE const AI_corr_module_descriptor*
+__AI_corr_module_load ( void *dl_handle, const char *fname )
 {
-	*n_functions = n_weight_functions;
-	return weight_functions;
-}		/* -----  end of function AI_get_corr_weights  ----- */
+	const AI_corr_module_descriptor  *module = NULL;
+	AI_corr_module_descriptor        *legacy = NULL;
+	char                             *err    = NULL;
+
+	if (( module = (const AI_corr_module_descriptor*) dlsym ( dl_handle, "AI_corr_module" )))
+	{
+		if ( module->version == 0 || module->version > AI_CORR_MODULE_VERSION )
+		{
+			_dpd.errMsg ( "AIPreproc: The correlation module '%s' has version %u, supported versions are 1 to %u\n",
+				fname, module->version, AI_CORR_MODULE_VERSION );
+			AI_fatal_err ( "Unsupported version of a correlation module", __FILE__, __LINE__ );
+		}
+
+		if ( !module->weight || ( !module->index && !module->index_batch ))
+		{
+			_dpd.errMsg ( "AIPreproc: The correlation module '%s' provides no weight or no correlation index function\n", fname );
+			AI_fatal_err ( "Invalid correlation module", __FILE__, __LINE__ );
+		}
+
+		return module;
+	}
+
+	/* The modules exporting only the functions are scored one couple at a time, and since they never declared
+	 * themselves thread-safe their calls are serialised */
+	if ( !( legacy = (AI_corr_module_descriptor*) calloc ( 1, sizeof ( AI_corr_module_descriptor ))))
+	{
+		AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+	}
+
+	legacy->version = AI_CORR_MODULE_VERSION;
+	legacy->name    = strdup ( fname );
+	legacy->flags   = 0;
+
+	*(void**) (&( legacy->index )) = dlsym ( dl_handle, "AI_corr_index" );
+
+	if ( !legacy->index )
+	{
+		if (( err = dlerror() ))
+		{
+			_dpd.errMsg ( "dlsym: %s\n", err );
+		}
+
+		AI_fatal_err ( "dlsym error", __FILE__, __LINE__ );
+	}
+
+	*(void**) (&( legacy->weight )) = dlsym ( dl_handle, "AI_corr_index_weight" );
+
+	if ( !legacy->weight )
+	{
+		if (( err = dlerror() ))
+		{
+			_dpd.errMsg ( "dlsym: %s\n", err );
+		}
+
+		AI_fatal_err ( "dlsym error", __FILE__, __LINE__ );
+	}
+
+	return legacy;
+}		/* -----  end of function __AI_corr_module_load  ----- */
+
+/**
+ * \brief  Call the teardown functions of the correlation modules when Snort exits
+ * \param  signal 	Signal received by Snort
+ * \param  arg 	Unused
+ */
+
+void
+AI_corr_modules_exit ( int signal, void *arg )
+{
+	size_t i;
+
+	for ( i=0; i < n_corr_modules; i++ )
+	{
+		if ( corr_modules[i]->teardown )
+			corr_modules[i]->teardown();
+	}
+}		/* -----  end of function AI_corr_modules_exit  ----- */
 
 #ifdef HAVE_LIBPYTHON2_6
 /**
@@ -96,6 +180,20 @@ AI_get_py_weights ( size_t *n_functions )
 	return py_weight_functions;
 }		/* -----  end of function AI_get_py_weights  ----- */
 
+/**
+ * \brief  Get the batch correlation functions from the Python modules, if Python support is enabled. The array
+ * has an element for each correlation module, NULL if the module doesn't provide the AI_corr_index_batch function
+ * \param  n_functions 	Reference to the number of functions in the array
+ * \return The array of Python batch correlation functions as PyObject**
+ */
+
+PyObject**
+AI_get_py_batch_functions ( size_t *n_functions )
+{
+	*n_functions = n_py_corr_functions;
+	return py_batch_functions;
+}		/* -----  end of function AI_get_py_batch_functions  ----- */
+
 /**
  * \brief  Convert an AI_snort_alert object to a PyAlert object that can be managed by a Python module
  * \param  alert 	AI_snort_alert object to be converted
@@ -108,25 +206,28 @@ AI_alert_to_pyalert ( AI_snort_alert *alert )
 	PyObject *pyalert = NULL;
 
 	PyObject *pMod  = NULL,
-		    *pObj  = NULL,
 		    *pArgs = NULL;
 
 	char src_addr[INET_ADDRSTRLEN] = { 0 },
 		dst_addr[INET_ADDRSTRLEN] = { 0 };
 	
-	if ( !( pMod = PyImport_ImportModule ( "snortai" )))
+	/* The 'snortai' module is only imported once, not once per alert */
+	if ( !py_alert_class )
 	{
-		PyErr_Print();
-		AI_fatal_err ( "Could not load Python module 'snortai'", __FILE__, __LINE__ );
-	}
+		if ( !( pMod = PyImport_ImportModule ( "snortai" )))
+		{
+			PyErr_Print();
+			AI_fatal_err ( "Could not load Python module 'snortai'", __FILE__, __LINE__ );
+		}
 
-	if ( !( pObj = PyObject_GetAttrString ( pMod, "alert" )))
-	{
-		PyErr_Print();
-		AI_fatal_err ( "'alert' object not found in the Python module 'snortai'", __FILE__, __LINE__ );
-	}
+		if ( !( py_alert_class = PyObject_GetAttrString ( pMod, "alert" )))
+		{
+			PyErr_Print();
+			AI_fatal_err ( "'alert' object not found in the Python module 'snortai'", __FILE__, __LINE__ );
+		}
 
-	Py_DECREF ( pMod );
+		Py_DECREF ( pMod );
+	}
 
 	if ( !( pArgs = Py_BuildValue ( "(OOOOOOOOOOOOO)",
 		Py_None,
@@ -147,15 +248,176 @@ AI_alert_to_pyalert ( AI_snort_alert *alert )
 		AI_fatal_err ( "Could not initialize the argument list for calling the Python 'alert' constructor", __FILE__, __LINE__ );
 	}
 
-	if ( !( pyalert = PyObject_CallObject ( pObj, pArgs )))
+	if ( !( pyalert = PyObject_CallObject ( py_alert_class, pArgs )))
 	{
 		PyErr_Print();
 		AI_fatal_err ( "Could not call the constructor over the Python object 'alert'", __FILE__, __LINE__ );
 	}
 
-	Py_DECREF ( pArgs ); Py_DECREF ( pObj );
+	Py_DECREF ( pArgs );
 	return pyalert;
 }		/* -----  end of function AI_alert_to_pyalert  ----- */
+
+/**
+ * \brief  Get the correlation index of a couple of alerts from the correlation function of a Python module
+ * \param  py_function 	Correlation function of the module
+ * \param  a 	Python object of the first alert
+ * \param  b 	Python object of the second alert
+ * \return The correlation index
+ */
+
+double
+AI_py_corr_index ( PyObject *py_function, PyObject *a, PyObject *b )
+{
+	double    value = 0.0;
+	PyObject  *pArgs = NULL,
+			*pRet  = NULL;
+
+	if ( !( pArgs = Py_BuildValue ( "(OO)", a, b )))
+	{
+		PyErr_Print();
+		AI_fatal_err ( "Could not initialize the Python arguments for the call", __FILE__, __LINE__ );
+	}
+
+	if ( !( pRet = PyEval_CallObject ( py_function, pArgs )))
+	{
+		PyErr_Print();
+		AI_fatal_err ( "Could not call the correlation function from the Python module", __FILE__, __LINE__ );
+	}
+
+	if ( !( PyArg_Parse ( pRet, "d", &value )))
+	{
+		PyErr_Print();
+		AI_fatal_err ( "Could not parse the correlation value out of the Python correlation function", __FILE__, __LINE__ );
+	}
+
+	Py_DECREF ( pRet );
+	Py_DECREF ( pArgs );
+	return value;
+}		/* -----  end of function AI_py_corr_index  ----- */
+
+/**
+ * \brief  Build the list of the alerts passed to the batch functions of the Python modules
+ * \param  py_alerts 	Python objects of the alerts (NULL for the alerts not to be passed, that are None in the list)
+ * \param  n_alerts 	Number of alerts
+ * \return The Python list
+ */
+
+PyObject*
+AI_py_alerts_list ( PyObject **py_alerts, unsigned int n_alerts )
+{
+	PyObject      *pAlerts = NULL,
+			    *pAlert  = NULL;
+	unsigned int  i;
+
+	if ( !( pAlerts = PyList_New ( n_alerts )))
+	{
+		PyErr_Print();
+		AI_fatal_err ( "Could not create the Python list of the alerts", __FILE__, __LINE__ );
+	}
+
+	for ( i=0; i < n_alerts; i++ )
+	{
+		pAlert = ( py_alerts[i] ) ? py_alerts[i] : Py_None;
+		Py_INCREF ( pAlert );
+		PyList_SET_ITEM ( pAlerts, i, pAlert );
+	}
+
+	return pAlerts;
+}		/* -----  end of function AI_py_alerts_list  ----- */
+
+/**
+ * \brief  Build the array.array('I') of the couples of alerts passed to the batch functions of the Python modules,
+ * containing the indexes of the two alerts of each couple one after the other
+ * \param  couples 	Couples of alerts
+ * \param  n_couples 	Number of couples
+ * \return The Python array
+ */
+
+PyObject*
+AI_py_couples_array ( const AI_correlation_candidate *couples, size_t n_couples )
+{
+	PyObject *pMod   = NULL,
+		    *pRaw   = NULL,
+		    *pPairs = NULL;
+
+	if ( !py_array_class )
+	{
+		if ( !( pMod = PyImport_ImportModule ( "array" )))
+		{
+			PyErr_Print();
+			AI_fatal_err ( "Could not load Python module 'array'", __FILE__, __LINE__ );
+		}
+
+		if ( !( py_array_class = PyObject_GetAttrString ( pMod, "array" )))
+		{
+			PyErr_Print();
+			AI_fatal_err ( "'array' object not found in the Python module 'array'", __FILE__, __LINE__ );
+		}
+
+		Py_DECREF ( pMod );
+	}
+
+	/* The couples are two unsigned int each, so the array is built from their raw memory at once */
+	if ( !( pRaw = PyString_FromStringAndSize ( (const char*) couples, n_couples * sizeof ( AI_correlation_candidate ))) ||
+			!( pPairs = PyObject_CallFunction ( py_array_class, "sO", "I", pRaw )))
+	{
+		PyErr_Print();
+		AI_fatal_err ( "Could not create the Python array of the couples of alerts", __FILE__, __LINE__ );
+	}
+
+	Py_DECREF ( pRaw );
+	return pPairs;
+}		/* -----  end of function AI_py_couples_array  ----- */
+
+/**
+ * \brief  Read the scores returned by the batch function of a Python correlation module, either as an object
+ * supporting the buffer protocol (e.g. array.array('d')) or as a sequence of numbers
+ * \param  pRet 	Object returned by the batch function
+ * \param  scores 	Array that will contain the scores
+ * \param  n_scores 	Number of scores expected
+ */
+
+void
+AI_py_batch_scores_read ( PyObject *pRet, double *scores, size_t n_scores )
+{
+	const void  *buf  = NULL;
+	Py_ssize_t  len   = 0,
+			  i;
+	PyObject    *pSeq = NULL;
+
+	/* Buffer of doubles: copied at once */
+	if ( PyObject_CheckReadBuffer ( pRet ) && PyObject_AsReadBuffer ( pRet, &buf, &len ) == 0 )
+	{
+		if ( (size_t) len != n_scores * sizeof ( double ))
+			AI_fatal_err ( "The batch function of the Python correlation module returned a wrong number of scores", __FILE__, __LINE__ );
+
+		memcpy ( scores, buf, len );
+		return;
+	}
+
+	PyErr_Clear();
+
+	if ( !( pSeq = PySequence_Fast ( pRet, "AI_corr_index_batch() must return a buffer or a sequence of numbers" )))
+	{
+		PyErr_Print();
+		AI_fatal_err ( "Could not parse the correlation values out of the Python batch correlation function", __FILE__, __LINE__ );
+	}
+
+	if ( (size_t) PySequence_Fast_GET_SIZE ( pSeq ) != n_scores )
+		AI_fatal_err ( "The batch function of the Python correlation module returned a wrong number of scores", __FILE__, __LINE__ );
+
+	for ( i=0; i < (Py_ssize_t) n_scores; i++ )
+		scores[i] = PyFloat_AsDouble ( PySequence_Fast_GET_ITEM ( pSeq, i ));
+
+	Py_DECREF ( pSeq );
+
+	if ( PyErr_Occurred() )
+	{
+		PyErr_Print();
+		AI_fatal_err ( "Could not parse the correlation values out of the Python batch correlation function", __FILE__, __LINE__ );
+	}
+}		/* -----  end of function AI_py_batch_scores_read  ----- */
 #endif
 
 /**
@@ -209,43 +471,21 @@ AI_init_corr_modules ()
 				AI_fatal_err ( "dlopen error", __FILE__, __LINE__ );
 			}
 
-			free ( fname );
-			fname = NULL;
-
-			if ( !( corr_functions = (double(**)(const AI_snort_alert*, const AI_snort_alert*))
-						realloc ( corr_functions, (++n_corr_functions) * sizeof ( double(*)(const AI_snort_alert*, const AI_snort_alert*) ))))
+			if ( !( corr_modules = (const AI_corr_module_descriptor**) realloc ( corr_modules, (++n_corr_modules) * sizeof ( AI_corr_module_descriptor* ))))
 			{
 				AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
 			}
 
-			*(void**) (&(corr_functions[ n_corr_functions - 1 ])) = dlsym ( dl_handles[n_dl_handles-1], "AI_corr_index" );
-
-			if ( !corr_functions[ n_corr_functions - 1 ] )
-			{
-				if (( err = dlerror() ))
-				{
-					_dpd.errMsg ( "dlsym: %s\n", err );
-				}
-
-				AI_fatal_err ( "dlsym error", __FILE__, __LINE__ );
-			}
+			corr_modules[ n_corr_modules - 1 ] = __AI_corr_module_load ( dl_handles[n_dl_handles-1], fname );
 
-			if ( !( weight_functions = (double(**)()) realloc ( weight_functions, (++n_weight_functions) * sizeof ( double(*)() ))))
+			if ( corr_modules[ n_corr_modules - 1 ]->init && corr_modules[ n_corr_modules - 1 ]->init() != 0 )
 			{
-				AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+				_dpd.errMsg ( "AIPreproc: The correlation module '%s' could not be initialized\n", fname );
+				AI_fatal_err ( "Correlation module initialization error", __FILE__, __LINE__ );
 			}
 
-			*(void**) (&(weight_functions[ n_weight_functions - 1 ])) = dlsym ( dl_handles[n_dl_handles-1], "AI_corr_index_weight" );
-
-			if ( !weight_functions[ n_weight_functions - 1 ] )
-			{
-				if (( err = dlerror() ))
-				{
-					_dpd.errMsg ( "dlsym: %s\n", err );
-				}
-
-				AI_fatal_err ( "dlsym error", __FILE__, __LINE__ );
-			}
+			free ( fname );
+			fname = NULL;
 		} else if ( preg_match ( "\\.py$", dir_info->d_name, NULL, NULL )) {
 			#ifdef HAVE_LIBPYTHON2_6
 
@@ -280,9 +520,22 @@ AI_init_corr_modules ()
 				AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
 			}
 
+			if ( !( py_batch_functions = (PyObject**) realloc ( py_batch_functions, n_py_corr_functions * sizeof ( PyObject* ))))
+			{
+				AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+			}
+
+			/* AI_corr_index_batch is optional: a module providing it is called once per correlation pass
+			 * over all the couples of alerts to be scored, instead of once per couple */
+			if ( !( py_batch_functions[ n_py_corr_functions - 1 ] = PyObject_GetAttrString ( pObj, "AI_corr_index_batch" )))
+				PyErr_Clear();
+
 			if ( !( py_corr_functions[ n_py_corr_functions - 1 ] = PyObject_GetAttrString ( pObj, "AI_corr_index" )))
 			{
-				AI_fatal_err ( "AI_corr_index() method not found in the Python correlation module", __FILE__, __LINE__ );
+				PyErr_Clear();
+
+				if ( !py_batch_functions[ n_py_corr_functions - 1 ] )
+					AI_fatal_err ( "AI_corr_index() method not found in the Python correlation module", __FILE__, __LINE__ );
 			}
 
 			if ( !( py_weight_functions = (PyObject**) realloc ( py_weight_functions, (++n_py_weight_functions) * sizeof ( PyObject* ))))
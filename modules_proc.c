@@ -0,0 +1,882 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  modules_proc.c
+ *
+ *    Description:  Execution of the extra correlation modules in helper processes
+ *
+ *        Version:  0.1
+ *        Created:  18/10/2026 21:37:52
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  BlackLight (http://0x00.ath.cx), <blacklight@autistici.org>
+ *        Licence:  GNU GPL v.3
+ *        Company:  DO WHAT YOU WANT CAUSE A PIRATE IS FREE, YOU ARE A PIRATE!
+ *
+ * =====================================================================================
+ */
+
+#include	"spp_ai.h"
+
+#include	<errno.h>
+#include	<fcntl.h>
+#include	<math.h>
+#include	<signal.h>
+#include	<stdio.h>
+#include	<stdlib.h>
+#include	<string.h>
+#include	<time.h>
+#include	<unistd.h>
+#include	<poll.h>
+#include	<sys/mman.h>
+#include	<sys/socket.h>
+#include	<sys/types.h>
+#include	<sys/wait.h>
+
+/** \defgroup modules_proc Execution of the extra correlation modules in helper processes. The alerts and the
+ * couples of a correlation pass are written by the correlation thread in a segment of shared memory that the
+ * helpers map read-only, and each helper writes the scores of its share of the couples in a second shared
+ * segment: a module crashing only takes its helper down, and the Python modules run in parallel, each helper
+ * with its own interpreter
+ * @{ */
+
+/** Alignment of the areas in the shared segments */
+#define 	PROC_ALIGN(x) 	(((x) + 7) & ~((size_t) 7))
+
+/** Offset of a missing string in the shared segment of the alerts */
+#define 	PROC_NO_STRING 	((size_t) -1)
+
+/** Time, in seconds, the helpers have for replying to the requests of a pass before being killed */
+#define 	PROC_REPLY_TIMEOUT 	300
+
+/** Time, in seconds, the helpers have for terminating on SIGTERM when Snort exits before being killed */
+#define 	PROC_EXIT_GRACE 	2
+
+/** Segment of shared memory, backed by an unlinked file */
+typedef struct  {
+	int     fd;
+	void    *addr;
+	size_t  size;
+} AI_proc_segment;
+
+/** Header of the shared segment of the alerts, followed by the flags of the modules to be run, the rows of
+ * the alerts, the couples to be scored and the strings of the alerts */
+typedef struct  {
+	unsigned int  n_alerts;
+	size_t        n_couples;
+	size_t        n_modules;
+	size_t        rows_offset;
+	size_t        couples_offset;
+	size_t        strings_offset;
+} AI_proc_header;
+
+/** Alert in the shared segment: a copy of the alert with its pointers cleared, and the offsets of its strings */
+typedef struct  {
+	AI_snort_alert  alert;
+	size_t          desc;
+	size_t          classification;
+} AI_proc_alert;
+
+/** Request sent to a helper: score the couples [first, first+n) of the current pass */
+typedef struct  {
+	unsigned long  pass;
+	size_t         alerts_size;
+	size_t         results_size;
+	size_t         first;
+	size_t         n;
+} AI_proc_request;
+
+/** Reply of a helper to a request */
+typedef struct  {
+	unsigned long  pass;
+	int            status;
+} AI_proc_reply;
+
+/** Helper process, seen from the correlation process */
+typedef struct  {
+	pid_t   pid;
+
+	/** End of the socket pair connected to the helper (-1 once the helper is lost) */
+	int     fd;
+
+	/** Range of couples assigned to the helper in the current pass */
+	size_t  first;
+	size_t  n;
+} AI_proc_helper;
+
+PRIVATE AI_proc_helper   *helpers         = NULL;
+PRIVATE unsigned long    n_helpers        = 0;
+PRIVATE BOOL             helpers_started  = false;
+PRIVATE unsigned long    proc_pass        = 0;
+
+PRIVATE AI_proc_segment  alerts_segment   = { -1, NULL, 0 };
+PRIVATE AI_proc_segment  results_segment  = { -1, NULL, 0 };
+
+/** Set in the helper processes */
+PRIVATE BOOL             is_helper        = false;
+
+/** Serialises the scoring passes of the correlation thread and the stop of the helpers when Snort exits */
+PRIVATE pthread_mutex_t  helpers_mutex    = PTHREAD_MUTEX_INITIALIZER;
+
+/** Set when Snort exits: the correlation thread stops waiting for the helpers */
+PRIVATE volatile BOOL    helpers_exiting  = false;
+
+/**
+ * \brief  Tell whether the current process is a helper process of the correlation modules
+ * \return true in a helper process, false in the Snort process
+ */
+
+BOOL
+AI_corr_modules_proc_is_helper ()
+{
+	return is_helper;
+}		/* -----  end of function AI_corr_modules_proc_is_helper  ----- */
+
+/**
+ * \brief  Get the number of extra correlation modules that can run in the helper processes: the C modules
+ * come first, then the Python ones
+ * \return The number of modules
+ */
+
+PRIVATE size_t
+__AI_proc_n_modules ()
+{
+	size_t n_modules = 0,
+		  n_py       = 0;
+
+	AI_get_corr_modules ( &n_modules );
+
+	#ifdef HAVE_LIBPYTHON2_6
+	AI_get_py_functions ( &n_py );
+	#endif
+
+	return n_modules + n_py;
+}		/* -----  end of function __AI_proc_n_modules  ----- */
+
+/**
+ * \brief  Create a segment of shared memory, as a file in /dev/shm (or in /tmp if /dev/shm is not available)
+ * unlinked right after being created, so that it is only reachable through the descriptors of the processes
+ * \param  segment 	Segment
+ * \return true if the segment was created, false otherwise
+ */
+
+PRIVATE BOOL
+__AI_proc_segment_create ( AI_proc_segment *segment )
+{
+	char path[64];
+
+	snprintf ( path, sizeof ( path ), "/dev/shm/snort_ai_XXXXXX" );
+
+	if (( segment->fd = mkstemp ( path )) < 0 )
+	{
+		snprintf ( path, sizeof ( path ), "/tmp/snort_ai_XXXXXX" );
+
+		if (( segment->fd = mkstemp ( path )) < 0 )
+			return false;
+	}
+
+	unlink ( path );
+	fcntl ( segment->fd, F_SETFD, FD_CLOEXEC );
+	segment->addr = NULL;
+	segment->size = 0;
+	return true;
+}		/* -----  end of function __AI_proc_segment_create  ----- */
+
+/**
+ * \brief  Make a segment of shared memory at least as large as a size, growing it geometrically
+ * \param  segment 	Segment
+ * \param  size 	Size needed
+ */
+
+PRIVATE void
+__AI_proc_segment_reserve ( AI_proc_segment *segment, size_t size )
+{
+	size_t page     = (size_t) sysconf ( _SC_PAGESIZE ),
+		  new_size = ( 2 * segment->size > size ) ? 2 * segment->size : size;
+
+	if ( size <= segment->size )
+		return;
+
+	new_size = ( new_size + page - 1 ) / page * page;
+
+	if ( segment->addr )
+		munmap ( segment->addr, segment->size );
+
+	if ( ftruncate ( segment->fd, (off_t) new_size ) != 0 ||
+			( segment->addr = mmap ( NULL, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, segment->fd, 0 )) == MAP_FAILED )
+		AI_fatal_err ( "Could not allocate the shared memory of the correlation modules", __FILE__, __LINE__ );
+
+	segment->size = new_size;
+}		/* -----  end of function __AI_proc_segment_reserve  ----- */
+
+/**
+ * \brief  Map a segment of shared memory in a helper process, again if the correlation process resized it
+ * \param  segment 	Mapping of the segment in the helper
+ * \param  size 	Current size of the segment
+ * \param  prot 	Protection of the mapping
+ */
+
+PRIVATE void
+__AI_proc_segment_map ( AI_proc_segment *segment, size_t size, int prot )
+{
+	if ( segment->addr && segment->size == size )
+		return;
+
+	if ( segment->addr )
+		munmap ( segment->addr, segment->size );
+
+	if (( segment->addr = mmap ( NULL, size, prot, MAP_SHARED, segment->fd, 0 )) == MAP_FAILED )
+		AI_fatal_err ( "Could not map the shared memory of the correlation modules", __FILE__, __LINE__ );
+
+	segment->size = size;
+}		/* -----  end of function __AI_proc_segment_map  ----- */
+
+/**
+ * \brief  Read or write a whole message on a socket
+ * \param  fd 	Socket
+ * \param  buf 	Message
+ * \param  len 	Length of the message
+ * \param  is_write 	true for writing the message, false for reading it
+ * \param  deadline 	Time by which the message has to be transferred (0 for waiting with no limit)
+ * \return true if the whole message was transferred, false on error, end of file, timeout (errno set to ETIMEDOUT)
+ * or exit of Snort (errno set to ECANCELED)
+ */
+
+PRIVATE BOOL
+__AI_proc_transfer ( int fd, void *buf, size_t len, BOOL is_write, time_t deadline )
+{
+	struct pollfd  pfd;
+	ssize_t        rc  = 0;
+	size_t         off = 0;
+	time_t         now = 0;
+
+	while ( off < len )
+	{
+		if ( deadline != 0 )
+		{
+			if (( now = time ( NULL )) >= deadline )
+			{
+				errno = ETIMEDOUT;
+				return false;
+			}
+
+			if ( helpers_exiting )
+			{
+				errno = ECANCELED;
+				return false;
+			}
+
+			pfd.fd      = fd;
+			pfd.events  = ( is_write ) ? POLLOUT : POLLIN;
+			pfd.revents = 0;
+
+			/* Wait at most a second at a time, so that the exit of Snort is noticed */
+			if (( rc = poll ( &pfd, 1, ( deadline - now > 1 ) ? 1000 : (int) ( deadline - now ) * 1000 )) < 0 && errno == EINTR )
+				continue;
+
+			if ( rc < 0 )
+				return false;
+
+			if ( rc == 0 )
+				continue;
+		}
+
+		rc = ( is_write ) ? send ( fd, (char*) buf + off, len - off, MSG_NOSIGNAL ) : recv ( fd, (char*) buf + off, len - off, 0 );
+
+		if ( rc < 0 && errno == EINTR )
+			continue;
+
+		if ( rc <= 0 )
+			return false;
+
+		off += (size_t) rc;
+	}
+
+	return true;
+}		/* -----  end of function __AI_proc_transfer  ----- */
+
+/**
+ * \brief  Build, in a helper process, the table of the alerts of the pass out of the shared segment. The
+ * alerts are local copies, pointing to their strings in the shared segment
+ * \param  header 	Header of the shared segment of the alerts
+ * \param  alerts 	Array of the local copies of the alerts (reallocated if needed)
+ * \param  table 	Table of the alerts, filled
+ */
+
+PRIVATE void
+__AI_proc_table_build ( const AI_proc_header *header, AI_snort_alert **alerts, AI_alert_table *table )
+{
+	const char           *base    = (const char*) header;
+	const AI_proc_alert  *rows    = (const AI_proc_alert*) ( base + header->rows_offset );
+	const char           *strings = base + header->strings_offset;
+	unsigned int         i;
+	AI_snort_alert       *alert   = NULL;
+
+	if ( header->n_alerts > table->size )
+	{
+		table->size = header->n_alerts;
+
+		if ( !( *alerts = (AI_snort_alert*) realloc ( *alerts, table->size * sizeof ( AI_snort_alert ))) ||
+				!( table->gid = (unsigned int*) realloc ( table->gid, table->size * sizeof ( unsigned int ))) ||
+				!( table->sid = (unsigned int*) realloc ( table->sid, table->size * sizeof ( unsigned int ))) ||
+				!( table->rev = (unsigned int*) realloc ( table->rev, table->size * sizeof ( unsigned int ))) ||
+				!( table->priority = (unsigned short*) realloc ( table->priority, table->size * sizeof ( unsigned short ))) ||
+				!( table->timestamp = (time_t*) realloc ( table->timestamp, table->size * sizeof ( time_t ))) ||
+				!( table->ip_src_addr = (uint32_t*) realloc ( table->ip_src_addr, table->size * sizeof ( uint32_t ))) ||
+				!( table->ip_dst_addr = (uint32_t*) realloc ( table->ip_dst_addr, table->size * sizeof ( uint32_t ))) ||
+				!( table->tcp_src_port = (uint16_t*) realloc ( table->tcp_src_port, table->size * sizeof ( uint16_t ))) ||
+				!( table->tcp_dst_port = (uint16_t*) realloc ( table->tcp_dst_port, table->size * sizeof ( uint16_t ))) ||
+				!( table->grouped_alerts_count = (unsigned int*) realloc ( table->grouped_alerts_count, table->size * sizeof ( unsigned int ))) ||
+				!( table->desc = (const char**) realloc ( table->desc, table->size * sizeof ( const char* ))) ||
+				!( table->classification = (const char**) realloc ( table->classification, table->size * sizeof ( const char* ))) ||
+				!( table->alerts = (AI_snort_alert**) realloc ( table->alerts, table->size * sizeof ( AI_snort_alert* ))))
+			AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+	}
+
+	table->n_alerts = header->n_alerts;
+
+	for ( i=0; i < header->n_alerts; i++ )
+	{
+		alert = &( (*alerts)[i] );
+		*alert = rows[i].alert;
+		alert->desc = ( rows[i].desc != PROC_NO_STRING ) ? (char*) ( strings + rows[i].desc ) : NULL;
+		alert->classification = ( rows[i].classification != PROC_NO_STRING ) ? (char*) ( strings + rows[i].classification ) : NULL;
+
+		table->gid[i]                  = alert->gid;
+		table->sid[i]                  = alert->sid;
+		table->rev[i]                  = alert->rev;
+		table->priority[i]             = alert->priority;
+		table->timestamp[i]            = alert->timestamp;
+		table->ip_src_addr[i]          = alert->ip_src_addr;
+		table->ip_dst_addr[i]          = alert->ip_dst_addr;
+		table->tcp_src_port[i]         = alert->tcp_src_port;
+		table->tcp_dst_port[i]         = alert->tcp_dst_port;
+		table->grouped_alerts_count[i] = alert->grouped_alerts_count;
+		table->desc[i]                 = alert->desc;
+		table->classification[i]       = alert->classification;
+		table->alerts[i]               = alert;
+	}
+}		/* -----  end of function __AI_proc_table_build  ----- */
+
+#ifdef HAVE_LIBPYTHON2_6
+/**
+ * \brief  Score a range of couples with the Python correlation modules, in a helper process
+ * \param  header 	Header of the shared segment of the alerts
+ * \param  table 	Table of the alerts
+ * \param  couples 	Couples to be scored
+ * \param  n 	Number of couples
+ * \param  results 	Scores of the couples of the pass, one array per module
+ */
+
+PRIVATE void
+__AI_proc_py_score ( const AI_proc_header *header, const AI_alert_table *table, const AI_correlation_candidate *couples,
+		size_t n, double *results )
+{
+	const unsigned char  *run = (const unsigned char*) ( header + 1 );
+	PyObject             **py_functions = NULL,
+				      **py_batch_functions = NULL,
+				      **py_alerts = NULL,
+				      *pAlerts = NULL,
+				      *pPairs  = NULL,
+				      *pRet    = NULL;
+	size_t               n_modules = 0,
+				      n_py      = 0,
+				      i, j;
+	double               *scores = NULL;
+
+	AI_get_corr_modules ( &n_modules );
+	py_functions = AI_get_py_functions ( &n_py );
+	py_batch_functions = AI_get_py_batch_functions ( &n_py );
+
+	for ( i=0; i < n_py && !run[ n_modules + i ]; i++ );
+
+	if ( i == n_py )
+		return;
+
+	/* Only the alerts of the couples of the range are converted to Python objects */
+	if ( !( py_alerts = (PyObject**) calloc ( table->n_alerts + 1, sizeof ( PyObject* ))))
+		AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+	for ( j=0; j < n; j++ )
+	{
+		if ( !py_alerts[ couples[j].a ] )
+			py_alerts[ couples[j].a ] = AI_alert_to_pyalert ( table->alerts[ couples[j].a ] );
+
+		if ( !py_alerts[ couples[j].b ] )
+			py_alerts[ couples[j].b ] = AI_alert_to_pyalert ( table->alerts[ couples[j].b ] );
+	}
+
+	for ( i=0; i < n_py; i++ )
+	{
+		if ( !run[ n_modules + i ] )
+			continue;
+
+		scores = results + ( n_modules + i ) * header->n_couples;
+
+		if ( py_batch_functions && py_batch_functions[i] )
+		{
+			if ( !pAlerts )
+			{
+				pAlerts = AI_py_alerts_list ( py_alerts, table->n_alerts );
+				pPairs  = AI_py_couples_array ( couples, n );
+			}
+
+			if ( !( pRet = PyObject_CallFunctionObjArgs ( py_batch_functions[i], pAlerts, pPairs, NULL )))
+			{
+				PyErr_Print();
+				AI_fatal_err ( "Could not call the batch correlation function from the Python module", __FILE__, __LINE__ );
+			}
+
+			AI_py_batch_scores_read ( pRet, scores, n );
+			Py_DECREF ( pRet );
+		} else {
+			for ( j=0; j < n; j++ )
+				scores[j] = AI_py_corr_index ( py_functions[i], py_alerts[ couples[j].a ], py_alerts[ couples[j].b ] );
+		}
+	}
+
+	if ( pAlerts )
+	{
+		Py_DECREF ( pPairs );
+		Py_DECREF ( pAlerts );
+	}
+
+	for ( j=0; j < table->n_alerts; j++ )
+	{
+		if ( py_alerts[j] )
+		{
+			Py_DECREF ( py_alerts[j] );
+		}
+	}
+
+	free ( py_alerts );
+}		/* -----  end of function __AI_proc_py_score  ----- */
+#endif
+
+/**
+ * \brief  Main loop of a helper process: score the ranges of couples requested by the correlation process, until
+ * the correlation process closes the socket
+ * \param  fd 	Socket connected to the correlation process
+ */
+
+PRIVATE void
+__AI_proc_helper_main ( int fd )
+{
+	const AI_corr_module_descriptor  **modules = NULL;
+	const AI_proc_header             *header   = NULL;
+	const AI_correlation_candidate   *couples  = NULL;
+	const unsigned char              *run      = NULL;
+	AI_proc_segment                  alerts_map  = { -1, NULL, 0 },
+							   results_map = { -1, NULL, 0 };
+	AI_proc_request                  request;
+	AI_proc_reply                    reply;
+	AI_alert_table                   table;
+	AI_snort_alert                   *alerts   = NULL;
+	size_t                           n_modules = 0,
+							   i, j;
+	double                           *scores   = NULL;
+
+	is_helper = true;
+
+	/* The signals meant for Snort (e.g. ^C on its terminal) are not for the helpers: a helper terminates when
+	 * the correlation process closes its socket */
+	signal ( SIGINT, SIG_IGN );
+	signal ( SIGQUIT, SIG_IGN );
+	signal ( SIGHUP, SIG_IGN );
+	signal ( SIGUSR1, SIG_IGN );
+	signal ( SIGUSR2, SIG_IGN );
+	signal ( SIGPIPE, SIG_IGN );
+	signal ( SIGTERM, SIG_DFL );
+
+	#ifdef HAVE_LIBPYTHON2_6
+	PyOS_AfterFork();
+	#endif
+
+	memset ( &table, 0, sizeof ( table ));
+	modules = AI_get_corr_modules ( &n_modules );
+	alerts_map.fd  = alerts_segment.fd;
+	results_map.fd = results_segment.fd;
+
+	while ( __AI_proc_transfer ( fd, &request, sizeof ( request ), false, 0 ))
+	{
+		__AI_proc_segment_map ( &alerts_map, request.alerts_size, PROT_READ );
+		__AI_proc_segment_map ( &results_map, request.results_size, PROT_READ | PROT_WRITE );
+
+		header  = (const AI_proc_header*) alerts_map.addr;
+		run     = (const unsigned char*) ( header + 1 );
+		couples = (const AI_correlation_candidate*) ( (const char*) header + header->couples_offset ) + request.first;
+		__AI_proc_table_build ( header, &alerts, &table );
+
+		for ( i=0; modules && i < n_modules; i++ )
+		{
+			if ( !run[i] )
+				continue;
+
+			scores = (double*) results_map.addr + i * header->n_couples + request.first;
+
+			if ( modules[i]->index_batch )
+			{
+				modules[i]->index_batch ( &table, couples, (unsigned int) request.n, scores );
+			} else {
+				for ( j=0; j < request.n; j++ )
+					scores[j] = modules[i]->index ( table.alerts[ couples[j].a ], table.alerts[ couples[j].b ] );
+			}
+		}
+
+		#ifdef HAVE_LIBPYTHON2_6
+		__AI_proc_py_score ( header, &table, couples, request.n, (double*) results_map.addr );
+		#endif
+
+		reply.pass   = request.pass;
+		reply.status = 0;
+
+		if ( !__AI_proc_transfer ( fd, &reply, sizeof ( reply ), true, 0 ))
+			break;
+	}
+
+	_exit ( EXIT_SUCCESS );
+}		/* -----  end of function __AI_proc_helper_main  ----- */
+
+/**
+ * \brief  Start the helper processes. They are forked from the correlation thread, which owns the Python
+ * interpreter, and they inherit the modules already loaded and the descriptors of the shared segments
+ */
+
+PRIVATE void
+__AI_proc_helpers_start ()
+{
+	unsigned long  i, j;
+	int            sv[2];
+	pid_t          pid;
+
+	helpers_started = true;
+
+	if ( !__AI_proc_segment_create ( &alerts_segment ) || !__AI_proc_segment_create ( &results_segment ))
+	{
+		_dpd.errMsg ( "AIPreproc: Could not create the shared memory of the correlation modules: %s, "
+			"the correlation modules are not used\n", strerror ( errno ));
+		return;
+	}
+
+	if ( !( helpers = (AI_proc_helper*) calloc ( config->correlationModulesProcesses, sizeof ( AI_proc_helper ))))
+		AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+	for ( i=0; i < config->correlationModulesProcesses; i++ )
+	{
+		if ( socketpair ( AF_UNIX, SOCK_STREAM, 0, sv ) != 0 )
+			break;
+
+		if (( pid = fork() ) < 0 )
+		{
+			close ( sv[0] );
+			close ( sv[1] );
+			break;
+		}
+
+		if ( pid == 0 )
+		{
+			close ( sv[0] );
+
+			for ( j=0; j < n_helpers; j++ )
+				close ( helpers[j].fd );
+
+			__AI_proc_helper_main ( sv[1] );
+		}
+
+		close ( sv[1] );
+		fcntl ( sv[0], F_SETFD, FD_CLOEXEC );
+		helpers[n_helpers].pid = pid;
+		helpers[n_helpers].fd  = sv[0];
+		n_helpers++;
+	}
+
+	if ( n_helpers < config->correlationModulesProcesses )
+	{
+		_dpd.errMsg ( "AIPreproc: Only %lu of %lu helper processes of the correlation modules could be started: %s\n",
+			n_helpers, config->correlationModulesProcesses, strerror ( errno ));
+	}
+}		/* -----  end of function __AI_proc_helpers_start  ----- */
+
+/**
+ * \brief  Give up a helper process that terminated or stopped answering: the scores of its range of couples
+ * are reset to NaN, so that the modules don't count for those couples in this pass
+ * \param  helper 	Helper
+ * \param  n_couples 	Number of couples of the pass
+ * \param  n_modules 	Number of modules
+ */
+
+PRIVATE void
+__AI_proc_helper_lost ( AI_proc_helper *helper, size_t n_couples, size_t n_modules )
+{
+	double  *results = (double*) results_segment.addr;
+	size_t  i, j;
+	int     status = 0;
+
+	/* A helper that sent a wrong reply may still be running */
+	close ( helper->fd );
+	helper->fd = -1;
+	kill ( helper->pid, SIGKILL );
+	waitpid ( helper->pid, &status, 0 );
+
+	if ( helpers_exiting )
+	{
+		/* The helpers are being stopped anyway */
+	} else if ( WIFSIGNALED ( status ))
+	{
+		_dpd.errMsg ( "AIPreproc: The helper process %d of the correlation modules was terminated by signal %d\n",
+			(int) helper->pid, WTERMSIG ( status ));
+	} else {
+		_dpd.errMsg ( "AIPreproc: The helper process %d of the correlation modules exited with status %d\n",
+			(int) helper->pid, WEXITSTATUS ( status ));
+	}
+
+	for ( i=0; i < n_modules; i++ )
+	{
+		for ( j=0; j < helper->n; j++ )
+			results[ i * n_couples + helper->first + j ] = NAN;
+	}
+}		/* -----  end of function __AI_proc_helper_lost  ----- */
+
+/**
+ * \brief  Write the alerts, the couples to be scored and the modules to be run in the shared segment of the alerts
+ * \param  table 	Table of the alerts
+ * \param  couples 	Couples to be scored
+ * \param  n_couples 	Number of couples
+ * \param  run 	Flags of the modules to be run
+ * \param  n_modules 	Number of modules
+ * \return The size of the data written
+ */
+
+PRIVATE size_t
+__AI_proc_alerts_write ( const AI_alert_table *table, const AI_correlation_candidate *couples, size_t n_couples,
+		const BOOL *run, size_t n_modules )
+{
+	AI_proc_header  header;
+	AI_proc_alert   *rows    = NULL;
+	unsigned char   *flags   = NULL;
+	char            *strings = NULL;
+	size_t          strings_size = 0,
+				 len, i;
+	unsigned int    row;
+
+	for ( row=0; row < table->n_alerts; row++ )
+	{
+		strings_size += ( table->desc[row] ) ? strlen ( table->desc[row] ) + 1 : 0;
+		strings_size += ( table->classification[row] ) ? strlen ( table->classification[row] ) + 1 : 0;
+	}
+
+	header.n_alerts       = table->n_alerts;
+	header.n_couples      = n_couples;
+	header.n_modules      = n_modules;
+	header.rows_offset    = PROC_ALIGN ( sizeof ( AI_proc_header ) + n_modules );
+	header.couples_offset = PROC_ALIGN ( header.rows_offset + table->n_alerts * sizeof ( AI_proc_alert ));
+	header.strings_offset = PROC_ALIGN ( header.couples_offset + n_couples * sizeof ( AI_correlation_candidate ));
+
+	__AI_proc_segment_reserve ( &alerts_segment, header.strings_offset + strings_size );
+	memcpy ( alerts_segment.addr, &header, sizeof ( header ));
+
+	flags = (unsigned char*) alerts_segment.addr + sizeof ( AI_proc_header );
+
+	for ( i=0; i < n_modules; i++ )
+		flags[i] = ( run[i] ) ? 1 : 0;
+
+	rows    = (AI_proc_alert*) ( (char*) alerts_segment.addr + header.rows_offset );
+	strings = (char*) alerts_segment.addr + header.strings_offset;
+	strings_size = 0;
+
+	/* The pointers of the alerts are only valid in the correlation process */
+	for ( row=0; row < table->n_alerts; row++ )
+	{
+		rows[row].alert = *( table->alerts[row] );
+		rows[row].alert.desc             = NULL;
+		rows[row].alert.classification   = NULL;
+		rows[row].alert.stream           = NULL;
+		rows[row].alert.next             = NULL;
+		rows[row].alert.grouped_alerts   = NULL;
+		rows[row].alert.hyperalert       = NULL;
+		rows[row].alert.parent_alerts    = NULL;
+		rows[row].alert.n_parent_alerts  = 0;
+		rows[row].alert.derived_alerts   = NULL;
+		rows[row].alert.n_derived_alerts = 0;
+		memset ( rows[row].alert.h_node, 0, sizeof ( rows[row].alert.h_node ));
+
+		rows[row].desc = rows[row].classification = PROC_NO_STRING;
+
+		if ( table->desc[row] )
+		{
+			len = strlen ( table->desc[row] ) + 1;
+			memcpy ( strings + strings_size, table->desc[row], len );
+			rows[row].desc = strings_size;
+			strings_size += len;
+		}
+
+		if ( table->classification[row] )
+		{
+			len = strlen ( table->classification[row] ) + 1;
+			memcpy ( strings + strings_size, table->classification[row], len );
+			rows[row].classification = strings_size;
+			strings_size += len;
+		}
+	}
+
+	memcpy ( (char*) alerts_segment.addr + header.couples_offset, couples, n_couples * sizeof ( AI_correlation_candidate ));
+	return header.strings_offset + strings_size;
+}		/* -----  end of function __AI_proc_alerts_write  ----- */
+
+/**
+ * \brief  Score the couples of a correlation pass with the extra correlation modules in the helper processes.
+ * The couples are split in a contiguous range per helper; a helper that crashes or doesn't reply in time is killed and not
+ * started again, and the couples of its range get no score from the modules in this pass
+ * \param  table 	Table of the alerts
+ * \param  couples 	Couples to be scored
+ * \param  n_couples 	Number of couples
+ * \param  run 	Flags of the modules to be run (the C modules first, then the Python ones)
+ * \return The scores, one array of n_couples elements per module (NaN for the couples without a score), or
+ * NULL if no helper process is running
+ */
+
+const double*
+AI_corr_modules_proc_score ( const AI_alert_table *table, const AI_correlation_candidate *couples, size_t n_couples,
+		const BOOL *run )
+{
+	AI_proc_request  request;
+	AI_proc_reply    reply;
+	size_t           n_modules = __AI_proc_n_modules(),
+				  n_alive   = 0,
+				  next      = 0,
+				  i, k;
+	double           *results  = NULL;
+	time_t           deadline  = 0;
+
+	pthread_mutex_lock ( &helpers_mutex );
+
+	if ( !helpers_started && !helpers_exiting )
+		__AI_proc_helpers_start();
+
+	for ( k=0; k < n_helpers; k++ )
+		n_alive += ( helpers[k].fd >= 0 ) ? 1 : 0;
+
+	if ( n_alive == 0 || n_couples == 0 || n_modules == 0 )
+	{
+		pthread_mutex_unlock ( &helpers_mutex );
+		return NULL;
+	}
+
+	__AI_proc_alerts_write ( table, couples, n_couples, run, n_modules );
+	__AI_proc_segment_reserve ( &results_segment, n_modules * n_couples * sizeof ( double ));
+	results = (double*) results_segment.addr;
+
+	for ( i=0; i < n_modules * n_couples; i++ )
+		results[i] = NAN;
+
+	memset ( &request, 0, sizeof ( request ));
+	request.pass         = ++proc_pass;
+	request.alerts_size  = alerts_segment.size;
+	request.results_size = results_segment.size;
+
+	/* A helper stuck in a module is killed once the deadline of the pass expires */
+	deadline = time ( NULL ) + PROC_REPLY_TIMEOUT;
+
+	for ( k=0, i=0; k < n_helpers; k++ )
+	{
+		helpers[k].first = helpers[k].n = 0;
+
+		if ( helpers[k].fd < 0 )
+			continue;
+
+		helpers[k].first = next;
+		helpers[k].n     = ( i + 1 ) * n_couples / n_alive - next;
+		next += helpers[k].n;
+		i++;
+
+		if ( helpers[k].n == 0 )
+			continue;
+
+		request.first = helpers[k].first;
+		request.n     = helpers[k].n;
+
+		if ( !__AI_proc_transfer ( helpers[k].fd, &request, sizeof ( request ), true, deadline ))
+			__AI_proc_helper_lost ( &( helpers[k] ), n_couples, n_modules );
+	}
+
+	for ( k=0; k < n_helpers; k++ )
+	{
+		if ( helpers[k].fd < 0 || helpers[k].n == 0 )
+			continue;
+
+		if ( !__AI_proc_transfer ( helpers[k].fd, &reply, sizeof ( reply ), false, deadline ))
+		{
+			if ( errno == ETIMEDOUT )
+			{
+				_dpd.errMsg ( "AIPreproc: The helper process %d of the correlation modules didn't reply within %d seconds\n",
+					(int) helpers[k].pid, PROC_REPLY_TIMEOUT );
+			}
+
+			__AI_proc_helper_lost ( &( helpers[k] ), n_couples, n_modules );
+		} else if ( reply.pass != request.pass || reply.status != 0 ) {
+			__AI_proc_helper_lost ( &( helpers[k] ), n_couples, n_modules );
+		}
+	}
+
+	pthread_mutex_unlock ( &helpers_mutex );
+	return results;
+}		/* -----  end of function AI_corr_modules_proc_score  ----- */
+
+/**
+ * \brief  Stop the helper processes of the correlation modules when Snort exits: the helpers get SIGTERM, and
+ * the ones still running after PROC_EXIT_GRACE seconds (e.g. stuck in a module) are killed
+ * \param  signal 	Signal that caused the exit
+ * \param  arg 	Unused
+ */
+
+void
+AI_corr_modules_proc_exit ( int signal, void *arg )
+{
+	unsigned long i, n_running = 0;
+	int           t;
+
+	/* The correlation thread stops waiting for the helpers within a second, and releases the lock */
+	helpers_exiting = true;
+	pthread_mutex_lock ( &helpers_mutex );
+
+	for ( i=0; i < n_helpers; i++ )
+	{
+		if ( helpers[i].fd < 0 )
+			continue;
+
+		kill ( helpers[i].pid, SIGTERM );
+		n_running++;
+	}
+
+	for ( t=0; t < PROC_EXIT_GRACE * 10 && n_running > 0; t++ )
+	{
+		usleep ( 100000 );
+
+		for ( i=0; i < n_helpers; i++ )
+		{
+			if ( helpers[i].fd >= 0 && waitpid ( helpers[i].pid, NULL, WNOHANG ) == helpers[i].pid )
+			{
+				close ( helpers[i].fd );
+				helpers[i].fd = -1;
+				n_running--;
+			}
+		}
+	}
+
+	for ( i=0; i < n_helpers; i++ )
+	{
+		if ( helpers[i].fd < 0 )
+			continue;
+
+		kill ( helpers[i].pid, SIGKILL );
+		waitpid ( helpers[i].pid, NULL, 0 );
+		close ( helpers[i].fd );
+		helpers[i].fd = -1;
+	}
+
+	pthread_mutex_unlock ( &helpers_mutex );
+}		/* -----  end of function AI_corr_modules_proc_exit  ----- */
+
+/** @} */
+
@@ -41,6 +41,16 @@ __mysql_is_init ( MYSQL *__DB )
 	return ( __DB != NULL );
 }
 
+PRIVATE void
+__mysql_do_close ( MYSQL **__DB )
+{
+	if ( *__DB )
+		mysql_close ( *__DB );
+
+	free ( *__DB );
+	*__DB = NULL;
+}
+
 PRIVATE void*
 __mysql_do_init ( MYSQL **__DB, BOOL is_out )
 {
@@ -54,39 +64,66 @@ __mysql_do_init ( MYSQL **__DB, BOOL is_out )
 
 	if ( !( mysql_init ( *__DB )))
 	{
+		free ( *__DB );
+		*__DB = NULL;
 		return NULL;
 	}
 
+	/* A failed connection must not leave a dangling descriptor, or the next
+	 * call would consider the database as already initialized */
 	if ( is_out )
 	{
-		if ( !mysql_real_connect ( *__DB, config->outdbhost, config->outdbuser, config->outdbpass, NULL, 0, NULL, 0 ))
+		/* The stored procedures of the partitioned schema return more than one result */
+		if ( !mysql_real_connect ( *__DB, config->outdbhost, config->outdbuser, config->outdbpass, NULL, 0, NULL, CLIENT_MULTI_RESULTS ))
 		{
+			__mysql_do_close ( __DB );
 			return NULL;
 		}
 
 		if ( mysql_select_db ( *__DB, config->outdbname ))
 		{
+			__mysql_do_close ( __DB );
 			return NULL;
 		}
 	} else {
 		if ( !mysql_real_connect ( *__DB, config->dbhost, config->dbuser, config->dbpass, NULL, 0, NULL, 0 ))
+		{
+			__mysql_do_close ( __DB );
 			return NULL;
+		}
 
 		if ( mysql_select_db ( *__DB, config->dbname ))
+		{
+			__mysql_do_close ( __DB );
 			return NULL;
+		}
 	}
 
 	return (void*) *__DB;
 }
 
-PRIVATE void
-__mysql_do_close ( MYSQL **__DB )
+/**
+ * \brief  Discard the results still pending on a connection after the first one of a statement
+ * \param  __DB 	Connection
+ * \return true if all the results were read successfully, false otherwise
+ */
+
+PRIVATE BOOL
+__mysql_do_drain ( MYSQL *__DB )
 {
-	if ( *__DB )
-		mysql_close ( *__DB );
+	MYSQL_RES *res = NULL;
+	BOOL      ok   = true;
+	int       rc   = 0;
 
-	free ( *__DB );
-	*__DB = NULL;
+	while (( rc = mysql_next_result ( __DB )) == 0 )
+	{
+		if (( res = mysql_store_result ( __DB )))
+			mysql_free_result ( res );
+		else if ( mysql_field_count ( __DB ) != 0 )
+			ok = false;
+	}
+
+	return ( ok && rc < 0 );
 }
 
 PRIVATE MYSQL_RES*
@@ -99,8 +136,11 @@ __mysql_do_query ( MYSQL *__DB, const char *query )
 		return NULL;
 	}
 
-	if ( !( res = mysql_store_result ( __DB )))
-		return NULL;
+	res = mysql_store_result ( __DB );
+
+	/* The results after the first one (e.g. the status of a CALL) are discarded, otherwise the next
+	 * statement on the connection would fail as out of sync */
+	__mysql_do_drain ( __DB );
 
 	return res;
 }
@@ -191,6 +231,37 @@ mysql_do_out_query ( const char *query )
 	return __mysql_do_query ( outdb, query );
 }
 
+/**
+ * \brief  Execute a statement not returning rows (INSERT, UPDATE, BEGIN, CALL...) on the output database
+ * \param  query 	Statement to be executed
+ * \return true if the statement was executed successfully, false otherwise
+ */
+
+BOOL
+mysql_do_out_exec ( const char *query )
+{
+	MYSQL_RES *res = NULL;
+	BOOL      ok   = true;
+
+	if ( !outdb )
+		return false;
+
+	if ( mysql_query ( outdb, query ))
+		return false;
+
+	if (( res = mysql_store_result ( outdb )))
+		mysql_free_result ( res );
+	else if ( mysql_field_count ( outdb ) != 0 )
+		ok = false;
+
+	/* A CALL returns its own status after the results of the procedure: all of them are read, so that the
+	 * connection is ready for the next statement, and an error in any of them fails the statement */
+	if ( !__mysql_do_drain ( outdb ))
+		ok = false;
+
+	return ok;
+}
+
 unsigned long
 mysql_do_out_escape_string ( char **to, const char *from, unsigned long length )
 {
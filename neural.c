@@ -42,6 +42,10 @@ PRIVATE som_network_t *net                       = NULL;
 PRIVATE AI_alerts_per_neuron *alerts_per_neuron = NULL;
 PRIVATE pthread_mutex_t neural_mutex;
 
+/** Version of the SOM model, increased each time the network is trained or loaded with new weights */
+PRIVATE unsigned long som_version                 = 0;
+PRIVATE time_t        som_loaded_time             = ( time_t ) 0;
+
 /**
  * \brief  Get the hash table containing the alerts associated to each output neuron
  * \return The hash table
@@ -72,7 +76,7 @@ AI_neural_correlation_weight ()
 	if ( !DB_out_init() )
 	{
 		pthread_mutex_unlock ( &outdb_mutex );
-		AI_fatal_err ( "Unable to connect to the database specified in module configuration", __FILE__, __LINE__ );
+		return 0.0;
 	}
 
 	pthread_mutex_unlock ( &outdb_mutex );
@@ -116,60 +120,43 @@ __AI_alert_to_som_data ( const AI_som_alert_tuple alert, double **input )
 }		/* -----  end of function __AI_alert_to_som_data  ----- */
 
 /**
- * \brief  Get the distance between two alerts mapped on the SOM neural network
- * \param  alert1 	Tuple identifying the first alert
- * \param  alert2 	Tuple identifying the second alert
- * \return The distance between the alerts
+ * \brief  Map an alert on the output layer of the SOM neural network, keeping track of the alerts associated to each neuron
+ * \param  alert 	Tuple identifying the alert
+ * \param  x 		Reference to the x coordinate of the best neuron for the alert
+ * \param  y 		Reference to the y coordinate of the best neuron for the alert
+ * \return false if the neural network is not available, true otherwise
  */
 
-PRIVATE double
-__AI_som_alert_distance ( const AI_som_alert_tuple alert1, const AI_som_alert_tuple alert2 )
+PRIVATE BOOL
+__AI_som_alert_neuron ( const AI_som_alert_tuple alert, size_t *x, size_t *y )
 {
-	double *input1 = NULL,
-		  *input2 = NULL;
-
-	size_t x1 = 0,
-		  y1 = 0,
-		  x2 = 0,
-		  y2 = 0;
-	
+	double *input = NULL;
 	int i;
 	BOOL is_found = false;
 	AI_alerts_per_neuron *found = NULL;
 	AI_alerts_per_neuron_key key;
 
-	if ( !( input1 = (double*) alloca ( SOM_NUM_ITEMS * sizeof ( double ))))
+	if ( !net )
 	{
-		AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+		return false;
 	}
 
-	if ( !( input2 = (double*) alloca ( SOM_NUM_ITEMS * sizeof ( double ))))
+	if ( !( input = (double*) alloca ( SOM_NUM_ITEMS * sizeof ( double ))))
 	{
 		AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
 	}
 
-	if ( !net )
-	{
-		return 0.0;
-	}
-
-	__AI_alert_to_som_data ( alert1, &input1 );
-	__AI_alert_to_som_data ( alert2, &input2 );
+	__AI_alert_to_som_data ( alert, &input );
 
 	pthread_mutex_lock ( &neural_mutex );
-
-	som_set_inputs ( net, input1 );
-	som_get_best_neuron_coordinates ( net, &x1, &y1 );
-
-	som_set_inputs ( net, input2 );
-	som_get_best_neuron_coordinates ( net, &x2, &y2 );
-
+	som_set_inputs ( net, input );
+	som_get_best_neuron_coordinates ( net, x, y );
 	pthread_mutex_unlock ( &neural_mutex );
 
-	/* Check if there are already entries in the hash table for these two neurons, otherwise
-	 * it creates them and append these two alerts */
-	key.x = x1;
-	key.y = y1;
+	/* Check if there is already an entry in the hash table for this neuron, otherwise
+	 * it creates it, and append the alert */
+	key.x = *x;
+	key.y = *y;
 	HASH_FIND ( hh, alerts_per_neuron, &key, sizeof ( key ), found );
 
 	if ( !found )
@@ -187,21 +174,19 @@ __AI_som_alert_distance ( const AI_som_alert_tuple alert1, const AI_som_alert_tu
 			AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
 		}
 
-		found->alerts[0] = alert1;
+		found->alerts[0] = alert;
 		HASH_ADD ( hh, alerts_per_neuron, key, sizeof ( key ), found );
 	} else {
-		is_found = false;
-
 		for ( i=0; i < found->n_alerts && !is_found; i++ )
 		{
 			if (
-				alert1.gid == found->alerts[i].gid &&
-				alert1.sid == found->alerts[i].sid &&
-				alert1.rev == found->alerts[i].rev &&
-				alert1.src_ip_addr == found->alerts[i].src_ip_addr &&
-				alert1.dst_ip_addr == found->alerts[i].dst_ip_addr &&
-				alert1.src_port == found->alerts[i].src_port &&
-				alert1.dst_port == found->alerts[i].dst_port )
+				alert.gid == found->alerts[i].gid &&
+				alert.sid == found->alerts[i].sid &&
+				alert.rev == found->alerts[i].rev &&
+				alert.src_ip_addr == found->alerts[i].src_ip_addr &&
+				alert.dst_ip_addr == found->alerts[i].dst_ip_addr &&
+				alert.src_port == found->alerts[i].src_port &&
+				alert.dst_port == found->alerts[i].dst_port )
 			{
 				is_found = true;
 			}
@@ -215,68 +200,88 @@ __AI_som_alert_distance ( const AI_som_alert_tuple alert1, const AI_som_alert_tu
 				AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
 			}
 
-			found->alerts[ found->n_alerts - 1 ] = alert1;
+			found->alerts[ found->n_alerts - 1 ] = alert;
 		}
 	}
 
-	key.x = x2;
-	key.y = y2;
-	HASH_FIND ( hh, alerts_per_neuron, &key, sizeof ( key ), found );
+	return true;
+}		/* -----  end of function __AI_som_alert_neuron  ----- */
 
-	if ( !found )
-	{
-		if ( !( found = (AI_alerts_per_neuron*) calloc ( 1, sizeof ( AI_alerts_per_neuron ))))
-		{
-			AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
-		}
+/**
+ * \brief  Get the correlation between two alerts given the coordinates of their neurons on the output layer:
+ * the inverse of their euclidean distance (the normalization is made considering that the maximum distance
+ * between two points on the output neurons matrix is the distance between the upper-left and bottom-right points)
+ * \param  x1 	x coordinate of the first alert
+ * \param  y1 	y coordinate of the first alert
+ * \param  x2 	x coordinate of the second alert
+ * \param  y2 	y coordinate of the second alert
+ * \return The correlation between the two alerts
+ */
 
-		found->key = key;
-		found->n_alerts = 1;
+double
+AI_neural_som_neurons_correlation ( int x1, int y1, int x2, int y2 )
+{
+	double distance = sqrt ((double) ( (x2-x1)*(x2-x1) + (y2-y1)*(y2-y1) )),
+		  max_distance = sqrt ((double) ( 2 * (config->outputNeuronsPerSide-1) * (config->outputNeuronsPerSide-1) ));
 
-		if ( !( found->alerts = (AI_som_alert_tuple*) calloc ( 1, sizeof ( AI_som_alert_tuple ))))
-		{
-			AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
-		}
+	return (( distance == max_distance ) ? 0.0 : ( 1.0 / ( 1.0 + distance )));
+}		/* -----  end of function AI_neural_som_neurons_correlation  ----- */
 
-		found->alerts[0] = alert2;
-		HASH_ADD ( hh, alerts_per_neuron, key, sizeof ( key ), found );
-	} else {
-		is_found = false;
+/**
+ * \brief  Convert an alert to a tuple suitable for the SOM neural network
+ * \param  table 	Table of alerts
+ * \param  row 	Row of the alert in the table
+ * \param  t 		Tuple to be filled
+ */
 
-		for ( i=0; i < found->n_alerts && !is_found; i++ )
-		{
-			if (
-				alert2.gid == found->alerts[i].gid &&
-				alert2.sid == found->alerts[i].sid &&
-				alert2.rev == found->alerts[i].rev &&
-				alert2.src_ip_addr == found->alerts[i].src_ip_addr &&
-				alert2.dst_ip_addr == found->alerts[i].dst_ip_addr &&
-				alert2.src_port == found->alerts[i].src_port &&
-				alert2.dst_port == found->alerts[i].dst_port )
-			{
-				is_found = true;
-			}
-		}
+PRIVATE void
+__AI_alert_table_row_to_som_tuple ( const AI_alert_table *table, unsigned int row, AI_som_alert_tuple *t )
+{
+	t->gid = table->gid[row];
+	t->sid = table->sid[row];
+	t->rev = table->rev[row];
+	t->src_ip_addr = ntohl ( table->ip_src_addr[row] );
+	t->dst_ip_addr = ntohl ( table->ip_dst_addr[row] );
+	t->src_port = ntohs ( table->tcp_src_port[row] );
+	t->dst_port = ntohs ( table->tcp_dst_port[row] );
+	t->timestamp = table->timestamp[row];
+	t->desc = (char*) table->desc[row];
+}		/* -----  end of function __AI_alert_table_row_to_som_tuple  ----- */
 
-		if ( !is_found )
-		{
-			if ( !( found->alerts = (AI_som_alert_tuple*) realloc ( found->alerts,
-				(++(found->n_alerts)) * sizeof ( AI_som_alert_tuple ))))
-			{
-				AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
-			}
+/**
+ * \brief  Map the alerts of a table on the output layer of the SOM neural network, so that the
+ * neural correlation of each couple of alerts can be computed without querying the network again
+ * \param  table 	Table of alerts
+ * \param  rows 	If not NULL, only the rows set in this array are mapped
+ * \param  x 		Array that will contain the x coordinate of the neuron of each row
+ * \param  y 		Array that will contain the y coordinate of the neuron of each row
+ * \return false if the neural network is not available, true otherwise
+ */
 
-			found->alerts[ found->n_alerts - 1 ] = alert2;
-		}
+BOOL
+AI_neural_som_neurons ( const AI_alert_table *table, const BOOL *rows, int *x, int *y )
+{
+	AI_som_alert_tuple t;
+	unsigned int       i;
+	size_t             nx = 0,
+				    ny = 0;
+
+	for ( i=0; i < table->n_alerts; i++ )
+	{
+		if ( rows && !rows[i] )
+			continue;
+
+		__AI_alert_table_row_to_som_tuple ( table, i, &t );
+
+		if ( !__AI_som_alert_neuron ( t, &nx, &ny ))
+			return false;
+
+		x[i] = (int) nx;
+		y[i] = (int) ny;
 	}
 
-	/* Return the normalized euclidean distance in [0,1] (the normalization is made considering that the maximum distance
-	 * between two points on the output neurons matrix is the distance between the upper-left and bottom-right points) */
-	/* return sqrt ((double) ( (x2-x1)*(x2-x1) + (y2-y1)*(y2-y1) )) / */
-	/* 	sqrt ((double) ( 2 * (config->outputNeuronsPerSide-1) * (config->outputNeuronsPerSide-1) )); */
-	
-	return sqrt ((double) ( (x2-x1)*(x2-x1) + (y2-y1)*(y2-y1) ));
-}		/* -----  end of function __AI_som_alert_distance  ----- */
+	return true;
+}		/* -----  end of function AI_neural_som_neurons  ----- */
 
 /**
  * \brief  Get the SOM neural correlation between two alerts given as AI_snort_alert objects
@@ -289,8 +294,10 @@ double
 AI_alert_neural_som_correlation ( const AI_snort_alert *a, const AI_snort_alert *b )
 {
 	AI_som_alert_tuple t1, t2;
-	double distance = 0.0,
-		  max_distance = 0.0;
+	size_t x1 = 0,
+		  y1 = 0,
+		  x2 = 0,
+		  y2 = 0;
 
 	t1.gid = a->gid;
 	t1.sid = a->sid;
@@ -312,11 +319,30 @@ AI_alert_neural_som_correlation ( const AI_snort_alert *a, const AI_snort_alert
 	t2.timestamp = b->timestamp;
 	t2.desc = b->desc;
 
-	distance = __AI_som_alert_distance ( t1, t2 );
-	max_distance = sqrt ((double) ( 2 * (config->outputNeuronsPerSide-1) * (config->outputNeuronsPerSide-1) ));
-	return (( distance == max_distance ) ? 0.0 : ( 1.0 / ( 1.0 + distance )));
+	if ( !__AI_som_alert_neuron ( t1, &x1, &y1 ) || !__AI_som_alert_neuron ( t2, &x2, &y2 ))
+		return 0.0;
+
+	return AI_neural_som_neurons_correlation ( (int) x1, (int) y1, (int) x2, (int) y2 );
 }		/* -----  end of function AI_alert_neural_som_correlation  ----- */
 
+/**
+ * \brief  Get the version of the SOM model, increased each time the network is trained or loaded from a newer
+ * network file. The scores computed with the same version of the model don't need to be computed again
+ * \return The version of the SOM model (0 if no network has been trained or loaded yet)
+ */
+
+unsigned long
+AI_neural_som_version ()
+{
+	unsigned long version;
+
+	pthread_mutex_lock ( &neural_mutex );
+	version = som_version;
+	pthread_mutex_unlock ( &neural_mutex );
+
+	return version;
+}		/* -----  end of function AI_neural_som_version  ----- */
+
 /**
  * \brief  Train the neural network taking the alerts from the latest serialization time
  */
@@ -340,7 +366,8 @@ __AI_som_train ()
 	if ( !DB_out_init() )
 	{
 		pthread_mutex_unlock ( &outdb_mutex );
-		AI_fatal_err ( "Unable to connect to the database specified in module configuration", __FILE__, __LINE__ );
+		_dpd.logMsg ( "AIPreproc: Warning: the output database is unavailable, the neural network will be trained at the next round\n" );
+		return;
 	}
 
 	pthread_mutex_unlock ( &outdb_mutex );
@@ -350,7 +377,7 @@ __AI_som_train ()
 		"SELECT gid, sid, rev, unix_timestamp(timestamp), ip_src_addr, ip_dst_addr, tcp_src_port, tcp_dst_port "
 		"FROM (%s a LEFT JOIN %s ip ON a.ip_hdr=ip.ip_hdr_id) LEFT JOIN %s tcp "
 		"ON a.tcp_hdr=tcp.tcp_hdr_id "
-		"WHERE unix_timestamp(timestamp) >= %lu",
+		"WHERE timestamp >= from_unixtime(%lu)",
 		outdb_config[ALERTS_TABLE], outdb_config[IPV4_HEADERS_TABLE], outdb_config[TCP_HEADERS_TABLE],
 		latest_serialization_time
 	);
@@ -359,7 +386,16 @@ __AI_som_train ()
 		"SELECT gid, sid, rev, date_part('epoch', \"timestamp\"(timestamp)), ip_src_addr, ip_dst_addr, tcp_src_port, tcp_dst_port "
 		"FROM (%s a LEFT JOIN %s ip ON a.ip_hdr=ip.ip_hdr_id) LEFT JOIN %s tcp "
 		"ON a.tcp_hdr=tcp.tcp_hdr_id "
-		"WHERE date_part ('epoch', \"timestamp\"(timestamp)) >= %lu",
+		"WHERE timestamp >= timestamp with time zone 'epoch' + %lu * interval '1 second'",
+		outdb_config[ALERTS_TABLE], outdb_config[IPV4_HEADERS_TABLE], outdb_config[TCP_HEADERS_TABLE],
+		latest_serialization_time
+	);
+	#elif 	HAVE_LIBSQLITE3
+	snprintf ( query, sizeof ( query ),
+		"SELECT gid, sid, rev, strftime('%%s', timestamp), ip_src_addr, ip_dst_addr, tcp_src_port, tcp_dst_port "
+		"FROM (%s a LEFT JOIN %s ip ON a.ip_hdr=ip.ip_hdr_id) LEFT JOIN %s tcp "
+		"ON a.tcp_hdr=tcp.tcp_hdr_id "
+		"WHERE timestamp >= datetime(%lu, 'unixepoch')",
 		outdb_config[ALERTS_TABLE], outdb_config[IPV4_HEADERS_TABLE], outdb_config[TCP_HEADERS_TABLE],
 		latest_serialization_time
 	);
@@ -432,6 +468,7 @@ __AI_som_train ()
 		som_train ( net, inputs, num_rows, config->neural_train_steps );
 	}
 
+	som_version++;
 	pthread_mutex_unlock ( &neural_mutex );
 
 	latest_serialization_time = time ( NULL );
@@ -481,6 +518,15 @@ AI_neural_thread ( void *arg )
 				AI_fatal_err ( "AIPreproc: Error in deserializing the neural network from the network file", __FILE__, __LINE__ );
 			}
 
+			/* The model only changes if the file was written after the latest load */
+			if ( net->serialization_time != som_loaded_time )
+			{
+				pthread_mutex_lock ( &neural_mutex );
+				som_loaded_time = net->serialization_time;
+				som_version++;
+				pthread_mutex_unlock ( &neural_mutex );
+			}
+
 			/* If more than N seconds passed from the latest serialization, re-train the neural network */
 			if ( (int) ( time (NULL) - net->serialization_time ) > config->neuralNetworkTrainingInterval )
 			{
@@ -29,19 +29,130 @@
 #include	"db.h"
 #include	"uthash.h"
 
-#include	<alloca.h>
+#include	<stdarg.h>
+#include	<sys/time.h>
+#include	<unistd.h>
+
+/** Size of the chunks in which the bulk queries on the output database are split */
+#define 	OUTDB_BULK_ROWS 	1024
+
+/** Interval in seconds between two rotations of the partitions of the output database */
+#define 	OUTDB_PARTITIONS_ROTATION_INTERVAL 	3600
+
+/** Generation of the edges of the correlation subgraphs archived out of the correlation horizon, which are never replaced */
+#define 	OUTDB_ARCHIVE_GENERATION 	0
+
+/** Interval in seconds between two connection attempts to an unavailable output database */
+#define 	OUTDB_RECONNECT_INTERVAL 	60
+
+/** Time in seconds after which a direct write to the output database is considered slow,
+ * and the following writes are diverted to the spool */
+#define 	OUTDB_SLOW_WRITE_THRESHOLD 	2.0
+
+/** Expressions converting a UNIX timestamp and a hex string to the types of the output database */
+#ifdef 	HAVE_LIBMYSQLCLIENT
+	#define 	OUTDB_UNIXTIME_FMT 	"from_unixtime('%lu')"
+	#define 	OUTDB_HEX_FMT 		"X'%s'"
+#elif 	HAVE_LIBPQ
+	#define 	OUTDB_UNIXTIME_FMT 	"timestamp with time zone 'epoch' + %lu * interval '1 second'"
+	#define 	OUTDB_HEX_FMT 		"decode('%s', 'hex')"
+#elif 	HAVE_LIBSQLITE3
+	#define 	OUTDB_UNIXTIME_FMT 	"datetime(%lu, 'unixepoch')"
+	#define 	OUTDB_HEX_FMT 		"X'%s'"
+#endif
+
+/** Entry of the alert_id -> cluster_id index. During a clustering pass the entries
+ * are also the nodes of a union-find forest over the alert IDs, so that the
+ * cluster assignments are computed in memory and written once per pass (or kept
+ * for the next pass, if they could not be written) */
+typedef struct _AI_cluster_index  {
+	/** Alert ID on the database (hash key) */
+	unsigned long              alert_id;
+
+	/** ID of the cluster the alert belongs to on the database, 0 if none */
+	unsigned long              cluster_id;
+
+	/** Parent in the union-find forest (pointing to itself for a root) */
+	struct _AI_cluster_index   *parent;
+
+	/** Rank of the node in the union-find forest */
+	unsigned int               rank;
+
+	/** Alert grouping the whole class (only meaningful on a root, and only until the end of the pass,
+	 * unless it is a copy kept for a flush that failed) */
+	AI_snort_alert             *alert;
+
+	/** Set if the alert is a copy owned by the index */
+	BOOL                       alert_owned;
 
-/** Hash table built as cache for the couple of alerts already belonging to the same cluster,
- * for avoiding more queries on the database*/
-typedef struct  {
-	AI_alerts_couple *alerts_couple;
-	unsigned long    cluster_id;
-	UT_hash_handle   hh;
-} AI_couples_cache;
+	/** Cluster ID computed for the class in the current pass (only meaningful on a root) */
+	unsigned long              new_cluster_id;
+
+	/** Next entry touched by the current clustering pass */
+	struct _AI_cluster_index   *next_dirty;
+
+	/** Set if the entry was touched by the current clustering pass */
+	BOOL                       dirty;
+
+	/** Make the struct 'hashable' */
+	UT_hash_handle             hh;
+} AI_cluster_index;
 
 /** Mutex object, for managing concurrent thread access to the database */
 pthread_mutex_t outdb_mutex;
-PRIVATE AI_couples_cache *couples_cache = NULL;
+
+/** alert_id -> cluster_id index */
+PRIVATE AI_cluster_index *cluster_index = NULL;
+
+/** Mutex on the cluster index, updated by the clustering workers */
+PRIVATE pthread_mutex_t  cluster_index_mutex;
+
+/** List of the index entries touched by the current clustering pass */
+PRIVATE AI_cluster_index *dirty_entries = NULL;
+
+/** Set when a direct write to the output database was slow, until the spool is drained */
+PRIVATE BOOL outdb_slow = false;
+
+/**
+ * \brief  Append a formatted string to a dynamically allocated query buffer, growing it if needed
+ * \param  query 	Reference to the query buffer
+ * \param  size 	Reference to the allocated size of the buffer
+ * \param  fmt 	Format string
+ */
+
+PRIVATE void
+__AI_query_append ( char **query, size_t *size, const char *fmt, ... )
+{
+	va_list ap;
+	size_t  len = ( *query ) ? strlen ( *query ) : 0;
+	int     n   = 0;
+
+	while ( 1 )
+	{
+		if ( !*query || *size - len < 2 )
+		{
+			*size = ( *size ) ? 2 * ( *size ) : 4096;
+
+			if ( !( *query = (char*) realloc ( *query, *size )))
+				AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+			( *query )[len] = 0;
+		}
+
+		va_start ( ap, fmt );
+		n = vsnprintf ( *query + len, *size - len, fmt, ap );
+		va_end ( ap );
+
+		if ( n >= 0 && (size_t) n < *size - len )
+			break;
+
+		( *query )[len] = 0;
+		*size *= 2;
+
+		if ( !( *query = (char*) realloc ( *query, *size )))
+			AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+	}
+}		/* -----  end of function __AI_query_append  ----- */
 
 /**
  * \brief  Initialize the mutex on the output database
@@ -51,49 +162,171 @@ void
 AI_outdb_mutex_initialize ()
 {
 	pthread_mutex_init ( &outdb_mutex, NULL );
+	pthread_mutex_init ( &cluster_index_mutex, NULL );
 }		/* -----  end of function AI_outdb_mutex_initialize  ----- */
 
 /**
- * \brief  Store an alert to the database
- * \param  alert 	Alert to be stored
+ * \brief  Append a statement to a group of statements, kept as a sequence of NUL-terminated strings
+ * \param  stmts 	Reference to the buffer of the group
+ * \param  len 	Reference to the length of the group
+ * \param  stmt 	Statement to be appended
  */
 
-void
-AI_store_alert_to_db ( AI_snort_alert *alert )
+PRIVATE void
+__AI_statements_append ( char **stmts, size_t *len, const char *stmt )
 {
-	char query[32768]      = { 0 },
-		iphdr_id_str[20]  = { 0 },
-		tcphdr_id_str[20] = { 0 },
-		srcip[INET_ADDRSTRLEN],
-		dstip[INET_ADDRSTRLEN];
-
-	unsigned char *pkt_data = NULL;
-	unsigned long latest_ip_hdr_id  = 0,
-			    latest_tcp_hdr_id = 0,
-			    latest_alert_id   = 0,
-			    pkt_size          = 0,
-			    pkt_size_offset   = 0;
+	size_t stmt_len = strlen ( stmt ) + 1;
 
-	struct pkt_info *pkt = NULL;
-	DB_result res;
+	if ( !( *stmts = (char*) realloc ( *stmts, *len + stmt_len )))
+		AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+	memcpy ( *stmts + *len, stmt, stmt_len );
+	*len += stmt_len;
+}		/* -----  end of function __AI_statements_append  ----- */
+
+/**
+ * \brief  Execute an INSERT on the alerts table of the output database, and read the ID the database assigned
+ * to the new alert through the same statement (PostgreSQL) or on the same connection, right after it
+ * \param  stmt 	INSERT statement
+ * \param  alert_id 	Reference to the ID of the new alert
+ * \return true if the alert was inserted and its ID read, false otherwise
+ */
+
+PRIVATE BOOL
+__AI_outdb_insert_alert ( const char *stmt, unsigned long *alert_id )
+{
+	DB_result res   = NULL;
 	DB_row    row;
+	BOOL      ok    = false;
+
+	#ifdef 	HAVE_LIBPQ
+	char      *query     = NULL;
+	size_t    query_size = 0;
+
+	__AI_query_append ( &query, &query_size, "%s RETURNING alert_id", stmt );
+	res = (DB_result) DB_out_query ( query );
+	free ( query );
+	#else
+	if ( !DB_out_exec ( stmt ))
+		return false;
+
+	#ifdef 	HAVE_LIBMYSQLCLIENT
+	res = (DB_result) DB_out_query ( "SELECT LAST_INSERT_ID()" );
+	#elif 	HAVE_LIBSQLITE3
+	res = (DB_result) DB_out_query ( "SELECT last_insert_rowid()" );
+	#endif
+	#endif
+
+	if ( !res )
+		return false;
+
+	if (( row = (DB_row) DB_fetch_row ( res )) && row[0] )
+	{
+		*alert_id = strtoul ( row[0], NULL, 10 );
+		ok = ( *alert_id != 0 );
+	}
+
+	DB_free_result ( res );
+	return ok;
+}		/* -----  end of function __AI_outdb_insert_alert  ----- */
+
+/**
+ * \brief  Execute a group of statements on the output database inside a single transaction
+ * \param  stmts 	Statements, as a sequence of NUL-terminated strings
+ * \param  len 	Length of the buffer
+ * \param  alert_stmt 	Index in the group of the INSERT of an alert whose ID is wanted
+ * \param  alert_id 	Reference to the ID of the inserted alert, set only if the group is committed (NULL if not wanted)
+ * \return outdb_write_ok if the whole group was committed, outdb_write_unavailable if the
+ * database could not be reached, outdb_write_failed if the database is reachable but the
+ * group was rejected
+ */
+
+AI_outdb_write_status
+AI_outdb_exec_statements ( const char *stmts, size_t len, size_t alert_stmt, unsigned long *alert_id )
+{
+	const char    *stmt = NULL;
+	BOOL          ok    = true;
+	size_t        n     = 0;
+	unsigned long id    = 0;
+	AI_outdb_write_status status = outdb_write_ok;
 
 	pthread_mutex_lock ( &outdb_mutex );
 
 	if ( !DB_out_init() )
 	{
 		pthread_mutex_unlock ( &outdb_mutex );
-		AI_fatal_err ( "Unable to connect to the specified output database", __FILE__, __LINE__ );
+		return outdb_write_unavailable;
+	}
+
+	ok = DB_out_exec ( "BEGIN" );
+
+	for ( stmt = stmts; ok && stmt < stmts + len; stmt += strlen ( stmt ) + 1, n++ )
+	{
+		if ( !*stmt )
+			continue;
+
+		/* The ID of the alert is read inside the transaction, before any other statement can insert an alert */
+		if ( alert_id && n == alert_stmt )
+			ok = __AI_outdb_insert_alert ( stmt, &id );
+		else
+			ok = DB_out_exec ( stmt );
+	}
+
+	if ( ok )
+		ok = DB_out_exec ( "COMMIT" );
+
+	if ( ok && alert_id )
+		*alert_id = id;
+
+	if ( !ok )
+	{
+		/* Drop the connection, so that a broken one is not reused, and tell
+		 * an outage from a statement rejected by a working database */
+		DB_out_exec ( "ROLLBACK" );
+		DB_out_close();
+		status = ( DB_out_init() ) ? outdb_write_failed : outdb_write_unavailable;
 	}
 
 	pthread_mutex_unlock ( &outdb_mutex );
+	return status;
+}		/* -----  end of function AI_outdb_exec_statements  ----- */
+
+/**
+ * \brief  Store an alert to the database. The headers, the alert and its packet stream are written
+ * as a single group of statements referencing each other through the latest IDs of the tables, so
+ * that the same group can be either executed right away or appended to the write-ahead spool when
+ * the database is unavailable or slow, and replayed later without any change
+ * \param  alert 	Alert to be stored
+ */
+
+void
+AI_store_alert_to_db ( AI_snort_alert *alert )
+{
+	char   *query = NULL,
+		  *stmts = NULL,
+		  *hex   = NULL,
+		  srcip[INET_ADDRSTRLEN],
+		  dstip[INET_ADDRSTRLEN];
+
+	const unsigned char *pkt_data = NULL;
+
+	size_t query_size = 0,
+		  stmts_len  = 0,
+		  alert_stmt = 0;
+
+	unsigned long i        = 0,
+			    pkt_size = 0;
+
+	double elapsed = 0.0;
+	struct timeval  start, end;
+	struct pkt_info *pkt = NULL;
+	AI_outdb_write_status status = outdb_write_unavailable;
 
 	inet_ntop ( AF_INET, &(alert->ip_src_addr), srcip, INET_ADDRSTRLEN );
 	inet_ntop ( AF_INET, &(alert->ip_dst_addr), dstip, INET_ADDRSTRLEN );
 
 	/* Store the IP header information */
-	memset ( query, 0, sizeof ( query ));
-	snprintf ( query, sizeof ( query ), "INSERT INTO %s (ip_tos, ip_len, ip_id, ip_ttl, ip_proto, ip_src_addr, ip_dst_addr) "
+	__AI_query_append ( &query, &query_size, "INSERT INTO %s (ip_tos, ip_len, ip_id, ip_ttl, ip_proto, ip_src_addr, ip_dst_addr) "
 			"VALUES (%u, %u, %u, %u, %u, '%s', '%s')",
 		outdb_config[IPV4_HEADERS_TABLE],
 		alert->ip_tos,
@@ -104,37 +337,13 @@ AI_store_alert_to_db ( AI_snort_alert *alert )
 		srcip,
 		dstip );
 
-	pthread_mutex_lock ( &outdb_mutex );
-	DB_free_result ((DB_result) DB_out_query ( query ));
-	pthread_mutex_unlock ( &outdb_mutex );
-
-	memset ( query, 0, sizeof ( query ));
-	snprintf ( query, sizeof ( query ), "SELECT MAX(ip_hdr_id) FROM %s", outdb_config[IPV4_HEADERS_TABLE] );
-
-	pthread_mutex_lock ( &outdb_mutex );
-
-	if ( !( res = (DB_result) DB_out_query ( query )))
-	{
-		_dpd.logMsg ( "AIPreproc: Warning: error in executing query: '%s'\n", query );
-		pthread_mutex_unlock ( &outdb_mutex );
-		return;
-	}
-
-	pthread_mutex_unlock ( &outdb_mutex );
-
-	if ( !( row = (DB_row) DB_fetch_row ( res )))
-	{
-		return;
-	}
-
-	latest_ip_hdr_id = strtoul ( row[0], NULL, 10 );
-	DB_free_result ( res );
+	__AI_statements_append ( &stmts, &stmts_len, query );
+	query[0] = 0;
 
 	if ( alert->ip_proto == IPPROTO_TCP || alert->ip_proto == IPPROTO_UDP )
 	{
 		/* Store the TCP header information */
-		memset ( query, 0, sizeof ( query ));
-		snprintf ( query, sizeof ( query ), "INSERT INTO %s (tcp_src_port, tcp_dst_port, tcp_seq, tcp_ack, tcp_flags, tcp_window, tcp_len) "
+		__AI_query_append ( &query, &query_size, "INSERT INTO %s (tcp_src_port, tcp_dst_port, tcp_seq, tcp_ack, tcp_flags, tcp_window, tcp_len) "
 				"VALUES (%u, %u, %u, %u, %u, %u, %u)",
 				outdb_config[TCP_HEADERS_TABLE],
 				ntohs (alert->tcp_src_port ),
@@ -145,391 +354,853 @@ AI_store_alert_to_db ( AI_snort_alert *alert )
 				ntohs (alert->tcp_window ),
 				ntohs (alert->tcp_len ));
 
-		pthread_mutex_lock ( &outdb_mutex );
-		DB_free_result ((DB_result) DB_out_query ( query ));
-		pthread_mutex_unlock ( &outdb_mutex );
+		__AI_statements_append ( &stmts, &stmts_len, query );
+		query[0] = 0;
+	}
 
-		memset ( query, 0, sizeof ( query ));
-		snprintf ( query, sizeof ( query ), "SELECT MAX(tcp_hdr_id) FROM %s", outdb_config[TCP_HEADERS_TABLE] );
+	__AI_query_append ( &query, &query_size, "INSERT INTO %s (gid, sid, rev, priority, description, classification, timestamp, ip_hdr%s) "
+			"VALUES (%u, %u, %u, %u, '%s', '%s', " OUTDB_UNIXTIME_FMT ", (SELECT MAX(ip_hdr_id) FROM %s)",
+		outdb_config[ALERTS_TABLE],
+		(( alert->ip_proto == IPPROTO_TCP ) ? ", tcp_hdr" : "" ),
+		alert->gid,
+		alert->sid,
+		alert->rev,
+		alert->priority,
+		((alert->desc) ? alert->desc : ""),
+		((alert->classification) ? alert->classification : ""),
+		alert->timestamp,
+		outdb_config[IPV4_HEADERS_TABLE] );
 
-		pthread_mutex_lock ( &outdb_mutex );
+	if ( alert->ip_proto == IPPROTO_TCP )
+	{
+		__AI_query_append ( &query, &query_size, ", (SELECT MAX(tcp_hdr_id) FROM %s)", outdb_config[TCP_HEADERS_TABLE] );
+	}
+
+	__AI_query_append ( &query, &query_size, ")" );
+	alert_stmt = ( alert->ip_proto == IPPROTO_TCP || alert->ip_proto == IPPROTO_UDP ) ? 2 : 1;
+	__AI_statements_append ( &stmts, &stmts_len, query );
+	query[0] = 0;
+
+	for ( pkt = alert->stream; pkt; pkt = pkt->next )
+	{
+		if ( !pkt->pkt || !pkt->pkt->pkt_data )
+			continue;
 
-		if ( !( res = (DB_result) DB_out_query ( query )))
+		if ( !pkt->pkt->ip4_header )
 		{
-			_dpd.logMsg ( "AIPreproc: Warning: error in executing query: '%s'\n", query );
-			pthread_mutex_unlock ( &outdb_mutex );
-			return;
+			pkt_size = pkt->pkt->pcap_header->len +
+				pkt->pkt->tcp_options_length +
+				pkt->pkt->payload_size;
+		} else {
+			pkt_size = pkt->pkt->ip4_header->data_length;
 		}
 
-		pthread_mutex_unlock ( &outdb_mutex );
+		if ( pkt_size == 0 )
+			continue;
 
-		if ( !( row = (DB_row) DB_fetch_row ( res )))
+		/* The packet is stored as a hex literal, which needs no connection to be escaped */
+		if ( !( hex = (char*) malloc ( 2 * pkt_size + 1 )))
+			AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+		for ( i=0, pkt_data = pkt->pkt->pkt_data; i < pkt_size; i++ )
 		{
-			return;
+			hex[2*i]     = "0123456789abcdef"[ pkt_data[i] >> 4 ];
+			hex[2*i + 1] = "0123456789abcdef"[ pkt_data[i] & 0x0f ];
 		}
 
-		latest_tcp_hdr_id = strtoul ( row[0], NULL, 10 );
-		DB_free_result ( res );
+		hex[ 2 * pkt_size ] = 0;
+
+		__AI_query_append ( &query, &query_size, "INSERT INTO %s (alert_id, pkt_len, timestamp, content) "
+			"VALUES ((SELECT MAX(alert_id) FROM %s), %u, " OUTDB_UNIXTIME_FMT ", " OUTDB_HEX_FMT ")",
+			outdb_config[PACKET_STREAMS_TABLE],
+			outdb_config[ALERTS_TABLE],
+			pkt->pkt->pcap_header->len + pkt->pkt->payload_size,
+			pkt->timestamp,
+			hex );
+
+		__AI_statements_append ( &stmts, &stmts_len, query );
+		query[0] = 0;
+		free ( hex );
 	}
 
-	if ( latest_ip_hdr_id )
+	/* Once the database has turned out to be slow, the writes keep going through the spool until
+	 * the replay thread has drained it. While there is a backlog the new alerts are spooled as well,
+	 * so that they are written in order */
+	if ( outdb_slow && !AI_spool_pending() )
+		outdb_slow = false;
+
+	if ( !outdb_slow && !AI_spool_pending() )
 	{
-		snprintf ( iphdr_id_str, sizeof ( iphdr_id_str ), ", %lu", latest_ip_hdr_id );
+		gettimeofday ( &start, NULL );
+		status = AI_outdb_exec_statements ( stmts, stmts_len, alert_stmt, &( alert->alert_id ));
+		gettimeofday ( &end, NULL );
+
+		elapsed = (double) ( end.tv_sec - start.tv_sec ) + (double) ( end.tv_usec - start.tv_usec ) / 1000000.0;
+
+		if ( status == outdb_write_ok )
+		{
+			if ( elapsed > OUTDB_SLOW_WRITE_THRESHOLD && AI_spool_enabled() )
+			{
+				_dpd.logMsg ( "AIPreproc: the output database took %.2f seconds to store an alert, "
+					"the next alerts will go through the spool\n", elapsed );
+				outdb_slow = true;
+			}
+
+			free ( query );
+			free ( stmts );
+			return;
+		}
+
+		if ( status == outdb_write_failed )
+		{
+			_dpd.logMsg ( "AIPreproc: Warning: the output database rejected the alert [%u:%u:%u], the alert was not stored\n",
+				alert->gid, alert->sid, alert->rev );
+			free ( query );
+			free ( stmts );
+			return;
+		}
 	}
 
-	if ( latest_tcp_hdr_id && alert->ip_proto == IPPROTO_TCP )
+	/* The alerts written through the spool get no alert_id, so they are left out of the
+	 * clusters and correlations stored on the database */
+	AI_spool_append ( stmts, stmts_len );
+	free ( query );
+	free ( stmts );
+}		/* -----  end of function AI_store_alert_to_db  ----- */
+
+/**
+ * \brief  Thread managing the partitions of the output database, if its tables are partitioned
+ * (see the partitioned schemas in schemas/): it periodically creates the partitions for the next days and
+ * drops the ones older than the output_database_retention option
+ * \param  arg 	Unused
+ */
+
+void*
+AI_outdb_retention_thread ( void *arg )
+{
+	char      query[1024] = { 0 };
+	BOOL      is_partitioned = false;
+
+	#ifndef 	HAVE_LIBSQLITE3
+	DB_result res;
+	DB_row    row;
+	#endif
+
+	pthread_mutex_lock ( &outdb_mutex );
+
+	while ( !DB_out_init() )
 	{
-		snprintf ( tcphdr_id_str, sizeof ( tcphdr_id_str ), ", %lu", latest_tcp_hdr_id );
+		pthread_mutex_unlock ( &outdb_mutex );
+		sleep ( OUTDB_RECONNECT_INTERVAL );
+		pthread_mutex_lock ( &outdb_mutex );
 	}
 
-	memset ( query, 0, sizeof ( query ));
-
+	#ifdef 	HAVE_LIBSQLITE3
+	/* SQLite has no partitions: the old rows are simply deleted through the indexes on the timestamps */
+	is_partitioned = ( config->outdbRetentionDays != 0 );
+	#else
 	#ifdef 	HAVE_LIBMYSQLCLIENT
-	snprintf ( query, sizeof ( query ), "INSERT INTO %s (gid, sid, rev, priority, description, classification, timestamp%s%s) "
-			"VALUES (%u, %u, %u, %u, '%s', '%s', from_unixtime('%lu')%s%s)",
-		outdb_config[ALERTS_TABLE],
-		((latest_ip_hdr_id  != 0) ? ", ip_hdr"  : ""),
-		((latest_tcp_hdr_id != 0) ? ", tcp_hdr" : ""),
-		alert->gid,
-		alert->sid,
-		alert->rev,
-		alert->priority,
-		((alert->desc) ? alert->desc : ""),
-		((alert->classification) ? alert->classification : ""),
-		alert->timestamp,
-		iphdr_id_str,
-		tcphdr_id_str );
+	snprintf ( query, sizeof ( query ), "SELECT COUNT(*) FROM information_schema.ROUTINES "
+		"WHERE ROUTINE_SCHEMA = DATABASE() AND ROUTINE_NAME = 'ca_rotate_partitions'" );
 	#elif 	HAVE_LIBPQ
-	snprintf ( query, sizeof ( query ), "INSERT INTO %s (gid, sid, rev, priority, description, classification, timestamp%s%s) "
-			"VALUES (%u, %u, %u, %u, '%s', '%s', timestamp with time zone 'epoch' + %lu * interval '1 second'%s%s)",
-		outdb_config[ALERTS_TABLE],
-		((latest_ip_hdr_id  != 0) ? ", ip_hdr"  : ""),
-		((latest_tcp_hdr_id != 0) ? ", tcp_hdr" : ""),
-		alert->gid,
-		alert->sid,
-		alert->rev,
-		alert->priority,
-		((alert->desc) ? alert->desc : ""),
-		((alert->classification) ? alert->classification : ""),
-		alert->timestamp,
-		iphdr_id_str,
-		tcphdr_id_str );
+	snprintf ( query, sizeof ( query ), "SELECT COUNT(*) FROM pg_proc WHERE proname = 'ca_rotate_partitions'" );
+	#endif
+
+	if (( res = (DB_result) DB_out_query ( query )))
+	{
+		if (( row = (DB_row) DB_fetch_row ( res )))
+		{
+			is_partitioned = ( row[0] && strtoul ( row[0], NULL, 10 ) > 0 );
+		}
+
+		DB_free_result ( res );
+	}
 	#endif
 
-	pthread_mutex_lock ( &outdb_mutex );
-	DB_free_result ((DB_result) DB_out_query ( query ));
 	pthread_mutex_unlock ( &outdb_mutex );
 
-	memset ( query, 0, sizeof ( query ));
-	snprintf ( query, sizeof ( query ), "SELECT MAX(alert_id) FROM %s", outdb_config[ALERTS_TABLE] );
+	if ( !is_partitioned )
+	{
+		if ( config->outdbRetentionDays != 0 )
+		{
+			_dpd.errMsg ( "AIPreproc: output_database_retention needs a partitioned output database "
+				"(see schemas/mysql_partitioned.sql or schemas/postgresql_partitioned.sql), no retention will be applied\n" );
+		}
 
-	pthread_mutex_lock ( &outdb_mutex );
+		pthread_exit ((void*) 0);
+		return (void*) 0;
+	}
 
-	if ( !( res = (DB_result) DB_out_query ( query )))
+	while ( 1 )
 	{
-		_dpd.logMsg ( "AIPreproc: Warning: error in executing query: '%s'\n", query );
+		#ifdef 	HAVE_LIBMYSQLCLIENT
+		snprintf ( query, sizeof ( query ), "CALL ca_rotate_partitions(%lu)", config->outdbRetentionDays );
+		#elif 	HAVE_LIBPQ
+		snprintf ( query, sizeof ( query ), "SELECT ca_rotate_partitions(%lu)", config->outdbRetentionDays );
+		#elif 	HAVE_LIBSQLITE3
+		snprintf ( query, sizeof ( query ),
+			"DELETE FROM %s WHERE timestamp < datetime('now', '-%lu days'); "
+			"DELETE FROM %s WHERE timestamp < datetime('now', '-%lu days')",
+			outdb_config[PACKET_STREAMS_TABLE], config->outdbRetentionDays,
+			outdb_config[ALERTS_TABLE], config->outdbRetentionDays );
+		#endif
+
+		pthread_mutex_lock ( &outdb_mutex );
+
+		if ( !DB_out_exec ( query ))
+		{
+			#ifdef 	HAVE_LIBMYSQLCLIENT
+			_dpd.errMsg ( "AIPreproc: Could not apply the retention of the output database: %s\n", DB_do_out_error() );
+			#else
+			_dpd.errMsg ( "AIPreproc: Could not apply the retention of the output database\n" );
+			#endif
+		}
+
 		pthread_mutex_unlock ( &outdb_mutex );
-		return;
+
+		sleep ( OUTDB_PARTITIONS_ROTATION_INTERVAL );
 	}
 
-	pthread_mutex_unlock ( &outdb_mutex );
+	pthread_exit ((void*) 0);
+	return (void*) 0;
+}		/* -----  end of function AI_outdb_retention_thread  ----- */
 
-	if ( !( row = (DB_row) DB_fetch_row ( res )))
+/**
+ * \brief  Get the entry of the cluster index associated to an alert ID, creating it if it does not exist yet
+ * \param  alert_id 	Alert ID on the database
+ * \return The entry in the index
+ */
+
+PRIVATE AI_cluster_index*
+__AI_cluster_index_get ( unsigned long alert_id )
+{
+	AI_cluster_index *entry = NULL;
+
+	HASH_FIND ( hh, cluster_index, &alert_id, sizeof ( alert_id ), entry );
+
+	if ( !entry )
 	{
-		return;
+		if ( !( entry = ( AI_cluster_index* ) calloc ( 1, sizeof ( AI_cluster_index ))))
+			AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+		entry->alert_id = alert_id;
+		entry->parent   = entry;
+		HASH_ADD ( hh, cluster_index, alert_id, sizeof ( alert_id ), entry );
 	}
 
-	latest_alert_id = strtoul ( row[0], NULL, 10 );
-	alert->alert_id = latest_alert_id;
-	DB_free_result ( res );
+	if ( !entry->dirty )
+	{
+		entry->dirty      = true;
+		entry->parent     = entry;
+		entry->rank       = 0;
+		entry->alert      = NULL;
+		entry->next_dirty = dirty_entries;
+		dirty_entries     = entry;
+	}
 
-	if ( alert->stream )
+	return entry;
+}		/* -----  end of function __AI_cluster_index_get  ----- */
+
+/**
+ * \brief  Find the root of the union-find class containing an entry of the cluster index (with path halving)
+ * \param  entry 	Entry of the index
+ * \return The root of the class
+ */
+
+PRIVATE AI_cluster_index*
+__AI_cluster_index_find ( AI_cluster_index *entry )
+{
+	while ( entry->parent != entry )
 	{
-		for ( pkt = alert->stream; pkt; pkt = pkt->next )
-		{
-			pkt_data = NULL;
+		entry->parent = entry->parent->parent;
+		entry = entry->parent;
+	}
 
-			if ( !pkt->pkt->ip4_header )
-			{
-				pkt_size = pkt->pkt->pcap_header->len +
-					pkt->pkt->tcp_options_length +
-					pkt->pkt->payload_size;
-			} else {
-				pkt_size = pkt->pkt->ip4_header->data_length;
-			}
+	return entry;
+}		/* -----  end of function __AI_cluster_index_find  ----- */
 
-			pkt_size_offset = 0;
+/**
+ * \brief  Reset the union-find forest built by the current clustering pass
+ */
 
-			if ( !( pkt_data = (unsigned char*) alloca ( 2 * ( pkt_size ) + 1 )))
-				AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+PRIVATE void
+__AI_cluster_index_reset ()
+{
+	AI_cluster_index *entry = NULL;
 
-			if ( pkt->pkt )
-			{
-				if ( pkt->pkt->pkt_data )
-				{
-					if ( strlen ((const char*) pkt->pkt->pkt_data ) != 0 )
-					{
-						DB_out_escape_string (
-							(char**) &pkt_data,
-							(const char*) pkt->pkt->pkt_data,
-							pkt_size );
-
-						memset ( query, 0, sizeof ( query ));
-
-						#ifdef 	HAVE_LIBMYSQLCLIENT
-						snprintf ( query, sizeof ( query ), "INSERT INTO %s (alert_id, pkt_len, timestamp, content) "
-							"VALUES (%lu, %u, from_unixtime('%lu'), '%s')",
-							outdb_config[PACKET_STREAMS_TABLE],
-							latest_alert_id,
-							pkt->pkt->pcap_header->len + pkt->pkt->payload_size,
-							pkt->timestamp,
-							pkt_data );
-						#elif 	HAVE_LIBPQ
-						snprintf ( query, sizeof ( query ), "INSERT INTO %s (alert_id, pkt_len, timestamp, content) "
-							"VALUES (%lu, %u, timestamp with time zone 'epoch' + %lu * interval '1 second', '%s')",
-							outdb_config[PACKET_STREAMS_TABLE],
-							latest_alert_id,
-							pkt->pkt->pcap_header->len + pkt->pkt->payload_size,
-							pkt->timestamp,
-							pkt_data );
-						#endif
-
-						pthread_mutex_lock ( &outdb_mutex );
-						DB_free_result ((DB_result) DB_out_query ( query ));
-						pthread_mutex_unlock ( &outdb_mutex );
-					}
-				}
-			}
-		}
+	while ( dirty_entries )
+	{
+		entry = dirty_entries;
+		dirty_entries = entry->next_dirty;
+
+		if ( entry->alert_owned )
+			free ( entry->alert );
+
+		entry->next_dirty  = NULL;
+		entry->parent      = entry;
+		entry->rank        = 0;
+		entry->alert       = NULL;
+		entry->alert_owned = false;
+		entry->dirty       = false;
 	}
+}		/* -----  end of function __AI_cluster_index_reset  ----- */
 
-	return;
-}		/* -----  end of function AI_store_alert_to_db  ----- */
+/**
+ * \brief  Keep the union-find forest of a flush that failed, so that its assignments are written by the next
+ * flush: the clustering is incremental and reports each membership only once, so they would be lost otherwise.
+ * The alerts grouping the classes belong to the clustering, which may release them, so the roots keep a copy
+ */
+
+PRIVATE void
+__AI_cluster_index_keep ()
+{
+	AI_cluster_index *entry = NULL;
+	AI_snort_alert   *copy  = NULL;
+
+	for ( entry = dirty_entries; entry; entry = entry->next_dirty )
+	{
+		if ( entry->alert_owned || !entry->alert )
+			continue;
+
+		if ( entry->parent != entry )
+		{
+			entry->alert = NULL;
+			continue;
+		}
+
+		if ( !( copy = ( AI_snort_alert* ) malloc ( sizeof ( AI_snort_alert ))))
+			AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+		/* Only the addresses and the ports are read from the copy, and their hierarchy nodes
+		 * live as long as the hierarchies */
+		memcpy ( copy, entry->alert, sizeof ( AI_snort_alert ));
+		entry->alert       = copy;
+		entry->alert_owned = true;
+	}
+}		/* -----  end of function __AI_cluster_index_keep  ----- */
 
 /**
- * \brief  Store an alert cluster to database
+ * \brief  Mark two alerts as belonging to the same cluster. Nothing is written to the
+ * database here: the assignments are kept in memory until AI_flush_clusters_to_db() is
+ * called at the end of the clustering pass.
+ * It can be called concurrently by the clustering workers
  * \param  alerts_couple 	Struct pointer containing the couple of alerts to be clustered together
+ * (alert1 is the alert that groups alert2)
  */
 
 void
 AI_store_cluster_to_db ( AI_alerts_couple *alerts_couple )
 {
-	int i;
-	unsigned long cluster1 = 0,
-			    cluster2 = 0,
-			    latest_cluster_id = 0;
+	AI_cluster_index *a = NULL,
+				  *b = NULL;
+
+	/* If one of the two alerts has no alert_id, simply return */
+	if ( !alerts_couple->alert1->alert_id || !alerts_couple->alert2->alert_id )
+	{
+		return;
+	}
+
+	pthread_mutex_lock ( &cluster_index_mutex );
+	a = __AI_cluster_index_find ( __AI_cluster_index_get ( alerts_couple->alert1->alert_id ));
+	b = __AI_cluster_index_find ( __AI_cluster_index_get ( alerts_couple->alert2->alert_id ));
+
+	if ( a != b )
+	{
+		if ( a->rank < b->rank )
+		{
+			a->parent = b;
+			a = b;
+		} else {
+			b->parent = a;
+
+			if ( a->rank == b->rank )
+				a->rank++;
+		}
+	}
+
+	/* The grouping alert holds the most generalized information about the cluster */
+	if ( a->alert_owned )
+	{
+		free ( a->alert );
+		a->alert_owned = false;
+	}
+
+	a->alert = alerts_couple->alert1;
+	pthread_mutex_unlock ( &cluster_index_mutex );
+}		/* -----  end of function AI_store_cluster_to_db  ----- */
 
-	char query[1024] = { 0 },
-		srcip[INET_ADDRSTRLEN] = { 0 },
+/**
+ * \brief  Append to an INSERT statement the values of the cluster grouped by an alert
+ * \param  query 	Query buffer
+ * \param  query_size 	Size of the query buffer
+ * \param  alert 	Alert grouping the cluster
+ * \param  sep 	Separator written before the values
+ */
+
+PRIVATE void
+__AI_cluster_values_append ( char **query, size_t *query_size, const AI_snort_alert *alert, const char *sep )
+{
+	char srcip[INET_ADDRSTRLEN] = { 0 },
 		dstip[INET_ADDRSTRLEN] = { 0 },
 		srcport[10] = { 0 },
 		dstport[10] = { 0 };
 
-	AI_couples_cache *found         = NULL;
-	DB_result res;
-	DB_row    row;
-	BOOL      new_cluster = false;
+	inet_ntop ( AF_INET, &(alert->ip_src_addr), srcip, INET_ADDRSTRLEN );
+	inet_ntop ( AF_INET, &(alert->ip_dst_addr), dstip, INET_ADDRSTRLEN );
+	snprintf ( srcport, sizeof ( srcport ), "%u", ntohs( alert->tcp_src_port ));
+	snprintf ( dstport, sizeof ( dstport ), "%u", ntohs( alert->tcp_dst_port ));
+
+	__AI_query_append ( query, query_size, "%s( '%s', '%s', '%s', '%s' )", sep,
+		(( alert->h_node[src_addr] ) ? alert->h_node[src_addr]->label : srcip ),
+		(( alert->h_node[dst_addr] ) ? alert->h_node[dst_addr]->label : dstip ),
+		(( alert->h_node[src_port] ) ? alert->h_node[src_port]->label : srcport ),
+		(( alert->h_node[dst_port] ) ? alert->h_node[dst_port]->label : dstport ));
+}		/* -----  end of function __AI_cluster_values_append  ----- */
+
+/**
+ * \brief  Insert the new clusters of a clustering pass, inside the transaction of the pass, and read the IDs
+ * the database assigned to them
+ * \param  new_roots 	Roots of the classes needing a new cluster
+ * \param  n_new_clusters 	Number of new clusters
+ * \return true if all the clusters were inserted and got their IDs, false otherwise
+ */
+
+PRIVATE BOOL
+__AI_clusters_insert ( AI_cluster_index **new_roots, unsigned long n_new_clusters )
+{
+	char          *query     = NULL;
+	size_t        query_size = 0;
+	unsigned long i          = 0;
+	BOOL          ok         = true;
+	DB_result     res;
+	DB_row        row;
+
+	#ifdef 	HAVE_LIBPQ
+	/* PostgreSQL returns the IDs of the inserted rows in the order of the VALUES list */
+	__AI_query_append ( &query, &query_size,
+		"INSERT INTO %s ( clustered_srcip, clustered_dstip, clustered_srcport, clustered_dstport ) VALUES ",
+		outdb_config[CLUSTERED_ALERTS_TABLE] );
 
-	/* Check if the couple of alerts is already in our cache, so it already
-	 * belongs to the same cluster. If so, just return */
-	HASH_FIND ( hh, couples_cache, alerts_couple, sizeof ( AI_alerts_couple ), found );
+	for ( i=0; i < n_new_clusters; i++ )
+		__AI_cluster_values_append ( &query, &query_size, new_roots[i]->alert, ( i > 0 ) ? ", " : "" );
 
-	if ( found )
+	__AI_query_append ( &query, &query_size, " RETURNING cluster_id" );
+
+	if ( !( res = (DB_result) DB_out_query ( query )))
 	{
-		return;
+		_dpd.logMsg ( "AIPreproc: Warning: error in executing query: '%s'\n", query );
+		free ( query );
+		return false;
 	}
 
-	/* Initialize the database (it just does nothing if it is already initialized) */
-	pthread_mutex_lock ( &outdb_mutex );
+	for ( i=0; i < n_new_clusters && ( row = (DB_row) DB_fetch_row ( res )); i++ )
+		new_roots[i]->new_cluster_id = strtoul ( row[0], NULL, 10 );
 
-	if ( !DB_out_init() )
+	ok = ( i == n_new_clusters );
+	DB_free_result ( res );
+	#else
+	/* The IDs of the rows of a multi-row INSERT are not guaranteed to be consecutive (e.g. with
+	 * innodb_autoinc_lock_mode=2), so the clusters are inserted one at a time and the ID of each one
+	 * is read on the same connection, together with the number of rows inserted */
+	for ( i=0; i < n_new_clusters && ok; i++ )
 	{
-		pthread_mutex_unlock ( &outdb_mutex );
-		AI_fatal_err ( "Unable to connect to the specified output database", __FILE__, __LINE__ );
+		if ( query )
+			query[0] = 0;
+
+		__AI_query_append ( &query, &query_size,
+			"INSERT INTO %s ( clustered_srcip, clustered_dstip, clustered_srcport, clustered_dstport ) VALUES ",
+			outdb_config[CLUSTERED_ALERTS_TABLE] );
+		__AI_cluster_values_append ( &query, &query_size, new_roots[i]->alert, "" );
+
+		if ( !DB_out_exec ( query ))
+		{
+			_dpd.logMsg ( "AIPreproc: Warning: error in executing query: '%s'\n", query );
+			ok = false;
+			break;
+		}
+
+		#ifdef 	HAVE_LIBMYSQLCLIENT
+		res = (DB_result) DB_out_query ( "SELECT LAST_INSERT_ID(), ROW_COUNT()" );
+		#elif 	HAVE_LIBSQLITE3
+		res = (DB_result) DB_out_query ( "SELECT last_insert_rowid(), changes()" );
+		#endif
+
+		if ( !res )
+		{
+			ok = false;
+			break;
+		}
+
+		if (( row = (DB_row) DB_fetch_row ( res )) && row[0] && row[1] && strtoul ( row[1], NULL, 10 ) == 1 )
+			new_roots[i]->new_cluster_id = strtoul ( row[0], NULL, 10 );
+		else
+			ok = false;
+
+		DB_free_result ( res );
 	}
+	#endif
 
-	pthread_mutex_unlock ( &outdb_mutex );
+	for ( i=0; i < n_new_clusters && ok; i++ )
+		ok = ( new_roots[i]->new_cluster_id != 0 );
 
-	/* If one of the two alerts has no alert_id, simply return */
-	if ( !alerts_couple->alert1->alert_id || !alerts_couple->alert2->alert_id )
-	{
+	free ( query );
+	return ok;
+}		/* -----  end of function __AI_clusters_insert  ----- */
+
+/**
+ * \brief  Write to the database the cluster assignments computed during the latest clustering
+ * pass: the new clusters are inserted and the alerts whose cluster changed are updated with
+ * bulk statements, all in a single transaction. If any statement fails the transaction is
+ * rolled back, and the assignments are kept and written again, together with the ones of the
+ * next pass, by the next flush
+ */
+
+void
+AI_flush_clusters_to_db ()
+{
+	unsigned long    n_new_clusters    = 0,
+				  n_updates         = 0;
+
+	char             *query = NULL,
+				  *ids   = NULL;
+
+	size_t           query_size = 0,
+				  ids_size   = 0;
+	AI_cluster_index *entry = NULL,
+				  *root  = NULL,
+				  **new_roots = NULL;
+	BOOL             ok = true;
+
+	if ( !dirty_entries )
 		return;
+
+	/* Pick, for each class, the lowest cluster ID already assigned on the database to one of its members */
+	for ( entry = dirty_entries; entry; entry = entry->next_dirty )
+	{
+		root = __AI_cluster_index_find ( entry );
+
+		if ( root == entry )
+			root->new_cluster_id = 0;
 	}
 
-	/* Check if there already exist a cluster containing one of them */
-	memset ( query, 0, sizeof ( query ));
-	snprintf ( query, sizeof ( query ),
-		"SELECT cluster_id FROM %s WHERE alert_id=%lu OR alert_id=%lu",
-		outdb_config[ALERTS_TABLE], alerts_couple->alert1->alert_id, alerts_couple->alert2->alert_id );
+	for ( entry = dirty_entries; entry; entry = entry->next_dirty )
+	{
+		root = __AI_cluster_index_find ( entry );
+
+		if ( entry->cluster_id && ( !root->new_cluster_id || entry->cluster_id < root->new_cluster_id ))
+			root->new_cluster_id = entry->cluster_id;
+	}
+
+	/* Classes with no cluster on the database yet need a new one */
+	for ( entry = dirty_entries; entry; entry = entry->next_dirty )
+	{
+		if ( entry->parent == entry && !entry->new_cluster_id && entry->alert )
+		{
+			if ( !( new_roots = ( AI_cluster_index** ) realloc ( new_roots, (++n_new_clusters) * sizeof ( AI_cluster_index* ))))
+				AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+			new_roots[ n_new_clusters - 1 ] = entry;
+		}
+	}
 
 	pthread_mutex_lock ( &outdb_mutex );
 
-	if ( !( res = (DB_result) DB_out_query ( query )))
+	/* If the database is unavailable the assignments are kept for the next flush */
+	if ( !DB_out_init() || !DB_out_exec ( "BEGIN" ))
 	{
-		_dpd.logMsg ( "AIPreproc: Warning: error in executing query: '%s'\n", query );
 		pthread_mutex_unlock ( &outdb_mutex );
+		_dpd.logMsg ( "AIPreproc: Warning: the output database is unavailable, "
+			"the clusters will be stored on the next clustering pass\n" );
+		__AI_cluster_index_keep();
+		free ( new_roots );
 		return;
 	}
 
-	pthread_mutex_unlock ( &outdb_mutex );
-	new_cluster = true;
+	if ( n_new_clusters > 0 )
+		ok = __AI_clusters_insert ( new_roots, n_new_clusters );
 
-	for ( i=0; (row = (DB_row) DB_fetch_row ( res )); i++ )
+	/* Update in bulk the alerts whose cluster changed. The in-memory index is only
+	 * updated once the transaction is committed */
+	for ( entry = dirty_entries; entry && ok; entry = entry->next_dirty )
 	{
-		new_cluster = false;
+		root = __AI_cluster_index_find ( entry );
 
-		if ( i == 0 )
+		if ( root->new_cluster_id && root->new_cluster_id != entry->cluster_id )
 		{
-			cluster1 = strtoul ( row[0], NULL, 10 );
-		} else if ( i == 1 ) {
-			cluster2 = strtoul ( row[0], NULL, 10 );
+			if ( n_updates == 0 )
+			{
+				__AI_query_append ( &query, &query_size, "UPDATE %s SET cluster_id = CASE alert_id", outdb_config[ALERTS_TABLE] );
+				__AI_query_append ( &ids, &ids_size, "%lu", entry->alert_id );
+			} else {
+				__AI_query_append ( &ids, &ids_size, ", %lu", entry->alert_id );
+			}
+
+			__AI_query_append ( &query, &query_size, " WHEN %lu THEN %lu", entry->alert_id, root->new_cluster_id );
+			n_updates++;
+		}
+
+		if ( n_updates > 0 && ( n_updates >= OUTDB_BULK_ROWS || !entry->next_dirty ))
+		{
+			__AI_query_append ( &query, &query_size, " END WHERE alert_id IN ( %s )", ids );
+
+			if ( !DB_out_exec ( query ))
+			{
+				_dpd.logMsg ( "AIPreproc: Warning: error in executing query: '%s'\n", query );
+				ok = false;
+			}
+
+			query[0] = 0;
+			ids[0] = 0;
+			n_updates = 0;
 		}
 	}
 
-	if ( cluster1 == 0 && cluster2 == 0 )
+	if ( ok )
+		ok = DB_out_exec ( "COMMIT" );
+
+	if ( !ok )
 	{
-		new_cluster = true;
+		DB_out_exec ( "ROLLBACK" );
+		_dpd.logMsg ( "AIPreproc: Warning: the clusters could not be stored on the output database, "
+			"they will be stored on the next clustering pass\n" );
 	}
 
-	DB_free_result ( res );
+	pthread_mutex_unlock ( &outdb_mutex );
 
-	/* If both the alerts already belong to the same cluster (but they're not in the cache yet),
-	 * insert them in the cache */
-	if ( cluster1 != 0 && cluster2 != 0 && cluster1 == cluster2 )
+	if ( !ok )
 	{
-		if ( !( found = ( AI_couples_cache* ) malloc ( sizeof ( AI_couples_cache ))))
-			AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
-		
-		found->alerts_couple = alerts_couple;
-		found->cluster_id = cluster1;
-		HASH_ADD ( hh, couples_cache, alerts_couple, sizeof ( AI_alerts_couple ), found );
+		__AI_cluster_index_keep();
+		free ( new_roots );
+		free ( query );
+		free ( ids );
 		return;
 	}
 
-	if ( new_cluster )
+	for ( entry = dirty_entries; entry; entry = entry->next_dirty )
 	{
-		/* Insert a new cluster containing alert1 and alert2 for now */
-		inet_ntop ( AF_INET, &(alerts_couple->alert1->ip_src_addr), srcip, INET_ADDRSTRLEN );
-		inet_ntop ( AF_INET, &(alerts_couple->alert1->ip_dst_addr), dstip, INET_ADDRSTRLEN );
-		snprintf ( srcport, sizeof ( srcport ), "%u", ntohs( alerts_couple->alert1->tcp_src_port ));
-		snprintf ( dstport, sizeof ( dstport ), "%u", ntohs( alerts_couple->alert1->tcp_dst_port ));
+		root = __AI_cluster_index_find ( entry );
 
-		memset ( query, 0, sizeof ( query ));
-		snprintf ( query, sizeof ( query ),
-			"INSERT INTO %s ( clustered_srcip, clustered_dstip, clustered_srcport, clustered_dstport ) "
-			"VALUES ( '%s', '%s', '%s', '%s' )",
-			outdb_config[CLUSTERED_ALERTS_TABLE],
-			((alerts_couple->alert1->h_node[src_addr]) ? alerts_couple->alert1->h_node[src_addr]->label : srcip),
-			((alerts_couple->alert1->h_node[dst_addr]) ? alerts_couple->alert1->h_node[dst_addr]->label : dstip),
-			((alerts_couple->alert1->h_node[src_port]) ? alerts_couple->alert1->h_node[src_port]->label : srcport),
-			((alerts_couple->alert1->h_node[dst_port]) ? alerts_couple->alert1->h_node[dst_port]->label : dstport)
-		);
+		if ( root->new_cluster_id )
+			entry->cluster_id = root->new_cluster_id;
+	}
 
-		pthread_mutex_lock ( &outdb_mutex );
-		DB_free_result ((DB_result) DB_out_query ( query ));
-		pthread_mutex_unlock ( &outdb_mutex );
+	__AI_cluster_index_reset();
+	free ( new_roots );
+	free ( query );
+	free ( ids );
+}		/* -----  end of function AI_flush_clusters_to_db  ----- */
 
-		memset ( query, 0, sizeof ( query ));
-		snprintf ( query, sizeof ( query ),
-			"SELECT MAX(cluster_id) FROM %s", outdb_config[CLUSTERED_ALERTS_TABLE] );
 
-		pthread_mutex_lock ( &outdb_mutex );
+/**
+ * \brief  Write the edges of the correlation graph under a given generation, in the current transaction
+ * (through COPY on PostgreSQL and multi-row INSERTs otherwise)
+ * \param  corrs 	Array of the correlated couples of alerts
+ * \param  n_corrs 	Number of elements in the array
+ * \param  generation 	Generation of the edges
+ * \param  query 	Reference to the query buffer
+ * \param  query_size 	Reference to the allocated size of the query buffer
+ * \return false as soon as a chunk of edges could not be written (the caller rolls back), true otherwise
+ */
+
+PRIVATE BOOL
+__AI_correlations_insert ( AI_alert_correlation **corrs, unsigned int n_corrs, unsigned long generation, char **query, size_t *query_size )
+{
+	unsigned int  i = 0,
+			    n_rows = 0;
+
+	if ( *query )
+		( *query )[0] = 0;
 
-		if ( !( res = (DB_result) DB_out_query ( query )))
+	#ifdef HAVE_LIBPQ
+		for ( i=0; i < n_corrs; i++ )
 		{
-			_dpd.logMsg ( "AIPreproc: Warning: error in executing query: '%s'\n", query );
-			pthread_mutex_unlock ( &outdb_mutex );
-			return;
+			if ( !corrs[i]->key.a->alert_id || !corrs[i]->key.b->alert_id )
+				continue;
+
+			__AI_query_append ( query, query_size, "%lu\t%lu\t%lu\t%f\n",
+				generation,
+				corrs[i]->key.a->alert_id,
+				corrs[i]->key.b->alert_id,
+				corrs[i]->correlation );
+			n_rows++;
 		}
 
-		pthread_mutex_unlock ( &outdb_mutex );
+		if ( n_rows > 0 )
+		{
+			char copy_stmt[256] = { 0 };
 
-		if ( !( row = (DB_row) DB_fetch_row ( res )))
+			snprintf ( copy_stmt, sizeof ( copy_stmt ),
+				"COPY %s ( generation, alert1, alert2, correlation_coeff ) FROM STDIN",
+				outdb_config[CORRELATED_ALERTS_TABLE] );
+
+			if ( !DB_out_copy ( copy_stmt, *query, strlen ( *query )))
+				return false;
+		}
+	#else
+		for ( i=0; i < n_corrs; i++ )
 		{
-			return;
+			if ( !corrs[i]->key.a->alert_id || !corrs[i]->key.b->alert_id )
+				continue;
+
+			if ( n_rows == 0 )
+			{
+				__AI_query_append ( query, query_size,
+					"INSERT INTO %s ( generation, alert1, alert2, correlation_coeff ) VALUES ",
+					outdb_config[CORRELATED_ALERTS_TABLE] );
+			}
+
+			__AI_query_append ( query, query_size, "%s( %lu, %lu, %lu, %f )",
+				(( n_rows > 0 ) ? ", " : "" ),
+				generation,
+				corrs[i]->key.a->alert_id,
+				corrs[i]->key.b->alert_id,
+				corrs[i]->correlation );
+
+			if ( ++n_rows >= OUTDB_BULK_ROWS )
+			{
+				if ( !DB_out_exec ( *query ))
+					return false;
+
+				( *query )[0] = 0;
+				n_rows = 0;
+			}
 		}
 
-		latest_cluster_id = strtoul ( row[0], NULL, 10 );
-		DB_free_result ( res );
+		if ( n_rows > 0 && !DB_out_exec ( *query ))
+			return false;
+	#endif
 
-		/* Update the two alerts, setting them as belonging to the new cluster */
-		memset ( query, 0, sizeof ( query ));
-		snprintf ( query, sizeof ( query ),
-			"UPDATE %s SET cluster_id=%lu WHERE alert_id=%lu OR alert_id=%lu",
-			outdb_config[ALERTS_TABLE], latest_cluster_id,
-			alerts_couple->alert1->alert_id, alerts_couple->alert2->alert_id );
+	if ( *query )
+		( *query )[0] = 0;
 
-		pthread_mutex_lock ( &outdb_mutex );
-		DB_free_result ((DB_result) DB_out_query ( query ));
+	return true;
+}		/* -----  end of function __AI_correlations_insert  ----- */
+
+/**
+ * \brief  Replace the correlation graph on the output database with the edges found in the
+ * latest correlation run. The edges are written under a new generation number in a single
+ * transaction, then the current generation is switched and the older ones are removed (except
+ * the archived edges), so that the readers selecting the edges of the current generation never
+ * see a half-written graph
+ * \param  corrs 	Array of the correlated couples of alerts
+ * \param  n_corrs 	Number of elements in the array
+ */
+
+void
+AI_store_correlations_to_db ( AI_alert_correlation **corrs, unsigned int n_corrs )
+{
+	unsigned long generation = 0;
+	char          *query = NULL;
+	size_t        query_size = 0;
+	BOOL          ok = true;
+	DB_result     res;
+	DB_row        row;
+
+	pthread_mutex_lock ( &outdb_mutex );
+
+	/* Initialize the database (it just does nothing if it is already initialized) */
+	if ( !DB_out_init() )
+	{
 		pthread_mutex_unlock ( &outdb_mutex );
-	} else {
-		/* Update the alert marked as 'not clustered' */
-		if ( !cluster1 )
+		_dpd.logMsg ( "AIPreproc: Warning: the output database is unavailable, the correlation graph was not stored\n" );
+		return;
+	}
+
+	__AI_query_append ( &query, &query_size, "SELECT MAX(generation) FROM %s", outdb_config[CORRELATION_GENERATION_TABLE] );
+
+	if (( res = (DB_result) DB_out_query ( query )))
+	{
+		if (( row = (DB_row) DB_fetch_row ( res )))
 		{
-			memset ( query, 0, sizeof ( query ));
-			snprintf ( query, sizeof ( query ),
-				"UPDATE %s SET cluster_id=%lu WHERE alert_id=%lu",
-				outdb_config[ALERTS_TABLE], cluster2, alerts_couple->alert1->alert_id );
-
-			pthread_mutex_lock ( &outdb_mutex );
-			DB_free_result ((DB_result) DB_out_query ( query ));
-			pthread_mutex_unlock ( &outdb_mutex );
-		} else {
-			memset ( query, 0, sizeof ( query ));
-			snprintf ( query, sizeof ( query ),
-				"UPDATE %s SET cluster_id=%lu WHERE alert_id=%lu",
-				outdb_config[ALERTS_TABLE], cluster1, alerts_couple->alert2->alert_id );
-
-			pthread_mutex_lock ( &outdb_mutex );
-			DB_free_result ((DB_result) DB_out_query ( query ));
-			pthread_mutex_unlock ( &outdb_mutex );
+			if ( row[0] )
+				generation = strtoul ( row[0], NULL, 10 );
 		}
+
+		DB_free_result ( res );
 	}
 
-	/* Add the couple to the cache */
-	if ( !( found = ( AI_couples_cache* ) malloc ( sizeof ( AI_couples_cache ))))
-		AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+	generation++;
+	query[0] = 0;
 
-	found->alerts_couple = alerts_couple;
-	found->cluster_id = cluster1;
-	HASH_ADD ( hh, couples_cache, alerts_couple, sizeof ( AI_alerts_couple ), found );
-}		/* -----  end of function AI_store_cluster_to_db  ----- */
+	/* Any failure rolls the whole transaction back, and the readers keep seeing the previous generation */
+	if ( !DB_out_exec ( "BEGIN" ))
+	{
+		pthread_mutex_unlock ( &outdb_mutex );
+		_dpd.logMsg ( "AIPreproc: Warning: unable to store the correlation graph to the output database\n" );
+		free ( query );
+		return;
+	}
+
+	/* Remove the leftovers of a previous run interrupted before switching generation */
+	__AI_query_append ( &query, &query_size, "DELETE FROM %s WHERE generation >= %lu",
+		outdb_config[CORRELATED_ALERTS_TABLE], generation );
+	ok = DB_out_exec ( query );
+
+	ok = ok && __AI_correlations_insert ( corrs, n_corrs, generation, &query, &query_size );
+
+	/* Switch to the new generation and drop the old ones */
+	if ( ok )
+	{
+		query[0] = 0;
+		__AI_query_append ( &query, &query_size, "UPDATE %s SET generation = %lu",
+			outdb_config[CORRELATION_GENERATION_TABLE], generation );
+		ok = DB_out_exec ( query );
+	}
+
+	if ( ok )
+	{
+		query[0] = 0;
+		__AI_query_append ( &query, &query_size, "DELETE FROM %s WHERE generation <> %d AND generation < %lu",
+			outdb_config[CORRELATED_ALERTS_TABLE], OUTDB_ARCHIVE_GENERATION, generation );
+		ok = DB_out_exec ( query );
+	}
+
+	if ( ok )
+		ok = DB_out_exec ( "COMMIT" );
 
+	if ( !ok )
+	{
+		_dpd.logMsg ( "AIPreproc: Warning: unable to store the correlation graph to the output database\n" );
+		DB_out_exec ( "ROLLBACK" );
+	}
+
+	pthread_mutex_unlock ( &outdb_mutex );
+	free ( query );
+}		/* -----  end of function AI_store_correlations_to_db  ----- */
 
 /**
- * \brief  Store the correlation between two alerts to the output database
- * \param  arg 	Structure containing the two alerts to be saved and their correlation
+ * \brief  Archive on the output database the edges of the correlation subgraphs that left the correlation
+ * horizon: they are stored under the archive generation, which is never replaced
+ * \param  corrs 	Array of the correlated couples of alerts
+ * \param  n_corrs 	Number of elements in the array
  */
 
 void
-AI_store_correlation_to_db ( AI_alert_correlation *corr )
+AI_archive_correlations_to_db ( AI_alert_correlation **corrs, unsigned int n_corrs )
 {
-	char query[1024] = { 0 };
+	char    *query = NULL;
+	size_t  query_size = 0;
 
-	/* Initialize the database (it just does nothing if it is already initialized) */
 	pthread_mutex_lock ( &outdb_mutex );
 
 	if ( !DB_out_init() )
 	{
 		pthread_mutex_unlock ( &outdb_mutex );
-		AI_fatal_err ( "Unable to connect to the specified output database", __FILE__, __LINE__ );
+		_dpd.logMsg ( "AIPreproc: Warning: the output database is unavailable, the archived correlations were not stored\n" );
+		return;
 	}
 
-	pthread_mutex_unlock ( &outdb_mutex );
-
-	memset ( query, 0, sizeof ( query ));
-	snprintf ( query, sizeof ( query ),
-		"INSERT INTO %s ( alert1, alert2, correlation_coeff ) "
-		"VALUES ( %lu, %lu, %f )",
-		outdb_config[CORRELATED_ALERTS_TABLE],
-		corr->key.a->alert_id,
-		corr->key.b->alert_id,
-		corr->correlation );
+	if ( !DB_out_exec ( "BEGIN" ) ||
+			!__AI_correlations_insert ( corrs, n_corrs, OUTDB_ARCHIVE_GENERATION, &query, &query_size ) ||
+			!DB_out_exec ( "COMMIT" ))
+	{
+		_dpd.logMsg ( "AIPreproc: Warning: unable to store the archived correlations to the output database\n" );
+		DB_out_exec ( "ROLLBACK" );
+	}
 
-	pthread_mutex_lock ( &outdb_mutex );
-	DB_free_result ((DB_result) DB_out_query ( query ));
 	pthread_mutex_unlock ( &outdb_mutex );
-}		/* -----  end of function AI_store_correlation_to_db  ----- */
+	free ( query );
+}		/* -----  end of function AI_archive_correlations_to_db  ----- */
 
 #endif
 
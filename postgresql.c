@@ -43,6 +43,15 @@ __postgresql_is_init ( PGconn *__DB )
 	return ( __DB != NULL );
 }
 
+PRIVATE void
+__postgresql_do_close ( PGconn **__DB )
+{
+	if ( *__DB )
+		PQfinish ( *__DB );
+
+	*__DB = NULL;
+}
+
 PRIVATE void*
 __postgresql_do_init ( PGconn **__DB, BOOL is_out )
 {
@@ -123,7 +132,10 @@ __postgresql_do_init ( PGconn **__DB, BOOL is_out )
 	}
 
 	if ( PQstatus ( *__DB = PQconnectdb ( conninfo )) != CONNECTION_OK )
+	{
+		__postgresql_do_close ( __DB );
 		return NULL;
+	}
 
 	return (void*) *__DB;
 }
@@ -138,7 +150,11 @@ __postgresql_do_query ( PGconn *__DB, const char *query )
 		AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
 
 	if ( PQresultStatus ( res->res = PQexec( __DB, query )) != PGRES_TUPLES_OK )
+	{
+		PQclear ( res->res );
+		free ( res );
 		return NULL;
+	}
 
 	ntuples = PQntuples ( res->res );
 	res->index = 0;
@@ -163,15 +179,6 @@ __postgresql_do_query ( PGconn *__DB, const char *query )
 	return res;
 }
 
-PRIVATE void
-__postgresql_do_close ( PGconn **__DB )
-{
-	if ( *__DB )
-		PQfinish ( *__DB );
-
-	*__DB = NULL;
-}
-
 /* End of private functions */
 /****************************/
 
@@ -258,6 +265,72 @@ postgresql_do_out_close ()
 	__postgresql_do_close ( &outdb );
 }
 
+/**
+ * \brief  Execute a statement not returning rows (INSERT, UPDATE, BEGIN...) on the output database
+ * \param  query 	Statement to be executed
+ * \return true if the statement was executed successfully, false otherwise
+ */
+
+BOOL
+postgresql_do_out_exec ( const char *query )
+{
+	BOOL     ok  = false;
+	PGresult *res = NULL;
+
+	if ( !outdb )
+		return false;
+
+	res = PQexec ( outdb, query );
+	ok  = ( PQresultStatus ( res ) == PGRES_COMMAND_OK || PQresultStatus ( res ) == PGRES_TUPLES_OK );
+	PQclear ( res );
+
+	return ok;
+}
+
+/**
+ * \brief  Load a block of rows into the output database through COPY ... FROM STDIN
+ * \param  copy_stmt 	COPY statement (e.g. "COPY table ( col1, col2 ) FROM STDIN")
+ * \param  data 		Rows in PostgreSQL text format (tab-separated fields, one row per line)
+ * \param  len 		Length of the data buffer
+ * \return true if the rows were loaded, false otherwise
+ */
+
+BOOL
+postgresql_do_out_copy ( const char *copy_stmt, const char *data, size_t len )
+{
+	BOOL     ok  = true;
+	PGresult *res = NULL;
+
+	if ( !outdb )
+		return false;
+
+	res = PQexec ( outdb, copy_stmt );
+
+	if ( PQresultStatus ( res ) != PGRES_COPY_IN )
+	{
+		PQclear ( res );
+		return false;
+	}
+
+	PQclear ( res );
+
+	if ( PQputCopyData ( outdb, data, (int) len ) != 1 )
+		ok = false;
+
+	if ( PQputCopyEnd ( outdb, ok ? NULL : "AIPreproc: error while sending data" ) != 1 )
+		ok = false;
+
+	while (( res = PQgetResult ( outdb )))
+	{
+		if ( PQresultStatus ( res ) != PGRES_COMMAND_OK )
+			ok = false;
+
+		PQclear ( res );
+	}
+
+	return ok;
+}
+
 /* Functions working on result sets */
 
 int
@@ -45,6 +45,9 @@ struct regex_cache_entry {
  */
 static struct regex_cache_entry *reg_cache = NULL;
 
+/** Lock over the regular expression cache, as preg_match is called by several threads at the same time */
+static pthread_rwlock_t reg_cache_lock = PTHREAD_RWLOCK_INITIALIZER;
+
 /**
  * \brief  Check if a string matches a regular expression
  * \param  expr 	Regular expression to be matched
@@ -68,7 +71,9 @@ preg_match ( const char* expr, char* str, char*** matches, int *nmatches )
 	/*
 	 * Search for a compiled regex in the cache.
 	 */
+	pthread_rwlock_rdlock ( &reg_cache_lock );
 	HASH_FIND_STR( reg_cache, expr, cached_regex );
+	pthread_rwlock_unlock ( &reg_cache_lock );
 
 	if( cached_regex != NULL ){
 		/*
@@ -78,20 +83,30 @@ preg_match ( const char* expr, char* str, char*** matches, int *nmatches )
 	} else {
 		/*
 		 * Not found, create a new structure, compile the regexp and add it to the cache
-		 * for latter use.
+		 * for latter use (unless another thread did it in the meantime).
 		 */
-		regex = (regex_t *)malloc( sizeof(regex_t) );
-		if ( regcomp ( regex, expr, REG_EXTENDED | REG_ICASE ) != 0 )  {
-			return -1;
+		pthread_rwlock_wrlock ( &reg_cache_lock );
+		HASH_FIND_STR( reg_cache, expr, cached_regex );
+
+		if( cached_regex != NULL ){
+			regex = cached_regex->compiled;
+		} else {
+			regex = (regex_t *)malloc( sizeof(regex_t) );
+			if ( regcomp ( regex, expr, REG_EXTENDED | REG_ICASE ) != 0 )  {
+				pthread_rwlock_unlock ( &reg_cache_lock );
+				return -1;
+			}
+			cached_regex = (struct regex_cache_entry *)malloc( sizeof( struct regex_cache_entry ) );
+			
+			strncpy( cached_regex->expression, expr, 0xFF );
+			cached_regex->compiled = regex;
+			/*
+			 * The key is the expression itself.
+			 */
+			HASH_ADD_STR( reg_cache, expression, cached_regex );
 		}
-		cached_regex = (struct regex_cache_entry *)malloc( sizeof( struct regex_cache_entry ) );
-		
-		strncpy( cached_regex->expression, expr, 0xFF );
-		cached_regex->compiled = regex;
-		/*
-		 * The key is the expression itself.
-		 */
-		HASH_ADD_STR( reg_cache, expression, cached_regex );
+
+		pthread_rwlock_unlock ( &reg_cache_lock );
 	}
 
 	if ( regex->re_nsub > 0 )
@@ -52,6 +52,8 @@ CREATE TABLE ca_alerts (
 	cluster_id     integer default 0,
 
 	primary key(alert_id),
+	key ca_alerts_timestamp_idx (timestamp),
+	key ca_alerts_cluster_id_idx (cluster_id),
 	foreign key(ip_hdr) references ca_ip_headers(ip_hdr_id),
 	foreign key(tcp_hdr) references ca_tcp_headers(tcp_hdr_id),
 	foreign key(cluster_id) references ca_clustered_alerts(cluster_id)
@@ -66,17 +68,29 @@ CREATE TABLE ca_packet_streams (
 	content        longblob,
 
 	primary key(pkt_id),
+	key ca_packet_streams_alert_id_idx (alert_id),
+	key ca_packet_streams_timestamp_idx (timestamp),
 	foreign key(alert_id) references ca_alerts(alert_id)
 );
 
 DROP TABLE IF EXISTS ca_correlated_alerts;
 CREATE TABLE ca_correlated_alerts (
+	generation        integer     default 0,
 	alert1            integer,
 	alert2            integer,
 	correlation_coeff double,
 
-	primary key(alert1, alert2),
+	primary key(generation, alert1, alert2),
+	key ca_correlated_alerts_alert1_idx (alert1),
+	key ca_correlated_alerts_alert2_idx (alert2),
 	foreign key(alert1) references ca_alerts(alert_id),
 	foreign key(alert2) references ca_alerts(alert_id)
 );
 
+DROP TABLE IF EXISTS ca_correlation_generation;
+CREATE TABLE ca_correlation_generation (
+	generation        integer     default 0
+);
+
+INSERT INTO ca_correlation_generation ( generation ) VALUES ( 0 );
+
@@ -0,0 +1,163 @@
+-- Partitioned variant of schemas/mysql.sql (MySQL >= 5.1).
+--
+-- ca_alerts and ca_packet_streams are partitioned by day on their timestamp.
+-- The partitions are created in advance and the ones older than the
+-- output_database_retention option are dropped by ca_rotate_partitions(),
+-- periodically called by the module, so that old alerts are removed
+-- without running a DELETE over the whole table.
+--
+-- Partitioned InnoDB tables can't have or be referenced by foreign keys,
+-- so the references to ca_alerts are not enforced by the DBMS here.
+
+DROP TABLE IF EXISTS ca_ipv4_headers;
+CREATE TABLE ca_ipv4_headers (
+	ip_hdr_id     integer     auto_increment,
+	ip_tos        integer,
+	ip_len        integer,
+	ip_id         integer,
+	ip_ttl        integer,
+	ip_proto      integer,
+	ip_src_addr   varchar(32),
+	ip_dst_addr   varchar(32),
+
+	primary key(ip_hdr_id)
+);
+
+DROP TABLE IF EXISTS ca_tcp_headers;
+CREATE TABLE ca_tcp_headers (
+	tcp_hdr_id     integer    auto_increment,
+	tcp_src_port   integer,
+	tcp_dst_port   integer,
+	tcp_seq        integer,
+	tcp_ack        integer,
+	tcp_flags      integer,
+	tcp_window     integer,
+	tcp_len        integer,
+
+	primary key(tcp_hdr_id)
+);
+
+DROP TABLE IF EXISTS ca_clustered_alerts;
+CREATE TABLE ca_clustered_alerts (
+	cluster_id        integer      auto_increment,
+	clustered_srcip   varchar(255) default null,
+	clustered_dstip   varchar(255) default null,
+	clustered_srcport varchar(255) default null,
+	clustered_dstport varchar(255) default null,
+
+	primary key(cluster_id)
+);
+
+DROP TABLE IF EXISTS ca_alerts;
+CREATE TABLE ca_alerts (
+	alert_id       integer     auto_increment,
+	gid            integer,
+	sid            integer,
+	rev            integer,
+	priority       integer,
+	description    varchar(255),
+	classification varchar(255),
+	timestamp      datetime    not null,
+	ip_hdr         integer default 0,
+	tcp_hdr        integer default 0,
+	cluster_id     integer default 0,
+
+	primary key(alert_id, timestamp),
+	key ca_alerts_timestamp_idx (timestamp),
+	key ca_alerts_cluster_id_idx (cluster_id)
+)
+PARTITION BY RANGE ( TO_DAYS(timestamp) ) (
+	PARTITION pmax VALUES LESS THAN MAXVALUE
+);
+
+DROP TABLE IF EXISTS ca_packet_streams;
+CREATE TABLE ca_packet_streams (
+	pkt_id         integer     auto_increment,
+	alert_id       integer,
+	pkt_len        integer,
+	timestamp      datetime    not null,
+	content        longblob,
+
+	primary key(pkt_id, timestamp),
+	key ca_packet_streams_alert_id_idx (alert_id),
+	key ca_packet_streams_timestamp_idx (timestamp)
+)
+PARTITION BY RANGE ( TO_DAYS(timestamp) ) (
+	PARTITION pmax VALUES LESS THAN MAXVALUE
+);
+
+DROP TABLE IF EXISTS ca_correlated_alerts;
+CREATE TABLE ca_correlated_alerts (
+	generation        integer     default 0,
+	alert1            integer,
+	alert2            integer,
+	correlation_coeff double,
+
+	primary key(generation, alert1, alert2),
+	key ca_correlated_alerts_alert1_idx (alert1),
+	key ca_correlated_alerts_alert2_idx (alert2)
+);
+
+DROP TABLE IF EXISTS ca_correlation_generation;
+CREATE TABLE ca_correlation_generation (
+	generation        integer     default 0
+);
+
+INSERT INTO ca_correlation_generation ( generation ) VALUES ( 0 );
+
+DELIMITER //
+
+-- Create the daily partitions of a table for today and the next two days
+-- (splitting the catch-all partition pmax), and drop the partitions whose
+-- rows are all older than retention_days days (0 = keep everything)
+DROP PROCEDURE IF EXISTS ca_rotate_table_partitions //
+CREATE PROCEDURE ca_rotate_table_partitions ( IN tbl VARCHAR(64), IN retention_days INT )
+BEGIN
+	DECLARE part_day  DATE;
+	DECLARE part_name VARCHAR(64);
+
+	SET part_day = CURDATE();
+
+	WHILE part_day <= CURDATE() + INTERVAL 2 DAY DO
+		SET part_name = CONCAT('p', DATE_FORMAT(part_day, '%Y%m%d'));
+
+		IF NOT EXISTS ( SELECT 1 FROM information_schema.PARTITIONS
+				WHERE TABLE_SCHEMA = DATABASE() AND TABLE_NAME = tbl AND PARTITION_NAME = part_name ) THEN
+			SET @ca_query = CONCAT('ALTER TABLE ', tbl, ' REORGANIZE PARTITION pmax INTO ( ',
+				'PARTITION ', part_name, ' VALUES LESS THAN (', TO_DAYS(part_day + INTERVAL 1 DAY), '), ',
+				'PARTITION pmax VALUES LESS THAN MAXVALUE )');
+			PREPARE ca_stmt FROM @ca_query;
+			EXECUTE ca_stmt;
+			DEALLOCATE PREPARE ca_stmt;
+		END IF;
+
+		SET part_day = part_day + INTERVAL 1 DAY;
+	END WHILE;
+
+	IF retention_days > 0 THEN
+		SET @ca_parts = NULL;
+
+		SELECT GROUP_CONCAT(PARTITION_NAME) INTO @ca_parts
+			FROM information_schema.PARTITIONS
+			WHERE TABLE_SCHEMA = DATABASE() AND TABLE_NAME = tbl
+			AND PARTITION_NAME <> 'pmax'
+			AND CAST(PARTITION_DESCRIPTION AS SIGNED) <= TO_DAYS(CURDATE() - INTERVAL retention_days DAY);
+
+		IF @ca_parts IS NOT NULL THEN
+			SET @ca_query = CONCAT('ALTER TABLE ', tbl, ' DROP PARTITION ', @ca_parts);
+			PREPARE ca_stmt FROM @ca_query;
+			EXECUTE ca_stmt;
+			DEALLOCATE PREPARE ca_stmt;
+		END IF;
+	END IF;
+END //
+
+DROP PROCEDURE IF EXISTS ca_rotate_partitions //
+CREATE PROCEDURE ca_rotate_partitions ( IN retention_days INT )
+BEGIN
+	CALL ca_rotate_table_partitions ( 'ca_alerts', retention_days );
+	CALL ca_rotate_table_partitions ( 'ca_packet_streams', retention_days );
+END //
+
+DELIMITER ;
+
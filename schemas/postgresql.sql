@@ -60,10 +60,25 @@ CREATE TABLE ca_packet_streams (
 
 DROP TABLE IF EXISTS ca_correlated_alerts CASCADE;
 CREATE TABLE ca_correlated_alerts (
+	generation        integer   default 0,
 	alert1            integer   references ca_alerts(alert_id),
 	alert2            integer   references ca_alerts(alert_id),
 	correlation_coeff real,
 
-	primary key(alert1, alert2)
+	primary key(generation, alert1, alert2)
 );
 
+CREATE INDEX ca_alerts_timestamp_idx ON ca_alerts ( timestamp );
+CREATE INDEX ca_alerts_cluster_id_idx ON ca_alerts ( cluster_id );
+CREATE INDEX ca_packet_streams_alert_id_idx ON ca_packet_streams ( alert_id );
+CREATE INDEX ca_packet_streams_timestamp_idx ON ca_packet_streams ( timestamp );
+CREATE INDEX ca_correlated_alerts_alert1_idx ON ca_correlated_alerts ( alert1 );
+CREATE INDEX ca_correlated_alerts_alert2_idx ON ca_correlated_alerts ( alert2 );
+
+DROP TABLE IF EXISTS ca_correlation_generation CASCADE;
+CREATE TABLE ca_correlation_generation (
+	generation        integer   default 0
+);
+
+INSERT INTO ca_correlation_generation ( generation ) VALUES ( 0 );
+
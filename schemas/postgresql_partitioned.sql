@@ -0,0 +1,148 @@
+-- Partitioned variant of schemas/postgresql.sql (PostgreSQL >= 11).
+--
+-- ca_alerts and ca_packet_streams are partitioned by day on their timestamp.
+-- The partitions are created in advance and the ones older than the
+-- output_database_retention option are dropped by ca_rotate_partitions(),
+-- periodically called by the module, so that old alerts are removed
+-- without running a DELETE over the whole table. Rows falling out of the
+-- existing daily partitions are kept in the <table>_default partitions.
+--
+-- The primary key of a partitioned table must include the partition key,
+-- so the references to ca_alerts(alert_id) are not enforced by the DBMS here.
+
+DROP TABLE IF EXISTS ca_ipv4_headers CASCADE;
+CREATE TABLE ca_ipv4_headers (
+	ip_hdr_id     serial   primary key,
+	ip_tos        integer,
+	ip_len        integer,
+	ip_id         integer,
+	ip_ttl        integer,
+	ip_proto      integer,
+	ip_src_addr   varchar(32),
+	ip_dst_addr   varchar(32)
+);
+INSERT INTO ca_ipv4_headers ( ip_hdr_id ) VALUES ( 0 );
+
+DROP TABLE IF EXISTS ca_tcp_headers CASCADE;
+CREATE TABLE ca_tcp_headers (
+	tcp_hdr_id     serial   primary key,
+	tcp_src_port   integer,
+	tcp_dst_port   integer,
+	tcp_seq        bigint,
+	tcp_ack        bigint,
+	tcp_flags      integer,
+	tcp_window     integer,
+	tcp_len        integer
+);
+INSERT INTO ca_tcp_headers ( tcp_hdr_id ) VALUES ( 0 );
+
+DROP TABLE IF EXISTS ca_clustered_alerts CASCADE;
+CREATE TABLE ca_clustered_alerts (
+	cluster_id        serial   primary key,
+	clustered_srcip   varchar(255) default null,
+	clustered_dstip   varchar(255) default null,
+	clustered_srcport varchar(255) default null,
+	clustered_dstport varchar(255) default null
+);
+INSERT INTO ca_clustered_alerts ( cluster_id ) VALUES ( 0 );
+
+DROP TABLE IF EXISTS ca_alerts CASCADE;
+CREATE TABLE ca_alerts (
+	alert_id       serial,
+	gid            integer,
+	sid            integer,
+	rev            integer,
+	priority       integer,
+	description    varchar(255),
+	classification varchar(255),
+	timestamp      timestamp not null,
+	ip_hdr         integer default 0 references ca_ipv4_headers(ip_hdr_id),
+	tcp_hdr        integer default 0 references ca_tcp_headers(tcp_hdr_id),
+	cluster_id     integer default 0 references ca_clustered_alerts(cluster_id),
+
+	primary key(alert_id, timestamp)
+) PARTITION BY RANGE ( timestamp );
+CREATE TABLE ca_alerts_default PARTITION OF ca_alerts DEFAULT;
+
+DROP TABLE IF EXISTS ca_packet_streams CASCADE;
+CREATE TABLE ca_packet_streams (
+	pkt_id         serial,
+	alert_id       integer,
+	pkt_len        integer,
+	timestamp      timestamp not null,
+	content        bytea,
+
+	primary key(pkt_id, timestamp)
+) PARTITION BY RANGE ( timestamp );
+CREATE TABLE ca_packet_streams_default PARTITION OF ca_packet_streams DEFAULT;
+
+DROP TABLE IF EXISTS ca_correlated_alerts CASCADE;
+CREATE TABLE ca_correlated_alerts (
+	generation        integer   default 0,
+	alert1            integer,
+	alert2            integer,
+	correlation_coeff real,
+
+	primary key(generation, alert1, alert2)
+);
+
+CREATE INDEX ca_alerts_timestamp_idx ON ca_alerts ( timestamp );
+CREATE INDEX ca_alerts_cluster_id_idx ON ca_alerts ( cluster_id );
+CREATE INDEX ca_packet_streams_alert_id_idx ON ca_packet_streams ( alert_id );
+CREATE INDEX ca_packet_streams_timestamp_idx ON ca_packet_streams ( timestamp );
+CREATE INDEX ca_correlated_alerts_alert1_idx ON ca_correlated_alerts ( alert1 );
+CREATE INDEX ca_correlated_alerts_alert2_idx ON ca_correlated_alerts ( alert2 );
+
+DROP TABLE IF EXISTS ca_correlation_generation CASCADE;
+CREATE TABLE ca_correlation_generation (
+	generation        integer   default 0
+);
+
+INSERT INTO ca_correlation_generation ( generation ) VALUES ( 0 );
+
+-- Create the daily partitions of a table for today and the next two days
+-- (moving there any row already stored in the default partition), and drop
+-- the partitions whose rows are all older than retention_days days
+-- (0 = keep everything). Returns the number of dropped partitions
+CREATE OR REPLACE FUNCTION ca_rotate_table_partitions ( tbl text, retention_days integer ) RETURNS integer AS $$
+DECLARE
+	part_day   date;
+	part       text;
+	n_dropped  integer := 0;
+BEGIN
+	FOR i IN 0..2 LOOP
+		part_day := current_date + i;
+		part     := tbl || '_p' || to_char ( part_day, 'YYYYMMDD' );
+
+		IF to_regclass ( part ) IS NULL THEN
+			EXECUTE format ( 'CREATE TABLE %I ( LIKE %I INCLUDING DEFAULTS INCLUDING CONSTRAINTS )', part, tbl );
+			EXECUTE format ( 'WITH moved AS ( DELETE FROM %I WHERE timestamp >= %L AND timestamp < %L RETURNING * ) '
+				'INSERT INTO %I SELECT * FROM moved', tbl || '_default', part_day, part_day + 1, part );
+			EXECUTE format ( 'ALTER TABLE %I ATTACH PARTITION %I FOR VALUES FROM ( %L ) TO ( %L )',
+				tbl, part, part_day, part_day + 1 );
+		END IF;
+	END LOOP;
+
+	IF retention_days > 0 THEN
+		FOR part IN
+			SELECT c.relname FROM pg_inherits i JOIN pg_class c ON c.oid = i.inhrelid
+			WHERE i.inhparent = tbl::regclass AND c.relname ~ ( '^' || tbl || '_p[0-9]{8}$' )
+		LOOP
+			IF to_date ( right ( part, 8 ), 'YYYYMMDD' ) + 1 <= current_date - retention_days THEN
+				EXECUTE format ( 'DROP TABLE %I', part );
+				n_dropped := n_dropped + 1;
+			END IF;
+		END LOOP;
+	END IF;
+
+	RETURN n_dropped;
+END;
+$$ LANGUAGE plpgsql;
+
+CREATE OR REPLACE FUNCTION ca_rotate_partitions ( retention_days integer ) RETURNS integer AS $$
+BEGIN
+	RETURN ca_rotate_table_partitions ( 'ca_alerts', retention_days ) +
+		ca_rotate_table_partitions ( 'ca_packet_streams', retention_days );
+END;
+$$ LANGUAGE plpgsql;
+
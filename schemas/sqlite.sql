@@ -0,0 +1,81 @@
+DROP TABLE IF EXISTS ca_ipv4_headers;
+CREATE TABLE ca_ipv4_headers (
+	ip_hdr_id     integer     primary key autoincrement,
+	ip_tos        integer,
+	ip_len        integer,
+	ip_id         integer,
+	ip_ttl        integer,
+	ip_proto      integer,
+	ip_src_addr   varchar(32),
+	ip_dst_addr   varchar(32)
+);
+
+DROP TABLE IF EXISTS ca_tcp_headers;
+CREATE TABLE ca_tcp_headers (
+	tcp_hdr_id     integer    primary key autoincrement,
+	tcp_src_port   integer,
+	tcp_dst_port   integer,
+	tcp_seq        integer,
+	tcp_ack        integer,
+	tcp_flags      integer,
+	tcp_window     integer,
+	tcp_len        integer
+);
+
+DROP TABLE IF EXISTS ca_clustered_alerts;
+CREATE TABLE ca_clustered_alerts (
+	cluster_id        integer      primary key autoincrement,
+	clustered_srcip   varchar(255) default null,
+	clustered_dstip   varchar(255) default null,
+	clustered_srcport varchar(255) default null,
+	clustered_dstport varchar(255) default null
+);
+
+DROP TABLE IF EXISTS ca_alerts;
+CREATE TABLE ca_alerts (
+	alert_id       integer     primary key autoincrement,
+	gid            integer,
+	sid            integer,
+	rev            integer,
+	priority       integer,
+	description    varchar(255),
+	classification varchar(255),
+	timestamp      datetime,
+	ip_hdr         integer default 0 references ca_ipv4_headers(ip_hdr_id),
+	tcp_hdr        integer default 0 references ca_tcp_headers(tcp_hdr_id),
+	cluster_id     integer default 0 references ca_clustered_alerts(cluster_id)
+);
+
+DROP TABLE IF EXISTS ca_packet_streams;
+CREATE TABLE ca_packet_streams (
+	pkt_id         integer     primary key autoincrement,
+	alert_id       integer     references ca_alerts(alert_id),
+	pkt_len        integer,
+	timestamp      datetime,
+	content        blob
+);
+
+DROP TABLE IF EXISTS ca_correlated_alerts;
+CREATE TABLE ca_correlated_alerts (
+	generation        integer     default 0,
+	alert1            integer     references ca_alerts(alert_id),
+	alert2            integer     references ca_alerts(alert_id),
+	correlation_coeff double,
+
+	primary key(generation, alert1, alert2)
+);
+
+CREATE INDEX ca_alerts_timestamp_idx ON ca_alerts ( timestamp );
+CREATE INDEX ca_alerts_cluster_id_idx ON ca_alerts ( cluster_id );
+CREATE INDEX ca_packet_streams_alert_id_idx ON ca_packet_streams ( alert_id );
+CREATE INDEX ca_packet_streams_timestamp_idx ON ca_packet_streams ( timestamp );
+CREATE INDEX ca_correlated_alerts_alert1_idx ON ca_correlated_alerts ( alert1 );
+CREATE INDEX ca_correlated_alerts_alert2_idx ON ca_correlated_alerts ( alert2 );
+
+DROP TABLE IF EXISTS ca_correlation_generation;
+CREATE TABLE ca_correlation_generation (
+	generation        integer     default 0
+);
+
+INSERT INTO ca_correlation_generation ( generation ) VALUES ( 0 );
+
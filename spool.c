@@ -0,0 +1,419 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  spool.c
+ *
+ *    Description:  Write-ahead spool keeping the writes to the output database while
+ *    			the database is unavailable or slow, and replaying them later
+ *
+ *        Version:  0.1
+ *        Created:  18/10/2026 15:21:07
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  BlackLight (http://0x00.ath.cx), <blacklight@autistici.org>
+ *        Licence:  GNU GPL v.3
+ *        Company:  DO WHAT YOU WANT CAUSE A PIRATE IS FREE, YOU ARE A PIRATE!
+ *
+ * =====================================================================================
+ */
+
+#include	"spp_ai.h"
+
+/** \defgroup spool Write-ahead spool for the output database
+ * @{ */
+
+#ifdef 	HAVE_DB
+
+#include	<stdint.h>
+#include	<stdio.h>
+#include	<sys/types.h>
+#include	<time.h>
+#include	<unistd.h>
+
+/** Interval in seconds between two replays of the spool */
+#define 	OUTDB_SPOOL_REPLAY_INTERVAL 	5
+
+/** Maximum number of records replayed before the offset of the spool is saved */
+#define 	OUTDB_SPOOL_REPLAY_BATCH 		256
+
+/** Interval in seconds between two reports of the lag of the spool */
+#define 	OUTDB_SPOOL_LAG_REPORT_INTERVAL 	60
+
+/** Header of a record of the spool. The header is followed by 'length' bytes
+ * containing the statements of the record as NUL-terminated strings */
+typedef struct  {
+	/** Time the record was spooled */
+	time_t    timestamp;
+
+	/** Length of the statements following the header */
+	uint32_t  length;
+} AI_spool_record_header;
+
+/** Spool file, opened in append mode */
+PRIVATE FILE            *spool = NULL;
+
+/** File keeping the offset of the first record not replayed yet */
+PRIVATE char            spool_offset_file[1040] = { 0 };
+
+/** Size of the spool file */
+PRIVATE off_t           spool_size = 0;
+
+/** Offset of the first record not replayed yet */
+PRIVATE off_t           spool_offset = 0;
+
+/** Number of records not replayed yet */
+PRIVATE unsigned long   spool_records = 0;
+
+/** Number of records discarded because the spool was full */
+PRIVATE unsigned long   spool_dropped = 0;
+
+/** Time the oldest record not replayed yet was spooled */
+PRIVATE time_t          spool_oldest = 0;
+
+/** Mutex protecting the spool */
+PRIVATE pthread_mutex_t spool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * \brief  Save the offset of the first record not replayed yet, so that a restarted
+ * module does not replay the same records twice. The offset is written to a temporary
+ * file renamed over the offset file, so that a crash never leaves a partial offset behind
+ */
+
+PRIVATE void
+__AI_spool_save_offset ()
+{
+	FILE *fp = NULL;
+	char tmp_file[sizeof ( spool_offset_file ) + 8] = { 0 };
+
+	snprintf ( tmp_file, sizeof ( tmp_file ), "%s.tmp", spool_offset_file );
+
+	if ( !( fp = fopen ( tmp_file, "w" )))
+	{
+		_dpd.errMsg ( "AIPreproc: Warning: unable to write the spool offset file '%s'\n", spool_offset_file );
+		return;
+	}
+
+	fprintf ( fp, "%llu\n", (unsigned long long) spool_offset );
+
+	if ( fclose ( fp ) != 0 || rename ( tmp_file, spool_offset_file ) != 0 )
+	{
+		_dpd.errMsg ( "AIPreproc: Warning: unable to write the spool offset file '%s'\n", spool_offset_file );
+		unlink ( tmp_file );
+	}
+}		/* -----  end of function __AI_spool_save_offset  ----- */
+
+/**
+ * \brief  Read the header of the record at a given offset of the spool
+ * \param  offset 	Offset of the record
+ * \param  header 	Reference to the header to be filled
+ * \return true if a complete record is stored at that offset, false otherwise
+ */
+
+PRIVATE BOOL
+__AI_spool_read_header ( off_t offset, AI_spool_record_header *header )
+{
+	if ( offset + (off_t) sizeof ( AI_spool_record_header ) > spool_size )
+		return false;
+
+	if ( fseeko ( spool, offset, SEEK_SET ) != 0 )
+		return false;
+
+	if ( fread ( header, sizeof ( AI_spool_record_header ), 1, spool ) != 1 )
+		return false;
+
+	return ( offset + (off_t) sizeof ( AI_spool_record_header ) + (off_t) header->length <= spool_size );
+}		/* -----  end of function __AI_spool_read_header  ----- */
+
+/**
+ * \brief  Check whether the spool is used
+ * \return true if a spool file is configured, false otherwise
+ */
+
+BOOL
+AI_spool_enabled ()
+{
+	return ( spool != NULL );
+}		/* -----  end of function AI_spool_enabled  ----- */
+
+/**
+ * \brief  Check whether the spool contains records not replayed yet
+ * \return true if there are records to be replayed, false otherwise
+ */
+
+BOOL
+AI_spool_pending ()
+{
+	BOOL pending = false;
+
+	pthread_mutex_lock ( &spool_mutex );
+	pending = ( spool_records > 0 );
+	pthread_mutex_unlock ( &spool_mutex );
+
+	return pending;
+}		/* -----  end of function AI_spool_pending  ----- */
+
+/**
+ * \brief  Open the spool file and recover the records left by a previous run
+ */
+
+void
+AI_spool_init ()
+{
+	FILE                   *fp = NULL;
+	off_t                  offset = 0;
+	unsigned long long     saved_offset = 0;
+	AI_spool_record_header header;
+
+	if ( strlen ( config->outdb_spool_file ) == 0 || config->outdbSpoolMaxSize == 0 )
+		return;
+
+	snprintf ( spool_offset_file, sizeof ( spool_offset_file ), "%s.offset", config->outdb_spool_file );
+
+	if ( !( spool = fopen ( config->outdb_spool_file, "a+b" )))
+	{
+		_dpd.errMsg ( "AIPreproc: Warning: unable to open the spool file '%s', "
+			"the alerts will be discarded while the output database is unavailable\n", config->outdb_spool_file );
+		return;
+	}
+
+	fseeko ( spool, 0, SEEK_END );
+	spool_size = ftello ( spool );
+
+	if (( fp = fopen ( spool_offset_file, "r" )))
+	{
+		if ( fscanf ( fp, "%llu", &saved_offset ) == 1 && (off_t) saved_offset <= spool_size )
+			spool_offset = (off_t) saved_offset;
+
+		fclose ( fp );
+	}
+
+	/* Count the records left to replay, and cut a record half-written by a crash */
+	for ( offset = spool_offset; __AI_spool_read_header ( offset, &header ); )
+	{
+		if ( spool_records++ == 0 )
+			spool_oldest = header.timestamp;
+
+		offset += sizeof ( AI_spool_record_header ) + header.length;
+	}
+
+	if ( offset < spool_size )
+	{
+		if ( ftruncate ( fileno ( spool ), offset ) == 0 )
+			spool_size = offset;
+	}
+
+	if ( spool_records > 0 )
+	{
+		_dpd.logMsg ( "AIPreproc: %lu records left in the output database spool will be replayed\n", spool_records );
+	}
+}		/* -----  end of function AI_spool_init  ----- */
+
+/**
+ * \brief  Append a group of statements to the spool
+ * \param  stmts 	Statements, as a sequence of NUL-terminated strings
+ * \param  len 	Length of the buffer
+ * \return true if the statements were spooled, false if they were discarded
+ */
+
+BOOL
+AI_spool_append ( const char *stmts, size_t len )
+{
+	AI_spool_record_header header;
+
+	if ( !spool )
+	{
+		_dpd.logMsg ( "AIPreproc: Warning: the output database is unavailable and no spool is configured, the alert was not stored\n" );
+		return false;
+	}
+
+	header.timestamp = time ( NULL );
+	header.length    = (uint32_t) len;
+
+	pthread_mutex_lock ( &spool_mutex );
+
+	if ( spool_size + (off_t) ( sizeof ( header ) + len ) > (off_t) config->outdbSpoolMaxSize * 1024 * 1024 )
+	{
+		if ( spool_dropped++ == 0 )
+		{
+			_dpd.errMsg ( "AIPreproc: Warning: the output database spool is full ( %lu MB ), "
+				"the alerts will be discarded until it is replayed\n", config->outdbSpoolMaxSize );
+		}
+
+		pthread_mutex_unlock ( &spool_mutex );
+		return false;
+	}
+
+	fseeko ( spool, 0, SEEK_END );
+
+	if ( fwrite ( &header, sizeof ( header ), 1, spool ) != 1 || fwrite ( stmts, 1, len, spool ) != len || fflush ( spool ) != 0 )
+	{
+		/* Don't leave a partial record behind */
+		fflush ( spool );
+
+		if ( ftruncate ( fileno ( spool ), spool_size ) != 0 )
+			_dpd.errMsg ( "AIPreproc: Warning: unable to restore the spool file after a failed write\n" );
+
+		spool_dropped++;
+		pthread_mutex_unlock ( &spool_mutex );
+		return false;
+	}
+
+	spool_size += sizeof ( header ) + len;
+
+	if ( spool_records++ == 0 )
+		spool_oldest = header.timestamp;
+
+	pthread_mutex_unlock ( &spool_mutex );
+	return true;
+}		/* -----  end of function AI_spool_append  ----- */
+
+/**
+ * \brief  Replay a batch of records from the spool
+ * \return Number of records replayed (or discarded because rejected by the database)
+ */
+
+PRIVATE unsigned long
+__AI_spool_replay_batch ()
+{
+	unsigned long          n = 0;
+	off_t                  offset = 0;
+	char                   *stmts = NULL;
+	AI_spool_record_header header;
+	AI_outdb_write_status  status;
+
+	for ( n=0; n < OUTDB_SPOOL_REPLAY_BATCH; n++ )
+	{
+		/* Appends only happen at the end of the file, so the record can be executed without holding the lock */
+		pthread_mutex_lock ( &spool_mutex );
+		offset = spool_offset;
+
+		if ( !__AI_spool_read_header ( offset, &header ))
+		{
+			pthread_mutex_unlock ( &spool_mutex );
+			break;
+		}
+
+		if ( !( stmts = (char*) malloc ( header.length + 1 )))
+			AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+		if ( fread ( stmts, 1, header.length, spool ) != header.length )
+		{
+			pthread_mutex_unlock ( &spool_mutex );
+			free ( stmts );
+			break;
+		}
+
+		pthread_mutex_unlock ( &spool_mutex );
+		stmts[ header.length ] = 0;
+
+		if (( status = AI_outdb_exec_statements ( stmts, header.length, 0, NULL )) == outdb_write_unavailable )
+		{
+			free ( stmts );
+			break;
+		}
+
+		/* A record rejected by a working database would block the spool forever */
+		if ( status == outdb_write_failed )
+		{
+			_dpd.logMsg ( "AIPreproc: Warning: the output database rejected a spooled record, the record was discarded\n" );
+		}
+
+		free ( stmts );
+
+		/* The offset is saved after each record executed, so that a crash in the middle of
+		 * a batch doesn't replay the records already committed */
+		pthread_mutex_lock ( &spool_mutex );
+		spool_offset = offset + sizeof ( AI_spool_record_header ) + header.length;
+		__AI_spool_save_offset();
+
+		if ( --spool_records > 0 )
+		{
+			if ( __AI_spool_read_header ( spool_offset, &header ))
+				spool_oldest = header.timestamp;
+		}
+
+		pthread_mutex_unlock ( &spool_mutex );
+	}
+
+	if ( n > 0 )
+	{
+		pthread_mutex_lock ( &spool_mutex );
+
+		/* The spool was drained: truncate it, so that it does not grow forever */
+		if ( spool_records == 0 && spool_offset == spool_size )
+		{
+			if ( ftruncate ( fileno ( spool ), 0 ) == 0 )
+			{
+				spool_size = spool_offset = 0;
+				__AI_spool_save_offset();
+			}
+		}
+		pthread_mutex_unlock ( &spool_mutex );
+	}
+
+	return n;
+}		/* -----  end of function __AI_spool_replay_batch  ----- */
+
+/**
+ * \brief  Thread replaying the records of the spool on the output database and periodically
+ * reporting its lag (number and size of the records not replayed yet, age of the oldest one)
+ * \param  arg 	Unused
+ */
+
+void*
+AI_outdb_spool_thread ( void *arg )
+{
+	unsigned long records = 0,
+			    dropped = 0,
+			    last_dropped = 0;
+	off_t         bytes = 0;
+	time_t        oldest = 0,
+			    last_report = 0;
+	BOOL          lagging = false;
+
+	if ( !spool )
+	{
+		pthread_exit ((void*) 0);
+		return (void*) 0;
+	}
+
+	while ( 1 )
+	{
+		while ( AI_spool_pending() && __AI_spool_replay_batch() == OUTDB_SPOOL_REPLAY_BATCH );
+
+		pthread_mutex_lock ( &spool_mutex );
+		records = spool_records;
+		bytes   = spool_size - spool_offset;
+		oldest  = spool_oldest;
+		dropped = spool_dropped;
+		pthread_mutex_unlock ( &spool_mutex );
+
+		if ( records > 0 || dropped != last_dropped )
+		{
+			if ( time ( NULL ) - last_report >= OUTDB_SPOOL_LAG_REPORT_INTERVAL )
+			{
+				_dpd.logMsg ( "AIPreproc: output database spool lag: %lu records, %llu bytes, oldest spooled %lu seconds ago, %lu discarded\n",
+					records, (unsigned long long) bytes, (unsigned long) (( records > 0 ) ? time ( NULL ) - oldest : 0 ), dropped );
+
+				last_report  = time ( NULL );
+				last_dropped = dropped;
+			}
+
+			lagging = ( records > 0 );
+		} else if ( lagging ) {
+			_dpd.logMsg ( "AIPreproc: the output database spool was replayed\n" );
+			lagging = false;
+		}
+
+		sleep ( OUTDB_SPOOL_REPLAY_INTERVAL );
+	}
+
+	pthread_exit ((void*) 0);
+	return (void*) 0;
+}		/* -----  end of function AI_outdb_spool_thread  ----- */
+
+#endif
+
+/** @} */
+
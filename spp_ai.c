@@ -24,11 +24,13 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 /** \defgroup spp_ai Main file for spp_ai module
  * @{ */
 
 AI_snort_alert* (*get_alerts)(void);
+AI_snort_alert* (*get_alerts_since)(AI_snort_alert**);
 AI_config *config = NULL;
 
 tSfPolicyUserContextId ex_config = NULL;
@@ -59,6 +61,16 @@ static void AI_reloadSwapFree(void *);
 void
 AI_fatal_err ( const char *msg, const char *file, const int line )
 {
+	/* In a helper process of the correlation modules an error only terminates the helper, which is then
+	 * given up by the correlation thread of Snort */
+	if ( AI_corr_modules_proc_is_helper() )
+	{
+		fprintf ( stderr, "%s: %s at %s:%d (%s)\n",
+			PREPROC_NAME, msg, file, line,
+			((errno != 0) ? strerror(errno) : ""));
+		_exit ( EXIT_FAILURE );
+	}
+
 	_dpd.fatalMsg ( "%s: %s at %s:%d (%s)\n",
 		PREPROC_NAME, msg, file, line,
 		((errno != 0) ? strerror(errno) : ""));
@@ -94,6 +106,11 @@ static void AI_init(char *args)
 			 neural_thread,
 			 correlation_thread;
 
+	#ifdef HAVE_DB
+	pthread_t  outdb_retention_thread,
+			 outdb_spool_thread;
+	#endif
+
 	tSfPolicyId policy_id = _dpd.getParserPolicy();
 
 	_dpd.logMsg("AI dynamic preprocessor configuration\n");
@@ -109,8 +126,10 @@ static void AI_init(char *args)
 	sfPolicyUserPolicySet(ex_config, policy_id);
 	sfPolicyUserDataSetCurrent(ex_config, config);
 
-	/* Initialize the extra correlation modules */
+	/* Initialize the extra correlation modules, and tear them down when Snort exits */
 	AI_init_corr_modules();
+	_dpd.addPreprocExit ( AI_corr_modules_proc_exit, NULL, PRIORITY_TRANSPORT, 10000 );
+	_dpd.addPreprocExit ( AI_corr_modules_exit, NULL, PRIORITY_TRANSPORT, 10000 );
 
 	/* If the hash_cleanup_interval or stream_expire_interval options are set to zero,
 	 * no cleanup will be made on the streams */
@@ -158,6 +177,28 @@ static void AI_init(char *args)
 		}
 	}
 
+	#ifdef HAVE_DB
+	/* If an output database is used, start the thread managing the partitions of its tables */
+	if ( config->outdbtype != outdb_none )
+	{
+		if ( pthread_create ( &outdb_retention_thread, NULL, AI_outdb_retention_thread, NULL ) != 0 )
+		{
+			AI_fatal_err ( "Failed to create the output database retention thread", __FILE__, __LINE__ );
+		}
+	}
+
+	/* If an output database is used, recover the writes spooled by a previous run and start the thread replaying them */
+	if ( config->outdbtype != outdb_none )
+	{
+		AI_spool_init();
+
+		if ( pthread_create ( &outdb_spool_thread, NULL, AI_outdb_spool_thread, NULL ) != 0 )
+		{
+			AI_fatal_err ( "Failed to create the output database spool thread", __FILE__, __LINE__ );
+		}
+	}
+	#endif
+
 	/* Register the preprocessor function, Transport layer, ID 10000 */
 	_dpd.addPreproc(AI_process, PRIORITY_TRANSPORT, 10000, PROTO_BIT__TCP | PROTO_BIT__UDP);
 	DEBUG_WRAP(_dpd.debugMsg(DEBUG_PLUGIN, "Preprocessor: AI is initialized\n"););
@@ -189,6 +230,7 @@ static AI_config * AI_parse(char *args)
 	int      len;
 	unsigned long int offset;
 	double   corr_threshold_coefficient = DEFAULT_CORR_THRESHOLD;
+	double   corr_threshold_tolerance   = DEFAULT_CORR_THRESHOLD_TOLERANCE;
 	uint32_t netmask;
 
 	int           min_val;
@@ -212,6 +254,13 @@ static AI_config * AI_parse(char *args)
 				cleanup_interval                     = 0,
 			     clusterfile_len                      = 0,
 			     cluster_max_alert_interval           = 0,
+			     clustering_threads                   = 0,
+			     correlation_threads                  = 0,
+			     correlation_modules_processes        = 0,
+			     correlation_horizon                  = 0,
+			     correlation_render_max_edges         = 0,
+			     correlation_render_interval          = 0,
+			     cluster_snapshot_interval            = 0,
 			     corr_alerts_dir_len                  = 0,
 				corr_modules_dir_len                 = 0,
 			     corr_rules_dir_len                   = 0,
@@ -222,6 +271,8 @@ static AI_config * AI_parse(char *args)
 				neural_clustering_interval           = 0,
 				neural_network_training_interval     = 0,
 				neural_train_steps                   = 0,
+				output_database_retention            = 0,
+				output_database_spool_max_size       = 0,
 				output_neurons_per_side              = 0,
 			     stream_expire_interval               = 0,
 				use_knowledge_base_correlation_index = 0,
@@ -423,6 +474,25 @@ static AI_config * AI_parse(char *args)
 	config->correlationThresholdCoefficient = corr_threshold_coefficient;
 	_dpd.logMsg( "    Correlation threshold coefficient: %f\n", corr_threshold_coefficient );
 
+	/* Parsing the correlation_threshold_tolerance option */
+	if (( arg = (char*) strcasestr( args, "correlation_threshold_tolerance" ) ))
+	{
+		for ( arg += strlen("correlation_threshold_tolerance");
+				*arg && (*arg < '0' || *arg > '9');
+				arg++ );
+
+		if ( !(*arg) )
+		{
+			AI_fatal_err( "correlation_threshold_tolerance option used but "
+				"no value specified", __FILE__, __LINE__ );
+		}
+
+		corr_threshold_tolerance = strtod ( arg, NULL );
+	}
+
+	config->correlationThresholdTolerance = corr_threshold_tolerance;
+	_dpd.logMsg( "    Correlation threshold tolerance: %f\n", corr_threshold_tolerance );
+
 	/* Parsing the bayesian_correlation_interval option */
 	if (( arg = (char*) strcasestr( args, "bayesian_correlation_interval" ) ))
 	{
@@ -510,6 +580,172 @@ static AI_config * AI_parse(char *args)
 	config->clusterMaxAlertInterval = cluster_max_alert_interval;
 	_dpd.logMsg( "    Cluster alert max interval: %u\n", config->clusterMaxAlertInterval );
 
+	/* Parsing the clustering_threads option */
+	if (( arg = (char*) strcasestr( args, "clustering_threads" ) ))
+	{
+		for ( arg += strlen("clustering_threads");
+				*arg && (*arg < '0' || *arg > '9');
+				arg++ );
+
+		if ( !(*arg) )
+		{
+			AI_fatal_err ( "clustering_threads option used but "
+				"no value specified", __FILE__, __LINE__ );
+		}
+
+		clustering_threads = strtoul ( arg, NULL, 10 );
+	} else {
+		clustering_threads = DEFAULT_CLUSTERING_THREADS;
+	}
+
+	config->clusteringThreads = clustering_threads;
+	_dpd.logMsg( "    Clustering threads: %u\n", config->clusteringThreads );
+
+	/* Parsing the correlation_threads option */
+	if (( arg = (char*) strcasestr( args, "correlation_threads" ) ))
+	{
+		for ( arg += strlen("correlation_threads");
+				*arg && (*arg < '0' || *arg > '9');
+				arg++ );
+
+		if ( !(*arg) )
+		{
+			AI_fatal_err ( "correlation_threads option used but "
+				"no value specified", __FILE__, __LINE__ );
+		}
+
+		correlation_threads = strtoul ( arg, NULL, 10 );
+	} else {
+		correlation_threads = DEFAULT_CORRELATION_THREADS;
+	}
+
+	config->correlationThreads = correlation_threads;
+	_dpd.logMsg( "    Correlation threads: %u\n", config->correlationThreads );
+
+	/* Parsing the correlation_modules_processes option */
+	if (( arg = (char*) strcasestr( args, "correlation_modules_processes" ) ))
+	{
+		for ( arg += strlen("correlation_modules_processes");
+				*arg && (*arg < '0' || *arg > '9');
+				arg++ );
+
+		if ( !(*arg) )
+		{
+			AI_fatal_err ( "correlation_modules_processes option used but "
+				"no value specified", __FILE__, __LINE__ );
+		}
+
+		correlation_modules_processes = strtoul ( arg, NULL, 10 );
+	} else {
+		correlation_modules_processes = DEFAULT_CORRELATION_MODULES_PROCESSES;
+	}
+
+	config->correlationModulesProcesses = correlation_modules_processes;
+	_dpd.logMsg( "    Correlation modules processes: %u\n", config->correlationModulesProcesses );
+
+	/* Parsing the correlation_horizon option */
+	if (( arg = (char*) strcasestr( args, "correlation_horizon" ) ))
+	{
+		for ( arg += strlen("correlation_horizon");
+				*arg && (*arg < '0' || *arg > '9');
+				arg++ );
+
+		if ( !(*arg) )
+		{
+			AI_fatal_err ( "correlation_horizon option used but "
+				"no value specified", __FILE__, __LINE__ );
+		}
+
+		correlation_horizon = strtoul ( arg, NULL, 10 );
+	} else {
+		correlation_horizon = DEFAULT_CORRELATION_HORIZON;
+	}
+
+	config->correlationHorizon = correlation_horizon;
+	_dpd.logMsg( "    Correlation horizon: %u\n", config->correlationHorizon );
+
+	/* Parsing the correlation_render_max_edges option */
+	if (( arg = (char*) strcasestr( args, "correlation_render_max_edges" ) ))
+	{
+		for ( arg += strlen("correlation_render_max_edges");
+				*arg && (*arg < '0' || *arg > '9');
+				arg++ );
+
+		if ( !(*arg) )
+		{
+			AI_fatal_err ( "correlation_render_max_edges option used but "
+				"no value specified", __FILE__, __LINE__ );
+		}
+
+		correlation_render_max_edges = strtoul ( arg, NULL, 10 );
+	} else {
+		correlation_render_max_edges = DEFAULT_CORRELATION_RENDER_MAX_EDGES;
+	}
+
+	config->correlationRenderMaxEdges = correlation_render_max_edges;
+	_dpd.logMsg( "    Correlation render max edges: %u\n", config->correlationRenderMaxEdges );
+
+	/* Parsing the correlation_render_interval option */
+	if (( arg = (char*) strcasestr( args, "correlation_render_interval" ) ))
+	{
+		for ( arg += strlen("correlation_render_interval");
+				*arg && (*arg < '0' || *arg > '9');
+				arg++ );
+
+		if ( !(*arg) )
+		{
+			AI_fatal_err ( "correlation_render_interval option used but "
+				"no value specified", __FILE__, __LINE__ );
+		}
+
+		correlation_render_interval = strtoul ( arg, NULL, 10 );
+	} else {
+		correlation_render_interval = DEFAULT_CORRELATION_RENDER_INTERVAL;
+	}
+
+	config->correlationRenderInterval = correlation_render_interval;
+	_dpd.logMsg( "    Correlation render interval: %u\n", config->correlationRenderInterval );
+
+	/* Parsing the cluster_snapshot_interval option */
+	if (( arg = (char*) strcasestr( args, "cluster_snapshot_interval" ) ))
+	{
+		for ( arg += strlen("cluster_snapshot_interval");
+				*arg && (*arg < '0' || *arg > '9');
+				arg++ );
+
+		if ( !(*arg) )
+		{
+			AI_fatal_err ( "cluster_snapshot_interval option used but "
+				"no value specified", __FILE__, __LINE__ );
+		}
+
+		cluster_snapshot_interval = strtoul ( arg, NULL, 10 );
+	} else {
+		cluster_snapshot_interval = DEFAULT_CLUSTER_SNAPSHOT_INTERVAL;
+	}
+
+	config->clusterSnapshotInterval = cluster_snapshot_interval;
+	_dpd.logMsg( "    Clustered alerts snapshot interval: %u\n", config->clusterSnapshotInterval );
+
+	/* Parsing the cluster_output_format option */
+	config->clusterOutputFormat = cluster_output_text;
+
+	if ( preg_match ( "cluster_output_format\\s+\"?([a-zA-Z]+)\"?", args, &matches, &nmatches ) > 0 )
+	{
+		if ( !strcasecmp ( matches[0], "json" ))
+			config->clusterOutputFormat = cluster_output_json;
+		else if ( strcasecmp ( matches[0], "text" ))
+			AI_fatal_err ( "cluster_output_format option used with an unknown format (allowed: text, json)", __FILE__, __LINE__ );
+
+		for ( i=0; i < nmatches; i++ )
+			free ( matches[i] );
+
+		free ( matches );
+		matches = NULL;
+	}
+
+	_dpd.logMsg( "    Clustered alerts format: %s\n", ( config->clusterOutputFormat == cluster_output_json ) ? "json" : "text" );
+
 	/* Parsing the neural_network_training_interval option */
 	if (( arg = (char*) strcasestr( args, "neural_network_training_interval" ) ))
 	{
@@ -1095,8 +1331,14 @@ static AI_config * AI_parse(char *args)
 				#else
 					config->outdbtype = outdb_postgresql;
 				#endif
+			} else if ( !strcasecmp ( matches[0], "sqlite" )) {
+				#ifndef HAVE_LIBSQLITE3
+					AI_fatal_err ( "sqlite output set in 'output_database' option but the module was not compiled through --with-sqlite option", __FILE__, __LINE__  );
+				#else
+					config->outdbtype = outdb_sqlite;
+				#endif
 			} else {
-				AI_fatal_err ( "Not supported database in configuration (supported types: mysql, postgresql)", __FILE__, __LINE__  );
+				AI_fatal_err ( "Not supported database in configuration (supported types: mysql, postgresql, sqlite)", __FILE__, __LINE__  );
 			}
 
 			for ( i=0; i < nmatches; i++ )
@@ -1161,6 +1403,70 @@ static AI_config * AI_parse(char *args)
 		_dpd.logMsg("    Saving output alerts to the database %s\n", config->outdbname );
 	}
 
+	/* Parsing the output_database_retention option */
+	if (( arg = (char*) strcasestr( args, "output_database_retention" ) ))
+	{
+		for ( arg += strlen("output_database_retention");
+				*arg && (*arg < '0' || *arg > '9');
+				arg++ );
+
+		if ( !(*arg) )
+		{
+			AI_fatal_err ( "output_database_retention option used but "
+				"no value specified", __FILE__, __LINE__ );
+		}
+
+		output_database_retention = strtoul ( arg, NULL, 10 );
+	} else {
+		output_database_retention = DEFAULT_OUTDB_RETENTION_DAYS;
+	}
+
+	config->outdbRetentionDays = output_database_retention;
+
+	if ( config->outdbtype != outdb_none && config->outdbRetentionDays != 0 )
+	{
+		_dpd.logMsg( "    Output database retention: %u days\n", config->outdbRetentionDays );
+	}
+
+	/* Parsing the output_database_spool_file option */
+	if ( preg_match ( "output_database_spool_file\\s+\"([^\"]*)\"", args, &matches, &nmatches ) > 0 )
+	{
+		strncpy ( config->outdb_spool_file, matches[0], sizeof ( config->outdb_spool_file ) - 1 );
+
+		for ( i=0; i < nmatches; i++ )
+			free ( matches[i] );
+
+		free ( matches );
+		matches = NULL;
+	} else {
+		strncpy ( config->outdb_spool_file, DEFAULT_OUTDB_SPOOL_FILE, sizeof ( config->outdb_spool_file ) - 1 );
+	}
+
+	/* Parsing the output_database_spool_max_size option */
+	if (( arg = (char*) strcasestr( args, "output_database_spool_max_size" ) ))
+	{
+		for ( arg += strlen("output_database_spool_max_size");
+				*arg && (*arg < '0' || *arg > '9');
+				arg++ );
+
+		if ( !(*arg) )
+		{
+			AI_fatal_err ( "output_database_spool_max_size option used but "
+				"no value specified", __FILE__, __LINE__ );
+		}
+
+		output_database_spool_max_size = strtoul ( arg, NULL, 10 );
+	} else {
+		output_database_spool_max_size = DEFAULT_OUTDB_SPOOL_MAX_SIZE;
+	}
+
+	config->outdbSpoolMaxSize = output_database_spool_max_size;
+
+	if ( config->outdbtype != outdb_none && config->outdbSpoolMaxSize != 0 && strlen ( config->outdb_spool_file ) != 0 )
+	{
+		_dpd.logMsg( "    Output database spool: %s (max %u MB)\n", config->outdb_spool_file, config->outdbSpoolMaxSize );
+	}
+
 
 	/* Parsing cluster options */
 	while ( preg_match ( "\\s*(cluster\\s*\\(\\s*)([^\\)]+)\\)", args, &matches, &nmatches ) > 0 )
@@ -1193,6 +1499,10 @@ static AI_config * AI_parse(char *args)
 				type = src_addr;
 			else if ( !strcasecmp ( matches[0], "dst_addr" ))
 				type = dst_addr;
+			else if ( !strcasecmp ( matches[0], "time" ))
+				type = alert_time;
+			else if ( !strcasecmp ( matches[0], "protocol" ))
+				type = ip_protocol;
 			else
 				AI_fatal_err ( "Unknown class type in configuration", __FILE__, __LINE__  );
 
@@ -1318,7 +1628,49 @@ static AI_config * AI_parse(char *args)
 
 					break;
 
-				/* TODO Manage ranges and clusters for timestamps (and more?) here */
+				/* The range of a time cluster is the width of its buckets */
+				case alert_time:
+					if ( !strcasecmp ( arg, "minute" ))
+						min_val = 60;
+					else if ( !strcasecmp ( arg, "hour" ))
+						min_val = 3600;
+					else if ( !strcasecmp ( arg, "day" ))
+						min_val = 86400;
+					else if ( preg_match ( "^([0-9]+)$", arg, &matches, &nmatches ) > 0 )
+						min_val = strtoul ( matches[0], NULL, 10 );
+					else
+						AI_fatal_err ( "Unallowed format for a time range in configuration file", __FILE__, __LINE__ );
+
+					if ( min_val <= 1 )
+						AI_fatal_err ( "The width of a time range should be greater than one second in configuration file", __FILE__, __LINE__ );
+
+					max_val = min_val;
+					break;
+
+				case ip_protocol:
+					if ( !strcasecmp ( arg, "icmp" )) {
+						min_val = max_val = IPPROTO_ICMP;
+					} else if ( !strcasecmp ( arg, "tcp" )) {
+						min_val = max_val = IPPROTO_TCP;
+					} else if ( !strcasecmp ( arg, "udp" )) {
+						min_val = max_val = IPPROTO_UDP;
+					} else if ( preg_match ( "^([0-9]+)-([0-9]+)$", arg, &matches, &nmatches ) > 0 ) {
+						min_val = strtoul ( matches[0], NULL, 10 );
+						max_val = strtoul ( matches[1], NULL, 10 );
+					} else if ( preg_match ( "^([0-9]+)$", arg, &matches, &nmatches ) > 0 ) {
+						min_val = strtoul ( matches[0], NULL, 10 );
+						max_val = min_val;
+					} else {
+						AI_fatal_err ( "Unallowed format for a protocol range in configuration file", __FILE__, __LINE__ );
+					}
+
+					if ( min_val > max_val || max_val > 255 )
+					{
+						AI_fatal_err ( "Parse error in configuration: invalid protocol range", __FILE__, __LINE__ );
+					}
+
+					break;
+
 				default:
 					break;
 			}
@@ -1479,11 +1831,13 @@ static AI_config * AI_parse(char *args)
 	{
 		#ifdef 	HAVE_DB
 			get_alerts = AI_db_get_alerts;
+			get_alerts_since = AI_db_get_alerts_since;
 		#else
 			AI_fatal_err ( "Using database alert log, but the module was not compiled with database support", __FILE__, __LINE__ );
 		#endif
 	} else {
 		get_alerts = AI_get_alerts;
+		get_alerts_since = AI_get_alerts_since;
 	}
 
 	return config;
@@ -85,6 +85,9 @@
 /** Default correlation threshold coefficient for correlating two hyperalerts */
 #define 	DEFAULT_CORR_THRESHOLD 				0.5
 
+/** Default tolerance (in standard deviations) on the correlation threshold before evaluating again the edges of the correlation graph */
+#define 	DEFAULT_CORR_THRESHOLD_TOLERANCE 		0.1
+
 /** Default size of the alerts' buffer to be periodically sent to the serialization thread */
 #define 	DEFAULT_ALERT_BUFSIZE 				30
 
@@ -112,6 +115,27 @@
 /** Default maximum interval, in seconds, between two alerts for being considered in the same cluster */
 #define 	DEFAULT_CLUSTER_MAX_ALERT_INTERVAL 	14400
 
+/** Default number of threads for clustering the alerts (0 = one per online processor) */
+#define 	DEFAULT_CLUSTERING_THREADS 		0
+
+/** Default number of threads for scoring the couples of alerts in the correlation (0 = one per online processor) */
+#define 	DEFAULT_CORRELATION_THREADS 		0
+
+/** Default number of helper processes running the extra correlation modules (0 = the modules run in the Snort process) */
+#define 	DEFAULT_CORRELATION_MODULES_PROCESSES 		0
+
+/** Default maximum interval, in seconds, between two alerts for being correlated (0 = no limit) */
+#define 	DEFAULT_CORRELATION_HORIZON 		0
+
+/** Default maximum number of edges of a scenario laid out with dot: larger scenarios are laid out with sfdp (0 = no limit) */
+#define 	DEFAULT_CORRELATION_RENDER_MAX_EDGES 	500
+
+/** Default minimum interval in seconds between two renderings of the correlation graph */
+#define 	DEFAULT_CORRELATION_RENDER_INTERVAL 	60
+
+/** Default interval in seconds between two snapshots of the clustered alerts file (0 = at every clustering pass) */
+#define 	DEFAULT_CLUSTER_SNAPSHOT_INTERVAL 	0
+
 /** Default number of neurons per side on the output matrix of the SOM neural network */
 #define 	DEFAULT_OUTPUT_NEURONS_PER_SIDE 		20
 
@@ -133,6 +157,16 @@
 /** Default setting for the use of the knowledge base alert correlation index */
 #define 	DEFAULT_USE_STREAM_HASH_TABLE 		1
 
+/** Default number of days the alerts and packet streams are kept in a partitioned output database
+ * (0 = keep everything) */
+#define 	DEFAULT_OUTDB_RETENTION_DAYS 		0
+
+/** Default file where the writes to the output database are spooled while the database is unavailable or slow */
+#define 	DEFAULT_OUTDB_SPOOL_FILE 			"/var/log/snort/outdb_spool"
+
+/** Default maximum size in MB of the output database spool (0 = no spool) */
+#define 	DEFAULT_OUTDB_SPOOL_MAX_SIZE 		64
+
 /** Default web server port */
 #define 	DEFAULT_WEBSERV_PORT 				7654
 
@@ -154,6 +188,10 @@
 #ifdef 	HAVE_LIBPQ
 #define 	HAVE_DB 	1
 #endif
+
+#ifdef 	HAVE_LIBSQLITE3
+#define 	HAVE_DB 	1
+#endif
 /****************************/
 
 extern DynamicPreprocessorData _dpd;
@@ -166,7 +204,7 @@ typedef enum { false, true } BOOL;
 /*****************************************************************/
 /** Possible types of clustering attributes */
 typedef enum {
-	none, src_addr, dst_addr, src_port, dst_port, CLUSTER_TYPES
+	none, src_addr, dst_addr, src_port, dst_port, alert_time, ip_protocol, CLUSTER_TYPES
 } cluster_type;
 /*****************************************************************/
 /** Each stream in the hash table is identified by the couple (src_ip, dst_port) */
@@ -228,6 +266,25 @@ typedef struct
 	/** Default maximum interval, in seconds, between two alerts for being considered in the same cluster */
 	unsigned long  clusterMaxAlertInterval;
 
+	/** Number of threads clustering the alerts (0 = one per online processor) */
+	unsigned long  clusteringThreads;
+
+	/** Number of threads scoring the couples of alerts in the correlation (0 = one per online processor) */
+	unsigned long  correlationThreads;
+
+	/** Number of helper processes running the extra correlation modules (0 = the modules run in the Snort process) */
+	unsigned long  correlationModulesProcesses;
+
+	/** Maximum interval in seconds between two alerts for being correlated: the alerts older than this interval
+	 * from the latest alert leave the correlation, and the subgraphs made only of them are archived (0 = no limit) */
+	unsigned long  correlationHorizon;
+
+	/** Maximum number of edges of a scenario laid out with dot, larger scenarios are laid out with sfdp (0 = no limit) */
+	unsigned long  correlationRenderMaxEdges;
+
+	/** Minimum interval in seconds between two renderings of the correlation graph */
+	unsigned long  correlationRenderInterval;
+
 	/** Interval in seconds between an invocation of the thread for parsing XML manual correlations and the next one */
 	unsigned long  manualCorrelationsParsingInterval;
 
@@ -278,6 +335,10 @@ typedef struct
 	 * may occur at all! */
 	double        correlationThresholdCoefficient;
 
+	/** Maximum shift of the correlation threshold, in standard deviations, before the couples already
+	 * in the correlation graph are evaluated again (the new couples are evaluated at every pass) */
+	double        correlationThresholdTolerance;
+
 	/** Port where the webserver providing the web interface for the correlation graph
 	 * will listen onto */
 	unsigned short webserv_port;
@@ -301,6 +362,13 @@ typedef struct
 	/** Clustered alerts file */
 	char          clusterfile[1024];
 
+	/** Format of the clustered alerts file */
+	enum          { cluster_output_text, cluster_output_json } clusterOutputFormat;
+
+	/** Interval in seconds between two snapshots of the clustered alerts file, the
+	 * clusters changed in the meantime are appended to its journal (0 = no journal) */
+	unsigned long clusterSnapshotInterval;
+
 	/** Correlation rules path */
 	char          corr_rules_dir[1024];
 
@@ -327,7 +395,7 @@ typedef struct
 
 	/** Output database type, if clustered alerts and
 	 * correlations are saved to a database as well */
-	enum          { outdb_none, outdb_mysql, outdb_postgresql, OUTDBTYPE_NUM } outdbtype;
+	enum          { outdb_none, outdb_mysql, outdb_postgresql, outdb_sqlite, OUTDBTYPE_NUM } outdbtype;
 
 	/** Output database name, if clustered alerts and
 	 * correlations are saved to a database as well */
@@ -344,6 +412,17 @@ typedef struct
 	/** Output database host, if clustered alerts and
 	 * correlations are saved to a database as well */
 	char          outdbhost[256];
+
+	/** Number of days the alerts and packet streams are kept on the output
+	 * database, if its tables are partitioned (0 = keep everything) */
+	unsigned long outdbRetentionDays;
+
+	/** File where the writes to the output database are spooled
+	 * while the database is unavailable or slow */
+	char          outdb_spool_file[1024];
+
+	/** Maximum size in MB of the output database spool (0 = no spool) */
+	unsigned long outdbSpoolMaxSize;
 } AI_config;
 /*****************************************************************/
 /** Data type for hierarchies used for clustering */
@@ -354,6 +433,10 @@ typedef struct _hierarchy_node
 	int                     min_val;
 	int                     max_val;
 	int                     nchildren;
+
+	/** Index of the node in the per-attribute count arrays of the clustering module */
+	unsigned int            id;
+
 	struct _hierarchy_node  *parent;
 	struct _hierarchy_node  **children;
 } hierarchy_node;
@@ -467,8 +550,114 @@ typedef struct _AI_snort_alert  {
 	/** Alert ID on the database, if the alerts
 	 * are stored on a database as well */
 	unsigned long int   alert_id;
+
+	/** Identifier of the cluster represented by
+	 * the alert, if the clustering algorithm is used */
+	unsigned long int   cluster_id;
 } AI_snort_alert;
 /*****************************************************************/
+/** Columnar table of alerts: the fields scanned by the analysis stages are kept in contiguous
+ * arrays, one element per alert, so that a scan only touches the columns it needs. The
+ * strings are interned, and each row keeps a reference to its alert in the linked list */
+typedef struct  {
+	/** Number of rows in the table */
+	unsigned int    n_alerts;
+
+	/** Number of rows allocated */
+	unsigned int    size;
+
+	unsigned int    *gid;
+	unsigned int    *sid;
+	unsigned int    *rev;
+	unsigned short  *priority;
+	time_t          *timestamp;
+	uint32_t        *ip_src_addr;
+	uint32_t        *ip_dst_addr;
+	uint16_t        *tcp_src_port;
+	uint16_t        *tcp_dst_port;
+	unsigned int    *grouped_alerts_count;
+	const char      **desc;
+	const char      **classification;
+
+	/** Alert corresponding to each row */
+	AI_snort_alert  **alerts;
+} AI_alert_table;
+/*****************************************************************/
+/** Couple of alerts (rows of the alert table) that could be correlated, A -> B */
+typedef struct  {
+	unsigned int  a;
+	unsigned int  b;
+} AI_correlation_candidate;
+/*****************************************************************/
+/** Version of the descriptor of the correlation modules implemented by the module */
+#define 	AI_CORR_MODULE_VERSION 	1
+
+/** Flag of a correlation module whose functions can be called by several threads at the same time */
+#define 	AI_CORR_MODULE_THREAD_SAFE 	0x01
+
+/** Descriptor of a correlation module, exported by the module as the symbol AI_corr_module. The modules
+ * exporting only the functions AI_corr_index and AI_corr_index_weight are still loaded, through a descriptor
+ * built by the module loader */
+typedef struct  {
+	/** Version of the descriptor the module was built against (AI_CORR_MODULE_VERSION) */
+	unsigned int  version;
+
+	/** Name of the module */
+	const char    *name;
+
+	/** AI_CORR_MODULE_* flags */
+	unsigned int  flags;
+
+	/** Called once when the module is loaded, before any other function (optional): a non-zero value
+	 * returned means that the module couldn't be initialized */
+	int           (*init)( void );
+
+	/** Called once when Snort exits (optional) */
+	void          (*teardown)( void );
+
+	/** Weight of the correlation index of the module, between 0 and 1, read once per correlation pass */
+	double        (*weight)( void );
+
+	/** Correlation index of a couple of alerts, between 0 and 1 (optional if index_batch is provided) */
+	double        (*index)( const AI_snort_alert*, const AI_snort_alert* );
+
+	/** Correlation indexes of a block of couples of alerts, given as rows of the columnar table of the
+	 * alerts, written in the array of the scores (optional) */
+	void          (*index_batch)( const AI_alert_table*, const AI_correlation_candidate*, unsigned int, double* );
+} AI_corr_module_descriptor;
+/*****************************************************************/
+/** Maximum nesting depth of a document written by a JSON writer */
+#define 	JSON_MAX_DEPTH 	32
+
+/** Streaming writer of a JSON file */
+typedef struct  {
+	/** Temporary file the document is written to */
+	FILE    *fp;
+
+	/** Path of the JSON file, and of the temporary file renamed over it */
+	char    file[1024];
+	char    tmp_file[1040];
+
+	/** Output buffer */
+	char    *buf;
+	size_t  len;
+	size_t  size;
+
+	/** Scratch buffer for encoding the base64 values */
+	char    *scratch;
+	size_t  scratch_size;
+
+	/** Nesting depth, and whether the object or array at each depth already has a member */
+	unsigned int  depth;
+	BOOL    has_items[JSON_MAX_DEPTH];
+
+	/** Set if a key was just written, so that its value needs no separator */
+	BOOL    after_key;
+
+	/** Set if a write on the file failed */
+	BOOL    error;
+} AI_json_writer;
+/*****************************************************************/
 /** Key for the AI_alert_event structure, containing the Snort ID of the alert */
 typedef struct  {
 	int gid;
@@ -564,12 +753,13 @@ typedef struct  {
 /*****************************************************************/
 
 /** Enumeration for describing the table in the output database */
-enum  { ALERTS_TABLE, IPV4_HEADERS_TABLE, TCP_HEADERS_TABLE, PACKET_STREAMS_TABLE, CLUSTERED_ALERTS_TABLE, CORRELATED_ALERTS_TABLE, N_TABLES };
+enum  { ALERTS_TABLE, IPV4_HEADERS_TABLE, TCP_HEADERS_TABLE, PACKET_STREAMS_TABLE, CLUSTERED_ALERTS_TABLE, CORRELATED_ALERTS_TABLE, CORRELATION_GENERATION_TABLE, N_TABLES };
 
 /** Tables in the output database */
 static const char *outdb_config[] __attribute__ (( unused )) = {
 	"ca_alerts", "ca_ipv4_headers", "ca_tcp_headers",
-	"ca_packet_streams", "ca_clustered_alerts", "ca_correlated_alerts"
+	"ca_packet_streams", "ca_clustered_alerts", "ca_correlated_alerts",
+	"ca_correlation_generation"
 };
 
 /*
@@ -594,8 +784,22 @@ void*              AI_webserv_thread ( void* );
 
 #ifdef 	HAVE_DB
 AI_snort_alert*    AI_db_get_alerts ( void );
+AI_snort_alert*    AI_db_get_alerts_since ( AI_snort_alert** );
 void               AI_db_free_alerts ( AI_snort_alert* );
 void*              AI_db_alertparser_thread ( void* );
+void*              AI_outdb_retention_thread ( void* );
+void*              AI_outdb_spool_thread ( void* );
+
+/** Outcome of a write on the output database */
+typedef enum  {
+	outdb_write_ok, outdb_write_unavailable, outdb_write_failed
+} AI_outdb_write_status;
+
+AI_outdb_write_status  AI_outdb_exec_statements ( const char*, size_t, size_t, unsigned long* );
+void               AI_spool_init ( void );
+BOOL               AI_spool_enabled ( void );
+BOOL               AI_spool_pending ( void );
+BOOL               AI_spool_append ( const char*, size_t );
 #endif
 
 void               AI_pkt_enqueue ( SFSnortPacket* );
@@ -606,7 +810,27 @@ void               AI_init_corr_modules ( void );
 
 struct pkt_info*   AI_get_stream_by_key ( struct pkt_key );
 AI_snort_alert*    AI_get_alerts ( void );
+AI_snort_alert*    AI_get_alerts_since ( AI_snort_alert** );
 AI_snort_alert*    AI_get_clustered_alerts ( void );
+AI_snort_alert*    AI_get_clustered_alerts_since ( time_t, AI_snort_alert** );
+
+const char*        AI_string_intern ( const char* );
+AI_alert_table*    AI_alert_table_new ( void );
+AI_alert_table*    AI_alert_table_from_list ( AI_snort_alert* );
+unsigned int       AI_alert_table_append ( AI_alert_table*, AI_snort_alert* );
+void               AI_alert_table_free ( AI_alert_table* );
+
+AI_json_writer*    AI_json_open ( const char* );
+BOOL               AI_json_close ( AI_json_writer* );
+void               AI_json_begin_object ( AI_json_writer* );
+void               AI_json_end_object ( AI_json_writer* );
+void               AI_json_begin_array ( AI_json_writer* );
+void               AI_json_end_array ( AI_json_writer* );
+void               AI_json_key ( AI_json_writer*, const char* );
+void               AI_json_string ( AI_json_writer*, const char* );
+void               AI_json_uint ( AI_json_writer*, unsigned long );
+void               AI_json_time ( AI_json_writer*, time_t );
+void               AI_json_base64 ( AI_json_writer*, const char*, size_t );
 
 void                   AI_serialize_alerts ( AI_snort_alert**, unsigned int );
 void                   AI_serializer ( AI_snort_alert* );
@@ -622,6 +846,9 @@ unsigned int           AI_get_history_alert_number ( void );
 
 double                 AI_alert_bayesian_correlation ( const AI_snort_alert*, const AI_snort_alert* );
 double                 AI_alert_neural_som_correlation ( const AI_snort_alert*, const AI_snort_alert* );
+double                 AI_neural_som_neurons_correlation ( int, int, int, int );
+BOOL                   AI_neural_som_neurons ( const AI_alert_table*, const BOOL*, int*, int* );
+unsigned long          AI_neural_som_version ( void );
 double                 AI_kb_correlation_coefficient ( const AI_snort_alert*, const AI_snort_alert* );
 
 double                 AI_neural_correlation_weight ( void );
@@ -631,17 +858,27 @@ int                    AI_geoinfobyaddr ( const char*, double** );
 void                   AI_outdb_mutex_initialize ( void );
 void                   AI_store_alert_to_db ( AI_snort_alert* );
 void                   AI_store_cluster_to_db ( AI_alerts_couple* );
-void                   AI_store_correlation_to_db ( AI_alert_correlation* );
+void                   AI_flush_clusters_to_db ( void );
+void                   AI_store_correlations_to_db ( AI_alert_correlation**, unsigned int );
+void                   AI_archive_correlations_to_db ( AI_alert_correlation**, unsigned int );
 void                   AI_kb_index_init ( AI_snort_alert* );
 AI_alerts_per_neuron*  AI_get_alerts_per_neuron ( void );
 
-double(**AI_get_corr_functions ( size_t* ))(const AI_snort_alert*, const AI_snort_alert*);
-double(**AI_get_corr_weights ( size_t* ))( void );
+const AI_corr_module_descriptor** AI_get_corr_modules ( size_t* );
+void                   AI_corr_modules_exit ( int, void* );
+const double*          AI_corr_modules_proc_score ( const AI_alert_table*, const AI_correlation_candidate*, size_t, const BOOL* );
+BOOL                   AI_corr_modules_proc_is_helper ( void );
+void                   AI_corr_modules_proc_exit ( int, void* );
 
 #ifdef HAVE_LIBPYTHON2_6
 
 PyObject** AI_get_py_functions ( size_t* );
 PyObject** AI_get_py_weights ( size_t* );
+PyObject** AI_get_py_batch_functions ( size_t* );
+double     AI_py_corr_index ( PyObject*, PyObject*, PyObject* );
+PyObject*  AI_py_alerts_list ( PyObject**, unsigned int );
+PyObject*  AI_py_couples_array ( const AI_correlation_candidate*, size_t );
+void       AI_py_batch_scores_read ( PyObject*, double*, size_t );
 PyObject* AI_alert_to_pyalert ( AI_snort_alert* );
 
 #endif
@@ -649,6 +886,9 @@ PyObject* AI_alert_to_pyalert ( AI_snort_alert* );
 /** Function pointer to the function used for getting the alert list (from log file, db, ...) */
 extern AI_snort_alert* (*get_alerts)(void);
 
+/** Function pointer to the function used for getting the alerts received after a certain one (from log file, db, ...) */
+extern AI_snort_alert* (*get_alerts_since)(AI_snort_alert**);
+
 /** Buffer containing the alerts to be serialized on the binary history file */
 extern AI_snort_alert   **alerts_pool;
 
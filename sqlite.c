@@ -0,0 +1,302 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  sqlite.c
+ *
+ *    Description:  Interface to an embedded SQLite database
+ *
+ *        Version:  0.1
+ *        Created:  18/10/2026 12:04:51
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  BlackLight (http://0x00.ath.cx), <blacklight@autistici.org>
+ *        Licence:  GNU GPL v.3
+ *        Company:  DO WHAT YOU WANT CAUSE A PIRATE IS FREE, YOU ARE A PIRATE!
+ *
+ * =====================================================================================
+ */
+
+#include	"spp_ai.h"
+#ifdef 	HAVE_LIBSQLITE3
+
+#include	"db.h"
+
+#include	<sqlite3.h>
+
+/** \defgroup sqlite Module for the interface with an embedded SQLite database
+ * @{ */
+
+/** Time in milliseconds a query waits for a lock held by another process (e.g. the web interface) */
+#define 	AI_SQLITE_BUSY_TIMEOUT 	5000
+
+/***************************/
+/* Database descriptors */
+PRIVATE sqlite3 *db    = NULL;
+PRIVATE sqlite3 *outdb = NULL;
+/***************************/
+
+/*************************************************************/
+/* Private functions (operating on the database descriptors) */
+
+PRIVATE BOOL
+__sqlite_is_init ( sqlite3 *__DB )
+{
+	return ( __DB != NULL );
+}
+
+PRIVATE void*
+__sqlite_do_init ( sqlite3 **__DB, BOOL is_out )
+{
+	const char *dbfile = ( is_out ) ? config->outdbname : config->dbname;
+
+	if ( __sqlite_is_init ( *__DB ))
+		return (void*) *__DB;
+
+	if ( sqlite3_open_v2 ( dbfile, __DB, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_FULLMUTEX, NULL ) != SQLITE_OK )
+	{
+		sqlite3_close ( *__DB );
+		*__DB = NULL;
+		return NULL;
+	}
+
+	sqlite3_busy_timeout ( *__DB, AI_SQLITE_BUSY_TIMEOUT );
+
+	/* With the write-ahead log the readers (e.g. the web interface) don't block the writes
+	 * of the module, and synchronous=NORMAL only syncs the log at checkpoints */
+	sqlite3_exec ( *__DB, "PRAGMA journal_mode=WAL", NULL, NULL, NULL );
+	sqlite3_exec ( *__DB, "PRAGMA synchronous=NORMAL", NULL, NULL, NULL );
+	sqlite3_exec ( *__DB, "PRAGMA foreign_keys=OFF", NULL, NULL, NULL );
+
+	return (void*) *__DB;
+}
+
+PRIVATE SQLITE_result*
+__sqlite_do_query ( sqlite3 *__DB, const char *query )
+{
+	int           i, rc;
+	const char    *tail = query;
+	const char    *value = NULL;
+	sqlite3_stmt  *stmt = NULL;
+	SQLITE_result *res  = NULL;
+
+	if ( !__DB )
+		return NULL;
+
+	/* Run all the statements in the query, keeping the rows returned by the last one */
+	while ( tail && *tail )
+	{
+		if ( sqlite3_prepare_v2 ( __DB, tail, -1, &stmt, &tail ) != SQLITE_OK )
+		{
+			sqlite_free_result ( res );
+			return NULL;
+		}
+
+		/* Empty statement (e.g. trailing spaces or semicolons) */
+		if ( !stmt )
+			break;
+
+		if ( sqlite3_column_count ( stmt ) > 0 )
+		{
+			sqlite_free_result ( res );
+
+			if ( !( res = (SQLITE_result*) calloc ( 1, sizeof ( SQLITE_result ))))
+				AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+			res->ncols = sqlite3_column_count ( stmt );
+		}
+
+		while (( rc = sqlite3_step ( stmt )) == SQLITE_ROW )
+		{
+			if ( !res )
+				continue;
+
+			if ( !( res->rows = (char***) realloc ( res->rows, (++(res->nrows)) * sizeof ( char** ))))
+				AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+			if ( !( res->rows[ res->nrows - 1 ] = (char**) calloc ( res->ncols, sizeof ( char* ))))
+				AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+
+			for ( i=0; i < res->ncols; i++ )
+			{
+				if (( value = (const char*) sqlite3_column_text ( stmt, i )))
+				{
+					if ( !( res->rows[ res->nrows - 1 ][i] = strdup ( value )))
+						AI_fatal_err ( "Fatal dynamic memory allocation error", __FILE__, __LINE__ );
+				}
+			}
+		}
+
+		sqlite3_finalize ( stmt );
+		stmt = NULL;
+
+		if ( rc != SQLITE_DONE )
+		{
+			sqlite_free_result ( res );
+			return NULL;
+		}
+	}
+
+	return res;
+}
+
+PRIVATE unsigned long
+__sqlite_do_escape_string ( char **to, const char *from, unsigned long length )
+{
+	unsigned long i, j;
+
+	if ( !from )
+		return 0;
+
+	if ( strlen ( from ) == 0 )
+		return 0;
+
+	/* The destination buffer is supposed to be at least 2*length+1 bytes long, as for mysql_real_escape_string */
+	for ( i=0, j=0; i < length && from[i]; i++ )
+	{
+		if ( from[i] == '\'' )
+			(*to)[j++] = '\'';
+
+		(*to)[j++] = from[i];
+	}
+
+	(*to)[j] = 0;
+	return j;
+}
+
+PRIVATE void
+__sqlite_do_close ( sqlite3 **__DB )
+{
+	if ( *__DB )
+		sqlite3_close ( *__DB );
+
+	*__DB = NULL;
+}
+
+/* End of private functions */
+/****************************/
+
+/********************/
+/* Public functions */
+
+BOOL
+sqlite_is_init ()
+{
+	return __sqlite_is_init ( db );
+}
+
+void*
+sqlite_do_init ()
+{
+	return __sqlite_do_init ( &db, false );
+}
+
+SQLITE_result*
+sqlite_do_query ( const char *query )
+{
+	return __sqlite_do_query ( db, query );
+}
+
+unsigned long
+sqlite_do_escape_string ( char **to, const char *from, unsigned long length )
+{
+	return __sqlite_do_escape_string ( to, from, length );
+}
+
+void
+sqlite_do_close ()
+{
+	__sqlite_do_close ( &db );
+}
+
+/* Output database functions */
+
+BOOL
+sqlite_is_out_init ()
+{
+	return __sqlite_is_init ( outdb );
+}
+
+void*
+sqlite_do_out_init ()
+{
+	return __sqlite_do_init ( &outdb, true );
+}
+
+SQLITE_result*
+sqlite_do_out_query ( const char *query )
+{
+	return __sqlite_do_query ( outdb, query );
+}
+
+/**
+ * \brief  Execute a statement not returning rows (INSERT, UPDATE, BEGIN...) on the output database
+ * \param  query 	Statement to be executed
+ * \return true if the statement was executed successfully, false otherwise
+ */
+
+BOOL
+sqlite_do_out_exec ( const char *query )
+{
+	if ( !outdb )
+		return false;
+
+	return ( sqlite3_exec ( outdb, query, NULL, NULL, NULL ) == SQLITE_OK );
+}
+
+unsigned long
+sqlite_do_out_escape_string ( char **to, const char *from, unsigned long length )
+{
+	return __sqlite_do_escape_string ( to, from, length );
+}
+
+void
+sqlite_do_out_close ()
+{
+	__sqlite_do_close ( &outdb );
+}
+
+/* Functions working on result sets */
+
+int
+sqlite_num_rows ( SQLITE_result *res )
+{
+	return res->nrows;
+}
+
+char**
+sqlite_fetch_row ( SQLITE_result *res )
+{
+	if ( (res->index++) >= res->nrows )
+		return NULL;
+
+	return res->rows[ res->index - 1 ];
+}
+
+void
+sqlite_free_result ( SQLITE_result *res )
+{
+	int i, j;
+
+	if ( res )
+	{
+		for ( i=0; i < res->nrows; i++ )
+		{
+			for ( j=0; j < res->ncols; j++ )
+				free ( res->rows[i][j] );
+
+			free ( res->rows[i] );
+		}
+
+		free ( res->rows );
+		free ( res );
+	}
+}
+
+/* End of public functions */
+/***************************/
+
+/* @} */
+
+#endif
+